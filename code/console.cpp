@@ -5,10 +5,12 @@
 
 #include "app.h"
 #include "font/utf8_stuff.h"
+#include "log_limit.h"
 #include "cvar.h"
 #include "BS_Archive/BS_json.h"
 #include "BS_Archive/BS_stream.h"
 #include "ui.h"
+#include "zone_profiler.h"
 
 #include <SDL2/SDL.h>
 
@@ -19,9 +21,6 @@
 // and maybe make it so that "console handled errors" will be shown in the "error box",
 // and "handled" errors (like a error manully presented through some UI) will not overwrite the box.
 
-std::mutex g_log_mut;
-log_queue g_log;
-
 static CVAR_T history_enabled
 #ifndef __EMSCRIPTEN__
 	= CVAR_T::RUNTIME;
@@ -36,124 +35,164 @@ static REGISTER_CVAR_INT(
 	history_enabled);
 static REGISTER_CVAR_INT(
 	cv_console_log_max_row_count,
-	500,
-	"the maximum number of rows shown in the log",
+	100000,
+	"the maximum number of lines kept in the log",
+	CVAR_T::RUNTIME);
+static REGISTER_CVAR_INT(
+	cv_console_log_max_kb,
+	8192,
+	"the maximum size of the text kept in the log (in kilobytes)",
 	CVAR_T::RUNTIME);
 
-void log_queue::push(CONSOLE_MESSAGE_TYPE type, const char* str, size_t len)
+void console_log_ring::set_limits(size_t max_lines_, size_t max_text_)
+{
+	max_lines = std::max<size_t>(max_lines_, 1);
+	max_text = std::max<size_t>(max_text_, 1);
+	while(line_count > max_lines || text_end - text_begin > max_text)
+	{
+		internal_pop_front();
+	}
+}
+
+void console_log_ring::push(CONSOLE_MESSAGE_TYPE type, const char* str, size_t size)
 {
 	ASSERT(str != NULL);
-	log_buffer* write_buf = &buffers[buf_write_id];
-	if(write_buf->message_count == MESSAGE_COUNT_SIZE ||
-	   write_buf->write_cursor + len + 1 > MESSAGE_BUFFER_SIZE)
-	{
-		++buf_write_id;
-		buf_write_id %= std::size(buffers);
-		write_buf = &buffers[buf_write_id];
-		if(buf_read_id == buf_write_id)
+	while(size != 0)
+	{
+		const char* newline = static_cast<const char*>(memchr(str, '\n', size));
+		size_t line_size = (newline != NULL) ? static_cast<size_t>(newline - str) : size;
+		if(!last_line_open)
+		{
+			internal_new_line(type);
+		}
+		internal_append(str, line_size);
+		if(newline == NULL)
 		{
-			++buf_read_id;
-			buf_read_id %= std::size(buffers);
+			last_line_open = true;
+			break;
 		}
-		write_buf->message_count = 0;
-		write_buf->messages_read = 0;
-		write_buf->write_cursor = 0;
-		write_buf->read_cursor = 0;
+		last_line_open = false;
+		str += line_size + 1;
+		size -= line_size + 1;
 	}
+}
 
-	log_message& entry = write_buf->entries[write_buf->message_count++];
-	entry.count = std::min<size_t>(len, MESSAGE_BUFFER_SIZE - 1);
-	entry.type = type;
+void console_log_ring::clear()
+{
+	line_first = end_id();
+	line_count = 0;
+	text_begin = text_end;
+	last_line_open = false;
+	std::vector<line_record>().swap(lines);
+	std::vector<char>().swap(text);
+}
 
-	char* cur = write_buf->data + write_buf->write_cursor;
-	memcpy(cur, str, entry.count);
-	if(entry.count != 0 && len > MESSAGE_BUFFER_SIZE - 1)
+void console_log_ring::get_text(const line_record& line, std::string& out) const
+{
+	out.resize(line.size);
+	internal_copy_out(line.offset, out.data(), line.size);
+}
+
+void console_log_ring::internal_pop_front()
+{
+	ASSERT(line_count != 0);
+	++line_first;
+	--line_count;
+	if(line_count == 0)
+	{
+		text_begin = text_end;
+		last_line_open = false;
+	}
+	else
 	{
-		cur[entry.count - 1] = '\n';
+		text_begin = get_line(line_first).offset;
 	}
-	cur[entry.count] = '\0';
-	write_buf->write_cursor += entry.count + 1;
 }
-void log_queue::push_vargs(CONSOLE_MESSAGE_TYPE type, const char* fmt, va_list args)
-{
-	ASSERT(fmt != NULL);
-	int ret;
-	va_list temp_args;
-	va_copy(temp_args, args);
-#ifdef WIN32
-	// win32 has a compatible C standard library, but annex k prevents exploits or something.
-	ret = _vscprintf(fmt, temp_args);
-#else
-	ret = vsnprintf(NULL, 0, fmt, temp_args);
-#endif
-	ASSERT(ret != -1);
-	va_end(temp_args);
 
-	size_t len = ret;
-
-	log_buffer* write_buf = &buffers[buf_write_id];
-	if(write_buf->message_count == MESSAGE_COUNT_SIZE ||
-	   write_buf->write_cursor + len + 1 > MESSAGE_BUFFER_SIZE)
+void console_log_ring::internal_new_line(CONSOLE_MESSAGE_TYPE type)
+{
+	while(line_count >= max_lines)
 	{
-		++buf_write_id;
-		buf_write_id %= std::size(buffers);
-		write_buf = &buffers[buf_write_id];
-		if(buf_read_id == buf_write_id)
+		internal_pop_front();
+	}
+	if(line_count == lines.size())
+	{
+		// the position of an id depends on the size, so copy them one by one.
+		size_t new_size = std::min(std::max<size_t>(64, lines.size() * 2), max_lines);
+		std::vector<line_record> new_lines(new_size);
+		for(uint64_t id = line_first; id != end_id(); ++id)
 		{
-			++buf_read_id;
-			buf_read_id %= std::size(buffers);
+			new_lines[id % new_size] = lines[id % lines.size()];
 		}
-		write_buf->message_count = 0;
-		write_buf->messages_read = 0;
-		write_buf->write_cursor = 0;
-		write_buf->read_cursor = 0;
+		lines.swap(new_lines);
 	}
+	lines[end_id() % lines.size()] = line_record{text_end, 0, type};
+	++line_count;
+}
 
-	log_message& entry = write_buf->entries[write_buf->message_count++];
-	entry.count = std::min<size_t>(len, MESSAGE_BUFFER_SIZE - 1);
-	entry.type = type;
+void console_log_ring::internal_append(const char* str, size_t size)
+{
+	ASSERT(line_count != 0);
+	line_record& line = lines[(end_id() - 1) % lines.size()];
 
-	char* cur = write_buf->data + write_buf->write_cursor;
+	// truncate the line if it's bigger than the whole ring.
+	size = std::min<size_t>(size, max_text - std::min<size_t>(line.size, max_text));
+	size = std::min<size_t>(size, UINT32_MAX - line.size);
+	if(size == 0)
+	{
+		return;
+	}
 
-#ifdef WIN32
-	ret = vsprintf_s(cur, entry.count + 1, fmt, args);
-#else
-	ret = vsnprintf(cur, entry.count + 1, fmt, args);
-#endif
-	if(entry.count != 0 && len > MESSAGE_BUFFER_SIZE - 1)
+	// this won't pop the line being appended because it fits by itself.
+	while(text_end - text_begin + size > max_text)
+	{
+		internal_pop_front();
+	}
+
+	size_t used = text_end - text_begin;
+	if(used + size > text.size())
 	{
-		cur[entry.count - 1] = '\n';
+		size_t new_size =
+			std::min(std::max<size_t>({4096, text.size() * 2, used + size}), max_text);
+		std::vector<char> temp(used);
+		internal_copy_out(text_begin, temp.data(), used);
+		text.assign(new_size, '\0');
+		internal_copy_in(text_begin, temp.data(), used);
 	}
-	cur[entry.count] = '\0';
-	write_buf->write_cursor += entry.count + 1;
+
+	internal_copy_in(text_end, str, size);
+	text_end += size;
+	// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+	line.size += size;
 }
-const char* log_queue::pop(log_message* message)
+
+void console_log_ring::internal_copy_out(uint64_t offset, char* out, size_t size) const
 {
-	log_buffer* read_buf = &buffers[buf_read_id];
-	if(read_buf->messages_read == MESSAGE_COUNT_SIZE ||
-	   read_buf->messages_read == read_buf->message_count)
+	if(size == 0)
 	{
-		if(buf_read_id != buf_write_id)
-		{
-			++buf_read_id;
-			buf_read_id %= std::size(buffers);
-			read_buf = &buffers[buf_read_id];
-		}
+		return;
 	}
-	if(read_buf->messages_read == read_buf->message_count)
+	ASSERT(size <= text.size());
+	size_t pos = offset % text.size();
+	size_t first = std::min(size, text.size() - pos);
+	memcpy(out, text.data() + pos, first);
+	memcpy(out + first, text.data(), size - first);
+}
+
+void console_log_ring::internal_copy_in(uint64_t offset, const char* str, size_t size)
+{
+	if(size == 0)
 	{
-		return NULL;
+		return;
 	}
-	*message = read_buf->entries[read_buf->messages_read++];
-	const char* str = read_buf->data + read_buf->read_cursor;
-	read_buf->read_cursor += message->count + 1;
-	return str;
+	ASSERT(size <= text.size());
+	size_t pos = offset % text.size();
+	size_t first = std::min(size, text.size() - pos);
+	memcpy(text.data() + pos, str, first);
+	memcpy(text.data(), str + first, size - first);
 }
 
-bool console_state::init(
-	font_style_interface* console_font_,
-	mono_2d_batcher* console_batcher_,
-	shader_mono_state& mono_shader)
+bool console_state::init(font_style_interface* console_font_, mono_2d_batcher* console_batcher_)
 {
 	ASSERT(console_font_ != NULL);
 	ASSERT(console_batcher_ != NULL);
@@ -183,14 +222,14 @@ bool console_state::init(
 	// vertex setup
 	ctx.glBindVertexArray(gl_log_vao_id);
 	ctx.glBindBuffer(GL_ARRAY_BUFFER, gl_log_interleave_vbo);
-	gl_create_interleaved_mono_vertex_vao(mono_shader);
+	gl_create_mono_instance_vao();
 
 	if(!log_box.init(
 		   "",
 		   console_batcher,
 		   console_font,
-		   TEXTP_Y_SCROLL | TEXTP_WORD_WRAP | TEXTP_DRAW_BBOX | TEXTP_READ_ONLY |
-			   TEXTP_DRAW_BACKDROP))
+		   TEXTP_Y_SCROLL | TEXTP_EXTERNAL_Y_SCROLL | TEXTP_WORD_WRAP | TEXTP_DRAW_BBOX |
+			   TEXTP_READ_ONLY | TEXTP_DRAW_BACKDROP))
 	{
 		return false;
 	}
@@ -226,7 +265,7 @@ bool console_state::init(
 	// vertex setup
 	ctx.glBindVertexArray(gl_prompt_vao_id);
 	ctx.glBindBuffer(GL_ARRAY_BUFFER, gl_prompt_interleave_vbo);
-	gl_create_interleaved_mono_vertex_vao(mono_shader);
+	gl_create_mono_instance_vao();
 
 	if(!prompt_cmd.init(
 		   "",
@@ -259,7 +298,7 @@ bool console_state::init(
 	// vertex setup
 	ctx.glBindVertexArray(gl_error_vao_id);
 	ctx.glBindBuffer(GL_ARRAY_BUFFER, gl_error_interleave_vbo);
-	gl_create_interleaved_mono_vertex_vao(mono_shader);
+	gl_create_mono_instance_vao();
 
 	if(!error_text.init(
 		   "",
@@ -330,7 +369,11 @@ bool console_state::destroy()
 	SAFE_GL_DELETE_VBO(gl_error_interleave_vbo);
 	SAFE_GL_DELETE_VAO(gl_error_vao_id);
 
-	log_line_count = 0;
+	log_ring.clear();
+	log_view_end = 0;
+	log_view_follow = true;
+	log_box_dirty = true;
+	log_scrollbar_held = false;
 	log_box.clear_string();
 	prompt_cmd.clear_string();
 	error_text.clear_string();
@@ -406,13 +449,253 @@ void console_state::serialize_history(BS_Archive& ar)
 	ar.EndObject();
 }
 
+size_t console_state::get_log_page_lines() const
+{
+	float lineskip = log_box.get_lineskip();
+	float height = log_box.box_ymax - log_box.box_ymin;
+	if(lineskip <= 0 || height <= lineskip)
+	{
+		return 1;
+	}
+	return static_cast<size_t>(height / lineskip);
+}
+
+void console_state::refresh_log_view()
+{
+	size_t page_lines = get_log_page_lines();
+	uint64_t end = log_ring.end_id();
+	// don't scroll past the first page, so the oldest line is at the top.
+	uint64_t min_end = log_ring.line_first + std::min<uint64_t>(page_lines, log_ring.line_count);
+	if(log_view_follow)
+	{
+		log_view_end = end;
+	}
+	log_view_end = std::clamp(log_view_end, min_end, end);
+	// scrolling to the bottom will follow the new lines again.
+	log_view_follow = (log_view_end == end);
+
+	// one extra line for the partial row at the top.
+	// if a line word wraps, the top lines are pushed out of the box.
+	uint64_t begin =
+		log_view_end -
+		std::min<uint64_t>(page_lines + 1, log_view_end - log_ring.line_first);
+	if(!log_box_dirty && begin == log_box_begin && log_view_end == log_box_end)
+	{
+		return;
+	}
+	log_box_begin = begin;
+	log_box_end = log_view_end;
+	log_box_dirty = false;
+
+	// this loses the selection, but you can scroll up to stop new lines from moving the view.
+	log_box.clear_string();
+	log_box.set_readonly(false);
+	for(uint64_t id = begin; id != log_view_end; ++id)
+	{
+		const console_log_ring::line_record& line = log_ring.get_line(id);
+		log_ring.get_text(line, log_line_buffer);
+
+		// every byte is at most one codepoint, plus the newline.
+		log_decode_buffer.resize(log_line_buffer.size() + 1);
+		// the bad bytes are kept as codepoints.
+		cpputf_decode_result decoded = cpputf_decode(
+			log_line_buffer.data(),
+			log_line_buffer.size(),
+			log_decode_buffer.data(),
+			log_decode_buffer.size(),
+			true);
+		size_t codepoint_count = decoded.written;
+		if(id + 1 != log_view_end)
+		{
+			log_decode_buffer[codepoint_count++] = U'\n';
+		}
+
+		switch(line.type)
+		{
+		case CONSOLE_MESSAGE_TYPE::INFO: log_box.current_color_index = 0; break;
+		case CONSOLE_MESSAGE_TYPE::ERROR: log_box.current_color_index = 1; break;
+		}
+		// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+		log_box.stb_insert_chars(
+			log_box.text_data.size(), log_decode_buffer.data(), codepoint_count);
+	}
+	log_box.set_readonly(true);
+	log_box.current_color_index = 0;
+
+	if(log_view_end == min_end && !log_view_follow)
+	{
+		log_box.scroll_to_top();
+	}
+	else
+	{
+		log_box.scroll_to_bottom();
+	}
+}
+
+void console_state::scroll_log_view(int64_t lines)
+{
+	if(lines < 0)
+	{
+		uint64_t up = static_cast<uint64_t>(-lines);
+		log_view_end -= std::min(up, log_view_end);
+	}
+	else
+	{
+		log_view_end += static_cast<uint64_t>(lines);
+	}
+	log_view_follow = false;
+	refresh_log_view();
+}
+
+bool console_state::get_log_thumb(float* ymin, float* ymax) const
+{
+	ASSERT(ymin != NULL);
+	ASSERT(ymax != NULL);
+	size_t page_lines = get_log_page_lines();
+	if(log_ring.line_count <= page_lines)
+	{
+		return false;
+	}
+	float track_height = log_box.box_ymax - log_box.box_ymin;
+	float thumb_height = track_height * static_cast<float>(page_lines) /
+						 static_cast<float>(log_ring.line_count);
+	thumb_height = std::min(std::max(thumb_height, log_box.scrollbar_thumb_min_size), track_height);
+
+	// the position of the top line, the row count is not known because of word wrap.
+	double scroll_max = static_cast<double>(log_ring.line_count - page_lines);
+	double scroll_pos =
+		static_cast<double>(log_view_end - log_ring.line_first) - static_cast<double>(page_lines);
+	double ratio = std::clamp(scroll_pos / scroll_max, 0.0, 1.0);
+
+	*ymin = std::floor(
+		log_box.box_ymin + (track_height - thumb_height) * static_cast<float>(ratio));
+	*ymax = *ymin + thumb_height;
+	return true;
+}
+
+void console_state::scroll_log_thumb_to(float mouse_y)
+{
+	float thumb_ymin;
+	float thumb_ymax;
+	if(!get_log_thumb(&thumb_ymin, &thumb_ymax))
+	{
+		return;
+	}
+	float track_space = (log_box.box_ymax - log_box.box_ymin) - (thumb_ymax - thumb_ymin);
+	if(track_space <= 0)
+	{
+		return;
+	}
+	double ratio = std::clamp(
+		static_cast<double>(mouse_y - log_thumb_click_offset - log_box.box_ymin) / track_space,
+		0.0,
+		1.0);
+	size_t page_lines = get_log_page_lines();
+	double scroll_max = static_cast<double>(log_ring.line_count - page_lines);
+	log_view_end =
+		log_ring.line_first + page_lines + static_cast<uint64_t>(std::llround(ratio * scroll_max));
+	log_view_follow = false;
+	refresh_log_view();
+}
+
+void console_state::draw_log_scrollbar()
+{
+	float ymin;
+	float ymax;
+	if(!get_log_thumb(&ymin, &ymax))
+	{
+		return;
+	}
+	auto white_uv = console_font->get_font_atlas()->white_uv;
+	float xmin = log_box.box_xmax - log_box.scrollbar_thickness;
+	float xmax = log_box.box_xmax;
+	std::array<uint8_t, 4> bbox_color = log_box.bbox_color;
+
+	// the rest of the scrollbar bbox is the log bbox.
+	console_batcher->draw_rect(
+		{xmin, log_box.box_ymin, xmin + 1, log_box.box_ymax}, white_uv, bbox_color);
+
+	console_batcher->draw_rect({xmin, ymin, xmax, ymax}, white_uv, log_box.scrollbar_color);
+	console_batcher->draw_rect({xmin, ymin, xmin + 1, ymax}, white_uv, bbox_color);
+	console_batcher->draw_rect({xmin, ymin, xmax, ymin + 1}, white_uv, bbox_color);
+	console_batcher->draw_rect({xmax - 1, ymin, xmax, ymax}, white_uv, bbox_color);
+	console_batcher->draw_rect({xmin, ymax - 1, xmax, ymax}, white_uv, bbox_color);
+}
+
+void console_state::log_scrollbar_input(SDL_Event& e)
+{
+	switch(e.type)
+	{
+	case SDL_MOUSEWHEEL: {
+		// only scroll when the mouse is currently hovering over the bounding box
+		int x;
+		int y;
+		SDL_GetMouseState(&x, &y);
+		float mouse_x = static_cast<float>(x);
+		float mouse_y = static_cast<float>(y);
+		if(log_box.box_ymax >= mouse_y && log_box.box_ymin <= mouse_y &&
+		   log_box.box_xmax >= mouse_x && log_box.box_xmin <= mouse_x)
+		{
+			scroll_log_view(-std::llround(e.wheel.y * cv_scroll_speed.data));
+			// I use leave to prevent multiple things scrolling.
+			e.type = SDL_MOUSEMOTION;
+			e.motion.x = x;
+			e.motion.y = y;
+			set_mouse_event_clipped(e);
+		}
+	}
+	break;
+	case SDL_MOUSEMOTION:
+		if(log_scrollbar_held)
+		{
+			if((e.motion.state & SDL_BUTTON_LMASK) == 0 && (e.motion.state & SDL_BUTTON_RMASK) == 0)
+			{
+				log_scrollbar_held = false;
+			}
+			else
+			{
+				scroll_log_thumb_to(static_cast<float>(e.motion.y));
+			}
+		}
+		break;
+	case SDL_MOUSEBUTTONUP:
+		if(log_scrollbar_held &&
+		   (e.button.button == SDL_BUTTON_LEFT || e.button.button == SDL_BUTTON_RIGHT))
+		{
+			log_scrollbar_held = false;
+			// eat
+			set_event_unfocus(e);
+		}
+		break;
+	case SDL_MOUSEBUTTONDOWN:
+		if((e.button.button == SDL_BUTTON_LEFT || e.button.button == SDL_BUTTON_RIGHT) &&
+		   !is_mouse_event_clipped(e))
+		{
+			float mouse_x = static_cast<float>(e.button.x);
+			float mouse_y = static_cast<float>(e.button.y);
+			float ymin;
+			float ymax;
+			if(get_log_thumb(&ymin, &ymax) && ymax >= mouse_y && ymin <= mouse_y &&
+			   log_box.box_xmax >= mouse_x &&
+			   log_box.box_xmax - log_box.scrollbar_thickness <= mouse_x)
+			{
+				log_scrollbar_held = true;
+				log_thumb_click_offset = mouse_y - ymin;
+				// eat (and unfocus the prompts)
+				set_event_unfocus(e);
+			}
+		}
+		break;
+	}
+}
+
 void console_state::resize_text_area()
 {
 	float width = static_cast<float>(cv_screen_width.data) / 2 - 60;
 	log_box.set_bbox(60, 60, width, static_cast<float>(cv_screen_height.data) / 2 - 60);
-	// TODO(dootsie): I don't like this, it should only move down when it already is at the
-	// bottom...
-	log_box.scroll_to_bottom();
+	// the number of lines on screen could change, and the word wrap moves the bottom.
+	log_box_dirty = true;
+	refresh_log_view();
 	prompt_cmd.set_bbox(60, log_box.box_ymax + 10.f, width, prompt_cmd.get_lineskip() + 1);
 
 	// this probably doesn't have enough hieght to fit in messages with stack traces,
@@ -497,6 +780,8 @@ CONSOLE_RESULT console_state::input(SDL_Event& e)
 		}
 	}
 
+	log_scrollbar_input(e);
+
 	switch(log_box.input(e))
 	{
 	case TEXT_PROMPT_RESULT::CONTINUE:
@@ -558,6 +843,9 @@ bool console_state::parse_input()
 	}
 	history_index = -1;
 
+	// the output of a command is never rate limited (help prints every cvar).
+	log_limit_exempt_scope exempt_log_limit;
+
 	// TODO: save options?
 	if(line == "help")
 	{
@@ -584,106 +872,43 @@ bool console_state::parse_input()
 
 bool console_state::update(double delta_sec)
 {
-	size_t message_count = 0;
-	char text_buffer[log_queue::MESSAGE_BUFFER_SIZE * 2];
-	log_queue::log_message message_buffer[log_queue::MESSAGE_COUNT_SIZE * 2];
-	// TIMER_U tick1;
-	// TIMER_U tick2;
+	// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+	size_t max_rows = std::max(cv_console_log_max_row_count.data, 0);
+	// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+	size_t max_text = static_cast<size_t>(std::max(cv_console_log_max_kb.data, 0)) * 1024;
+	log_ring.set_limits(max_rows, max_text);
+
+	// this doesn't block the threads that are logging.
+	log_sink_take_console_batch(&log_batch);
+	const char* str_cur = log_batch.text.data();
+	for(const log_queue::log_message& message : log_batch.messages)
 	{
-		// tick1 = timer_now();
-#ifndef __EMSCRIPTEN__
-		// YOU CANNOT PRINT TO SLOG OR SERR IN THIS LOCK!!!
-		std::lock_guard<std::mutex> lk(g_log_mut);
-#endif
-		const char* msg;
-		size_t start_index = 0;
-		while((msg = g_log.pop(&message_buffer[message_count])) != NULL)
-		{
-			ASSERT(message_count < std::size(message_buffer));
-			ASSERT(start_index + message_buffer[message_count].count < std::size(text_buffer));
-			memcpy(text_buffer + start_index, msg, message_buffer[message_count].count);
-			start_index += message_buffer[message_count].count;
-			message_count++;
-		}
-		text_buffer[start_index] = '\0';
-		// tick2 = timer_now();
+		log_ring.push(message.type, str_cur, message.count);
+		str_cur += message.count;
 	}
-	// slogf("console time: %g\n",timer_delta_ms(tick1, tick2));
-
-	if(message_count != 0)
+	bool has_messages = !log_batch.messages.empty();
+	if(log_batch.dropped != 0)
 	{
-		const char* str_cur = text_buffer;
-		for(size_t i = 0; i < message_count; ++i)
-		{
-			STB_TEXTEDIT_CHARTYPE codepoint_buffer[std::size(text_buffer)];
-			size_t codepoint_count = 0;
-			const char* str_end = str_cur + message_buffer[i].count;
-			while(str_cur != str_end)
-			{
-				uint32_t codepoint;
-				utf8::internal::utf_error err_code =
-					utf8::internal::validate_next(str_cur, str_end, codepoint);
-				if(err_code != utf8::internal::UTF8_OK)
-				{
-					// this will happen when you use have a very large single message
-					// with unicode characters, and it overflows text_buffer.
-					slogf("console_state::%s bad utf8: %s\n", __func__, cpputf_get_error(err_code));
-					codepoint = static_cast<unsigned char>(*str_cur);
-					++str_cur;
-				}
-				if(codepoint_count >= std::size(codepoint_buffer) - 1)
-				{
-					slogf("console_state::%s info: trunc log\n", __func__);
-					break;
-				}
-				codepoint_buffer[codepoint_count++] = codepoint;
-
-				if(codepoint == '\n')
-				{
-					log_line_count++;
-				}
-			}
-			switch(message_buffer[i].type)
-			{
-			case CONSOLE_MESSAGE_TYPE::INFO: log_box.current_color_index = 0; break;
-			case CONSOLE_MESSAGE_TYPE::ERROR: log_box.current_color_index = 1; break;
-			}
-			// printf("char_count: %zu\n", char_count);
-			// TODO(dootsie): I should probably include a newline before truncation...
-			codepoint_buffer[codepoint_count] = '\0';
-
-			log_box.set_readonly(false);
-			// NOLINTNEXTLINE(bugprone-narrowing-conversions)
-			log_box.stb_insert_chars(log_box.text_data.size(), codepoint_buffer, codepoint_count);
-			log_box.set_readonly(true);
-		}
-		log_box.current_color_index = 0;
-
-		// TODO(dootsie): I don't always want this to scroll to the bottom,
-		// I would like it to only do that when the scrollbar is already at the bottom!
-		log_box.scroll_to_bottom();
-
-		// this probably isn't the fastest way of doing this.
-		// I probably could implement this inside of text_prompt_wrapper itself
-		// using some sort of sliding window thingy in pretext
-		// and it would also fix the problem of this not being word-wrap aware.
-		if(log_line_count > cv_console_log_max_row_count.data)
+		char note[100];
+		int ret = snprintf(
+			note,
+			sizeof(note),
+			"warning: %zu log messages were dropped (the log buffer was full)\n",
+			log_batch.dropped);
+		if(ret > 0)
 		{
-			auto trim_cursor = log_box.text_data.begin();
-			auto trim_end = log_box.text_data.end();
-			for(; log_line_count > cv_console_log_max_row_count.data; log_line_count--)
-			{
-				for(; trim_cursor != trim_end && (trim_cursor++)->codepoint != '\n';)
-				{
-				}
-			}
-			log_box.set_readonly(false);
-			// TODO: this causes the selection to be bugged out...
-			// NOLINTNEXTLINE(bugprone-narrowing-conversions)
-			log_box.stb_delete_chars(0, std::distance(log_box.text_data.begin(), trim_cursor));
-			log_box.set_readonly(true);
+			log_ring.push(
+				CONSOLE_MESSAGE_TYPE::ERROR, note, std::min<size_t>(ret, sizeof(note) - 1));
+			has_messages = true;
 		}
 	}
+	// the last line could be continued without adding a line.
+	if(has_messages && log_view_follow)
+	{
+		log_box_dirty = true;
+	}
+	refresh_log_view();
+
 	log_box.update(delta_sec);
 	prompt_cmd.update(delta_sec);
 	error_text.update(delta_sec);
@@ -693,6 +918,8 @@ bool console_state::update(double delta_sec)
 
 bool console_state::render()
 {
+	ZONE_SCOPE("console_state::render");
+
 	if(log_box.draw_requested())
 	{
 		console_batcher->clear();
@@ -702,16 +929,17 @@ bool console_state::render()
 			// put the message into the console instead
 			post_error(serr_get_error());
 		}
-		log_vertex_count = console_batcher->get_current_vertex_count();
+		draw_log_scrollbar();
+		log_quad_count = console_batcher->get_current_quad_count();
 		if(console_batcher->get_quad_count() != 0)
 		{
 			ctx.glBindBuffer(GL_ARRAY_BUFFER, gl_log_interleave_vbo);
 			ctx.glBufferData(
-				GL_ARRAY_BUFFER, console_batcher->get_total_vertex_size(), NULL, GL_STREAM_DRAW);
+				GL_ARRAY_BUFFER, console_batcher->get_total_buffer_size(), NULL, GL_STREAM_DRAW);
 			ctx.glBufferSubData(
 				GL_ARRAY_BUFFER,
 				0,
-				console_batcher->get_current_vertex_size(),
+				console_batcher->get_current_buffer_size(),
 				console_batcher->buffer);
 			ctx.glBindBuffer(GL_ARRAY_BUFFER, 0);
 		}
@@ -726,16 +954,16 @@ bool console_state::render()
 			// put the message into the console instead
 			post_error(serr_get_error());
 		}
-		prompt_vertex_count = console_batcher->get_current_vertex_count();
+		prompt_quad_count = console_batcher->get_current_quad_count();
 		if(console_batcher->get_quad_count() != 0)
 		{
 			ctx.glBindBuffer(GL_ARRAY_BUFFER, gl_prompt_interleave_vbo);
 			ctx.glBufferData(
-				GL_ARRAY_BUFFER, console_batcher->get_total_vertex_size(), NULL, GL_STREAM_DRAW);
+				GL_ARRAY_BUFFER, console_batcher->get_total_buffer_size(), NULL, GL_STREAM_DRAW);
 			ctx.glBufferSubData(
 				GL_ARRAY_BUFFER,
 				0,
-				console_batcher->get_current_vertex_size(),
+				console_batcher->get_current_buffer_size(),
 				console_batcher->buffer);
 			ctx.glBindBuffer(GL_ARRAY_BUFFER, 0);
 		}
@@ -745,7 +973,7 @@ bool console_state::render()
 		// dont draw the bbox
 		if(error_text.text_data.empty())
 		{
-			error_vertex_count = 0;
+			error_quad_count = 0;
 		}
 		else
 		{
@@ -756,26 +984,32 @@ bool console_state::render()
 				// put the message into the console instead
 				post_error(serr_get_error());
 			}
-			error_vertex_count = console_batcher->get_current_vertex_count();
+			error_quad_count = console_batcher->get_current_quad_count();
 			if(console_batcher->get_quad_count() != 0)
 			{
 				ctx.glBindBuffer(GL_ARRAY_BUFFER, gl_error_interleave_vbo);
 				ctx.glBufferData(
 					GL_ARRAY_BUFFER,
-					console_batcher->get_total_vertex_size(),
+					console_batcher->get_total_buffer_size(),
 					NULL,
 					GL_STREAM_DRAW);
 				ctx.glBufferSubData(
 					GL_ARRAY_BUFFER,
 					0,
-					console_batcher->get_current_vertex_size(),
+					console_batcher->get_current_buffer_size(),
 					console_batcher->buffer);
 				ctx.glBindBuffer(GL_ARRAY_BUFFER, 0);
 			}
 		}
 	}
 
-	if(log_vertex_count != 0)
+	// upload any new glyphs into the atlas
+	if(!console_font->get_font_atlas()->flush_uploads())
+	{
+		return false;
+	}
+
+	if(log_quad_count != 0)
 	{
 		float x;
 		float y;
@@ -794,13 +1028,13 @@ bool console_state::render()
 			ctx.glScissor(
 				scissor_x, cv_screen_height.data - scissor_y - scissor_h, scissor_w, scissor_h);
 			ctx.glBindVertexArray(gl_log_vao_id);
-			ctx.glDrawArrays(GL_TRIANGLES, 0, log_vertex_count);
+			gl_draw_mono_quads(gl_log_interleave_vbo, 0, log_quad_count);
 			ctx.glBindVertexArray(0);
 			ctx.glDisable(GL_SCISSOR_TEST);
 		}
 	}
 
-	if(prompt_vertex_count != 0)
+	if(prompt_quad_count != 0)
 	{
 		float x;
 		float y;
@@ -818,13 +1052,13 @@ bool console_state::render()
 			ctx.glScissor(
 				scissor_x, cv_screen_height.data - scissor_y - scissor_h, scissor_w, scissor_h);
 			ctx.glBindVertexArray(gl_prompt_vao_id);
-			ctx.glDrawArrays(GL_TRIANGLES, 0, prompt_vertex_count);
+			gl_draw_mono_quads(gl_prompt_interleave_vbo, 0, prompt_quad_count);
 			ctx.glBindVertexArray(0);
 			ctx.glDisable(GL_SCISSOR_TEST);
 		}
 	}
 
-	if(error_vertex_count != 0)
+	if(error_quad_count != 0)
 	{
 		float x;
 		float y;
@@ -842,7 +1076,7 @@ bool console_state::render()
 			ctx.glScissor(
 				scissor_x, cv_screen_height.data - scissor_y - scissor_h, scissor_w, scissor_h);
 			ctx.glBindVertexArray(gl_error_vao_id);
-			ctx.glDrawArrays(GL_TRIANGLES, 0, error_vertex_count);
+			gl_draw_mono_quads(gl_error_interleave_vbo, 0, error_quad_count);
 			ctx.glBindVertexArray(0);
 			ctx.glDisable(GL_SCISSOR_TEST);
 		}
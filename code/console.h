@@ -7,66 +7,71 @@
 #include "font/font_manager.h"
 #include "font/text_prompt.h"
 #include "BS_Archive/BS_archive.h"
+#include "log_sink.h"
 
 #include <SDL2/SDL.h>
 #include <deque>
+#include <vector>
 #include <memory>
 
-// I don't use threads on emscripten.
-#ifndef __EMSCRIPTEN__
-#include <mutex>
-#include <atomic>
-#endif
-
-enum class CONSOLE_MESSAGE_TYPE
+// the lines of the console log, when it's full the oldest line is dropped.
+// the text is stored as utf8 without the newline, and it's only decoded
+// when it's on screen (see console_state::refresh_log_view).
+// a line is identified by it's id, which counts every line ever pushed,
+// so the view can keep it's position while old lines are trimmed.
+struct console_log_ring
 {
-	INFO,
-	ERROR
-};
-
-struct log_queue
-{
-	enum
-	{
-		MESSAGE_COUNT_SIZE = 100,
-		MESSAGE_BUFFER_SIZE = 10000,
-	};
-	struct log_message
+	struct line_record
 	{
-		size_t count; // the number of characters written (the return value of fprintf)
+		// the position in the text ring, this only increases (use get_text)
+		uint64_t offset;
+		uint32_t size;
 		CONSOLE_MESSAGE_TYPE type;
 	};
 
-	// there are 2 buffers, which get swapped when filled.
-	// if a buffer cannot swap because the other buffer has messages,
-	// the buffer's messages will be erased.
-	// the reason why I did this is not for multithreading
-	// but because this implementation is more simple than a circular buffer.
-	struct log_buffer
+	// both rings grow up to the limits, so a large limit costs nothing until it's used.
+	std::vector<line_record> lines;
+	std::vector<char> text;
+	size_t max_lines = 1;
+	size_t max_text = 1;
+
+	// the id of the oldest line
+	uint64_t line_first = 0;
+	size_t line_count = 0;
+	// the text ring holds [text_begin, text_end)
+	uint64_t text_begin = 0;
+	uint64_t text_end = 0;
+	// the last message didn't end with a newline, so the next message continues the line.
+	bool last_line_open = false;
+
+	// trims the oldest lines if it's above the new limits.
+	void set_limits(size_t max_lines_, size_t max_text_);
+
+	// the message is split by newlines, a line longer than max_text is truncated.
+	void push(CONSOLE_MESSAGE_TYPE type, const char* str, size_t size);
+	// frees the memory, the ids keep counting.
+	void clear();
+
+	uint64_t end_id() const
 	{
-		size_t message_count = 0;
-		size_t messages_read = 0;
-		size_t write_cursor = 0;
-		size_t read_cursor = 0;
-		log_message entries[MESSAGE_COUNT_SIZE];
-		char data[MESSAGE_BUFFER_SIZE];
-	};
-
-	size_t buf_write_id = 0;
-	size_t buf_read_id = 0;
-	log_buffer buffers[2];
-
-	void push(CONSOLE_MESSAGE_TYPE type, const char* str, size_t len);
-	void push_vargs(CONSOLE_MESSAGE_TYPE type, const char* fmt, va_list args);
-	const char* pop(log_message* message);
+		return line_first + line_count;
+	}
+	const line_record& get_line(uint64_t id) const
+	{
+		ASSERT(id >= line_first && id < end_id());
+		return lines[id % lines.size()];
+	}
+	// copies the text of the line into out (no newline)
+	void get_text(const line_record& line, std::string& out) const;
+
+	// internal
+	void internal_pop_front();
+	void internal_new_line(CONSOLE_MESSAGE_TYPE type);
+	void internal_append(const char* str, size_t size);
+	void internal_copy_out(uint64_t offset, char* out, size_t size) const;
+	void internal_copy_in(uint64_t offset, const char* str, size_t size);
 };
 
-#ifndef __EMSCRIPTEN__
-// the queue's mutex
-extern std::mutex g_log_mut;
-#endif
-extern log_queue g_log;
-
 enum class CONSOLE_RESULT
 {
 	CONTINUE,
@@ -75,9 +80,24 @@ enum class CONSOLE_RESULT
 
 struct console_state
 {
-	// keep track of how many newlines are drawn
-	// to cut lines from the top when the limit is reached.
-	int log_line_count = 0;
+	// the log is kept here, log_box only holds the lines on screen.
+	console_log_ring log_ring;
+	// the view shows the lines before log_view_end (a line id).
+	uint64_t log_view_end = 0;
+	// move log_view_end when new lines come in.
+	bool log_view_follow = true;
+	// the lines that are in log_box, it's refilled when the view moves.
+	uint64_t log_box_begin = 0;
+	uint64_t log_box_end = 0;
+	bool log_box_dirty = true;
+	// the scrollbar for log_ring (log_box's scrollbar only knows about the lines on screen)
+	bool log_scrollbar_held = false;
+	float log_thumb_click_offset = 0;
+	// the new messages (reused every update)
+	log_sink_batch log_batch;
+	// temporary buffers for refresh_log_view
+	std::string log_line_buffer;
+	std::vector<STB_TEXTEDIT_CHARTYPE> log_decode_buffer;
 
 	std::array<text_prompt_wrapper::color_pair, 1> log_color_table = {
 		text_prompt_wrapper::color_pair{{255, 255, 255, 255}, RGBA8_PREMULT(255, 0, 0, 200)}};
@@ -91,20 +111,20 @@ struct console_state
 	text_prompt_wrapper log_box;
 	GLuint gl_log_interleave_vbo = 0;
 	GLuint gl_log_vao_id = 0;
-	GLsizei log_vertex_count = 0;
+	GLsizei log_quad_count = 0;
 
 	// the text you type into
 	text_prompt_wrapper prompt_cmd;
 	GLuint gl_prompt_interleave_vbo = 0;
 	GLuint gl_prompt_vao_id = 0;
-	GLsizei prompt_vertex_count = 0;
+	GLsizei prompt_quad_count = 0;
 
 	// this is the last error that was printed
 	// put into a static area so you can read it.
 	text_prompt_wrapper error_text;
 	GLuint gl_error_interleave_vbo = 0;
 	GLuint gl_error_vao_id = 0;
-	GLsizei error_vertex_count = 0;
+	GLsizei error_quad_count = 0;
 
 	const char* history_path = "console_hist.json";
 	std::deque<std::string> command_history;
@@ -112,16 +132,26 @@ struct console_state
 	std::string original_prompt;
 	int history_index = -1;
 
-	NDSERR bool init(
-		font_style_interface* console_font_,
-		mono_2d_batcher* console_batcher_,
-		shader_mono_state& mono_shader);
+	NDSERR bool init(font_style_interface* console_font_, mono_2d_batcher* console_batcher_);
 	NDSERR bool destroy();
 
 	NDSERR CONSOLE_RESULT input(SDL_Event& e);
 
 	void resize_text_area();
 
+	// the number of whole lines that fit in log_box.
+	size_t get_log_page_lines() const;
+	// clamp the view and refill log_box if the lines on screen changed.
+	void refresh_log_view();
+	// scroll the view by a number of lines (negative is up)
+	void scroll_log_view(int64_t lines);
+	// the scrollbar of log_ring, false if everything fits.
+	bool get_log_thumb(float* ymin, float* ymax) const;
+	void draw_log_scrollbar();
+	void scroll_log_thumb_to(float mouse_y);
+	// the mouse wheel and the scrollbar of the log, this converts the events it uses.
+	void log_scrollbar_input(SDL_Event& e);
+
 	NDSERR bool parse_input();
 
 	// this checks for new logs
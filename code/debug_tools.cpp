@@ -90,12 +90,20 @@ static REGISTER_CVAR_INT(
 
 #if defined(__linux__)
 #include <dlfcn.h> // for dladdr
+#include <sys/uio.h> // for process_vm_readv
+#include <ucontext.h>
+#include <unistd.h>
 #endif
 
 #ifdef __GNUG__
 #include <cxxabi.h>
 #endif
 
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
 
 struct debug_stacktrace_info
 {
@@ -249,19 +257,166 @@ static int bt_full_callback(
 	return payload->call(&info, NULL, payload->ud);
 }
 
+static void bt_state_error_callback(void* vdata, const char* msg, int errnum)
+{
+	(void)vdata;
+	(void)errnum;
+	fprintf(stderr, "libbacktrace error: %s\n", (msg != NULL ? msg : "no error?"));
+}
+
+
 // wrapper because static initialization of a constructor is thread safe.
 struct bt_state_wrapper
 {
 	backtrace_state* state;
-	explicit bt_state_wrapper(bt_payload& info)
-	: state(backtrace_create_state(NULL, 1, bt_error_callback, &info))
+	bt_state_wrapper()
+	: state(backtrace_create_state(NULL, 1, bt_state_error_callback, NULL))
+	{
+	}
+};
+
+// set by debug_prepare_signal_stacktrace.
+static std::atomic<bool> g_bt_signal_prepared{false};
+
+static backtrace_state* bt_get_state()
+{
+	static bt_state_wrapper state;
+	return state.state;
+}
+
+// the symbols of a pc, an inlined function has more than one frame.
+struct bt_cached_frame
+{
+	uintptr_t addr;
+	const char* module;
+	const char* function;
+	const char* file;
+	int line;
+	// if this is set, the frame is a libbacktrace error.
+	const char* error;
+};
+
+// symbolizing a pc (reading the debug info and demangling) is very slow,
+// so every pc is only symbolized once, and the names are shared between the frames.
+struct bt_symbol_cache
+{
+	std::mutex mut;
+	// the cvars the names were made with, the cache is cleared if they change.
+	int demangle = -1;
+	int full_paths = -1;
+	std::unordered_map<uintptr_t, std::vector<bt_cached_frame>> frames;
+	// the strings never move (it's node based).
+	std::unordered_set<std::string> names;
+
+	// requires the lock.
+	void check_cvars()
+	{
+		if(demangle != cv_bt_demangle.data || full_paths != cv_bt_full_paths.data)
+		{
+			frames.clear();
+			names.clear();
+			demangle = cv_bt_demangle.data;
+			full_paths = cv_bt_full_paths.data;
+		}
+	}
+
+	const char* intern(const char* str)
+	{
+		if(str == NULL)
+		{
+			return NULL;
+		}
+		return names.emplace(str).first->c_str();
+	}
+};
+
+static bt_symbol_cache& bt_get_cache()
+{
+	static bt_symbol_cache cache;
+	return cache;
+}
+
+struct bt_resolve_payload
+{
+	bt_symbol_cache* cache;
+	std::vector<bt_cached_frame>* frames;
+};
+
+static int bt_resolve_callback(debug_stacktrace_info* data, const char* error, void* ud)
+{
+	ASSERT(ud != NULL);
+	bt_resolve_payload* payload = static_cast<bt_resolve_payload*>(ud);
+	bt_cached_frame frame{};
+	if(data == NULL)
+	{
+		frame.error = payload->cache->intern(error);
+	}
+	else
 	{
+		frame.addr = data->addr;
+		frame.module = payload->cache->intern(data->module);
+		frame.function = payload->cache->intern(data->function);
+		frame.file = payload->cache->intern(data->file);
+		frame.line = data->line;
 	}
+	payload->frames->push_back(frame);
+	return 0;
+}
+
+// requires the cache lock.
+static const std::vector<bt_cached_frame>&
+	bt_resolve_pc(bt_symbol_cache& cache, backtrace_state* state, uintptr_t pc)
+{
+	auto [it, inserted] = cache.frames.try_emplace(pc);
+	if(!inserted)
+	{
+		return it->second;
+	}
+	std::vector<bt_cached_frame> frames;
+	bt_resolve_payload resolve{&cache, &frames};
+
+	bt_payload info;
+	info.call = bt_resolve_callback;
+	info.ud = &resolve;
+	info.state = state;
+	backtrace_pcinfo(state, pc, bt_full_callback, bt_error_callback, &info);
+
+	bool has_frame = false;
+	for(const bt_cached_frame& frame : frames)
+	{
+		has_frame = has_frame || frame.error == NULL;
+	}
+	if(!has_frame)
+	{
+		// no debug info, this tries dladdr and the symbol table.
+		bt_full_callback(&info, pc, NULL, 0, NULL);
+	}
+	it->second = std::move(frames);
+	return it->second;
+}
+
+struct bt_simple_payload
+{
+	uintptr_t* pcs;
+	int max_count;
+	int count;
 };
 
-static __attribute__((noinline)) bool
-	debug_raw_stacktrace(debug_stacktrace_callback callback, void* ud, int skip)
+static int bt_simple_callback(void* vdata, uintptr_t pc)
+{
+	bt_simple_payload* payload = static_cast<bt_simple_payload*>(vdata);
+	// don't know why this is always at the bottom of the stack in libbacktrace
+	if(pc == static_cast<uintptr_t>(-1))
+	{
+		return 0;
+	}
+	payload->pcs[payload->count++] = pc;
+	return (payload->count == payload->max_count) ? 1 : 0;
+}
+
+__attribute__((noinline)) int debug_capture_stacktrace(uintptr_t* pcs, int max_count, int skip)
 {
+	ASSERT(pcs != NULL);
 #if defined(_WIN32)
 	if(cv_bt_trap.data == 1 || (cv_bt_trap.data == 2 && IsDebuggerPresent()))
 	{
@@ -274,32 +429,15 @@ static __attribute__((noinline)) bool
 	}
 #endif
 
-	bt_payload info;
-	info.call = callback;
-	info.ud = ud;
-	info.idx = 0;
-	info.syminfo_module = NULL;
-
-	static bt_state_wrapper state(info);
-	info.state = state.state;
-	if(state.state == NULL)
+	backtrace_state* state = bt_get_state();
+	if(state == NULL || max_count <= 0)
 	{
-		return false;
+		return 0;
 	}
-#if 0
-	TIMER_U tick1;
-	TIMER_U tick2;
-	tick1 = timer_now();
-#endif
-	// resolving the debug info is very slow, but you could offload the overhead by using
-	// backtrace_simple and in another thread you can resolving the debug info from backtrace_pcinfo
-	int ret = backtrace_full(state.state, skip + 1, bt_full_callback, bt_error_callback, &info);
-
-#if 0
-	tick2 = timer_now();
-	slogf("bt time = %f\n", timer_delta_ms(tick1, tick2));
-#endif
-	return ret == 0;
+	bt_simple_payload payload{pcs, max_count, 0};
+	// this only unwinds the stack, the symbols are looked up by debug_str_stacktrace_pcs.
+	backtrace_simple(state, skip + 1, bt_simple_callback, bt_state_error_callback, &payload);
+	return payload.count;
 }
 
 // format: MODULE ! FUNCTION [FILE @ LINE] or MODULE ! PTR
@@ -373,14 +511,225 @@ err:
 	return -1;
 }
 
+// the registers of the interrupted code, for walking the frame pointers.
+struct bt_signal_regs
+{
+	uintptr_t pc;
+	uintptr_t fp;
+	uintptr_t sp;
+};
+
+static bool bt_get_signal_regs(void* ucontext, bt_signal_regs* out)
+{
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+	const ucontext_t* context = static_cast<const ucontext_t*>(ucontext);
+#if defined(__x86_64__)
+	out->pc = context->uc_mcontext.gregs[REG_RIP];
+	out->fp = context->uc_mcontext.gregs[REG_RBP];
+	out->sp = context->uc_mcontext.gregs[REG_RSP];
+#else
+	out->pc = context->uc_mcontext.pc;
+	out->fp = context->uc_mcontext.regs[29];
+	out->sp = context->uc_mcontext.sp;
+#endif
+	return true;
+#else
+	(void)ucontext;
+	(void)out;
+	return false;
+#endif
+}
+
+#if defined(__linux__)
+enum
+{
+	// the smallest page size, a page that was read once doesn't need the syscall again.
+	BT_PAGE_SIZE = 4096
+};
+
+// reads the frame record at fp (the next fp and the return address) without faulting,
+// process_vm_readv returns EFAULT for memory that isn't readable.
+static bool bt_read_frame_record(uintptr_t fp, uintptr_t* record_out, uintptr_t* valid_page)
+{
+	size_t size = sizeof(uintptr_t) * 2;
+	uintptr_t page = fp & ~static_cast<uintptr_t>(BT_PAGE_SIZE - 1);
+	bool one_page = (fp - page) + size <= BT_PAGE_SIZE;
+	if(one_page && page == *valid_page)
+	{
+		memcpy(record_out, reinterpret_cast<const void*>(fp), size);
+		return true;
+	}
+	iovec local{record_out, size};
+	iovec remote{reinterpret_cast<void*>(fp), size};
+	if(process_vm_readv(getpid(), &local, 1, &remote, 1, 0) != static_cast<ssize_t>(size))
+	{
+		return false;
+	}
+	if(one_page)
+	{
+		*valid_page = page;
+	}
+	return true;
+}
+#endif
+
+bool debug_prepare_signal_stacktrace()
+{
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+	// the symbols are loaded later, but check that libbacktrace works now.
+	if(bt_get_state() == NULL)
+	{
+		serrf("%s: failed to create the libbacktrace state\n", __func__);
+		return false;
+	}
+	// the walk reads the stack with process_vm_readv, a sandbox could block it.
+	uintptr_t value = 1;
+	uintptr_t record[2];
+	uintptr_t valid_page = 0;
+	if(!bt_read_frame_record(reinterpret_cast<uintptr_t>(&value), record, &valid_page))
+	{
+		serrf("%s: process_vm_readv failed, reason: %s\n", __func__, strerror(errno));
+		return false;
+	}
+	g_bt_signal_prepared.store(true, std::memory_order_release);
+	return true;
+#else
+	serrf("%s: the frame pointer walk is not supported on this platform\n", __func__);
+	return false;
+#endif
+}
+
+int debug_capture_stacktrace_in_signal(uintptr_t* pcs, int max_count, void* ucontext)
+{
+	ASSERT(pcs != NULL);
+	bt_signal_regs regs;
+	if(!g_bt_signal_prepared.load(std::memory_order_acquire) || max_count <= 0 ||
+	   ucontext == NULL || !bt_get_signal_regs(ucontext, &regs))
+	{
+		return 0;
+	}
+	int count = 0;
+	pcs[count++] = regs.pc;
+#if defined(__linux__)
+	// a frame record is {the caller's fp, the return address},
+	// the records are higher on the stack than the last one (or it's not a frame pointer).
+	uintptr_t fp = regs.fp;
+	uintptr_t last = regs.sp;
+	uintptr_t valid_page = 0;
+	while(count < max_count && fp >= last && fp % sizeof(uintptr_t) == 0)
+	{
+		uintptr_t record[2];
+		if(!bt_read_frame_record(fp, record, &valid_page) || record[1] == 0)
+		{
+			break;
+		}
+		// the return address is after the call, libbacktrace also subtracts 1.
+		pcs[count++] = record[1] - 1;
+		last = fp + sizeof(record);
+		fp = record[0];
+	}
+#endif
+	return count;
+}
+
+bool debug_str_folded_stack(std::string* out, const uintptr_t* pcs, int count)
+{
+	ASSERT(out != NULL);
+	ASSERT(pcs != NULL || count == 0);
+	backtrace_state* state = bt_get_state();
+	if(state == NULL || count == 0)
+	{
+		return false;
+	}
+
+	bt_symbol_cache& cache = bt_get_cache();
+	std::lock_guard<std::mutex> lk(cache.mut);
+	cache.check_cvars();
+
+	// the pcs are from the top of the stack, the folded stack starts from the bottom.
+	bool first = true;
+	char buffer[100];
+	for(int i = count; i-- > 0;)
+	{
+		const std::vector<bt_cached_frame>& frames = bt_resolve_pc(cache, state, pcs[i]);
+		// the inlined functions are also from the top.
+		for(size_t j = frames.size(); j-- > 0;)
+		{
+			const bt_cached_frame& frame = frames[j];
+			if(frame.error != NULL)
+			{
+				continue;
+			}
+			if(!first)
+			{
+				out->push_back(';');
+			}
+			first = false;
+			if(frame.function != NULL)
+			{
+				*out += frame.function;
+				continue;
+			}
+			int ret = snprintf(
+				buffer,
+				sizeof(buffer),
+				"%s+%" PRIxPTR,
+				(frame.module != NULL ? frame.module : "?"),
+				frame.addr);
+			if(ret > 0)
+			{
+				out->append(buffer, std::min<size_t>(ret, sizeof(buffer) - 1));
+			}
+		}
+	}
+	return true;
+}
+
+bool debug_str_stacktrace_pcs(std::string* out, const uintptr_t* pcs, int count)
+{
+	ASSERT(out != NULL);
+	ASSERT(pcs != NULL || count == 0);
+	backtrace_state* state = bt_get_state();
+	if(state == NULL || count == 0)
+	{
+		return false;
+	}
+
+	bt_symbol_cache& cache = bt_get_cache();
+	std::lock_guard<std::mutex> lk(cache.mut);
+	cache.check_cvars();
+
+	int index = 0;
+	for(int i = 0; i < count; ++i)
+	{
+		for(const bt_cached_frame& frame : bt_resolve_pc(cache, state, pcs[i]))
+		{
+			if(frame.error != NULL)
+			{
+				raw_string_callback(NULL, frame.error, out);
+				continue;
+			}
+			debug_stacktrace_info info{
+				++index, frame.addr, frame.module, frame.function, frame.file, frame.line};
+			if(raw_string_callback(&info, NULL, out) != 0)
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
 __attribute__((noinline)) bool debug_str_stacktrace(std::string* out, int skip)
 {
-    return debug_raw_stacktrace(raw_string_callback, out, skip);
+	uintptr_t pcs[DEBUG_STACKTRACE_MAX_FRAMES];
+	int count = debug_capture_stacktrace(pcs, std::size(pcs), skip);
+	return debug_str_stacktrace_pcs(out, pcs, count);
 }
 
 #else
 
-__attribute__((noinline)) bool debug_str_stacktrace(std::string*, int)
+__attribute__((noinline)) int debug_capture_stacktrace(uintptr_t*, int, int)
 {
 #if defined(_WIN32)
 	if(cv_bt_trap.data == 1 || (cv_bt_trap.data == 2 && IsDebuggerPresent()))
@@ -393,8 +742,36 @@ __attribute__((noinline)) bool debug_str_stacktrace(std::string*, int)
 		raise(SIGTRAP);
 	}
 #endif
+	return 0;
+}
+
+bool debug_str_stacktrace_pcs(std::string*, const uintptr_t*, int)
+{
+	return false;
+}
+
+bool debug_prepare_signal_stacktrace()
+{
+	serrf("%s: requires libbacktrace\n", __func__);
+	return false;
+}
+
+int debug_capture_stacktrace_in_signal(uintptr_t*, int, void*)
+{
+	return 0;
+}
+
+bool debug_str_folded_stack(std::string*, const uintptr_t*, int)
+{
 	return false;
 }
+
+__attribute__((noinline)) bool debug_str_stacktrace(std::string* out, int skip)
+{
+	uintptr_t pcs[1];
+	int count = debug_capture_stacktrace(pcs, std::size(pcs), skip);
+	return debug_str_stacktrace_pcs(out, pcs, count);
+}
 #endif
 
 #endif // __EMSCRIPTEN__
@@ -6,6 +6,12 @@
 #define HAS_STACKTRACE_PROBABLY
 #endif
 
+enum
+{
+	// the frames that debug_str_stacktrace shows.
+	DEBUG_STACKTRACE_MAX_FRAMES = 64
+};
+
 #if defined(__EMSCRIPTEN__)
 
 #include <emscripten.h>
@@ -25,9 +31,44 @@ inline int debug_str_stacktrace(std::string* out, int)
     out += '\n';
 	return 0;
 }
+// emscripten_get_callstack only makes text.
+inline int debug_capture_stacktrace(uintptr_t*, int, int)
+{
+	return 0;
+}
+inline bool debug_str_stacktrace_pcs(std::string*, const uintptr_t*, int)
+{
+	return false;
+}
 #else
 
 // return false means no stacktrace, no serr message.
 // format: MODULE ! FUNCTION [FILE @ LINE] or MODULE ! PTR
+// this is debug_capture_stacktrace + debug_str_stacktrace_pcs.
 bool debug_str_stacktrace(std::string* out, int skip);
+
+// only unwinds the stack (cheap), returns the number of pcs (0 = no stacktrace).
+// the pcs can be symbolized later (or on another thread) with debug_str_stacktrace_pcs.
+int debug_capture_stacktrace(uintptr_t* pcs, int max_count, int skip);
+
+// symbolizes the pcs from debug_capture_stacktrace (any thread).
+// every pc is only looked up once, after that it's a hash lookup,
+// the cache is cleared if cv_bt_demangle or cv_bt_full_paths change.
+bool debug_str_stacktrace_pcs(std::string* out, const uintptr_t* pcs, int count);
+
+// for a signal handler (SA_SIGINFO), call debug_prepare_signal_stacktrace first.
+// this is async signal safe (libbacktrace's unwinder takes the loader locks, so it isn't),
+// it walks the frame pointers from the ucontext, and reads the stack with process_vm_readv,
+// so a bad frame pointer stops the walk instead of crashing.
+// the stack starts at the pc in the ucontext, returns 0 if it wasn't prepared.
+// the code needs -fno-omit-frame-pointer (USE_LIBBACKTRACE sets it),
+// the stack ends early in libraries without frame pointers (libc, the GL driver),
+// and a sample in a function's prologue or a leaf function (gcc omits the frame pointer)
+// misses the caller (linux x86_64 and arm64 only).
+NDSERR bool debug_prepare_signal_stacktrace();
+int debug_capture_stacktrace_in_signal(uintptr_t* pcs, int max_count, void* ucontext);
+
+// the function names of the pcs for a flamegraph (bottom;...;top), without a newline.
+// unknown functions are MODULE+ADDRESS.
+bool debug_str_folded_stack(std::string* out, const uintptr_t* pcs, int count);
 #endif
\ No newline at end of file
@@ -7,9 +7,16 @@
 
 #include "RWops.h"
 #include "font/font_manager.h"
+#include "font/font_atlas_cache.h"
+#include "font/font_bit_kernels.h"
+#include "font/utf8_stuff.h"
 #include "app.h"
 #include "debug_tools.h"
+#include "frame_watchdog.h"
 #include "keybind.h"
+#include "log_queue.h"
+#include "telemetry.h"
+#include "zone_profiler.h"
 
 #include <SDL2/SDL.h>
 #include <glm/ext/matrix_clip_space.hpp>
@@ -37,6 +44,18 @@ static REGISTER_CVAR_STRING(
 	"the fallback font used for rare unicode",
 	CVAR_T::STARTUP);
 
+static REGISTER_CVAR_STRING(
+	cv_hexfile_cache_path,
+	"unifont-full.hex.bin",
+	"a binary version of cv_hexfile_path generated on startup, \"\" = don't write a cache",
+	CVAR_T::STARTUP);
+
+static REGISTER_CVAR_STRING(
+	cv_font_atlas_cache_path,
+	"font_atlas.bin",
+	"the glyphs of cv_string_font are saved here on exit and loaded on startup, \"\" = off",
+	CVAR_T::STARTUP);
+
 static REGISTER_CVAR_STRING(
 	cv_string,
 	"test\n"
@@ -61,10 +80,78 @@ REGISTER_CVAR_INT(
 	"0 = off, 1 = on, can't bold or italics, but looks different",
 	CVAR_T::STARTUP);
 
+static REGISTER_CVAR_INT(
+	cv_string_sdf,
+	0,
+	"0 = off, 1 = signed distance field glyphs, crisp at any scale (if linear filtering)",
+	CVAR_T::STARTUP);
+
+static REGISTER_CVAR_INT(
+	cv_bench_font_packer,
+	0,
+	"0 = off, 1 = print a benchmark of the font atlas packers using unifont and cv_string_font",
+	CVAR_T::STARTUP);
+
+static REGISTER_CVAR_INT(
+	cv_bench_font_bits,
+	0,
+	"0 = off, 1 = print a benchmark of the hex decoding and 1bpp expanding kernels",
+	CVAR_T::STARTUP);
+
+static REGISTER_CVAR_INT(
+	cv_bench_utf8,
+	0,
+	"0 = off, 1 = print a benchmark of decoding ascii, mixed and CJK utf8",
+	CVAR_T::STARTUP);
+
+static REGISTER_CVAR_INT(
+	cv_perf_window_ms,
+	2000,
+	"the p99 / p99.9 of the perf text are from the last 1 to 2 of these (milliseconds)",
+	CVAR_T::RUNTIME);
+
+static REGISTER_CVAR_INT(
+	cv_perf_dump_ms,
+	0,
+	"how often the percentiles of the perf counters are appended to cv_perf_dump_file "
+	"(milliseconds, 0 = off)",
+	CVAR_T::RUNTIME);
+
+static REGISTER_CVAR_STRING(
+	cv_perf_dump_file,
+	"perf.csv",
+	"the file for cv_perf_dump_ms, CSV or JSON lines if it ends with .json",
+	CVAR_T::RUNTIME);
+
+static REGISTER_CVAR_INT(
+	cv_font_batch_max_quads,
+	262144,
+	"the most glyphs and rects the text batch can grow to (24 bytes each), the rest are dropped",
+	CVAR_T::STARTUP);
+
+#ifndef __EMSCRIPTEN__
+static REGISTER_CVAR_INT(
+	cv_font_raster_threads,
+	0,
+	"0 = rasterize glyphs on the main thread, 1+ = the number of threads that rasterize glyphs",
+	CVAR_T::STARTUP);
+#endif
+
 // if the pixel's alpha is is greater/equal than the reference value, draw the pixel.
 REGISTER_CVAR_DOUBLE(
 	cv_string_alpha_test, -1, "-1 = no alpha testing, 0-1 = alpha test", CVAR_T::STARTUP);
 
+// the shader and the font settings need to agree.
+static bool use_sdf_font()
+{
+#ifdef FONT_HAS_SDF
+	// unifont is a bitmap font.
+	return cv_string_sdf.data == 1 && cv_string_font.data != "unifont";
+#else
+	return false;
+#endif
+}
+
 // keybinds
 REGISTER_CVAR_KEY_BIND_KEY(cv_bind_move_forward, SDLK_w, false, "move forward");
 REGISTER_CVAR_KEY_BIND_KEY(cv_bind_move_backward, SDLK_s, false, "move backward");
@@ -453,7 +540,14 @@ bool demo_state::init()
 	// all my shaders only use 1 texture.
 	ctx.glActiveTexture(GL_TEXTURE0);
 
-	if(cv_string_alpha_test.data == -1)
+	if(use_sdf_font())
+	{
+		if(!mono_shader.create_sdf())
+		{
+			return false;
+		}
+	}
+	else if(cv_string_alpha_test.data == -1)
 	{
 		if(!mono_shader.create())
 		{
@@ -515,6 +609,11 @@ EMSCRIPTEN_RESULT em_ret = emscripten_set_pointerlockchange_callback("#canvas",
 
 #endif
 
+	if(!frame_watchdog_init())
+	{
+		return false;
+	}
+
 	timer_last = timer_now();
 	return true;
 }
@@ -721,16 +820,38 @@ bool demo_state::init_gl_font()
 		TIMER_U end;
 		start = timer_now();
 #endif
-		Unique_RWops hex_file = Unique_RWops_OpenFS(cv_hexfile_path.data, "rb");
-		// Unique_RWops hex_file = Unique_RWops_OpenFS("unifont_upper-14.0.02.hex", "rb");
-		if(!hex_file)
+		const char* hex_cache_path =
+			(cv_hexfile_cache_path.data.empty() ? NULL : cv_hexfile_cache_path.data.c_str());
+		if(!font_manager.hex_font.init(
+			   cv_hexfile_path.data.c_str(), hex_cache_path, &font_manager.atlas))
 		{
 			return false;
 		}
 
-		if(!font_manager.hex_font.init(std::move(hex_file), &font_manager.atlas))
+		if(cv_bench_font_packer.data == 1)
 		{
-			return false;
+			const char* ttf_path =
+				(cv_string_font.data == "unifont" ? NULL : cv_string_font.data.c_str());
+			if(!bench_font_atlas_packers(&font_manager, ttf_path))
+			{
+				return false;
+			}
+		}
+
+		if(cv_bench_font_bits.data == 1)
+		{
+			if(!bench_font_bit_kernels())
+			{
+				return false;
+			}
+		}
+
+		if(cv_bench_utf8.data == 1)
+		{
+			if(!bench_cpputf_decode())
+			{
+				return false;
+			}
 		}
 
 #if 0
@@ -804,6 +925,23 @@ bool demo_state::init_gl_font()
 			font_settings.force_bitmap = true;
 		}
 
+#ifdef FONT_HAS_SDF
+		if(use_sdf_font())
+		{
+			// hinting for mono doesn't make sense for a distance field.
+			font_settings.render_mode = FT_RENDER_MODE_SDF;
+			font_settings.load_flags = FT_LOAD_DEFAULT;
+			// the outline needs to fit inside of the spread, with a bit of room for smoothing.
+			// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+			int spread = std::ceil(std::max(font_settings.outline_size, font_settings.bold_x)) + 2;
+			font_settings.sdf_spread = std::clamp(spread, 4, 32);
+			if(cv_font_linear_filtering.data == 0)
+			{
+				slogf("info: cv_string_sdf looks blocky without cv_font_linear_filtering\n");
+			}
+		}
+#endif
+
 		if(!font_rasterizer.set_face_settings(&font_settings))
 		{
 			return false;
@@ -811,6 +949,31 @@ bool demo_state::init_gl_font()
 
 		font_style.init(&font_manager, &font_rasterizer);
 		current_font = &font_style;
+
+		if(!cv_font_atlas_cache_path.data.empty())
+		{
+			if(!font_atlas_cache_load(
+				   &font_style,
+				   cv_string_font.data.c_str(),
+				   cv_font_atlas_cache_path.data.c_str()))
+			{
+				// a broken cache isn't fatal, the glyphs will just be rasterized again,
+				// and the error was already printed.
+				(void)serr_get_error();
+			}
+		}
+
+#ifndef __EMSCRIPTEN__
+		if(cv_font_raster_threads.data > 0)
+		{
+			if(!font_raster_workers.init(
+				   cv_string_font.data.c_str(), &font_settings, cv_font_raster_threads.data))
+			{
+				return false;
+			}
+			font_style.raster_pool = &font_raster_workers;
+		}
+#endif
 	}
 
 #if 0
@@ -840,22 +1003,29 @@ bool demo_state::init_gl_font()
 	// vertex setup
 	ctx.glBindVertexArray(gl_font_vao_id);
 	ctx.glBindBuffer(GL_ARRAY_BUFFER, gl_font_interleave_vbo);
-	gl_create_interleaved_mono_vertex_vao(mono_shader);
+	gl_create_mono_instance_vao();
 
-	size_t max_quads = 10000;
-	font_batcher_buffer =
-		std::make_unique<gl_mono_vertex[]>(max_quads * mono_2d_batcher::QUAD_VERTS);
-	font_batcher.init(font_batcher_buffer.get(), max_quads);
+	if(cv_font_batch_max_quads.data < 1)
+	{
+		serrf(
+			"%s error: invalid cv_font_batch_max_quads: %d\n",
+			__func__,
+			cv_font_batch_max_quads.data);
+		return false;
+	}
+	size_t max_quads = cv_font_batch_max_quads.data;
+	// it grows when it's full, so start small.
+	font_batcher.init(std::min<size_t>(1024, max_quads), max_quads);
 
 	font_painter.init(&font_batcher, current_font);
 	// font_painter.set_scale(2);
 
-	if(!console_menu.init(current_font, &font_batcher, mono_shader))
+	if(!console_menu.init(current_font, &font_batcher))
 	{
 		return false;
 	}
 
-	if(!option_menu.init(current_font, &font_batcher, mono_shader))
+	if(!option_menu.init(current_font, &font_batcher))
 	{
 		return false;
 	}
@@ -881,6 +1051,20 @@ bool demo_state::destroy_gl_font()
 {
 	bool success = true;
 
+	// font_style.atlas is only set if cv_string_font is a TTF.
+	if(font_style.atlas != NULL && !cv_font_atlas_cache_path.data.empty())
+	{
+		success = font_atlas_cache_save(
+					  &font_style,
+					  cv_string_font.data.c_str(),
+					  cv_font_atlas_cache_path.data.c_str()) &&
+				  success;
+	}
+
+#ifndef __EMSCRIPTEN__
+	// join the threads before the settings are gone.
+	success = font_raster_workers.destroy() && success;
+#endif
 	success = font_style.destroy() && success;
 	success = font_rasterizer.destroy() && success;
 	success = font_manager.destroy() && success;
@@ -895,6 +1079,8 @@ bool demo_state::destroy()
 {
 	bool success = true;
 
+	success = frame_watchdog_destroy() && success;
+
 	success = option_menu.destroy() && success;
 	success = console_menu.destroy() && success;
 
@@ -951,6 +1137,8 @@ bool demo_state::unfocus_all()
 
 bool demo_state::input(SDL_Event& e)
 {
+	ZONE_SCOPE("demo_state::input");
+
 	switch(e.type)
 	{
 	case SDL_WINDOWEVENT:
@@ -1201,8 +1389,42 @@ bool demo_state::input(SDL_Event& e)
 }
 bool demo_state::update(double delta_sec)
 {
+	ZONE_SCOPE("demo_state::update");
+
 	float color_delta = static_cast<float>(delta_sec);
 
+#ifndef __EMSCRIPTEN__
+	if(font_style.raster_pool != NULL)
+	{
+		// store the glyphs that were rasterized in the background,
+		// this will bump the evict_generation so the placeholders get redrawn.
+		// resizing the atlas will flush the staged glyphs, so this needs the unpack alignment.
+		ctx.glBindTexture(GL_TEXTURE_2D, font_manager.atlas.gl_atlas_tex_id);
+		ctx.glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		font_style.process_raster_results();
+		ctx.glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		ctx.glBindTexture(GL_TEXTURE_2D, 0);
+	}
+#endif
+
+	// if the atlas evicted glyphs, any vertices sitting in a VBO could point to garbage.
+	if(atlas_evict_generation != font_manager.atlas.evict_generation)
+	{
+		atlas_evict_generation = font_manager.atlas.evict_generation;
+		// this is the easiest way to make everything redraw.
+		SDL_Event fake_event;
+		set_event_resize(fake_event);
+		if(show_console && console_menu.input(fake_event) == CONSOLE_RESULT::ERROR)
+		{
+			return false;
+		}
+		if(show_options && option_menu.input(fake_event) == OPTIONS_MENU_RESULT::ERROR)
+		{
+			return false;
+		}
+		perf_redraw = true;
+	}
+
 	// this will not actually draw, this will just modify the atlas and buffer data.
 	if(show_console)
 	{
@@ -1262,6 +1484,8 @@ bool demo_state::update(double delta_sec)
 
 bool demo_state::render()
 {
+	ZONE_SCOPE("demo_state::render");
+
 	glm::vec3 up = {0, 1, 0};
 
 	TIMER_U tick1;
@@ -1339,16 +1563,22 @@ bool demo_state::render()
 	}
 
 	// ctx.glActiveTexture(GL_TEXTURE0);
-	ctx.glBindTexture(GL_TEXTURE_2D, font_manager.gl_atlas_tex_id);
+	ctx.glBindTexture(GL_TEXTURE_2D, font_manager.atlas.gl_atlas_tex_id);
 
 	// since the text is stored in a GL_RED texture,
 	// I would need to pad each row to align to 4, but I don't.
 	ctx.glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
-	if(show_text && gl_font_vertex_count != 0)
+	// the glyphs from perf_time and update()
+	if(!font_manager.atlas.flush_uploads())
+	{
+		return false;
+	}
+
+	if(show_text && gl_font_quad_count != 0)
 	{
 		ctx.glBindVertexArray(gl_font_vao_id);
-		ctx.glDrawArrays(GL_TRIANGLES, 0, gl_font_vertex_count);
+		gl_draw_mono_quads(gl_font_interleave_vbo, 0, gl_font_quad_count);
 		ctx.glBindVertexArray(0);
 	}
 
@@ -1387,7 +1617,10 @@ bool demo_state::render()
 	tick1 = timer_now();
 	// tick1 = tick2;
 
-	SDL_GL_SwapWindow(g_app.window);
+	{
+		ZONE_SCOPE("SDL_GL_SwapWindow");
+		SDL_GL_SwapWindow(g_app.window);
+	}
 
 	// this could help with vsync causing bad latency, in exchange for less gpu utilization.
 	// but you could also use use CPU time on non-opengl stuff, and then sleep the remainder.
@@ -1405,6 +1638,18 @@ DEMO_RESULT demo_state::process()
 
 	tick1 = timer_now();
 
+	frame_watchdog_heartbeat();
+
+	// the trace is written before the zones of the next frame start.
+	if(!zone_profiler_new_frame())
+	{
+		console_menu.post_error(serr_get_error());
+	}
+	ZONE_SCOPE("frame");
+
+	// for the atlas LRU
+	font_manager.atlas.new_frame();
+
 	SDL_Event e;
 	while(SDL_PollEvent(&e) != 0)
 	{
@@ -1536,6 +1781,14 @@ DEMO_RESULT demo_state::process()
 		}
 	}
 
+	if(!perf_dump())
+	{
+		// not fatal, perf_dump won't try the same file again.
+		console_menu.post_error(serr_get_error());
+	}
+
+	publish_telemetry(delta);
+
 	return DEMO_RESULT::CONTINUE;
 }
 
@@ -1552,15 +1805,29 @@ bool demo_state::perf_time()
 	total_start = tick_now;
 
 	static TIMER_U display_timer = tick_now;
+	static TIMER_U window_timer = tick_now;
+
+	if(timer_delta_ms(window_timer, tick_now) > cv_perf_window_ms.data)
+	{
+		window_timer = tick_now;
+		perf_total.next_window();
+		perf_input.next_window();
+		perf_update.next_window();
+		perf_render.next_window();
+#ifndef __EMSCRIPTEN__
+		perf_swap.next_window();
+#endif
+	}
 
 	// TODO: I should also draw from SDL_WINDOWEVENT_SIZE_CHANGED!
-	if(timer_delta_ms(display_timer, tick_now) > 100)
+	if(perf_redraw || timer_delta_ms(display_timer, tick_now) > 100)
 	{
 		bool success = true;
 		display_timer = tick_now;
+		perf_redraw = false;
 
 		// load the atlas texture.
-		ctx.glBindTexture(GL_TEXTURE_2D, font_manager.gl_atlas_tex_id);
+		ctx.glBindTexture(GL_TEXTURE_2D, font_manager.atlas.gl_atlas_tex_id);
 		// since the text is stored in a GL_RED texture,
 		// I would need to pad each row to align to 4, but I don't.
 		ctx.glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
@@ -1591,16 +1858,16 @@ bool demo_state::perf_time()
 		ctx.glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 		ctx.glBindTexture(GL_TEXTURE_2D, 0);
 
-		gl_font_vertex_count = font_batcher.get_current_vertex_count();
+		gl_font_quad_count = font_batcher.get_current_quad_count();
 
 		if(font_batcher.get_quad_count() != 0)
 		{
 			ctx.glBindBuffer(GL_ARRAY_BUFFER, gl_font_interleave_vbo);
 			// orphaning
 			ctx.glBufferData(
-				GL_ARRAY_BUFFER, font_batcher.get_total_vertex_size(), NULL, GL_STREAM_DRAW);
+				GL_ARRAY_BUFFER, font_batcher.get_total_buffer_size(), NULL, GL_STREAM_DRAW);
 			ctx.glBufferSubData(
-				GL_ARRAY_BUFFER, 0, font_batcher.get_current_vertex_size(), font_batcher.buffer);
+				GL_ARRAY_BUFFER, 0, font_batcher.get_current_buffer_size(), font_batcher.buffer);
 			ctx.glBindBuffer(GL_ARRAY_BUFFER, 0);
 		}
 
@@ -1659,7 +1926,7 @@ bool demo_state::display_perf_text()
 	font_painter.set_xy(x, y);
 	font_painter.set_anchor(TEXT_ANCHOR::TOP_RIGHT);
 
-	success = success && font_painter.draw_text("average / low / high\n");
+	success = success && font_painter.draw_text("average / low / high / p99 / p99.9\n");
 	success = success && perf_total.display("total", &font_painter);
 	success = success && perf_input.display("input", &font_painter);
 	success = success && perf_update.display("update", &font_painter);
@@ -1667,11 +1934,114 @@ bool demo_state::display_perf_text()
 #ifndef __EMSCRIPTEN__
 	success = success && perf_swap.display("swap", &font_painter);
 #endif
+	const font_atlas& atlas = font_manager.atlas;
+	success = success && font_painter.draw_format(
+							 "atlas: %u (%.1f%%) evicted: %u\n",
+							 atlas.atlas_size,
+							 static_cast<double>(atlas.get_occupancy() * 100.f),
+							 atlas.stats.evicted_glyphs);
+	success = success && font_painter.draw_format(
+							 "uploads: %u (%.1fkb) last frame: %u (%u glyphs)\n",
+							 atlas.stats.upload_count,
+							 static_cast<double>(atlas.stats.upload_bytes) / 1024.0,
+							 atlas.last_frame_uploads.uploads,
+							 atlas.last_frame_uploads.glyphs);
+	// the batcher is shared, so the last batch is whatever was drawn before this text.
+	const mono_2d_batcher::batch_stats& batch_stats = font_batcher.stats;
+	success = success && font_painter.draw_format(
+							 "batch: %zu peak: %zu size: %zu grows: %u dropped: %zu\n",
+							 batch_stats.last_batch_quads,
+							 batch_stats.peak_quads,
+							 font_batcher.size,
+							 batch_stats.grow_count,
+							 batch_stats.dropped_quads);
 	return success;
 }
 
+bool demo_state::perf_dump()
+{
+	if(cv_perf_dump_ms.data <= 0)
+	{
+		return true;
+	}
+	// don't repeat the error every interval.
+	if(perf_dump_failed && perf_dump_failed_file == cv_perf_dump_file.data)
+	{
+		return true;
+	}
+	perf_dump_failed = false;
+	TIMER_U tick_now = timer_now();
+	static TIMER_U start_timer = tick_now;
+	static TIMER_U dump_timer = tick_now;
+	if(timer_delta_ms(dump_timer, tick_now) < cv_perf_dump_ms.data)
+	{
+		return true;
+	}
+	dump_timer = tick_now;
+
+	perf_histogram_row rows[] = {
+		{"total", &perf_total.dump},
+		{"input", &perf_input.dump},
+		{"update", &perf_update.dump},
+		{"render", &perf_render.dump},
+#ifndef __EMSCRIPTEN__
+		{"swap", &perf_swap.dump},
+#endif
+	};
+	bool success = perf_histogram_dump(
+		cv_perf_dump_file.data.c_str(),
+		timer_delta<1>(start_timer, tick_now),
+		rows,
+		std::size(rows));
+	perf_total.dump.reset();
+	perf_input.dump.reset();
+	perf_update.dump.reset();
+	perf_render.dump.reset();
+#ifndef __EMSCRIPTEN__
+	perf_swap.dump.reset();
+#endif
+	if(!success)
+	{
+		perf_dump_failed = true;
+		perf_dump_failed_file = cv_perf_dump_file.data;
+	}
+	return success;
+}
+
+void demo_state::publish_telemetry(double frame_sec)
+{
+	const font_atlas& atlas = font_manager.atlas;
+	double values[TELEMETRY_COUNTER_COUNT] = {};
+	values[TELEMETRY_FRAME_MS] = frame_sec * 1000.0;
+	values[TELEMETRY_INPUT_MS] = perf_input.last;
+	values[TELEMETRY_UPDATE_MS] = perf_update.last;
+	values[TELEMETRY_RENDER_MS] = perf_render.last;
+#ifndef __EMSCRIPTEN__
+	values[TELEMETRY_SWAP_MS] = perf_swap.last;
+#endif
+	values[TELEMETRY_GLYPH_MISSES] = font_style.glyph_misses;
+	values[TELEMETRY_LAYOUT_MISSES] = font_painter.layout_cache.stats.misses;
+	values[TELEMETRY_ATLAS_OCCUPANCY] = static_cast<double>(atlas.get_occupancy() * 100.f);
+	values[TELEMETRY_ATLAS_UPLOAD_BYTES] = atlas.last_frame_uploads.bytes;
+	values[TELEMETRY_ATLAS_EVICTED_GLYPHS] = atlas.stats.evicted_glyphs;
+	values[TELEMETRY_ATLAS_RESIZES] = atlas.stats.resize_count;
+	values[TELEMETRY_BATCH_GROWS] = font_batcher.stats.grow_count;
+	// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+	values[TELEMETRY_LOG_QUEUE_BYTES] = g_log.pending_bytes();
+	telemetry_publish(values);
+}
+
 bool bench_data::display(const char* msg, font_sprite_painter* font_painter)
 {
+	// the window could have just started.
+	perf_histogram percentiles = last_window;
+	percentiles.merge(window);
 	return font_painter->draw_format(
-		"%s: %.2f / %.2f / %.2f\n", msg, accum_ms(), low_ms(), high_ms());
+		"%s: %.2f / %.2f / %.2f / %.2f / %.2f\n",
+		msg,
+		interval.average_ms(),
+		interval.low_ms(),
+		interval.high_ms(),
+		percentiles.percentile(99),
+		percentiles.percentile(99.9));
 }
@@ -7,10 +7,12 @@
 //#include "shaders/basic.h"
 #include "shaders/mono.h"
 #include "font/font_manager.h"
+#include "font/font_raster_pool.h"
 #include "font/text_prompt.h"
 #include "console.h"
 #include "options_menu/options_tree.h"
 #include "cvar.h"
+#include "perf_histogram.h"
 
 #include <SDL2/SDL.h>
 
@@ -44,40 +46,33 @@ extern cvar_key_bind cv_bind_reset_window_size;
 extern cvar_key_bind cv_bind_toggle_text;
 extern cvar_key_bind cv_bind_soft_reboot;
 
-// This is absolutely not the best way of doing this...
 struct bench_data
 {
-	TIMER_RESULT accum = 0, high = 0, low = std::numeric_limits<TIMER_RESULT>::max();
-	size_t samples = 0;
+	// since the text was drawn (the average / low / high).
+	perf_histogram interval;
+	// the percentiles are from the current and the last cv_perf_window_ms.
+	perf_histogram window;
+	perf_histogram last_window;
+	// since cv_perf_dump_file was written.
+	perf_histogram dump;
+	// the last sample (for the telemetry).
+	TIMER_RESULT last = 0;
+
 	void test(TIMER_RESULT dt)
 	{
-		low = std::min(low, dt);
-		high = std::max(high, dt);
-		accum += dt;
-		++samples;
-	}
-	TIMER_RESULT accum_ms()
-	{
-		return accum / static_cast<TIMER_RESULT>(samples);
+		last = dt;
+		interval.record(dt);
+		window.record(dt);
+		dump.record(dt);
 	}
-	TIMER_RESULT high_ms()
+	void reset()
 	{
-		return high;
+		interval.reset();
 	}
-	TIMER_RESULT low_ms()
+	void next_window()
 	{
-		if(low == std::numeric_limits<TIMER_RESULT>::max())
-		{
-			return 0;
-		}
-		return low;
-	}
-	void reset()
-	{
-		high = 0; // could use limits...
-		low = std::numeric_limits<TIMER_RESULT>::max();
-		accum = 0;
-		samples = 0;
+		last_window = window;
+		window.reset();
 	}
 
 	NDSERR bool display(const char* msg, font_sprite_painter* font_painter);
@@ -107,7 +102,7 @@ struct demo_state
 	shader_mono_state mono_shader;
 	GLuint gl_font_interleave_vbo = 0;
 	GLuint gl_font_vao_id = 0;
-	GLsizei gl_font_vertex_count = 0;
+	GLsizei gl_font_quad_count = 0;
 
 	// GLuint gl_prompt_interleave_vbo = 0;
 	// GLuint gl_prompt_vao_id = 0;
@@ -127,6 +122,10 @@ struct demo_state
 	// places glyphs into the atlas texture, and
 	// stores the location of glyphs in the atlas
 	font_bitmap_cache font_style;
+#ifndef __EMSCRIPTEN__
+	// optional, rasterizes font_style glyphs on other threads (cv_font_raster_threads)
+	font_raster_pool font_raster_workers;
+#endif
 	// if you want to use unifont as a standalone style, use this.
 	hex_font_placeholder unifont_style;
 
@@ -136,7 +135,6 @@ struct demo_state
 	// convenience wrapper for drawing quads vertices into a buffer.
 	// you only need one.
 	mono_2d_batcher font_batcher;
-	std::unique_ptr<gl_mono_vertex[]> font_batcher_buffer;
 
 	bool show_text = true;
 
@@ -148,6 +146,12 @@ struct demo_state
 
 	bool update_screen_resize = true;
 
+	// redraw the perf text without waiting for the timer.
+	bool perf_redraw = true;
+
+	// compared with font_atlas::evict_generation to know when to redraw.
+	uint32_t atlas_evict_generation = 0;
+
 	TIMER_U timer_last = TIMER_NULL;
 
 	// this should be float or byte
@@ -182,6 +186,9 @@ struct demo_state
 #ifndef __EMSCRIPTEN__
 	bench_data perf_swap;
 #endif
+	// perf_dump failed to write perf_dump_failed_file.
+	bool perf_dump_failed = false;
+	std::string perf_dump_failed_file;
 
 	NDSERR bool init();
 	NDSERR bool init_gl_font();
@@ -197,5 +204,10 @@ struct demo_state
 	NDSERR DEMO_RESULT process();
 
 	NDSERR bool perf_time();
+	// appends the perf counters to cv_perf_dump_file every cv_perf_dump_ms.
+	// after an error it stops until cv_perf_dump_file is changed (perf_dump_failed_file).
+	NDSERR bool perf_dump();
+	// the counters of this frame for cv_telemetry_shm.
+	void publish_telemetry(double frame_sec);
 	NDSERR bool display_perf_text();
 };
@@ -0,0 +1,457 @@
+#include "../global_pch.h"
+#include "../global.h"
+
+#include "atlas_packer.h"
+
+#include "font_manager.h"
+#include "../app.h" // for cv_font_linear_filtering
+
+#include <algorithm>
+#include <memory>
+
+void font_guillotine_packer::init(uint32_t size)
+{
+	free_rects.clear();
+	packer_size = size;
+	used_area = 0;
+	used_height = 0;
+	free_rects.insert(packer_rect{0, 0, size, size});
+}
+
+void font_guillotine_packer::grow(uint32_t new_size)
+{
+	ASSERT(new_size > packer_size);
+	// the new area is an L shape, cut it into the right side and the bottom.
+	free_rects.insert(packer_rect{packer_size, 0, new_size - packer_size, packer_size});
+	free_rects.insert(packer_rect{0, packer_size, new_size, new_size - packer_size});
+	packer_size = new_size;
+}
+
+bool font_guillotine_packer::insert(uint32_t w_in, uint32_t h_in, uint32_t* x_out, uint32_t* y_out)
+{
+	ASSERT(x_out != NULL);
+	ASSERT(y_out != NULL);
+	ASSERT(w_in != 0 && h_in != 0);
+
+	// find the shortest free rect that can fit the glyph.
+	// within the same height the rects are sorted by width,
+	// so this only checks one rect per unique height (and there aren't many).
+	auto it = free_rects.lower_bound(packer_rect{0, 0, w_in, h_in});
+	while(it != free_rects.end() && it->w < w_in)
+	{
+		it = free_rects.lower_bound(packer_rect{0, 0, w_in, it->h});
+	}
+	if(it == free_rects.end())
+	{
+		return false;
+	}
+
+	packer_rect rect = *it;
+	free_rects.erase(it);
+
+	*x_out = rect.x;
+	*y_out = rect.y;
+
+	uint32_t right_w = rect.w - w_in;
+	uint32_t bottom_h = rect.h - h_in;
+
+	// the right side keeps the height of the glyph, so glyphs of the same height form a row,
+	// and the bottom gets the full width of the rect.
+	// unless the rect is tall and skinny, then split the other way to keep the bottom in one piece.
+	packer_rect right;
+	packer_rect bottom;
+	if(right_w >= bottom_h)
+	{
+		right = packer_rect{rect.x + w_in, rect.y, right_w, h_in};
+		bottom = packer_rect{rect.x, rect.y + h_in, rect.w, bottom_h};
+	}
+	else
+	{
+		right = packer_rect{rect.x + w_in, rect.y, right_w, rect.h};
+		bottom = packer_rect{rect.x, rect.y + h_in, w_in, bottom_h};
+	}
+	if(right.w != 0 && right.h != 0)
+	{
+		free_rects.insert(right);
+	}
+	if(bottom.w != 0 && bottom.h != 0)
+	{
+		free_rects.insert(bottom);
+	}
+
+	used_area += static_cast<uint64_t>(w_in) * h_in;
+	used_height = std::max(used_height, rect.y + h_in);
+	return true;
+}
+
+void font_guillotine_packer::remove(uint32_t x, uint32_t y, uint32_t w, uint32_t h)
+{
+	ASSERT(w != 0 && h != 0);
+	ASSERT(x + w <= packer_size && y + h <= packer_size);
+	ASSERT(used_area >= static_cast<uint64_t>(w) * h);
+	// the neighbors are not merged, this would need a spatial index,
+	// an evicted slot will be reused by the same or smaller glyphs,
+	// and everything else is handled by font_atlas::compact.
+	free_rects.insert(packer_rect{x, y, w, h});
+	used_area -= static_cast<uint64_t>(w) * h;
+}
+
+void font_span_packer::init(uint32_t size)
+{
+	span_buckets.clear();
+	packer_size = size;
+	spans_allocated = 0;
+	used_height = 0;
+}
+
+#if defined(__clang__)
+// ubsan is triggered by -(span_granularity)
+__attribute__((no_sanitize("unsigned-integer-overflow")))
+#endif
+bool font_span_packer::insert(uint32_t w_in, uint32_t h_in, uint32_t* x_out, uint32_t* y_out)
+{
+	ASSERT(x_out != NULL);
+	ASSERT(y_out != NULL);
+	ASSERT(w_in != 0 && h_in != 0);
+
+	if(w_in > packer_size || h_in > packer_size)
+	{
+		return false;
+	}
+
+	// size_t size = ceil(float(w) / float(span_granularity)) * span_granularity
+	// this wont work with non power of 2's
+	uint32_t pixel_size = (w_in - 1u + span_granularity) & -(span_granularity);
+	uint32_t span_size = pixel_size / span_granularity;
+
+	// closest bucket to the size of the glyph that is larger than the size of the entry.
+	span_bucket* closest_bucket = NULL;
+
+	// this is a brute force lookup, but should be negligible.
+	for(span_bucket& bucket : span_buckets)
+	{
+		if(bucket.bucket_depth + h_in > packer_size)
+		{
+			continue;
+		}
+		if(bucket.span_count == span_size)
+		{
+			*x_out = bucket.span_start * span_granularity;
+			*y_out = bucket.bucket_depth;
+			bucket.bucket_depth += h_in;
+			used_height = std::max(used_height, bucket.bucket_depth);
+			return true;
+		}
+		if(bucket.span_count > span_size)
+		{
+			if(closest_bucket == NULL || bucket.span_count < closest_bucket->span_count)
+			{
+				closest_bucket = &bucket;
+			}
+		}
+	}
+
+	// allocate a new bucket because you can.
+	if((spans_allocated + span_size) * span_granularity <= packer_size)
+	{
+		span_buckets.emplace_back(spans_allocated, span_size, 0);
+		spans_allocated += span_size;
+
+		*x_out = span_buckets.back().span_start * span_granularity;
+		*y_out = span_buckets.back().bucket_depth;
+
+		span_buckets.back().bucket_depth += h_in;
+		used_height = std::max(used_height, span_buckets.back().bucket_depth);
+
+		return true;
+	}
+
+	// canabalize a bigger bucket.
+	if(closest_bucket != NULL)
+	{
+		// integer trunc is desired.
+		if(closest_bucket->span_count / span_size == 0)
+		{
+			// don't split because more than half is used.
+			*x_out = closest_bucket->span_start * span_granularity;
+			*y_out = closest_bucket->bucket_depth;
+			closest_bucket->bucket_depth += h_in;
+			used_height = std::max(used_height, closest_bucket->bucket_depth);
+			return true;
+		}
+
+		// split
+		span_buckets.emplace_back(
+			closest_bucket->span_start + span_size,
+			closest_bucket->span_count - span_size,
+			closest_bucket->bucket_depth);
+
+		*x_out = closest_bucket->span_start * span_granularity;
+		*y_out = closest_bucket->bucket_depth;
+
+		// std::deque won't invalidate
+		closest_bucket->span_count = span_size;
+		closest_bucket->bucket_depth += h_in;
+		used_height = std::max(used_height, closest_bucket->bucket_depth);
+
+		return true;
+	}
+
+	return false;
+}
+
+struct bench_glyph_size
+{
+	uint32_t w;
+	uint32_t h;
+};
+
+template<class T>
+static void bench_packer(
+	const char* packer_name,
+	const char* set_name,
+	uint32_t size,
+	const std::vector<bench_glyph_size>& glyphs)
+{
+	T packer;
+	packer.init(size);
+
+	uint64_t glyph_area = 0;
+	size_t inserted = 0;
+
+	TIMER_U t1 = timer_now();
+	for(const bench_glyph_size& glyph : glyphs)
+	{
+		uint32_t x_out;
+		uint32_t y_out;
+		if(packer.insert(glyph.w, glyph.h, &x_out, &y_out))
+		{
+			glyph_area += static_cast<uint64_t>(glyph.w) * glyph.h;
+			++inserted;
+		}
+	}
+	TIMER_U t2 = timer_now();
+
+	// efficiency is the glyph area divided by the area above the lowest glyph.
+	double efficiency = 0;
+	if(packer.used_height != 0)
+	{
+		efficiency = static_cast<double>(glyph_area) /
+					 (static_cast<double>(size) * static_cast<double>(packer.used_height));
+	}
+	slogf(
+		"%-10s %-12s inserted: %zu/%zu, %.1f ns/insert, efficiency: %.1f%%, height: %u\n",
+		packer_name,
+		set_name,
+		inserted,
+		glyphs.size(),
+		timer_delta<1000000000>(t1, t2) / static_cast<double>(glyphs.size()),
+		efficiency * 100.0,
+		packer.used_height);
+}
+
+// this is what font_atlas does when it's full, evict old glyphs, then compact.
+static void bench_guillotine_compact(
+	const char* set_name, uint32_t size, const std::vector<bench_glyph_size>& glyphs)
+{
+	font_guillotine_packer packer;
+	packer.init(size);
+
+	std::vector<font_guillotine_packer::packer_rect> live;
+	for(const bench_glyph_size& glyph : glyphs)
+	{
+		uint32_t x_out;
+		uint32_t y_out;
+		if(packer.insert(glyph.w, glyph.h, &x_out, &y_out))
+		{
+			live.push_back(font_guillotine_packer::packer_rect{x_out, y_out, glyph.w, glyph.h});
+		}
+	}
+
+	// evict every other glyph
+	std::vector<font_guillotine_packer::packer_rect> kept;
+	for(size_t i = 0; i < live.size(); ++i)
+	{
+		if(i % 2 == 0)
+		{
+			packer.remove(live[i].x, live[i].y, live[i].w, live[i].h);
+		}
+		else
+		{
+			kept.push_back(live[i]);
+		}
+	}
+
+	// how many of the glyphs that didn't fit can fit into the holes.
+	size_t reused = 0;
+	for(size_t i = 0; i < live.size(); i += 2)
+	{
+		uint32_t x_out;
+		uint32_t y_out;
+		if(packer.insert(live[i].w, live[i].h, &x_out, &y_out))
+		{
+			++reused;
+		}
+	}
+
+	// compact the kept glyphs, the same order as font_atlas::compact
+	TIMER_U t1 = timer_now();
+	std::sort(
+		kept.begin(),
+		kept.end(),
+		[](const font_guillotine_packer::packer_rect& lhs,
+		   const font_guillotine_packer::packer_rect& rhs) {
+			if(lhs.h != rhs.h)
+			{
+				return lhs.h > rhs.h;
+			}
+			return lhs.w > rhs.w;
+		});
+	font_guillotine_packer compacted;
+	compacted.init(size);
+	uint64_t glyph_area = 0;
+	for(font_guillotine_packer::packer_rect& rect : kept)
+	{
+		if(!compacted.insert(rect.w, rect.h, &rect.x, &rect.y))
+		{
+			slogf("%s: compacting failed?\n", __func__);
+			return;
+		}
+		glyph_area += static_cast<uint64_t>(rect.w) * rect.h;
+	}
+	TIMER_U t2 = timer_now();
+
+	double efficiency = 0;
+	if(compacted.used_height != 0)
+	{
+		efficiency = static_cast<double>(glyph_area) /
+					 (static_cast<double>(size) * static_cast<double>(compacted.used_height));
+	}
+	slogf(
+		"%-10s %-12s evicted: %zu, reinserted: %zu, compacted %zu in %.2fms, efficiency: %.1f%%\n",
+		"compact",
+		set_name,
+		(live.size() + 1) / 2,
+		reused,
+		kept.size(),
+		timer_delta_ms(t1, t2),
+		efficiency * 100.0);
+}
+
+static void bench_glyph_set(
+	const char* set_name, uint32_t size, const std::vector<bench_glyph_size>& glyphs)
+{
+	bench_packer<font_span_packer>("span", set_name, size, glyphs);
+	bench_packer<font_guillotine_packer>("guillotine", set_name, size, glyphs);
+	bench_guillotine_compact(set_name, size, glyphs);
+}
+
+bool bench_font_atlas_packers(font_manager_state* font_manager, const char* ttf_path)
+{
+	ASSERT(font_manager != NULL);
+
+	// the same padding as the glyphs in font_manager.cpp
+	uint32_t padding = 1;
+	if(cv_font_linear_filtering.data == 1)
+	{
+		padding = 2;
+	}
+
+	uint32_t size = font_manager->atlas.atlas_max_size;
+
+	slogf("info: atlas packer benchmark (%ux%u)\n", size, size);
+
+	{
+		// unifont, every glyph in codepoint order, with the outline.
+		hex_font_data& hex_font = font_manager->hex_font;
+		std::vector<bench_glyph_size> glyphs;
+		std::unique_ptr<hex_font_data::hex_glyph_entry[]> temp_glyphs =
+			std::make_unique<hex_font_data::hex_glyph_entry[]>(HEX_CHUNK_GLYPHS);
+		for(size_t i = 0; i < hex_font.hex_block_chunks.size(); ++i)
+		{
+			memset(
+				temp_glyphs.get(), 0, sizeof(hex_font_data::hex_glyph_entry) * HEX_CHUNK_GLYPHS);
+			switch(hex_font.load_hex_block(i, temp_glyphs.get()))
+			{
+			case FONT_BASIC_RESULT::SUCCESS: break;
+			case FONT_BASIC_RESULT::NOT_FOUND: continue;
+			case FONT_BASIC_RESULT::ERROR: return false;
+			}
+			for(size_t j = 0; j < HEX_CHUNK_GLYPHS; ++j)
+			{
+				if(!temp_glyphs[j].hex_found)
+				{
+					continue;
+				}
+				uint32_t width = temp_glyphs[j].hex_full ? HEX_FULL_WIDTH : HEX_HALF_WIDTH;
+				glyphs.push_back(bench_glyph_size{width + padding, HEX_HEIGHT + padding});
+				glyphs.push_back(bench_glyph_size{width + padding + 2, HEX_HEIGHT + padding + 2});
+			}
+		}
+		bench_glyph_set("unifont", size, glyphs);
+	}
+
+	if(ttf_path == NULL)
+	{
+		return true;
+	}
+
+	Unique_RWops font_file = Unique_RWops_OpenFS(ttf_path, "rb");
+	if(!font_file)
+	{
+		return false;
+	}
+	font_ttf_rasterizer rasterizer;
+	if(!rasterizer.create(font_manager->FTLibrary, std::move(font_file)))
+	{
+		return false;
+	}
+
+	// the glyph sizes from the metrics, the glyphs don't need to be rendered.
+	// the glyphs are loaded in charmap order, but big fonts are capped.
+	const size_t max_glyphs = 4096;
+	const float point_sizes[] = {12, 16, 24, 32, 48};
+	std::vector<bench_glyph_size> all_glyphs;
+	for(float point_size : point_sizes)
+	{
+		font_ttf_face_settings settings;
+		settings.point_size = point_size;
+		if(!rasterizer.set_face_settings(&settings))
+		{
+			return false;
+		}
+
+		std::vector<bench_glyph_size> glyphs;
+		FT_UInt glyph_index;
+		FT_ULong codepoint = FT_Get_First_Char(rasterizer.face, &glyph_index);
+		while(glyph_index != 0 && glyphs.size() < max_glyphs)
+		{
+			FT_Error error;
+			if((error = FT_Load_Glyph(rasterizer.face, glyph_index, settings.load_flags)) != 0)
+			{
+				TTF_SetFTError(rasterizer.font_file->name(), error);
+				return false;
+			}
+			FT_Glyph_Metrics& metrics = rasterizer.face->glyph->metrics;
+			// 26.6 fixed point, rounded up
+			uint32_t width = (metrics.width + 63) / 64;
+			uint32_t height = (metrics.height + 63) / 64;
+			if(width != 0 && height != 0)
+			{
+				glyphs.push_back(bench_glyph_size{width + padding, height + padding});
+			}
+			codepoint = FT_Get_Next_Char(rasterizer.face, codepoint, &glyph_index);
+		}
+
+		char set_name[32];
+		snprintf(set_name, sizeof(set_name), "ttf %.0fpt", static_cast<double>(point_size));
+		bench_glyph_set(set_name, size, glyphs);
+
+		all_glyphs.insert(all_glyphs.end(), glyphs.begin(), glyphs.end());
+	}
+
+	// every point size mixed together is closer to what the atlas sees.
+	bench_glyph_set("ttf mixed", size, all_glyphs);
+
+	return rasterizer.destroy();
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "../global.h"
+
+#include <cstdint>
+#include <deque>
+#include <set>
+#include <vector>
+
+// the rectangle allocators for font_atlas.
+// these only do the bookkeeping, the texture is handled by font_atlas.
+
+// a guillotine packer, every insert splits a free rect into 2 smaller free rects.
+// the free rects are sorted by size so finding a slot is a lower_bound instead of a scan,
+// and unlike the span buckets, slots can be given back with remove()
+// (but removed slots are not merged, which is why font_atlas has a compact pass)
+struct font_guillotine_packer
+{
+	struct packer_rect
+	{
+		uint32_t x;
+		uint32_t y;
+		uint32_t w;
+		uint32_t h;
+	};
+
+	// sorted by the height first, so that similar glyphs stack into rows.
+	struct packer_rect_cmp
+	{
+		bool operator()(const packer_rect& lhs, const packer_rect& rhs) const
+		{
+			if(lhs.h != rhs.h)
+			{
+				return lhs.h < rhs.h;
+			}
+			if(lhs.w != rhs.w)
+			{
+				return lhs.w < rhs.w;
+			}
+			if(lhs.y != rhs.y)
+			{
+				return lhs.y < rhs.y;
+			}
+			return lhs.x < rhs.x;
+		}
+	};
+
+	std::set<packer_rect, packer_rect_cmp> free_rects;
+
+	// width and height of the area being packed.
+	uint32_t packer_size = 0;
+
+	// the sum of every allocated rect.
+	uint64_t used_area = 0;
+
+	// the bottom most pixel that has been allocated (for measuring efficiency)
+	uint32_t used_height = 0;
+
+	void init(uint32_t size);
+
+	// extend the packed area to new_size, the existing rects are not moved.
+	void grow(uint32_t new_size);
+
+	// returns false if out of space.
+	bool insert(uint32_t w_in, uint32_t h_in, uint32_t* x_out, uint32_t* y_out);
+
+	// give back a rect from insert().
+	void remove(uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+
+	// note the free area is fragmented, so a glyph this big probably won't fit.
+	uint64_t get_free_area() const
+	{
+		return static_cast<uint64_t>(packer_size) * packer_size - used_area;
+	}
+};
+
+// this is the old span bucket allocator that font_atlas used,
+// it is only kept so that bench_font_atlas_packers has something to compare against.
+// the atlas is split into columns of spans, and each column (bucket) is filled downwards,
+// buckets are found with a linear scan, and space is never reclaimed.
+struct font_span_packer
+{
+	struct span_bucket
+	{
+		// emplace_back annoyance.
+		span_bucket(uint32_t start, uint32_t count, uint32_t depth)
+		: span_start(start)
+		, span_count(count)
+		, bucket_depth(depth)
+		{
+		}
+		// the chunk offset (in spans)
+		uint32_t span_start;
+		// the number of spans of width (in spans)
+		uint32_t span_count;
+		// the ammount of the chunk that is allocated (in pixels)
+		uint32_t bucket_depth;
+	};
+
+	// a span is the unit slot within the atlas
+	std::deque<span_bucket> span_buckets;
+
+	uint32_t packer_size = 0;
+
+	// the number of pixels each span holds.
+	// needs to be a power of 2
+	uint32_t span_granularity = 8;
+
+	// so I don't need to loop through span_buckets to get the size.
+	uint32_t spans_allocated = 0;
+
+	uint32_t used_height = 0;
+
+	void init(uint32_t size);
+
+	// returns false if out of space.
+	bool insert(uint32_t w_in, uint32_t h_in, uint32_t* x_out, uint32_t* y_out);
+};
+
+struct font_manager_state;
+
+// packs the glyph sizes from the unifont (and a TTF at multiple point sizes if ttf_path is set)
+// with every packer, and prints the ns per insert and packing efficiency.
+// this doesn't touch the real atlas, but it will load the whole hex file.
+NDSERR bool bench_font_atlas_packers(font_manager_state* font_manager, const char* ttf_path);
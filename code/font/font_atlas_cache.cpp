@@ -0,0 +1,638 @@
+#include "../global_pch.h"
+#include "../global.h"
+
+#include "font_atlas_cache.h"
+
+#include "font_manager.h"
+#include "hex_font_binary.h"
+
+#include "../BS_Archive/BS_binary.h"
+#include "../BS_Archive/BS_stream.h"
+#include "../RWops.h"
+#include "../app.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <iterator>
+#include <string_view>
+
+enum
+{
+	FONT_ATLAS_CACHE_MAGIC = 0x43414653, // "SFAC"
+	// increment this if the layout changes.
+	FONT_ATLAS_CACHE_VERSION = 1,
+	// U+10FFFF / FONT_CACHE_CHUNK_GLYPHS
+	FONT_ATLAS_CACHE_MAX_BLOCKS = 0x110000 / font_bitmap_cache::FONT_CACHE_CHUNK_GLYPHS,
+	// the guillotine packer doesn't merge rects, but this should be way more than enough.
+	FONT_ATLAS_CACHE_MAX_FREE_RECTS = 1 << 20
+};
+
+static_assert(font_bitmap_cache::FONT_CACHE_CHUNK_GLYPHS % 64 == 0);
+
+// if anything in here changes, the glyphs would be different.
+struct font_atlas_cache_key
+{
+	uint32_t magic = FONT_ATLAS_CACHE_MAGIC;
+	uint32_t version = FONT_ATLAS_CACHE_VERSION;
+	uint64_t font_hash = 0;
+	float point_size = 0;
+	float bold_x = 0;
+	float bold_y = 0;
+	float outline_size = 0;
+	float italics_skew = 0;
+	bool force_bitmap = false;
+	int32_t render_mode = 0;
+	int32_t sdf_spread = 0;
+	int32_t load_flags = 0;
+	uint32_t atlas_max_size = 0;
+	// the padding around the glyphs depends on this.
+	bool linear_filtering = false;
+
+	bool operator==(const font_atlas_cache_key& rhs) const
+	{
+		return magic == rhs.magic && version == rhs.version && font_hash == rhs.font_hash &&
+			   point_size == rhs.point_size && bold_x == rhs.bold_x && bold_y == rhs.bold_y &&
+			   outline_size == rhs.outline_size && italics_skew == rhs.italics_skew &&
+			   force_bitmap == rhs.force_bitmap && render_mode == rhs.render_mode &&
+			   sdf_spread == rhs.sdf_spread && load_flags == rhs.load_flags &&
+			   atlas_max_size == rhs.atlas_max_size && linear_filtering == rhs.linear_filtering;
+	}
+	bool operator!=(const font_atlas_cache_key& rhs) const
+	{
+		return !(*this == rhs);
+	}
+};
+
+struct font_atlas_cache_file : public BS_Serializable
+{
+	// for reading, if the key doesn't match expected_key, stale is set and reading stops.
+	font_atlas_cache_key key;
+	font_atlas_cache_key expected_key;
+	bool stale = false;
+
+	uint32_t atlas_size = 0;
+	// the number of rows of pixels that were saved, the rest is zero.
+	uint32_t rows = 0;
+	// atlas_size wide, the reader allocates atlas_size * atlas_size.
+	std::vector<uint8_t> pixels;
+
+	font_guillotine_packer packer;
+	font_glyph_entry white_glyph{};
+
+	std::vector<font_bitmap_cache::font_cache_block> blocks;
+
+	void Serialize(BS_Archive& ar) override;
+};
+
+static void serialize_key(BS_Archive& ar, font_atlas_cache_key& key)
+{
+	ar.Uint32(key.magic);
+	ar.Uint32(key.version);
+	ar.Uint64(key.font_hash);
+	ar.Float(key.point_size);
+	ar.Float(key.bold_x);
+	ar.Float(key.bold_y);
+	ar.Float(key.outline_size);
+	ar.Float(key.italics_skew);
+	ar.Bool(key.force_bitmap);
+	ar.Int32(key.render_mode);
+	ar.Int32(key.sdf_spread);
+	ar.Int32(key.load_flags);
+	ar.Uint32(key.atlas_max_size);
+	ar.Bool(key.linear_filtering);
+}
+
+static void serialize_glyph_entry(BS_Archive& ar, font_glyph_entry& entry)
+{
+	// the type is checked by validate_cache_file.
+	uint8_t type = static_cast<uint8_t>(entry.type);
+	ar.Uint8(type);
+	entry.type = static_cast<FONT_ENTRY>(type);
+	ar.Uint8(entry.sdf);
+	ar.Uint16(entry.rect_x);
+	ar.Uint16(entry.rect_y);
+	ar.Uint16(entry.rect_w);
+	ar.Uint16(entry.rect_h);
+	ar.Int16(entry.advance);
+	ar.Int16(entry.xmin);
+	ar.Int16(entry.ymin);
+}
+
+template<size_t N>
+static void serialize_bitset(BS_Archive& ar, std::bitset<N>& bits)
+{
+	for(size_t i = 0; i < N; i += 64)
+	{
+		uint64_t word = 0;
+		if(ar.IsWriter())
+		{
+			for(size_t j = 0; j < 64; ++j)
+			{
+				word |= static_cast<uint64_t>(bits.test(i + j)) << j;
+			}
+		}
+		if(!ar.Uint64(word))
+		{
+			return;
+		}
+		if(ar.IsReader())
+		{
+			for(size_t j = 0; j < 64; ++j)
+			{
+				bits.set(i + j, ((word >> j) & 1) != 0);
+			}
+		}
+	}
+}
+
+struct read_pixel_row_state
+{
+	uint8_t* dest;
+	size_t size;
+};
+
+static bool read_pixel_row_cb(const char* str, size_t size, void* ud)
+{
+	read_pixel_row_state* state = static_cast<read_pixel_row_state*>(ud);
+	if(size != state->size)
+	{
+		serrf("pixel row size mismatch, expected: %zu result: %zu\n", state->size, size);
+		return false;
+	}
+	memcpy(state->dest, str, size);
+	return true;
+}
+
+void font_atlas_cache_file::Serialize(BS_Archive& ar)
+{
+	serialize_key(ar, key);
+	if(!ar.Good())
+	{
+		return;
+	}
+	if(ar.IsReader() && key != expected_key)
+	{
+		stale = true;
+		return;
+	}
+
+	{
+		// the rows are strings, so the size is limited to a uint16_t.
+		const uint32_t max_size = std::min<uint32_t>(key.atlas_max_size, BS_MAX_STRING_SIZE);
+		BS_min_max_state<uint32_t> size_state{atlas_size, 1, max_size};
+		if(!ar.Uint32_CB(atlas_size, decltype(size_state)::call, &size_state))
+		{
+			return;
+		}
+		BS_min_max_state<uint32_t> rows_state{rows, 0, atlas_size};
+		if(!ar.Uint32_CB(rows, decltype(rows_state)::call, &rows_state))
+		{
+			return;
+		}
+	}
+
+	if(ar.IsReader())
+	{
+		pixels.assign(static_cast<size_t>(atlas_size) * atlas_size, 0);
+	}
+	ASSERT(pixels.size() >= static_cast<size_t>(atlas_size) * rows);
+	for(uint32_t y = 0; y < rows; ++y)
+	{
+		uint8_t* row = pixels.data() + static_cast<size_t>(y) * atlas_size;
+		read_pixel_row_state row_state{row, atlas_size};
+		if(!ar.StringZ_CB(
+			   std::string_view(reinterpret_cast<const char*>(row), atlas_size),
+			   atlas_size,
+			   read_pixel_row_cb,
+			   &row_state))
+		{
+			return;
+		}
+	}
+
+	// the packer
+	{
+		ar.Uint64(packer.used_area);
+		ar.Uint32(packer.used_height);
+
+		// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+		uint32_t free_count = packer.free_rects.size();
+		BS_min_max_state<uint32_t> free_state{free_count, 0, FONT_ATLAS_CACHE_MAX_FREE_RECTS};
+		if(!ar.Uint32_CB(free_count, decltype(free_state)::call, &free_state))
+		{
+			return;
+		}
+		if(ar.IsReader())
+		{
+			packer.packer_size = atlas_size;
+			for(uint32_t i = 0; i < free_count && ar.Good(); ++i)
+			{
+				font_guillotine_packer::packer_rect rect;
+				ar.Uint32(rect.x);
+				ar.Uint32(rect.y);
+				ar.Uint32(rect.w);
+				ar.Uint32(rect.h);
+				packer.free_rects.insert(rect);
+			}
+		}
+		else
+		{
+			for(font_guillotine_packer::packer_rect rect : packer.free_rects)
+			{
+				ar.Uint32(rect.x);
+				ar.Uint32(rect.y);
+				ar.Uint32(rect.w);
+				ar.Uint32(rect.h);
+			}
+		}
+	}
+
+	serialize_glyph_entry(ar, white_glyph);
+
+	// the glyph tables
+	{
+		// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+		uint32_t block_count = blocks.size();
+		BS_min_max_state<uint32_t> block_state{block_count, 0, FONT_ATLAS_CACHE_MAX_BLOCKS};
+		if(!ar.Uint32_CB(block_count, decltype(block_state)::call, &block_state))
+		{
+			return;
+		}
+		if(ar.IsReader())
+		{
+			blocks.resize(block_count);
+		}
+		for(font_bitmap_cache::font_cache_block& block : blocks)
+		{
+			if(!ar.Good())
+			{
+				return;
+			}
+			serialize_bitset(ar, block.bad_indexes);
+
+			// a bit for every style that has glyphs.
+			uint8_t style_mask = 0;
+			for(size_t i = 0; i < std::size(block.glyphs); ++i)
+			{
+				if(block.glyphs[i])
+				{
+					style_mask |= (1 << i);
+				}
+			}
+			ar.Uint8(style_mask);
+
+			for(size_t i = 0; i < std::size(block.glyphs); ++i)
+			{
+				if((style_mask & (1 << i)) == 0)
+				{
+					continue;
+				}
+				if(ar.IsReader())
+				{
+					block.glyphs[i] = std::make_unique<font_glyph_entry[]>(
+						font_bitmap_cache::FONT_CACHE_CHUNK_GLYPHS);
+				}
+				for(size_t j = 0; j < font_bitmap_cache::FONT_CACHE_CHUNK_GLYPHS; ++j)
+				{
+					serialize_glyph_entry(ar, block.glyphs[i][j]);
+				}
+			}
+		}
+	}
+}
+
+static bool validate_glyph_rect(const font_atlas_cache_file& file, const font_glyph_entry& entry)
+{
+	switch(entry.type)
+	{
+	case FONT_ENTRY::UNDEFINED:
+	case FONT_ENTRY::SPACE: return true;
+	case FONT_ENTRY::GLYPH:
+		return static_cast<uint32_t>(entry.rect_x) + entry.rect_w <= file.atlas_size &&
+			   static_cast<uint32_t>(entry.rect_y) + entry.rect_h <= file.rows;
+	case FONT_ENTRY::PENDING: break;
+	}
+	// PENDING is never saved.
+	return false;
+}
+
+// the archive only checks the sizes, this checks that nothing is outside of the atlas.
+static bool validate_cache_file(const font_atlas_cache_file& file, const char* cache_path)
+{
+	if((file.atlas_size & (file.atlas_size - 1)) != 0)
+	{
+		serrf("%s error: atlas size not a power of 2: %u\n", cache_path, file.atlas_size);
+		return false;
+	}
+	if(file.white_glyph.type != FONT_ENTRY::GLYPH || !validate_glyph_rect(file, file.white_glyph))
+	{
+		serrf("%s error: invalid white glyph\n", cache_path);
+		return false;
+	}
+	for(const font_guillotine_packer::packer_rect& rect : file.packer.free_rects)
+	{
+		if(static_cast<uint64_t>(rect.x) + rect.w > file.atlas_size ||
+		   static_cast<uint64_t>(rect.y) + rect.h > file.atlas_size)
+		{
+			serrf("%s error: free rect out of bounds\n", cache_path);
+			return false;
+		}
+	}
+	for(const font_bitmap_cache::font_cache_block& block : file.blocks)
+	{
+		for(const std::unique_ptr<font_glyph_entry[]>& style_glyphs : block.glyphs)
+		{
+			if(!style_glyphs)
+			{
+				continue;
+			}
+			for(size_t i = 0; i < font_bitmap_cache::FONT_CACHE_CHUNK_GLYPHS; ++i)
+			{
+				if(!validate_glyph_rect(file, style_glyphs[i]))
+				{
+					serrf("%s error: invalid glyph\n", cache_path);
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+static bool get_cache_key(
+	font_bitmap_cache* cache, const char* font_path, font_atlas_cache_key* key_out)
+{
+	ASSERT(cache->current_rasterizer != NULL);
+	ASSERT(cache->atlas != NULL);
+
+	if(!hex_binary_hash_file(font_path, &key_out->font_hash))
+	{
+		return false;
+	}
+
+	const font_ttf_face_settings* settings = cache->current_rasterizer->face_settings;
+	key_out->point_size = settings->point_size;
+	key_out->bold_x = settings->bold_x;
+	key_out->bold_y = settings->bold_y;
+	key_out->outline_size = settings->outline_size;
+	key_out->italics_skew = settings->italics_skew;
+	key_out->force_bitmap = settings->force_bitmap;
+	key_out->render_mode = settings->render_mode;
+	key_out->sdf_spread = settings->sdf_spread;
+	key_out->load_flags = settings->load_flags;
+	key_out->atlas_max_size = cache->atlas->atlas_max_size;
+	key_out->linear_filtering = (cv_font_linear_filtering.data == 1);
+	return true;
+}
+
+bool font_atlas_cache_load(font_bitmap_cache* cache, const char* font_path, const char* cache_path)
+{
+	ASSERT(cache != NULL);
+	ASSERT(font_path != NULL);
+	ASSERT(cache_path != NULL);
+
+	if(!cache->font_cache_blocks.empty())
+	{
+		serrf("%s error: the font already has glyphs\n", __func__);
+		return false;
+	}
+
+	TIMER_U t1 = timer_now();
+
+	FILE* fp = fopen(cache_path, "rb");
+	if(fp == NULL)
+	{
+		// not existing is expected, it's written on exit.
+		if(errno != ENOENT)
+		{
+			slogf("info: failed to open: `%s`, reason: %s\n", cache_path, strerror(errno));
+		}
+		return true;
+	}
+	RWops_Stdio cache_file(fp, cache_path);
+
+	font_atlas_cache_file file;
+	if(!get_cache_key(cache, font_path, &file.expected_key))
+	{
+		return false;
+	}
+
+	{
+		// the pixels are most of the file, so a bigger buffer than usual.
+		char buffer[4096];
+		BS_ReadStream sb(&cache_file, buffer, sizeof(buffer));
+		BS_BinaryReader ar(sb);
+		file.Serialize(ar);
+		if(file.stale)
+		{
+			slogf("info: %s is out of date\n", cache_path);
+			return cache_file.close();
+		}
+		if(!ar.Finish(cache_path))
+		{
+			return false;
+		}
+	}
+	if(!cache_file.close())
+	{
+		return false;
+	}
+
+	if(!validate_cache_file(file, cache_path))
+	{
+		return false;
+	}
+
+	font_atlas* atlas = cache->atlas;
+
+	// the whole texture is replaced, so every glyph needs to go (the hex font too).
+	for(font_atlas_listener* listener : atlas->listeners)
+	{
+		listener->evict_atlas_glyphs(atlas->current_frame + 1);
+	}
+
+	if(!atlas->restore(file.atlas_size, file.pixels, std::move(file.packer), file.white_glyph))
+	{
+		return false;
+	}
+
+	cache->font_cache_blocks = std::move(file.blocks);
+	if(!cache->font_cache_blocks.empty())
+	{
+		for(size_t i = 0; i < std::size(cache->ascii_glyphs); ++i)
+		{
+			cache->ascii_glyphs[i] = cache->font_cache_blocks[0].glyphs[i].get();
+		}
+	}
+
+	std::vector<font_glyph_entry*> glyphs;
+	cache->get_atlas_glyphs(glyphs);
+
+	slogf(
+		"info: loaded %s (glyphs: %zu, atlas: %u, %.2fms)\n",
+		cache_path,
+		glyphs.size(),
+		file.atlas_size,
+		timer_delta_ms(t1, timer_now()));
+
+	return true;
+}
+
+bool font_atlas_cache_save(font_bitmap_cache* cache, const char* font_path, const char* cache_path)
+{
+	ASSERT(cache != NULL);
+	ASSERT(font_path != NULL);
+	ASSERT(cache_path != NULL);
+
+	TIMER_U t1 = timer_now();
+
+	font_atlas* atlas = cache->atlas;
+	ASSERT(atlas != NULL);
+
+	font_atlas_cache_file file;
+	if(!get_cache_key(cache, font_path, &file.key))
+	{
+		return false;
+	}
+
+	// the staged glyphs need to be inside of the texture before it's read.
+	ctx.glBindTexture(GL_TEXTURE_2D, atlas->gl_atlas_tex_id);
+	ctx.glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	bool flushed = atlas->flush_uploads();
+	ctx.glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	ctx.glBindTexture(GL_TEXTURE_2D, 0);
+	if(!flushed)
+	{
+		return false;
+	}
+
+	// copy the tables, the copies are re-packed so the live glyphs are not touched.
+	std::vector<font_glyph_entry*> glyphs;
+	file.white_glyph = atlas->white_glyph;
+	glyphs.push_back(&file.white_glyph);
+	file.blocks.resize(cache->font_cache_blocks.size());
+	for(size_t i = 0; i < cache->font_cache_blocks.size(); ++i)
+	{
+		font_bitmap_cache::font_cache_block& src_block = cache->font_cache_blocks[i];
+		font_bitmap_cache::font_cache_block& dest_block = file.blocks[i];
+		dest_block.bad_indexes = src_block.bad_indexes;
+		for(size_t j = 0; j < std::size(src_block.glyphs); ++j)
+		{
+			if(!src_block.glyphs[j])
+			{
+				continue;
+			}
+			dest_block.glyphs[j] =
+				std::make_unique<font_glyph_entry[]>(font_bitmap_cache::FONT_CACHE_CHUNK_GLYPHS);
+			for(size_t k = 0; k < font_bitmap_cache::FONT_CACHE_CHUNK_GLYPHS; ++k)
+			{
+				font_glyph_entry& entry = dest_block.glyphs[j][k];
+				entry = src_block.glyphs[j][k];
+				entry.last_used = 0;
+				if(entry.type == FONT_ENTRY::PENDING)
+				{
+					// it will be rasterized again.
+					memset(&entry, 0, sizeof(entry));
+				}
+				if(entry.type == FONT_ENTRY::GLYPH)
+				{
+					glyphs.push_back(&entry);
+				}
+			}
+		}
+	}
+
+	// only this font's glyphs are saved, so the holes from the hex font are packed away.
+	// tallest first packs the best (same as compact)
+	std::sort(
+		glyphs.begin(), glyphs.end(), [](const font_glyph_entry* lhs, const font_glyph_entry* rhs) {
+			if(lhs->rect_h != rhs->rect_h)
+			{
+				return lhs->rect_h > rhs->rect_h;
+			}
+			return lhs->rect_w > rhs->rect_w;
+		});
+
+	file.atlas_size = atlas->atlas_size;
+	file.packer.init(file.atlas_size);
+
+	uint32_t src_rows = 0;
+	std::vector<font_guillotine_packer::packer_rect> new_rects(glyphs.size());
+	for(size_t i = 0; i < glyphs.size(); ++i)
+	{
+		src_rows = std::max<uint32_t>(src_rows, glyphs[i]->rect_y + glyphs[i]->rect_h);
+		new_rects[i].w = glyphs[i]->rect_w;
+		new_rects[i].h = glyphs[i]->rect_h;
+		if(!file.packer.insert(new_rects[i].w, new_rects[i].h, &new_rects[i].x, &new_rects[i].y))
+		{
+			// this shouldn't be possible because the glyphs fit before.
+			serrf("%s: glyphs don't fit (%zu glyphs)\n", __func__, glyphs.size());
+			return false;
+		}
+		file.rows = std::max(file.rows, new_rects[i].y + new_rects[i].h);
+	}
+
+	std::vector<uint8_t> atlas_pixels;
+	if(!atlas->read_pixels(src_rows, atlas_pixels))
+	{
+		return false;
+	}
+
+	file.pixels.assign(static_cast<size_t>(file.atlas_size) * file.rows, 0);
+	for(size_t i = 0; i < glyphs.size(); ++i)
+	{
+		font_glyph_entry& glyph = *glyphs[i];
+		for(uint32_t y = 0; y < glyph.rect_h; ++y)
+		{
+			memcpy(
+				file.pixels.data() + static_cast<size_t>(new_rects[i].y + y) * file.atlas_size +
+					new_rects[i].x,
+				atlas_pixels.data() + static_cast<size_t>(glyph.rect_y + y) * file.atlas_size +
+					glyph.rect_x,
+				glyph.rect_w);
+		}
+		glyph.rect_x = new_rects[i].x;
+		glyph.rect_y = new_rects[i].y;
+	}
+
+	std::string temp_path = std::string(cache_path) + ".tmp";
+	{
+		FILE* fp = serr_wrapper_fopen(temp_path.c_str(), "wb");
+		if(fp == NULL)
+		{
+			return false;
+		}
+		RWops_Stdio cache_file(fp, temp_path);
+		char buffer[4096];
+		BS_WriteStream sb(&cache_file, buffer, sizeof(buffer));
+		BS_BinaryWriter ar(sb);
+		file.Serialize(ar);
+		bool success = ar.Finish(temp_path.c_str());
+		success = cache_file.close() && success;
+		if(!success)
+		{
+			remove(temp_path.c_str());
+			return false;
+		}
+	}
+#ifdef _WIN32
+	// windows won't rename over an existing file.
+	remove(cache_path);
+#endif
+	if(rename(temp_path.c_str(), cache_path) != 0)
+	{
+		serrf("Failed to rename: `%s`, reason: %s\n", temp_path.c_str(), strerror(errno));
+		remove(temp_path.c_str());
+		return false;
+	}
+
+	slogf(
+		"info: wrote %s (glyphs: %zu, %zukb, %.2fms)\n",
+		cache_path,
+		glyphs.size() - 1,
+		(static_cast<size_t>(file.atlas_size) * file.rows) / 1024,
+		timer_delta_ms(t1, timer_now()));
+
+	return true;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "../global.h"
+
+struct font_bitmap_cache;
+
+// saves the glyphs that a font_bitmap_cache rasterized (and the part of the atlas they use),
+// so the next startup can put them back into the atlas with one upload instead of rasterizing.
+// the file is a BS_Archive binary:
+//   the key (the hash of the font file, font_ttf_face_settings, the atlas max size, filtering)
+//   the glyph tables of font_bitmap_cache::font_cache_blocks (including bad_indexes)
+//   the packer state, the white glyph, and the pixels (only the rows that are used)
+// if any part of the key changed, the cache is ignored and it's overwritten on the next save.
+// only this font's glyphs are saved, they are re-packed like font_atlas::compact,
+// and the hex font glyphs are evicted on load (they are cheap to load again).
+
+// call this right after font_bitmap_cache::init, before any glyph is loaded.
+// a missing or out of date cache is not an error (it only prints info),
+// the whole atlas texture is replaced, so anything that was drawn needs to be redrawn.
+NDSERR bool font_atlas_cache_load(
+	font_bitmap_cache* cache, const char* font_path, const char* cache_path);
+
+// call this before font_bitmap_cache::destroy, this will unbind GL_TEXTURE_2D.
+// writes to a temporary file and renames it, so a crash won't leave a half written cache.
+NDSERR bool font_atlas_cache_save(
+	font_bitmap_cache* cache, const char* font_path, const char* cache_path);
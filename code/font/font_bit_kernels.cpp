@@ -0,0 +1,346 @@
+#include "../global_pch.h"
+#include "../global.h"
+
+#include "font_bit_kernels.h"
+
+#include <vector>
+
+// AVX2 isn't used, unifont rows are only 8 or 16 pixels, and a whole glyph
+// is 128 or 256 bytes, so 128 bit registers are already enough.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FONT_BIT_USE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define FONT_BIT_USE_NEON
+#include <arm_neon.h>
+#endif
+
+const char* font_bit_kernel_name()
+{
+#if defined(FONT_BIT_USE_SSE2)
+	return "sse2";
+#elif defined(FONT_BIT_USE_NEON)
+	return "neon";
+#else
+	return "scalar";
+#endif
+}
+
+void font_expand_1bpp_row_scalar(const uint8_t* src, uint8_t* dst, size_t width)
+{
+	ASSERT(src != NULL);
+	ASSERT(dst != NULL);
+	for(size_t i = 0; i < width; ++i)
+	{
+		*dst++ = ((src[i / 8] & (0x80 >> (i % 8))) == 0) ? 0 : 255;
+	}
+}
+
+void font_expand_1bpp_row(const uint8_t* src, uint8_t* dst, size_t width)
+{
+	ASSERT(src != NULL);
+	ASSERT(dst != NULL);
+
+	size_t i = 0;
+#if defined(FONT_BIT_USE_SSE2)
+	// 2 bytes -> 16 pixels, every byte is copied 8 times and tested against a different bit.
+	const __m128i mask =
+		_mm_setr_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+	for(; i + 16 <= width; i += 16)
+	{
+		__m128i bits = _mm_cvtsi32_si128(src[0] | (src[1] << 8));
+		bits = _mm_unpacklo_epi8(bits, bits);
+		bits = _mm_unpacklo_epi16(bits, bits);
+		bits = _mm_unpacklo_epi32(bits, bits);
+		__m128i pixels = _mm_cmpeq_epi8(_mm_and_si128(bits, mask), mask);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst), pixels);
+		src += 2;
+		dst += 16;
+	}
+#elif defined(FONT_BIT_USE_NEON)
+	const uint8_t mask_data[16] = {128, 64, 32, 16, 8, 4, 2, 1, 128, 64, 32, 16, 8, 4, 2, 1};
+	const uint8x16_t mask = vld1q_u8(mask_data);
+	for(; i + 16 <= width; i += 16)
+	{
+		uint8x16_t bits = vcombine_u8(vdup_n_u8(src[0]), vdup_n_u8(src[1]));
+		vst1q_u8(dst, vtstq_u8(bits, mask));
+		src += 2;
+		dst += 16;
+	}
+#endif
+	font_expand_1bpp_row_scalar(src, dst, width - i);
+}
+
+void font_expand_1bpp(
+	const uint8_t* src,
+	size_t src_pitch,
+	uint8_t* dst,
+	size_t dst_pitch,
+	size_t width,
+	size_t rows)
+{
+	ASSERT(src != NULL);
+	ASSERT(dst != NULL);
+	if(width % 8 == 0 && src_pitch * 8 == width && dst_pitch == width)
+	{
+		font_expand_1bpp_row(src, dst, width * rows);
+		return;
+	}
+	for(size_t y = 0; y < rows; ++y)
+	{
+		font_expand_1bpp_row(src + y * src_pitch, dst + y * dst_pitch, width);
+	}
+}
+
+static int hex_nibble(char c)
+{
+	if(c >= '0' && c <= '9')
+	{
+		return c - '0';
+	}
+	if(c >= 'A' && c <= 'F')
+	{
+		return c - 'A' + 10;
+	}
+	if(c >= 'a' && c <= 'f')
+	{
+		return c - 'a' + 10;
+	}
+	return -1;
+}
+
+bool font_decode_hex_scalar(const char* src, uint8_t* dst, size_t byte_count)
+{
+	ASSERT(src != NULL);
+	ASSERT(dst != NULL);
+	for(size_t i = 0; i < byte_count; ++i)
+	{
+		int high = hex_nibble(src[i * 2]);
+		int low = hex_nibble(src[i * 2 + 1]);
+		if(high < 0 || low < 0)
+		{
+			return false;
+		}
+		dst[i] = (high << 4) | low;
+	}
+	return true;
+}
+
+#if defined(FONT_BIT_USE_SSE2)
+// returns the nibble of every character, and sets valid to 0xFF if the character is hex.
+static __m128i sse2_hex_nibbles(__m128i chars, __m128i* valid_out)
+{
+	// ascii is under 128, so signed compares work, and anything over 127 is negative.
+	__m128i is_digit = _mm_and_si128(
+		_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)),
+		_mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1)));
+	__m128i lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+	__m128i is_alpha = _mm_and_si128(
+		_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+		_mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+	__m128i digit = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+	__m128i alpha = _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10));
+	*valid_out = _mm_or_si128(is_digit, is_alpha);
+	return _mm_or_si128(_mm_and_si128(is_digit, digit), _mm_and_si128(is_alpha, alpha));
+}
+
+// 16 characters -> 8 bytes in the low half of each 16 bit lane.
+static __m128i sse2_hex_pairs(__m128i nibbles)
+{
+	// the first character of a pair is the low byte of the lane.
+	__m128i high = _mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0xFF)), 4);
+	__m128i low = _mm_srli_epi16(nibbles, 8);
+	return _mm_or_si128(high, low);
+}
+#endif
+
+bool font_decode_hex(const char* src, uint8_t* dst, size_t byte_count)
+{
+	ASSERT(src != NULL);
+	ASSERT(dst != NULL);
+
+	size_t i = 0;
+#if defined(FONT_BIT_USE_SSE2)
+	// 32 characters -> 16 bytes
+	for(; i + 16 <= byte_count; i += 16)
+	{
+		__m128i valid_a;
+		__m128i valid_b;
+		__m128i nibbles_a =
+			sse2_hex_nibbles(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)), &valid_a);
+		__m128i nibbles_b = sse2_hex_nibbles(
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16)), &valid_b);
+		if(_mm_movemask_epi8(_mm_and_si128(valid_a, valid_b)) != 0xFFFF)
+		{
+			return false;
+		}
+		__m128i bytes = _mm_packus_epi16(sse2_hex_pairs(nibbles_a), sse2_hex_pairs(nibbles_b));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst), bytes);
+		src += 32;
+		dst += 16;
+	}
+#elif defined(FONT_BIT_USE_NEON)
+	// 32 characters -> 16 bytes, vld2 splits the first and second character of each pair.
+	for(; i + 16 <= byte_count; i += 16)
+	{
+		uint8x16x2_t chars = vld2q_u8(reinterpret_cast<const uint8_t*>(src));
+		uint8x16_t nibbles[2];
+		uint8x16_t valid = vdupq_n_u8(0xFF);
+		for(size_t j = 0; j < 2; ++j)
+		{
+			uint8x16_t c = chars.val[j];
+			uint8x16_t is_digit =
+				vandq_u8(vcgeq_u8(c, vdupq_n_u8('0')), vcleq_u8(c, vdupq_n_u8('9')));
+			uint8x16_t lower = vorrq_u8(c, vdupq_n_u8(0x20));
+			uint8x16_t is_alpha =
+				vandq_u8(vcgeq_u8(lower, vdupq_n_u8('a')), vcleq_u8(lower, vdupq_n_u8('f')));
+			uint8x16_t digit = vsubq_u8(c, vdupq_n_u8('0'));
+			uint8x16_t alpha = vsubq_u8(lower, vdupq_n_u8('a' - 10));
+			nibbles[j] = vorrq_u8(vandq_u8(is_digit, digit), vandq_u8(is_alpha, alpha));
+			valid = vandq_u8(valid, vorrq_u8(is_digit, is_alpha));
+		}
+		uint64x2_t valid64 = vreinterpretq_u64_u8(valid);
+		if((vgetq_lane_u64(valid64, 0) & vgetq_lane_u64(valid64, 1)) != ~UINT64_C(0))
+		{
+			return false;
+		}
+		vst1q_u8(dst, vorrq_u8(vshlq_n_u8(nibbles[0], 4), nibbles[1]));
+		src += 32;
+		dst += 16;
+	}
+#endif
+	return font_decode_hex_scalar(src, dst, byte_count - i);
+}
+
+bool bench_font_bit_kernels()
+{
+	// a full plane like unifont, 1/4 of them are full width (roughly like the BMP).
+	const size_t glyph_count = 65536;
+	const size_t half_bytes = 8 * 16 / 8;
+	const size_t full_bytes = 16 * 16 / 8;
+	const size_t passes = 8;
+
+	std::vector<uint8_t> glyph_full(glyph_count);
+	std::vector<size_t> glyph_offsets(glyph_count);
+	std::vector<char> hex_text;
+	std::vector<uint8_t> bits;
+
+	uint32_t rng = 0x12345678;
+	auto next_random = [&rng]() {
+		// xorshift32
+		rng ^= rng << 13;
+		rng ^= rng >> 17;
+		rng ^= rng << 5;
+		return rng;
+	};
+	const char* hex_chars = "0123456789ABCDEF";
+	for(size_t i = 0; i < glyph_count; ++i)
+	{
+		glyph_full[i] = (next_random() % 4) == 0;
+		glyph_offsets[i] = bits.size();
+		size_t size = glyph_full[i] ? full_bytes : half_bytes;
+		for(size_t j = 0; j < size; ++j)
+		{
+			uint8_t value = next_random() & 0xFF;
+			bits.push_back(value);
+			hex_text.push_back(hex_chars[value >> 4]);
+			hex_text.push_back(hex_chars[value & 0xF]);
+		}
+	}
+
+	std::vector<uint8_t> decoded(bits.size());
+	std::vector<uint8_t> decoded_scalar(bits.size());
+	std::vector<uint8_t> pixels(bits.size() * 8);
+	std::vector<uint8_t> pixels_scalar(bits.size() * 8);
+
+	TIMER_RESULT decode_scalar_ns = 0;
+	TIMER_RESULT decode_ns = 0;
+	TIMER_RESULT expand_scalar_ns = 0;
+	TIMER_RESULT expand_ns = 0;
+
+	for(size_t pass = 0; pass < passes; ++pass)
+	{
+		TIMER_U start = timer_now();
+		for(size_t i = 0; i < glyph_count; ++i)
+		{
+			size_t size = glyph_full[i] ? full_bytes : half_bytes;
+			size_t offset = glyph_offsets[i];
+			if(!font_decode_hex_scalar(
+				   hex_text.data() + offset * 2, decoded_scalar.data() + offset, size))
+			{
+				serrf("%s: scalar decode failed\n", __func__);
+				return false;
+			}
+		}
+		TIMER_U end = timer_now();
+		decode_scalar_ns += timer_delta<1000000000>(start, end);
+
+		start = timer_now();
+		for(size_t i = 0; i < glyph_count; ++i)
+		{
+			size_t size = glyph_full[i] ? full_bytes : half_bytes;
+			size_t offset = glyph_offsets[i];
+			if(!font_decode_hex(hex_text.data() + offset * 2, decoded.data() + offset, size))
+			{
+				serrf("%s: decode failed\n", __func__);
+				return false;
+			}
+		}
+		end = timer_now();
+		decode_ns += timer_delta<1000000000>(start, end);
+
+		start = timer_now();
+		for(size_t i = 0; i < glyph_count; ++i)
+		{
+			size_t size = glyph_full[i] ? full_bytes : half_bytes;
+			size_t offset = glyph_offsets[i];
+			font_expand_1bpp_row_scalar(
+				bits.data() + offset, pixels_scalar.data() + offset * 8, size * 8);
+		}
+		end = timer_now();
+		expand_scalar_ns += timer_delta<1000000000>(start, end);
+
+		start = timer_now();
+		for(size_t i = 0; i < glyph_count; ++i)
+		{
+			size_t width = glyph_full[i] ? 16 : 8;
+			size_t offset = glyph_offsets[i];
+			font_expand_1bpp(
+				bits.data() + offset, width / 8, pixels.data() + offset * 8, width, width, 16);
+		}
+		end = timer_now();
+		expand_ns += timer_delta<1000000000>(start, end);
+	}
+
+	if(decoded != bits || decoded_scalar != bits)
+	{
+		serrf("%s: decoded hex doesn't match\n", __func__);
+		return false;
+	}
+	if(pixels != pixels_scalar)
+	{
+		serrf("%s: expanded pixels don't match\n", __func__);
+		return false;
+	}
+
+	auto glyphs_per_sec = [&](TIMER_RESULT ns) {
+		return static_cast<double>(glyph_count * passes) / (ns / 1000000000.0);
+	};
+	slogf(
+		"info: font bit kernels (%s), %zu glyphs x %zu passes\n",
+		font_bit_kernel_name(),
+		glyph_count,
+		passes);
+	slogf(
+		"info: hex decode   scalar: %.2fM glyphs/sec, %s: %.2fM glyphs/sec\n",
+		glyphs_per_sec(decode_scalar_ns) / 1000000.0,
+		font_bit_kernel_name(),
+		glyphs_per_sec(decode_ns) / 1000000.0);
+	slogf(
+		"info: 1bpp expand  scalar: %.2fM glyphs/sec, %s: %.2fM glyphs/sec\n",
+		glyphs_per_sec(expand_scalar_ns) / 1000000.0,
+		font_bit_kernel_name(),
+		glyphs_per_sec(expand_ns) / 1000000.0);
+
+	return true;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "../global.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// the loops that turn unifont and FT_PIXEL_MODE_MONO glyphs into 8bpp atlas pixels.
+// these use SSE2 or NEON if the compiler has it, otherwise it's the scalar version.
+// 1bpp bitmaps are MSB first (the left most pixel is 0x80), like unifont and freetype.
+
+// the name of the kernels that were compiled in ("sse2", "neon", "scalar")
+const char* font_bit_kernel_name();
+
+// expand width pixels from 1bpp to 8bpp (0 or 255)
+// src needs (width + 7) / 8 bytes, and dst needs width bytes.
+void font_expand_1bpp_row(const uint8_t* src, uint8_t* dst, size_t width);
+
+// the same as font_expand_1bpp_row but for every row,
+// if both bitmaps are tightly packed, this is one big row.
+void font_expand_1bpp(
+	const uint8_t* src,
+	size_t src_pitch,
+	uint8_t* dst,
+	size_t dst_pitch,
+	size_t width,
+	size_t rows);
+
+// decode byte_count bytes from pairs of hex characters (0-9, A-F, a-f)
+// returns false if there was a character that wasn't hex (dst will contain garbage).
+[[nodiscard]] bool font_decode_hex(const char* src, uint8_t* dst, size_t byte_count);
+
+// the plain versions, for checking and comparing against the SIMD versions.
+void font_expand_1bpp_row_scalar(const uint8_t* src, uint8_t* dst, size_t width);
+[[nodiscard]] bool font_decode_hex_scalar(const char* src, uint8_t* dst, size_t byte_count);
+
+// decodes and expands a full plane (65536 glyphs) of random unifont glyphs,
+// with the scalar and SIMD kernels, and prints the glyphs per second.
+// this will also check that the SIMD kernels match the scalar kernels.
+NDSERR bool bench_font_bit_kernels();
@@ -2,13 +2,14 @@
 #include "../global.h"
 
 #include "font_manager.h"
+#include "font_raster_pool.h"
+#include "font_bit_kernels.h"
 
 #include "utf8_stuff.h"
 
-// for reading files, since I like the stream API.
-#include "../BS_Archive/BS_stream.h"
 #include "../cvar.h"
 #include "../app.h" //for cv_ui_scale for the font painter
+#include "../zone_profiler.h"
 
 #include <cmath>
 #include <cstddef>
@@ -22,6 +23,7 @@
 #include FT_STROKER_H
 #include FT_BITMAP_H
 #include FT_OUTLINE_H
+#include FT_MODULE_H
 // I can't really support color because my atlas is black and white for GPU memory reasons.
 //#include FT_COLOR_H
 
@@ -33,7 +35,33 @@
 #define FT_FLOOR(X) (((X) & -64) / 64)
 
 static REGISTER_CVAR_INT(
-	cv_font_atlas_size, 16384, "the texture size, must be a power of 2", CVAR_T::STARTUP);
+	cv_font_atlas_size,
+	4096,
+	"the maximum texture size, old glyphs are evicted past this, must be a power of 2",
+	CVAR_T::STARTUP);
+static REGISTER_CVAR_INT(
+	cv_font_atlas_initial_size,
+	512,
+	"the starting texture size, doubles until cv_font_atlas_size, must be a power of 2",
+	CVAR_T::STARTUP);
+
+static REGISTER_CVAR_INT(
+	cv_font_atlas_eviction_warning,
+	1,
+	"0 = off, 1 = on, log when the font atlas is full and evicts old glyphs",
+	CVAR_T::RUNTIME);
+
+static REGISTER_CVAR_INT(
+	cv_font_atlas_pbo,
+	0,
+	"0 = off, 1 = on, upload new glyphs through a pixel buffer object",
+	CVAR_T::RUNTIME);
+
+static REGISTER_CVAR_INT(
+	cv_font_layout_cache,
+	1,
+	"0 = off, 1 = on, reuse the vertices of text that was drawn before",
+	CVAR_T::RUNTIME);
 
 // this is an annoying warning because the glyph will still use the unifont fallback,
 // and if the unifont also doesn't have the font, it turns into an error.
@@ -132,17 +160,19 @@ RAII_FT_Bitmap::~RAII_FT_Bitmap()
 static void convert_glyph_format(
 	font_style_interface* font, font_glyph_entry* in, font_style_result* out, float font_scale)
 {
-	float atlas_size = static_cast<float>(font->get_font_atlas()->atlas_size);
-	out->atlas_xmin = static_cast<float>(in->rect_x) / atlas_size;
-	out->atlas_ymin = static_cast<float>(in->rect_y) / atlas_size;
-	out->atlas_xmax = static_cast<float>(in->rect_x + in->rect_w) / atlas_size;
-	out->atlas_ymax = static_cast<float>(in->rect_y + in->rect_h) / atlas_size;
+	// the UV's are in pixels, the shader will divide by the texture size.
+	// this is so that resizing the atlas doesn't invalidate anything.
+	out->atlas_xmin = static_cast<float>(in->rect_x);
+	out->atlas_ymin = static_cast<float>(in->rect_y);
+	out->atlas_xmax = static_cast<float>(in->rect_x + in->rect_w);
+	out->atlas_ymax = static_cast<float>(in->rect_y + in->rect_h);
 
 	out->glyph_xmin = static_cast<float>(in->xmin) * font_scale;
 	out->glyph_ymin = font->get_ascent(font_scale) - (static_cast<float>(in->ymin) * font_scale);
 	out->glyph_xmax = out->glyph_xmin + static_cast<float>(in->rect_w) * font_scale;
 	out->glyph_ymax = out->glyph_ymin + (static_cast<float>(in->rect_h) * font_scale);
 	out->advance = static_cast<float>(in->advance) * font_scale;
+	out->sdf_weight = 0;
 }
 
 bool font_manager_state::create()
@@ -173,95 +203,12 @@ bool font_manager_state::create()
 	int gl_max_texture_size = 0;
 	ctx.glGetIntegerv(GL_MAX_TEXTURE_SIZE, &gl_max_texture_size);
 
-	atlas.atlas_size = std::min(cv_font_atlas_size.data, gl_max_texture_size);
-
-	// create the texture for the atlas
-	ctx.glGenTextures(1, &gl_atlas_tex_id);
-	if(gl_atlas_tex_id == 0)
-	{
-		serrf("%s error: glGenTextures failed\n", __func__);
-		return false;
-	}
-
-	ctx.glActiveTexture(GL_TEXTURE0);
-	ctx.glBindTexture(GL_TEXTURE_2D, gl_atlas_tex_id);
-	ctx.glTexImage2D(
-		GL_TEXTURE_2D,
-		0,
-		GL_R8,
-		atlas.atlas_size, // NOLINT(bugprone-narrowing-conversions)
-		atlas.atlas_size, // NOLINT(bugprone-narrowing-conversions)
-		0,
-		GL_RED,
-		GL_UNSIGNED_BYTE,
-		NULL);
-
-	// Set texture parameters
-	ctx.glTexParameteri(
-		GL_TEXTURE_2D,
-		GL_TEXTURE_MAG_FILTER,
-		(cv_font_linear_filtering.data == 1 ? GL_LINEAR : GL_NEAREST));
-	ctx.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	ctx.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	ctx.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	ctx.glBindTexture(GL_TEXTURE_2D, 0);
-
-// webgl will always clear the texture for security reasons.
-#ifndef __EMSCRIPTEN__
-
-#if 0
-	static GLuint query = 0;
-	TIMER_U t1 = timer_now();
-	if(cv_has_EXT_disjoint_timer_query.data == 1)
-	{
-		// static GLuint query = 0;
-		if(query == 0)
-		{
-			ctx.glGenQueriesEXT(1, &query);
-		}
-		ctx.glBeginQueryEXT(GL_TIME_ELAPSED_EXT, query);
-	}
-#endif
-
-	// because of filtering, I need to pad textures in the atlas,
-	// but unwritten areas will have garbage, so clear the texture to be zero's.
-
-	unsigned int fbo;
-	ctx.glGenFramebuffers(1, &fbo);
-	if(fbo == 0)
+	uint32_t max_size = std::min(cv_font_atlas_size.data, gl_max_texture_size);
+	uint32_t initial_size = std::min<uint32_t>(cv_font_atlas_initial_size.data, max_size);
+	if(!atlas.create(initial_size, max_size))
 	{
-		serrf("%s error: glGenFramebuffers failed\n", __func__);
 		return false;
 	}
-	ctx.glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
-	ctx.glFramebufferTexture2D(
-		GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gl_atlas_tex_id, 0);
-	GLenum color_attachment = GL_COLOR_ATTACHMENT0;
-	ctx.glDrawBuffers(1, &color_attachment);
-	// note this is a GL_RED texture, and only the RED value matters.
-	GLfloat clearColor[4] = {0, 0, 0, 0};
-	ctx.glClearBufferfv(GL_COLOR, 0, clearColor);
-	ctx.glDrawBuffers(0, NULL);
-	ctx.glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-	ctx.glDeleteFramebuffers(1, &fbo);
-	fbo = 0;
-
-#if 0
-    // yes this takes a long time...
-	if(cv_has_EXT_disjoint_timer_query.data == 1)
-	{
-		TIMER_U t2 = timer_now();
-		ctx.glEndQueryEXT(GL_TIME_ELAPSED_EXT);
-
-		GLuint64 elapsed_time;
-		ctx.glGetQueryObjectui64vEXT(query, GL_QUERY_RESULT, &elapsed_time);
-		slogf(
-			"atlas fbo time: %f, cpu: %f\n",
-			static_cast<double>(elapsed_time) / 1000000.0,
-			timer_delta_ms(t1, t2));
-	}
-#endif
-#endif
 
 	// upload 4 pixels for padding
 	// technically I could use one pixel but see cool_fade
@@ -280,11 +227,10 @@ bool font_manager_state::create()
 		return false;
 	}
 
-	float atlas_size = static_cast<float>(atlas.atlas_size);
-	atlas.white_uv[0] = (static_cast<float>(x_out) + 0.5f) / atlas_size;
-	atlas.white_uv[2] = (static_cast<float>(x_out) + 1.5f) / atlas_size;
-	atlas.white_uv[1] = (static_cast<float>(y_out) + 0.5f) / atlas_size;
-	atlas.white_uv[3] = (static_cast<float>(y_out) + 1.5f) / atlas_size;
+	// this isn't owned by any listener so it's never evicted, but compact() can move it.
+	atlas.white_glyph =
+		font_glyph_entry(FONT_ENTRY::GLYPH, x_out, y_out, 2 + offset, 2 + offset, 0, 0, 0);
+	atlas.update_white_uv();
 
 	uint8_t cool_fade = 255;
 	if(cv_font_linear_filtering.data == 1)
@@ -293,7 +239,7 @@ bool font_manager_state::create()
 		cool_fade = 170;
 	}
 	uint8_t pixel[4] = {255, 255, cool_fade, cool_fade};
-	ctx.glBindTexture(GL_TEXTURE_2D, gl_atlas_tex_id);
+	ctx.glBindTexture(GL_TEXTURE_2D, atlas.gl_atlas_tex_id);
 	ctx.glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 	// NOLINTNEXTLINE(bugprone-narrowing-conversions)
 	ctx.glTexSubImage2D(GL_TEXTURE_2D, 0, x_out, y_out, 2, 2, GL_RED, GL_UNSIGNED_BYTE, pixel);
@@ -320,7 +266,7 @@ bool font_manager_state::destroy()
 		FTLibrary = NULL;
 	}
 
-	SAFE_GL_DELETE_TEXTURE(gl_atlas_tex_id);
+	success = atlas.destroy() && success;
 
 	return GL_CHECK(__func__) == GL_NO_ERROR && success;
 }
@@ -478,11 +424,34 @@ bool font_ttf_rasterizer::set_face_settings(const font_ttf_face_settings* settin
 		}
 	}
 
+#ifdef FONT_HAS_SDF
+	if(settings->render_mode == FT_RENDER_MODE_SDF)
+	{
+		// this is global to the library, but every rasterizer uses the same settings.
+		FT_Int spread = settings->sdf_spread;
+		if((error = FT_Property_Set(FTLibrary, "sdf", "spread", &spread)) != 0)
+		{
+			TTF_SetFTError(font_file->name(), error);
+			return false;
+		}
+	}
+#endif
+
 	face_settings = settings;
 
 	return true;
 }
 
+bool font_ttf_rasterizer::is_sdf() const
+{
+	ASSERT(face_settings != NULL);
+#ifdef FONT_HAS_SDF
+	return face_settings->render_mode == FT_RENDER_MODE_SDF;
+#else
+	return false;
+#endif
+}
+
 bool font_ttf_rasterizer::render_glyph(FT_Glyph* glyph_out, unsigned style_flags)
 {
 	ASSERT(face != NULL);
@@ -584,240 +553,733 @@ bool font_ttf_rasterizer::render_glyph(FT_Glyph* glyph_out, unsigned style_flags
 	return true;
 }
 
-#if defined(__clang__)
-// ubsan is triggered by -(span_granularity)
-__attribute__((no_sanitize("unsigned-integer-overflow")))
-#endif
-bool font_atlas::find_atlas_slot(uint32_t w_in, uint32_t h_in, uint32_t* x_out, uint32_t* y_out)
+// creates a blank texture for the atlas, and leaves it bound.
+// pixels can be NULL
+static GLuint create_atlas_texture(uint32_t size, const uint8_t* pixels = NULL)
 {
-	ASSERT(x_out != NULL);
-	ASSERT(y_out != NULL);
-	// NOTE: probably could flip the bitmaps and compare which wastes less space.
-	if(w_in == 0)
+	GLuint tex_id = 0;
+	ctx.glGenTextures(1, &tex_id);
+	if(tex_id == 0)
 	{
-		serrf("%s: width 0\n", __func__);
-		return false;
+		serrf("%s error: glGenTextures failed\n", __func__);
+		return 0;
 	}
-	if(h_in == 0)
+
+	ctx.glActiveTexture(GL_TEXTURE0);
+	ctx.glBindTexture(GL_TEXTURE_2D, tex_id);
+	ctx.glTexImage2D(
+		GL_TEXTURE_2D,
+		0,
+		GL_R8,
+		size, // NOLINT(bugprone-narrowing-conversions)
+		size, // NOLINT(bugprone-narrowing-conversions)
+		0,
+		GL_RED,
+		GL_UNSIGNED_BYTE,
+		pixels);
+
+	// Set texture parameters
+	ctx.glTexParameteri(
+		GL_TEXTURE_2D,
+		GL_TEXTURE_MAG_FILTER,
+		(cv_font_linear_filtering.data == 1 ? GL_LINEAR : GL_NEAREST));
+	ctx.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	ctx.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	ctx.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	return tex_id;
+}
+
+bool font_atlas::create(uint32_t initial_size, uint32_t max_size)
+{
+	ASSERT(initial_size <= max_size);
+	atlas_size = initial_size;
+	atlas_max_size = max_size;
+
+	gl_atlas_tex_id = create_atlas_texture(atlas_size);
+	if(gl_atlas_tex_id == 0)
 	{
-		serrf("%s: height 0\n", __func__);
 		return false;
 	}
-	if(w_in > atlas_size)
+
+// webgl will always clear the texture for security reasons.
+#ifndef __EMSCRIPTEN__
+	// because of filtering, I need to pad textures in the atlas,
+	// but unwritten areas will have garbage, so clear the texture to be zero's.
+
+	unsigned int fbo;
+	ctx.glGenFramebuffers(1, &fbo);
+	if(fbo == 0)
 	{
-		serrf("%s: width (%u) > atlas (%u)\n", __func__, w_in, atlas_size);
+		serrf("%s error: glGenFramebuffers failed\n", __func__);
 		return false;
 	}
-	if(h_in > atlas_size)
+	ctx.glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+	ctx.glFramebufferTexture2D(
+		GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gl_atlas_tex_id, 0);
+	GLenum color_attachment = GL_COLOR_ATTACHMENT0;
+	ctx.glDrawBuffers(1, &color_attachment);
+	// note this is a GL_RED texture, and only the RED value matters.
+	GLfloat clearColor[4] = {0, 0, 0, 0};
+	ctx.glClearBufferfv(GL_COLOR, 0, clearColor);
+	ctx.glDrawBuffers(0, NULL);
+	ctx.glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	ctx.glDeleteFramebuffers(1, &fbo);
+	fbo = 0;
+#endif
+
+	ctx.glBindTexture(GL_TEXTURE_2D, 0);
+
+	packer.init(atlas_size);
+
+	return GL_CHECK(__func__) == GL_NO_ERROR;
+}
+
+bool font_atlas::destroy()
+{
+	SAFE_GL_DELETE_TEXTURE(gl_atlas_tex_id);
+	SAFE_GL_DELETE_VBO(gl_upload_pbo);
+	staged_rects.clear();
+
+	if(!listeners.empty())
+	{
+		serrf("%s: atlas destroyed with %zu listeners\n", __func__, listeners.size());
+		listeners.clear();
+	}
+
+	return GL_CHECK(__func__) == GL_NO_ERROR;
+}
+
+bool font_atlas::grow_atlas()
+{
+	ASSERT(atlas_size < atlas_max_size);
+
+	// the staged glyphs need to be inside of the texture before it's copied.
+	if(!flush_uploads())
 	{
-		serrf("%s: height (%u) > atlas (%u)\n", __func__, h_in, atlas_size);
 		return false;
 	}
 
-	// size_t size = ceil(float(w) / float(span_granularity)) * span_granularity
-	// this wont work with non power of 2's
-	uint32_t pixel_size = (w_in - 1u + span_granularity) & -(span_granularity);
-	uint32_t span_size = pixel_size / span_granularity;
+	TIMER_U t1 = timer_now();
 
-	// closest bucket to the size of the glyph that is larger than the size of the entry.
-	span_bucket* closest_bucket = NULL;
+	uint32_t new_size = std::min(atlas_size * 2, atlas_max_size);
 
-	// this is a brute force lookup, but should be negligible.
-	for(span_bucket& bucket : span_buckets)
+	GLuint new_tex_id = create_atlas_texture(new_size);
+	if(new_tex_id == 0)
 	{
-		if(bucket.bucket_depth + h_in > atlas_size)
-		{
-			continue;
-		}
-		if(bucket.span_count == span_size)
-		{
-			*x_out = bucket.span_start * span_granularity;
-			*y_out = bucket.bucket_depth;
-			bucket.bucket_depth += h_in;
-			return true;
-		}
-		if(bucket.span_count > span_size)
-		{
-			if(closest_bucket == NULL || bucket.span_count < closest_bucket->span_count)
-			{
-				closest_bucket = &bucket;
-			}
-		}
+		return false;
+	}
+
+	unsigned int fbo;
+	ctx.glGenFramebuffers(1, &fbo);
+	if(fbo == 0)
+	{
+		serrf("%s error: glGenFramebuffers failed\n", __func__);
+		ctx.glDeleteTextures(1, &new_tex_id);
+		return false;
 	}
+	ctx.glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+#ifndef __EMSCRIPTEN__
+	// clear the new texture, because the copy only fills the top left.
+	ctx.glFramebufferTexture2D(
+		GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, new_tex_id, 0);
+	GLenum color_attachment = GL_COLOR_ATTACHMENT0;
+	ctx.glDrawBuffers(1, &color_attachment);
+	GLfloat clearColor[4] = {0, 0, 0, 0};
+	ctx.glClearBufferfv(GL_COLOR, 0, clearColor);
+	ctx.glDrawBuffers(0, NULL);
+#endif
+
+	// copy the old atlas into the top left of the new atlas.
+	ctx.glFramebufferTexture2D(
+		GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gl_atlas_tex_id, 0);
+	ctx.glReadBuffer(GL_COLOR_ATTACHMENT0);
+	ctx.glBindTexture(GL_TEXTURE_2D, new_tex_id);
+	ctx.glCopyTexSubImage2D(
+		GL_TEXTURE_2D,
+		0,
+		0,
+		0,
+		0,
+		0,
+		atlas_size, // NOLINT(bugprone-narrowing-conversions)
+		atlas_size); // NOLINT(bugprone-narrowing-conversions)
+
+	ctx.glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	ctx.glDeleteFramebuffers(1, &fbo);
+
+	// the new texture stays bound, because glyphs are being loaded.
+	SAFE_GL_DELETE_TEXTURE(gl_atlas_tex_id);
+	gl_atlas_tex_id = new_tex_id;
 
-	// allocate a new bucket because you can.
-	if((spans_allocated + span_size) * span_granularity <= atlas_size)
+	slogf(
+		"info: font atlas resized (%u -> %u, %.2fms)\n",
+		atlas_size,
+		new_size,
+		timer_delta_ms(t1, timer_now()));
+
+	atlas_size = new_size;
+	packer.grow(atlas_size);
+	++stats.resize_count;
+
+	return GL_RUNTIME(__func__) == GL_NO_ERROR;
+}
+
+bool font_atlas::evict_lru_glyphs(uint64_t area_in)
+{
+	// a staged glyph could be evicted and the slot reused before the upload.
+	if(!flush_uploads())
 	{
-		span_buckets.emplace_back(spans_allocated, span_size, 0);
-		spans_allocated += span_size;
+		return false;
+	}
 
-		*x_out = span_buckets.back().span_start * span_granularity;
-		*y_out = span_buckets.back().bucket_depth;
+	std::vector<font_glyph_entry*> glyphs;
+	for(font_atlas_listener* listener : listeners)
+	{
+		listener->get_atlas_glyphs(glyphs);
+	}
 
-		span_buckets.back().bucket_depth += h_in;
+	// anything used this frame could already be inside of a batch.
+	glyphs.erase(
+		std::remove_if(
+			glyphs.begin(),
+			glyphs.end(),
+			[this](const font_glyph_entry* glyph) { return glyph->last_used == current_frame; }),
+		glyphs.end());
 
-		return true;
+	if(glyphs.empty())
+	{
+		return false;
 	}
 
-	// canabalize a bigger bucket.
-	if(closest_bucket != NULL)
+	std::sort(
+		glyphs.begin(), glyphs.end(), [](const font_glyph_entry* lhs, const font_glyph_entry* rhs) {
+			return lhs->last_used < rhs->last_used;
+		});
+
+	// evict a big chunk so that this doesn't happen for every new glyph.
+	uint64_t target_area =
+		std::max<uint64_t>(area_in, static_cast<uint64_t>(atlas_size) * atlas_size / 8);
+
+	// everything older than the cutoff frame gets evicted.
+	uint32_t cutoff_frame = 0;
+	uint64_t evict_area = 0;
+	for(const font_glyph_entry* glyph : glyphs)
 	{
-		// integer trunc is desired.
-		if(closest_bucket->span_count / span_size == 0)
+		if(evict_area >= target_area && glyph->last_used >= cutoff_frame)
 		{
-			// don't split because more than half is used.
-			*x_out = closest_bucket->span_start * span_granularity;
-			*y_out = closest_bucket->bucket_depth;
-			closest_bucket->bucket_depth += h_in;
-			return true;
+			break;
 		}
+		evict_area += static_cast<uint64_t>(glyph->rect_w) * glyph->rect_h;
+		cutoff_frame = glyph->last_used + 1;
+	}
+	ASSERT(cutoff_frame <= current_frame);
 
-		// split
-		span_buckets.emplace_back(
-			closest_bucket->span_start + closest_bucket->span_count,
-			closest_bucket->span_count - span_size,
-			closest_bucket->bucket_depth);
-
-		*x_out = closest_bucket->span_start * span_granularity;
-		*y_out = closest_bucket->bucket_depth;
+	uint32_t evicted_before = stats.evicted_glyphs;
+	for(font_atlas_listener* listener : listeners)
+	{
+		listener->evict_atlas_glyphs(cutoff_frame);
+	}
 
-		// std::deque won't invalidate
-		closest_bucket->span_count = span_size;
-		closest_bucket->bucket_depth += h_in;
+	++stats.evict_count;
+	++evict_generation;
 
-		return true;
+	if(cv_font_atlas_eviction_warning.data != 0)
+	{
+		slogf(
+			"info: font atlas evicted glyphs (glyphs: %u, age: %u frames)\n",
+			stats.evicted_glyphs - evicted_before,
+			current_frame - cutoff_frame + 1);
 	}
-
-	serrf(
-		"%s: ran out of atlas space (free %u, size %u)\n",
-		__func__,
-		(atlas_size / span_granularity) - spans_allocated,
-		span_size);
-	return false;
+	return stats.evicted_glyphs != evicted_before;
 }
 
-bool hex_font_data::init(Unique_RWops file, font_atlas* atlas_)
+bool font_atlas::compact()
 {
-	ASSERT(file);
-	ASSERT(atlas_);
-	atlas = atlas_;
-	hex_font_file = std::move(file);
-	char internal_buffer[2048];
-	BS_ReadStream stream(hex_font_file.get(), internal_buffer, sizeof(internal_buffer));
+	if(!flush_uploads())
+	{
+		return false;
+	}
+
+	TIMER_U t1 = timer_now();
 
-	// scan the hex file to find the file position of all the blocks.
-	while(true)
+	std::vector<font_glyph_entry*> glyphs;
+	glyphs.push_back(&white_glyph);
+	for(font_atlas_listener* listener : listeners)
 	{
-		// NOLINTNEXTLINE(bugprone-narrowing-conversions)
-		RW_ssize_t stream_cursor = stream.Tell();
-		if(stream_cursor < 0)
+		listener->get_atlas_glyphs(glyphs);
+	}
+
+	// tallest first packs the best.
+	std::sort(
+		glyphs.begin(), glyphs.end(), [](const font_glyph_entry* lhs, const font_glyph_entry* rhs) {
+			if(lhs->rect_h != rhs->rect_h)
+			{
+				return lhs->rect_h > rhs->rect_h;
+			}
+			return lhs->rect_w > rhs->rect_w;
+		});
+
+	font_guillotine_packer new_packer;
+	new_packer.init(atlas_size);
+
+	std::vector<font_guillotine_packer::packer_rect> new_rects(glyphs.size());
+	for(size_t i = 0; i < glyphs.size(); ++i)
+	{
+		new_rects[i].w = glyphs[i]->rect_w;
+		new_rects[i].h = glyphs[i]->rect_h;
+		if(!new_packer.insert(new_rects[i].w, new_rects[i].h, &new_rects[i].x, &new_rects[i].y))
 		{
+			// this shouldn't be possible because the glyphs fit before.
+			serrf("%s: glyphs don't fit (%zu glyphs)\n", __func__, glyphs.size());
 			return false;
 		}
-		char32_t codepoint;
-		// get the character XXXX:...
-		{
-			// in hexadecimal, 8 characters = 4 bytes.
-			char codepoint_hex[9];
-			size_t i = 0;
-			for(; i < sizeof(codepoint_hex) - 1; ++i)
-			{
-				codepoint_hex[i] = stream.Take();
-				if(codepoint_hex[i] == '\0')
-				{
-					if(i == 0)
-					{
-						// this is linux inserting a newline at the end of the file
-						// even though the file doesn't end with a newline
-						return true;
-					}
-					serrf("%s: unexpected end or null\n", hex_font_file->name());
-					return false;
-				}
-				if(codepoint_hex[i] == ':')
-				{
-					break;
-				}
-			}
-			// terminator
-			codepoint_hex[i] = '\0';
+	}
+
+	GLuint new_tex_id = create_atlas_texture(atlas_size);
+	if(new_tex_id == 0)
+	{
+		return false;
+	}
+
+	unsigned int fbo;
+	ctx.glGenFramebuffers(1, &fbo);
+	if(fbo == 0)
+	{
+		serrf("%s error: glGenFramebuffers failed\n", __func__);
+		ctx.glDeleteTextures(1, &new_tex_id);
+		return false;
+	}
+	ctx.glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+#ifndef __EMSCRIPTEN__
+	// clear the new texture, the padding around the glyphs is copied but the gaps are not.
+	ctx.glFramebufferTexture2D(
+		GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, new_tex_id, 0);
+	GLenum color_attachment = GL_COLOR_ATTACHMENT0;
+	ctx.glDrawBuffers(1, &color_attachment);
+	GLfloat clearColor[4] = {0, 0, 0, 0};
+	ctx.glClearBufferfv(GL_COLOR, 0, clearColor);
+	ctx.glDrawBuffers(0, NULL);
+#endif
+
+	// copy every glyph from the old atlas into the new one.
+	// performance: this is one copy per glyph, but this should be rare.
+	ctx.glFramebufferTexture2D(
+		GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gl_atlas_tex_id, 0);
+	ctx.glReadBuffer(GL_COLOR_ATTACHMENT0);
+	ctx.glBindTexture(GL_TEXTURE_2D, new_tex_id);
+	for(size_t i = 0; i < glyphs.size(); ++i)
+	{
+		ctx.glCopyTexSubImage2D(
+			GL_TEXTURE_2D,
+			0,
+			new_rects[i].x, // NOLINT(bugprone-narrowing-conversions)
+			new_rects[i].y, // NOLINT(bugprone-narrowing-conversions)
+			glyphs[i]->rect_x,
+			glyphs[i]->rect_y,
+			glyphs[i]->rect_w,
+			glyphs[i]->rect_h);
+	}
+
+	ctx.glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	ctx.glDeleteFramebuffers(1, &fbo);
+
+	// the new texture stays bound, because glyphs are being loaded.
+	SAFE_GL_DELETE_TEXTURE(gl_atlas_tex_id);
+	gl_atlas_tex_id = new_tex_id;
+
+	for(size_t i = 0; i < glyphs.size(); ++i)
+	{
+		glyphs[i]->rect_x = new_rects[i].x;
+		glyphs[i]->rect_y = new_rects[i].y;
+	}
+	packer = std::move(new_packer);
+	update_white_uv();
+
+	++stats.compact_count;
+	// any glyph that was already drawn this frame will be wrong for a frame.
+	++evict_generation;
+
+	slogf(
+		"info: font atlas compacted (glyphs: %zu, occupancy: %.1f%%, %.2fms)\n",
+		glyphs.size(),
+		static_cast<double>(get_occupancy() * 100.f),
+		timer_delta_ms(t1, timer_now()));
+
+	return GL_RUNTIME(__func__) == GL_NO_ERROR;
+}
+
+bool font_atlas::find_atlas_slot(uint32_t w_in, uint32_t h_in, uint32_t* x_out, uint32_t* y_out)
+{
+	ASSERT(x_out != NULL);
+	ASSERT(y_out != NULL);
+	// NOTE: probably could flip the bitmaps and compare which wastes less space.
+	if(w_in == 0)
+	{
+		serrf("%s: width 0\n", __func__);
+		return false;
+	}
+	if(h_in == 0)
+	{
+		serrf("%s: height 0\n", __func__);
+		return false;
+	}
+	if(w_in > atlas_max_size)
+	{
+		serrf("%s: width (%u) > atlas (%u)\n", __func__, w_in, atlas_max_size);
+		return false;
+	}
+	if(h_in > atlas_max_size)
+	{
+		serrf("%s: height (%u) > atlas (%u)\n", __func__, h_in, atlas_max_size);
+		return false;
+	}
+
+	if(packer.insert(w_in, h_in, x_out, y_out))
+	{
+		return true;
+	}
+
+	while(atlas_size < atlas_max_size)
+	{
+		if(!grow_atlas())
+		{
+			return false;
+		}
+		if(packer.insert(w_in, h_in, x_out, y_out))
+		{
+			return true;
+		}
+	}
+
+	uint64_t area = static_cast<uint64_t>(w_in) * h_in;
+	if(evict_lru_glyphs(area) && packer.insert(w_in, h_in, x_out, y_out))
+	{
+		return true;
+	}
+
+	// the evicted slots are probably too fragmented.
+	if(packer.get_free_area() >= area)
+	{
+		if(!compact())
+		{
+			return false;
+		}
+		if(packer.insert(w_in, h_in, x_out, y_out))
+		{
+			return true;
+		}
+	}
+
+	serrf(
+		"%s: ran out of atlas space (free %" PRIu64 ", size %ux%u)\n",
+		__func__,
+		packer.get_free_area(),
+		w_in,
+		h_in);
+	return false;
+}
+
+void font_atlas::stage_glyph(
+	uint32_t slot_x,
+	uint32_t slot_y,
+	uint32_t slot_w,
+	uint32_t slot_h,
+	uint32_t offset,
+	const uint8_t* pixels,
+	uint32_t w,
+	uint32_t h,
+	uint32_t pitch)
+{
+	ASSERT(pixels != NULL);
+	ASSERT(offset + w <= slot_w && offset + h <= slot_h);
+	ASSERT(w <= pitch);
 
-			char* buffer_end;
+	size_t staging_offset = staging_pixels.size();
+	staging_pixels.resize(staging_offset + static_cast<size_t>(slot_w) * slot_h, 0);
+	uint8_t* dest = staging_pixels.data() + staging_offset;
+	for(uint32_t y = 0; y < h; ++y)
+	{
+		memcpy(dest + (y + offset) * slot_w + offset, pixels + static_cast<size_t>(y) * pitch, w);
+	}
+
+	staged_rects.push_back(staged_rect{slot_x, slot_y, slot_w, slot_h, staging_offset});
+}
 
-			pop_errno_t pop_errno;
-			// I am casting a long to int, but it shouldn't be possible to use more than 4 bytes.
-			codepoint = strtoul(codepoint_hex, &buffer_end, 16);
-			if(errno == ERANGE)
+bool font_atlas::flush_uploads()
+{
+	if(staged_rects.empty())
+	{
+		return true;
+	}
+
+	ZONE_SCOPE("font_atlas::flush_uploads");
+
+	// the packer puts glyphs with the same height next to each other,
+	// so sort them into rows, and any neighbors in the row become one upload.
+	std::sort(
+		staged_rects.begin(), staged_rects.end(), [](const staged_rect& lhs, const staged_rect& rhs) {
+			if(lhs.y != rhs.y)
 			{
-				serrf("%s: out of range\n", hex_font_file->name());
-				return false;
+				return lhs.y < rhs.y;
 			}
-
-			if(buffer_end != codepoint_hex + i || codepoint_hex == buffer_end)
+			if(lhs.h != rhs.h)
 			{
-				serrf("%s: failed to convert hex\n", hex_font_file->name());
-				return false;
+				return lhs.h < rhs.h;
 			}
+			return lhs.x < rhs.x;
+		});
+
+	// find the runs, and copy them into merge_pixels
+	std::vector<staged_rect> runs;
+	merge_pixels.clear();
+	for(size_t i = 0; i < staged_rects.size();)
+	{
+		const staged_rect& first = staged_rects[i];
+		size_t end = i + 1;
+		uint32_t run_w = first.w;
+		while(end < staged_rects.size() && staged_rects[end].y == first.y &&
+			  staged_rects[end].h == first.h && staged_rects[end].x == first.x + run_w)
+		{
+			run_w += staged_rects[end].w;
+			++end;
 		}
-		// get the bitmap XXXX:XXXXXXXXXXXXXXXX...
+
+		size_t run_offset = merge_pixels.size();
+		merge_pixels.resize(run_offset + static_cast<size_t>(run_w) * first.h);
+		uint8_t* dest = merge_pixels.data() + run_offset;
+		for(uint32_t y = 0; y < first.h; ++y)
 		{
-			if((codepoint / HEX_CHUNK_GLYPHS) >= hex_block_chunks.size())
+			for(size_t j = i; j < end; ++j)
 			{
-				// slogf("block: %zu, offset %ld\n", hex_block_chunks.size(), stream_cursor);
-				hex_block_chunks.resize(codepoint / HEX_CHUNK_GLYPHS + 1);
-				hex_block_chunks.back().offset = stream_cursor;
+				const staged_rect& rect = staged_rects[j];
+				memcpy(dest, staging_pixels.data() + rect.offset + y * rect.w, rect.w);
+				dest += rect.w;
 			}
+		}
+		runs.push_back(staged_rect{first.x, first.y, run_w, first.h, run_offset});
+		i = end;
+	}
 
-			// if the codepoint is using a block that is before the back() block.
-			if((codepoint / HEX_CHUNK_GLYPHS) + 1 < hex_block_chunks.size())
+	bool use_pbo = cv_font_atlas_pbo.data == 1;
+	if(use_pbo)
+	{
+		if(gl_upload_pbo == 0)
+		{
+			ctx.glGenBuffers(1, &gl_upload_pbo);
+			if(gl_upload_pbo == 0)
 			{
-				serrf("%s: hex unsorted %u\n", hex_font_file->name(), codepoint);
+				serrf("%s error: glGenBuffers failed\n", __func__);
 				return false;
 			}
+		}
+		ctx.glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gl_upload_pbo);
+		// a new buffer every time, so the driver doesn't need to wait for the last upload.
+		ctx.glBufferData(
+			GL_PIXEL_UNPACK_BUFFER, merge_pixels.size(), merge_pixels.data(), GL_STREAM_DRAW);
+	}
+
+	for(const staged_rect& run : runs)
+	{
+		// with a PBO the pointer is an offset into the buffer.
+		const uint8_t* source = use_pbo ? reinterpret_cast<const uint8_t*>(run.offset)
+										: merge_pixels.data() + run.offset;
+		ctx.glTexSubImage2D(
+			GL_TEXTURE_2D,
+			0,
+			run.x, // NOLINT(bugprone-narrowing-conversions)
+			run.y, // NOLINT(bugprone-narrowing-conversions)
+			run.w, // NOLINT(bugprone-narrowing-conversions)
+			run.h, // NOLINT(bugprone-narrowing-conversions)
+			GL_RED,
+			GL_UNSIGNED_BYTE,
+			source);
+	}
+
+	if(use_pbo)
+	{
+		ctx.glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+
+	frame_uploads.uploads += runs.size();
+	frame_uploads.glyphs += staged_rects.size();
+	frame_uploads.bytes += merge_pixels.size();
+	stats.upload_count += runs.size();
+	stats.upload_bytes += merge_pixels.size();
+
+	staged_rects.clear();
+	staging_pixels.clear();
 
-			size_t i = 0;
-			char c;
-			for(;; ++i)
+	return GL_RUNTIME(__func__) == GL_NO_ERROR;
+}
+
+float font_atlas::get_occupancy() const
+{
+	return static_cast<float>(
+		static_cast<double>(packer.used_area) /
+		(static_cast<double>(atlas_size) * static_cast<double>(atlas_size)));
+}
+
+bool font_atlas::read_pixels(uint32_t rows, std::vector<uint8_t>& pixels_out)
+{
+	ASSERT(rows <= atlas_size);
+
+	unsigned int fbo;
+	ctx.glGenFramebuffers(1, &fbo);
+	if(fbo == 0)
+	{
+		serrf("%s error: glGenFramebuffers failed\n", __func__);
+		return false;
+	}
+	ctx.glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	ctx.glFramebufferTexture2D(
+		GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gl_atlas_tex_id, 0);
+	ctx.glReadBuffer(GL_COLOR_ATTACHMENT0);
+
+	// GL_RED is not a format GLES must support for glReadPixels, but GL_RGBA is.
+	std::vector<uint8_t> rgba(static_cast<size_t>(atlas_size) * rows * 4);
+	ctx.glReadPixels(
+		0,
+		0,
+		atlas_size, // NOLINT(bugprone-narrowing-conversions)
+		rows, // NOLINT(bugprone-narrowing-conversions)
+		GL_RGBA,
+		GL_UNSIGNED_BYTE,
+		rgba.data());
+
+	ctx.glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	ctx.glDeleteFramebuffers(1, &fbo);
+
+	pixels_out.resize(static_cast<size_t>(atlas_size) * rows);
+	for(size_t i = 0; i < pixels_out.size(); ++i)
+	{
+		pixels_out[i] = rgba[i * 4];
+	}
+
+	return GL_CHECK(__func__) == GL_NO_ERROR;
+}
+
+bool font_atlas::restore(
+	uint32_t size,
+	const std::vector<uint8_t>& pixels,
+	font_guillotine_packer packer_in,
+	const font_glyph_entry& white_glyph_in)
+{
+	ASSERT(size <= atlas_max_size);
+	ASSERT(pixels.size() == static_cast<size_t>(size) * size);
+	ASSERT(packer_in.packer_size == size);
+
+	// the staged glyphs belong to glyphs that were evicted.
+	staged_rects.clear();
+	staging_pixels.clear();
+
+	GLuint new_tex_id = create_atlas_texture(size, pixels.data());
+	if(new_tex_id == 0)
+	{
+		return false;
+	}
+	SAFE_GL_DELETE_TEXTURE(gl_atlas_tex_id);
+	gl_atlas_tex_id = new_tex_id;
+	ctx.glBindTexture(GL_TEXTURE_2D, 0);
+
+	atlas_size = size;
+	packer = std::move(packer_in);
+	white_glyph = white_glyph_in;
+	update_white_uv();
+
+	++evict_generation;
+
+	return GL_CHECK(__func__) == GL_NO_ERROR;
+}
+
+bool hex_font_data::init(const char* hex_path, const char* cache_path, font_atlas* atlas_)
+{
+	ASSERT(hex_path != NULL);
+	ASSERT(atlas_);
+	atlas = atlas_;
+	atlas->add_listener(this);
+	hex_font_name = hex_path;
+
+	uint64_t source_size;
+	int64_t source_mtime;
+	if(!hex_binary_stat(hex_path, &source_size, &source_mtime))
+	{
+		return false;
+	}
+
+	bool cache_valid = false;
+	if(cache_path != NULL && hex_binary.open_file(cache_path))
+	{
+		if(hex_binary_validate(hex_binary, cache_path))
+		{
+			const hex_binary_header* header = hex_binary.header();
+			if(header->source_size == source_size && header->source_mtime == source_mtime)
 			{
-				if(i > HEX_FULL_WIDTH * HEX_HEIGHT / 8 * 2)
+				cache_valid = true;
+			}
+			else if(header->source_size == source_size)
+			{
+				// the file could have been copied or touched, the hash is slower but still
+				// faster than parsing.
+				uint64_t source_hash;
+				if(!hex_binary_hash_file(hex_path, &source_hash))
 				{
-					serrf("%s: line too long\n", hex_font_file->name());
 					return false;
 				}
-				c = stream.Take();
-
-				if(c == '\n' || c == '\0')
+				cache_valid = (header->source_hash == source_hash);
+				// so the next startup doesn't hash it again (not fatal if it fails).
+				if(cache_valid && hex_binary_update_mtime(cache_path, source_mtime))
 				{
-					break;
+					slogf("info: %s has a new mtime, but it didn't change\n", hex_path);
 				}
 			}
+		}
+		if(!cache_valid)
+		{
+			slogf("info: %s is out of date\n", cache_path);
+		}
+	}
 
-			if(i != (HEX_HALF_WIDTH * HEX_HEIGHT / 8) * 2 &&
-			   i != (HEX_FULL_WIDTH * HEX_HEIGHT / 8) * 2)
-			{
-				serrf("%s: bad size\n", hex_font_file->name());
-				return false;
-			}
-			if(c == '\0')
-			{
-				return true;
-			}
+	if(!cache_valid)
+	{
+		TIMER_U start = timer_now();
+		std::vector<uint8_t> binary;
+		if(!hex_binary_build(hex_path, source_size, source_mtime, binary))
+		{
+			return false;
+		}
+		TIMER_U end = timer_now();
+		slogf("info: parsed %s in %.2fms\n", hex_path, timer_delta_ms(start, end));
+		// if the cache can't be written, just use the memory.
+		if(cache_path != NULL && hex_binary_save(cache_path, binary))
+		{
+			slogf("info: wrote %s (%zukb)\n", cache_path, binary.size() / 1024);
 		}
+		hex_binary.use_memory(std::move(binary));
 	}
-	// return true;
+
+	const hex_binary_header* header = hex_binary.header();
+	const uint32_t* block_offsets = hex_binary.block_offsets();
+	hex_block_chunks.resize(header->block_count);
+	for(size_t i = 0; i < header->block_count; ++i)
+	{
+		hex_block_chunks[i].offset = block_offsets[i];
+	}
+
+	return true;
 }
 bool hex_font_data::destroy()
 {
-	bool success = true;
-	if(hex_font_file)
+	if(atlas != NULL)
 	{
-		if(!hex_font_file->close())
-		{
-			success = false;
-		}
-		hex_font_file.reset();
+		atlas->remove_listener(this);
+		atlas = NULL;
 	}
-	return success;
+	hex_block_chunks.clear();
+	hex_binary.close();
+	return true;
 }
 
 FONT_RESULT
@@ -829,7 +1291,7 @@ hex_font_data::get_glyph(
 	// TODO (dootsie): should print a warning if you use bold or italics? but spam...
 	bool outline = (style & FONT_STYLE_OUTLINE) != 0;
 
-	if(!hex_font_file)
+	if(hex_binary.data == NULL)
 	{
 		return FONT_RESULT::NOT_FOUND;
 	}
@@ -869,7 +1331,7 @@ hex_font_data::get_glyph(
 			current_chunk->glyphs.get(),
 			0,
 			sizeof(decltype(current_chunk->glyphs)::element_type) * HEX_CHUNK_GLYPHS);
-		switch(load_hex_block(block_index))
+		switch(load_hex_block(block_index, current_chunk->glyphs.get()))
 		{
 		case FONT_BASIC_RESULT::SUCCESS: break;
 		case FONT_BASIC_RESULT::NOT_FOUND: return FONT_RESULT::NOT_FOUND;
@@ -884,10 +1346,21 @@ hex_font_data::get_glyph(
 		//*glyph = (outline ? current.u.hex_glyph.outline : current.u.hex_glyph.normal);
 		font_glyph_entry* input =
 			(outline ? &current.u.hex_glyph.outline : &current.u.hex_glyph.normal);
+		atlas->touch_glyph(input);
 		convert_glyph_format(this, input, glyph, font_scale);
 		return FONT_RESULT::SUCCESS;
 	}
 
+	if(current.hex_evicted)
+	{
+		switch(reload_evicted_glyphs(block_index))
+		{
+		case FONT_BASIC_RESULT::SUCCESS: break;
+		case FONT_BASIC_RESULT::NOT_FOUND: return FONT_RESULT::NOT_FOUND;
+		case FONT_BASIC_RESULT::ERROR: return FONT_RESULT::ERROR;
+		}
+	}
+
 	if(!current.hex_found)
 	{
 		return FONT_RESULT::NOT_FOUND;
@@ -905,19 +1378,7 @@ hex_font_data::get_glyph(
 	}
 
 	uint8_t rgba_tex[HEX_HEIGHT * HEX_FULL_WIDTH];
-	uint8_t* img_cur = rgba_tex;
-
-	for(size_t j = 0, size = height * width / 8; j < size; ++j)
-	{
-		for(size_t bit = 0; bit < 8; ++bit)
-		{
-			uint8_t fill = ((current.u.hex_data[j] & (1 << (7 - bit))) == 0) ? 0 : 255;
-			*img_cur++ = fill;
-			//*img_cur++ = fill;
-			//*img_cur++ = fill;
-			//*img_cur++ = fill;
-		}
-	}
+	font_expand_1bpp(current.u.hex_data, width / 8, rgba_tex, width, width, height);
 
 	// apply a outline effect
 	size_t hex_w = (current.hex_full ? HEX_FULL_WIDTH : HEX_HALF_WIDTH);
@@ -965,49 +1426,58 @@ hex_font_data::get_glyph(
 
 	uint32_t x_out;
 	uint32_t y_out;
-	if(!atlas->find_atlas_slot(width + padding, height + padding, &x_out, &y_out))
-	{
-		return FONT_RESULT::ERROR;
-	}
-
 	uint32_t outline_x_out;
 	uint32_t outline_y_out;
 
-	if(!atlas->find_atlas_slot(
-		   width + padding + 2, height + padding + 2, &outline_x_out, &outline_y_out))
+	// compact() only keeps the glyphs in the atlas, so if finding the outline slot compacts,
+	// the normal slot is gone (another glyph could be moved into it), and both are found again.
+	// this only retries once, a second compaction means the atlas is basically full.
+	for(int attempt = 0;; ++attempt)
 	{
-		return FONT_RESULT::ERROR;
-	}
+		if(!atlas->find_atlas_slot(width + padding, height + padding, &x_out, &y_out))
+		{
+			return FONT_RESULT::ERROR;
+		}
+		uint32_t compact_count = atlas->stats.compact_count;
 
-	// ctx.glBindTexture(GL_TEXTURE_2D, gl_atlas_tex_id);
-	// note the outline requires GL_UNPACK_ALIGNMENT set to 1
-	ctx.glTexSubImage2D(
-		GL_TEXTURE_2D,
-		0,
-		x_out + offset, // NOLINT(bugprone-narrowing-conversions)
-		y_out + offset, // NOLINT(bugprone-narrowing-conversions)
-		width,
-		height,
-		GL_RED,
-		GL_UNSIGNED_BYTE,
-		rgba_tex);
+		bool found = atlas->find_atlas_slot(
+			width + padding + 2, height + padding + 2, &outline_x_out, &outline_y_out);
+		bool compacted = atlas->stats.compact_count != compact_count;
+		if(found && !compacted)
+		{
+			break;
+		}
+		if(!found)
+		{
+			if(!compacted)
+			{
+				// give back the normal slot.
+				atlas->packer.remove(x_out, y_out, width + padding, height + padding);
+			}
+			return FONT_RESULT::ERROR;
+		}
+		atlas->packer.remove(
+			outline_x_out, outline_y_out, width + padding + 2, height + padding + 2);
+		if(attempt != 0)
+		{
+			serrf("%s: the atlas was compacted while finding the glyph slots\n", __func__);
+			return FONT_RESULT::ERROR;
+		}
+	}
 
-	ctx.glTexSubImage2D(
-		GL_TEXTURE_2D,
-		0,
-		outline_x_out + offset, // NOLINT(bugprone-narrowing-conversions)
-		outline_y_out + offset, // NOLINT(bugprone-narrowing-conversions)
+	// uploaded with the next flush_uploads()
+	atlas->stage_glyph(
+		x_out, y_out, width + padding, height + padding, offset, rgba_tex, width, height, width);
+	atlas->stage_glyph(
+		outline_x_out,
+		outline_y_out,
+		width + padding + 2,
+		height + padding + 2,
+		offset,
+		outline_image_data,
 		width + 2,
 		height + 2,
-		GL_RED,
-		GL_UNSIGNED_BYTE,
-		outline_image_data);
-	// ctx.glBindTexture(GL_TEXTURE_2D, 0);
-
-	if(GL_RUNTIME(__func__) != GL_NO_ERROR)
-	{
-		return FONT_RESULT::ERROR;
-	}
+		width + 2);
 
 	current.u.hex_glyph.normal = font_glyph_entry(
 		FONT_ENTRY::GLYPH,
@@ -1034,6 +1504,7 @@ hex_font_data::get_glyph(
 	//*glyph = (outline ? current.u.hex_glyph.outline : current.u.hex_glyph.normal);
 	font_glyph_entry* input =
 		(outline ? &current.u.hex_glyph.outline : &current.u.hex_glyph.normal);
+	atlas->touch_glyph(input);
 	convert_glyph_format(this, input, glyph, font_scale);
 
 	current.hex_init = true;
@@ -1046,7 +1517,7 @@ FONT_BASIC_RESULT hex_font_data::get_advance(char32_t codepoint, float* advance,
 	ASSERT(atlas);
 	ASSERT(advance != NULL);
 
-	if(!hex_font_file)
+	if(hex_binary.data == NULL)
 	{
 		return FONT_BASIC_RESULT::NOT_FOUND;
 	}
@@ -1070,7 +1541,7 @@ FONT_BASIC_RESULT hex_font_data::get_advance(char32_t codepoint, float* advance,
 			current_chunk->glyphs.get(),
 			0,
 			sizeof(decltype(current_chunk->glyphs)::element_type) * HEX_CHUNK_GLYPHS);
-		FONT_BASIC_RESULT ret = load_hex_block(block_index);
+		FONT_BASIC_RESULT ret = load_hex_block(block_index, current_chunk->glyphs.get());
 		if(ret != FONT_BASIC_RESULT::SUCCESS)
 		{
 			return ret;
@@ -1101,189 +1572,117 @@ FONT_BASIC_RESULT hex_font_data::get_advance(char32_t codepoint, float* advance,
 	return FONT_BASIC_RESULT::SUCCESS;
 }
 
-FONT_BASIC_RESULT hex_font_data::load_hex_block(size_t block_index)
+FONT_BASIC_RESULT hex_font_data::load_hex_block(size_t block_index, hex_glyph_entry* glyphs_out)
 {
+	ASSERT(glyphs_out != NULL);
+	ASSERT(block_index < hex_block_chunks.size());
 	hex_block_chunk* chunk = &hex_block_chunks[block_index];
-	ASSERT(chunk);
-	ASSERT(chunk->offset != -2);
 
-	if(chunk->offset == -2)
+	// the offset is kept, because evicted glyphs need to be loaded again.
+	if(chunk->offset == 0)
 	{
-		// TODO(dootsie): would be better if the offset wasn't overridden...
-		serrf(
-			"%s: chunk already loaded (block: %zu, offset: %ld)\n",
-			hex_font_file->name(),
-			block_index,
-			chunk->offset);
+		return FONT_BASIC_RESULT::NOT_FOUND;
 	}
 
-	if(chunk->offset < 0)
+	// hex_binary_validate checked the bounds.
+	const hex_binary_block* block =
+		reinterpret_cast<const hex_binary_block*>(hex_binary.data + chunk->offset);
+
+	for(size_t i = 0; i < HEX_CHUNK_GLYPHS; ++i)
 	{
-		return FONT_BASIC_RESULT::NOT_FOUND;
+		uint8_t flags = block->flags[i];
+		if((flags & HEX_BINARY_FOUND) == 0)
+		{
+			continue;
+		}
+		hex_glyph_entry& current_entry = glyphs_out[i];
+		current_entry.hex_found = true;
+		current_entry.hex_full = (flags & HEX_BINARY_FULL) != 0;
+		memcpy(
+			current_entry.u.hex_data,
+			block->data[i],
+			current_entry.hex_full ? HEX_FULL_WIDTH * HEX_HEIGHT / 8
+								   : HEX_HALF_WIDTH * HEX_HEIGHT / 8);
 	}
+	return FONT_BASIC_RESULT::SUCCESS;
+}
+
+FONT_BASIC_RESULT hex_font_data::reload_evicted_glyphs(size_t block_index)
+{
+	hex_block_chunk* chunk = &hex_block_chunks[block_index];
+	ASSERT(chunk->glyphs);
 
-	auto temp_offset = chunk->offset;
-	chunk->offset = -2;
+	// the hex data was overwritten by the atlas location, so load the whole block again.
+	std::unique_ptr<hex_glyph_entry[]> temp_glyphs =
+		std::make_unique<hex_glyph_entry[]>(HEX_CHUNK_GLYPHS);
+	memset(temp_glyphs.get(), 0, sizeof(hex_glyph_entry) * HEX_CHUNK_GLYPHS);
 
-	if(hex_font_file->seek(temp_offset, RW_SEEK_SET) < 0)
+	FONT_BASIC_RESULT ret = load_hex_block(block_index, temp_glyphs.get());
+	if(ret != FONT_BASIC_RESULT::SUCCESS)
 	{
-		return FONT_BASIC_RESULT::ERROR;
+		return ret;
 	}
 
-	char internal_buffer[2048];
-	BS_ReadStream stream(hex_font_file.get(), internal_buffer, sizeof(internal_buffer));
-
-	while(true)
+	for(size_t i = 0; i < HEX_CHUNK_GLYPHS; ++i)
 	{
-		char32_t codepoint;
-		// in hexadecimal, 8 characters = 4 bytes.
-		char codepoint_hex[9];
-		// get the character XXXX:...
+		hex_glyph_entry& entry = chunk->glyphs[i];
+		if(entry.hex_evicted)
 		{
-			size_t i = 0;
-			for(; i < sizeof(codepoint_hex) - 1; ++i)
-			{
-				codepoint_hex[i] = stream.Take();
-				if(codepoint_hex[i] == '\0')
-				{
-					if(i == 0)
-					{
-						// this is linux inserting a newline at the end of the file
-						// even though the file doesn't end with a newline
-						return FONT_BASIC_RESULT::SUCCESS;
-					}
-					serrf(
-						"%s: unexpected end or null (block: %zu, offset: %ld)\n",
-						hex_font_file->name(),
-						block_index,
-						temp_offset);
-					return FONT_BASIC_RESULT::ERROR;
-				}
-				if(codepoint_hex[i] == ':')
-				{
-					break;
-				}
-			}
-			// terminator
-			codepoint_hex[i] = '\0';
-
-			char* buffer_end;
-
-			pop_errno_t pop_errno;
-			// I am casting a long to int, but it shouldn't be possible to use more than 4 bytes.
-			codepoint = strtoul(codepoint_hex, &buffer_end, 16);
-			if(errno == ERANGE)
-			{
-				serrf(
-					"%s: out of range (block: %zu, offset: %ld)\n",
-					hex_font_file->name(),
-					block_index,
-					temp_offset);
-				return FONT_BASIC_RESULT::ERROR;
-			}
+			ASSERT(!entry.hex_init);
+			memcpy(entry.u.hex_data, temp_glyphs[i].u.hex_data, sizeof(entry.u.hex_data));
+			entry.hex_evicted = false;
+		}
+	}
+	return FONT_BASIC_RESULT::SUCCESS;
+}
 
-			if(buffer_end != codepoint_hex + i || codepoint_hex == buffer_end)
-			{
-				serrf(
-					"%s: failed to convert hex (block: %zu, offset: %ld)\n",
-					hex_font_file->name(),
-					block_index,
-					temp_offset);
-				return FONT_BASIC_RESULT::ERROR;
-			}
+void hex_font_data::get_atlas_glyphs(std::vector<font_glyph_entry*>& glyphs_out)
+{
+	for(hex_block_chunk& chunk : hex_block_chunks)
+	{
+		if(!chunk.glyphs)
+		{
+			continue;
 		}
-		// get the bitmap XXXX:XXXXXXXXXXXXXXXX...
+		for(size_t i = 0; i < HEX_CHUNK_GLYPHS; ++i)
 		{
-			if(codepoint / HEX_CHUNK_GLYPHS == block_index + 1)
+			hex_glyph_entry& entry = chunk.glyphs[i];
+			if(entry.hex_init)
 			{
-				return FONT_BASIC_RESULT::SUCCESS;
+				glyphs_out.push_back(&entry.u.hex_glyph.normal);
+				glyphs_out.push_back(&entry.u.hex_glyph.outline);
 			}
-			if(codepoint / HEX_CHUNK_GLYPHS != block_index)
-			{
-				serrf(
-					"%s: hex out of range (cp: %u, block: %zu, offset: %ld)\n",
-					hex_font_file->name(),
-					codepoint,
-					block_index,
-					temp_offset);
-				return FONT_BASIC_RESULT::ERROR;
-			}
-
-			hex_glyph_entry& current_entry = chunk->glyphs[codepoint % HEX_CHUNK_GLYPHS];
-
-			size_t i = 0;
-			size_t size = 0;
-			char c;
-			unsigned char first_pair = '\0';
-			for(;; ++i)
-			{
-				if(i > HEX_FULL_WIDTH * HEX_HEIGHT / 8 * 2)
-				{
-					serrf(
-						"%s: line too long (block: %zu, offset: %ld)\n",
-						hex_font_file->name(),
-						block_index,
-						temp_offset);
-					return FONT_BASIC_RESULT::ERROR;
-				}
-				unsigned char temp;
-				c = stream.Take();
-
-				if(c == '\n' || c == '\0')
-				{
-					break;
-				}
-
-				if(c >= '0' && c <= '9')
-				{
-					temp = c - '0';
-				}
-				else if(c >= 'A' && c <= 'F')
-				{
-					temp = c - 'A' + 10;
-				}
-				else
-				{
-					serrf(
-						"%s: bad hex (block: %zu, offset: %ld)\n",
-						hex_font_file->name(),
-						block_index,
-						temp_offset);
-					return FONT_BASIC_RESULT::ERROR;
-				}
-				if((i % 2) == 0)
-				{
-					first_pair = temp;
-				}
-				else
-				{
-					current_entry.u.hex_data[size++] = (first_pair << 4) | temp;
-				}
-			}
-
-			if(size != HEX_HALF_WIDTH * HEX_HEIGHT / 8 && size != HEX_FULL_WIDTH * HEX_HEIGHT / 8)
-			{
-				serrf(
-					"%s: bad size (block: %zu, offset: %ld)\n",
-					hex_font_file->name(),
-					block_index,
-					temp_offset);
-				return FONT_BASIC_RESULT::ERROR;
-			}
-
-			current_entry.hex_found = true;
+		}
+	}
+}
 
-			if(size == HEX_FULL_WIDTH * HEX_HEIGHT / 8)
+void hex_font_data::evict_atlas_glyphs(uint32_t frame)
+{
+	for(hex_block_chunk& chunk : hex_block_chunks)
+	{
+		if(!chunk.glyphs)
+		{
+			continue;
+		}
+		for(size_t i = 0; i < HEX_CHUNK_GLYPHS; ++i)
+		{
+			hex_glyph_entry& entry = chunk.glyphs[i];
+			if(!entry.hex_init)
 			{
-				current_entry.hex_full = true;
+				continue;
 			}
-			if(c == '\0')
+			// the normal and outline are evicted together, because they share the hex_data.
+			if(entry.u.hex_glyph.normal.last_used < frame &&
+			   entry.u.hex_glyph.outline.last_used < frame)
 			{
-				return FONT_BASIC_RESULT::SUCCESS;
+				atlas->free_slot(entry.u.hex_glyph.normal);
+				atlas->free_slot(entry.u.hex_glyph.outline);
+				entry.hex_init = false;
+				entry.hex_evicted = true;
+				atlas->stats.evicted_glyphs += 2;
 			}
 		}
 	}
-	// return true;
 }
 
 void font_bitmap_cache::init(font_manager_state* font_manager, font_ttf_rasterizer* rasterizer)
@@ -1292,6 +1691,7 @@ void font_bitmap_cache::init(font_manager_state* font_manager, font_ttf_rasteriz
 	ASSERT(rasterizer != NULL);
 
 	atlas = &font_manager->atlas;
+	atlas->add_listener(this);
 	current_rasterizer = rasterizer;
 	fallback = &font_manager->hex_font;
 
@@ -1303,14 +1703,23 @@ void font_bitmap_cache::init(font_manager_state* font_manager, font_ttf_rasteriz
 		bitmap_scale = face_settings->point_size / static_cast<float>(bitmap_height);
 	}
 
-	FT_Bitmap_Init(&convert_bitmap);
+	FT_Bitmap_Init(&scratch.convert_bitmap);
 }
 
 bool font_bitmap_cache::destroy()
 {
+#ifndef __EMSCRIPTEN__
+	// the pool is owned by whoever set it.
+	raster_pool = NULL;
+#endif
+	if(atlas != NULL)
+	{
+		atlas->remove_listener(this);
+		atlas = NULL;
+	}
 	if(current_rasterizer != NULL)
 	{
-		FT_Error error = FT_Bitmap_Done(current_rasterizer->FTLibrary, &convert_bitmap);
+		FT_Error error = FT_Bitmap_Done(current_rasterizer->FTLibrary, &scratch.convert_bitmap);
 		if(error != 0)
 		{
 			TTF_SetFTError(current_rasterizer->font_file->name(), error);
@@ -1325,36 +1734,56 @@ bool font_bitmap_cache::destroy()
 
 font_bitmap_cache::~font_bitmap_cache()
 {
+	if(atlas != NULL)
+	{
+		atlas->remove_listener(this);
+		atlas = NULL;
+	}
 	if(current_rasterizer != NULL)
 	{
 		// the error is ignored
-		FT_Error error = FT_Bitmap_Done(current_rasterizer->FTLibrary, &convert_bitmap);
+		FT_Error error = FT_Bitmap_Done(current_rasterizer->FTLibrary, &scratch.convert_bitmap);
 		ASSERT(error == 0);
 		(void)error;
 		current_rasterizer = NULL;
 	}
 }
 
-FT_Bitmap* font_bitmap_cache::render_tf_glyph(
-	FT_UInt glyph_index, font_style_type style, unique_ft_glyph& ftglyph)
+FT_Bitmap* font_ttf_rasterizer::render_bitmap_glyph(
+	FT_UInt glyph_index,
+	font_style_type style,
+	unique_ft_glyph& ftglyph,
+	font_bitmap_scratch* scratch,
+	bool* sdf_out)
 {
+	ASSERT(face != NULL);
+	ASSERT(face_settings != NULL);
+	ASSERT(scratch != NULL);
+	ASSERT(sdf_out != NULL);
+
+	ZONE_SCOPE("font_ttf_rasterizer::render_bitmap_glyph");
+
+	*sdf_out = false;
+
+	FT_Bitmap* convert_bitmap = &scratch->convert_bitmap;
+
 	FT_Error error;
 
 	// load the outline or bitmap
 	if((error = FT_Load_Glyph(
-			current_rasterizer->face,
+			face,
 			glyph_index,
-			current_rasterizer->face_settings->load_flags)) != 0)
+			face_settings->load_flags)) != 0)
 	{
-		TTF_SetFTError(current_rasterizer->font_file->name(), error);
+		TTF_SetFTError(font_file->name(), error);
 		return NULL;
 	}
 	{
 		FT_Glyph tmp_ftglyph;
 		// You must call FT_Done_Glyph on this.
-		if((error = FT_Get_Glyph(current_rasterizer->face->glyph, &tmp_ftglyph)) != 0)
+		if((error = FT_Get_Glyph(face->glyph, &tmp_ftglyph)) != 0)
 		{
-			TTF_SetFTError(current_rasterizer->font_file->name(), error);
+			TTF_SetFTError(font_file->name(), error);
 			return NULL;
 		}
 		ftglyph.reset(tmp_ftglyph);
@@ -1364,7 +1793,7 @@ FT_Bitmap* font_bitmap_cache::render_tf_glyph(
 	if(ftglyph->format == FT_GLYPH_FORMAT_OUTLINE)
 	{
 		int temp_style = style;
-		if(current_rasterizer->face_settings->force_bitmap && use_outline)
+		if(face_settings->force_bitmap && use_outline)
 		{
 			// force the outline to not be rendered, so that I can make the outline use the bitmap
 			// routine.
@@ -1372,16 +1801,17 @@ FT_Bitmap* font_bitmap_cache::render_tf_glyph(
 		}
 		FT_Glyph tmp_ftglyph;
 		// You must call FT_Done_Glyph on this.
-		if(!current_rasterizer->render_glyph(&tmp_ftglyph, temp_style))
+		if(!render_glyph(&tmp_ftglyph, temp_style))
 		{
 			return NULL;
 		}
 		// this will destroy the original outline and move the bitmap into it
 		ftglyph.reset(tmp_ftglyph);
+		*sdf_out = is_sdf();
 	}
 	if(ftglyph->format != FT_GLYPH_FORMAT_BITMAP)
 	{
-		serrf("%s not a bitmap?\n", current_rasterizer->font_file->name());
+		serrf("%s not a bitmap?\n", font_file->name());
 		return NULL;
 	}
 
@@ -1398,17 +1828,42 @@ FT_Bitmap* font_bitmap_cache::render_tf_glyph(
 	}
 
 	bool use_bitmap_embold =
-		use_outline && (was_bitmap || current_rasterizer->face_settings->force_bitmap);
+		use_outline && (was_bitmap || face_settings->force_bitmap);
+
+	if(ftglyph_bitmap->bitmap.pixel_mode == FT_PIXEL_MODE_MONO && !use_bitmap_embold)
+	{
+		// FT_Bitmap_Convert would give me 0-1 one bit at a time, so expand it myself.
+		ASSERT(bitmap->pitch >= 0);
+		scratch->expand_pixels.resize(static_cast<size_t>(bitmap->width) * bitmap->rows);
+		font_expand_1bpp(
+			bitmap->buffer,
+			bitmap->pitch,
+			scratch->expand_pixels.data(),
+			bitmap->width,
+			bitmap->width,
+			bitmap->rows);
+
+		FT_Bitmap* expand_bitmap = &scratch->expand_bitmap;
+		FT_Bitmap_Init(expand_bitmap);
+		expand_bitmap->rows = bitmap->rows;
+		expand_bitmap->width = bitmap->width;
+		// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+		expand_bitmap->pitch = bitmap->width;
+		expand_bitmap->buffer = scratch->expand_pixels.data();
+		expand_bitmap->num_grays = 256;
+		expand_bitmap->pixel_mode = FT_PIXEL_MODE_GRAY;
+		return expand_bitmap;
+	}
 
 	if(ftglyph_bitmap->bitmap.pixel_mode != FT_PIXEL_MODE_GRAY || use_bitmap_embold)
 	{
 		if((error = FT_Bitmap_Convert(
-				current_rasterizer->FTLibrary, &ftglyph_bitmap->bitmap, &convert_bitmap, 1)) != 0)
+				FTLibrary, &ftglyph_bitmap->bitmap, convert_bitmap, 1)) != 0)
 		{
-			TTF_SetFTError(current_rasterizer->font_file->name(), error);
+			TTF_SetFTError(font_file->name(), error);
 			return NULL;
 		}
-		bitmap = &convert_bitmap;
+		bitmap = convert_bitmap;
 	}
 
 	// I could also try to implement bold as well here,
@@ -1417,26 +1872,26 @@ FT_Bitmap* font_bitmap_cache::render_tf_glyph(
 	{
 		// this returns an error for "space" characters
 		if((error = FT_Bitmap_Embolden(
-				current_rasterizer->FTLibrary,
-				&convert_bitmap,
-				static_cast<FT_Pos>(current_rasterizer->face_settings->outline_size * 64 * 2),
-				static_cast<FT_Pos>(current_rasterizer->face_settings->outline_size * 64 * 2))) !=
+				FTLibrary,
+				convert_bitmap,
+				static_cast<FT_Pos>(face_settings->outline_size * 64 * 2),
+				static_cast<FT_Pos>(face_settings->outline_size * 64 * 2))) !=
 		   0)
 		{
-			TTF_SetFTError(current_rasterizer->font_file->name(), error);
+			TTF_SetFTError(font_file->name(), error);
 			return NULL;
 		}
 		// I probably shouldn't do this, but it works!
 		ftglyph_bitmap->left -=
-			static_cast<FT_Int>(current_rasterizer->face_settings->outline_size);
-		ftglyph_bitmap->top += static_cast<FT_Int>(current_rasterizer->face_settings->outline_size);
+			static_cast<FT_Int>(face_settings->outline_size);
+		ftglyph_bitmap->top += static_cast<FT_Int>(face_settings->outline_size);
 	}
 
 	if(ftglyph_bitmap->bitmap.pixel_mode == FT_PIXEL_MODE_MONO)
 	{
-		// this will contain 0-1 instead of 0-255...
-		unsigned char* buffer = convert_bitmap.buffer;
-		size_t length = convert_bitmap.width * convert_bitmap.rows;
+		// the embolden needs a freetype bitmap, so this will contain 0-1 instead of 0-255...
+		unsigned char* buffer = convert_bitmap->buffer;
+		size_t length = convert_bitmap->width * convert_bitmap->rows;
 
 		for(size_t j = 0; j < length; ++j)
 		{
@@ -1447,6 +1902,46 @@ FT_Bitmap* font_bitmap_cache::render_tf_glyph(
 	return bitmap;
 }
 
+FT_Bitmap* font_bitmap_cache::render_tf_glyph(
+	FT_UInt glyph_index, font_style_type style, unique_ft_glyph& ftglyph, bool* sdf_out)
+{
+	return current_rasterizer->render_bitmap_glyph(
+		glyph_index, style, ftglyph, &scratch, sdf_out);
+}
+
+font_style_type font_bitmap_cache::get_raster_style(font_style_type style) const
+{
+	ASSERT(current_rasterizer != NULL);
+	if(current_rasterizer->is_sdf())
+	{
+		// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+		return style & FONT_STYLE_ITALICS;
+	}
+	return style;
+}
+
+float font_bitmap_cache::get_sdf_weight(font_style_type style) const
+{
+	ASSERT(current_rasterizer != NULL);
+	const font_ttf_face_settings* face_settings = current_rasterizer->face_settings;
+
+	// the distance in pixels to move the edge outwards.
+	float offset = 0;
+	if((style & FONT_STYLE_BOLD) != 0)
+	{
+		// FT_Outline_EmboldenXY grows both sides by half.
+		offset += std::max(face_settings->bold_x, face_settings->bold_y) / 2.f;
+	}
+	if((style & FONT_STYLE_OUTLINE) != 0)
+	{
+		offset += face_settings->outline_size;
+	}
+
+	// the texture holds 0.5 at the edge, and the spread is 0.5 away from it.
+	float spread = static_cast<float>(face_settings->sdf_spread);
+	return 1.f + std::min(offset, spread) * (0.5f / spread);
+}
+
 float font_bitmap_cache::get_ascent(float font_scale)
 {
 	FT_Face face = current_rasterizer->face;
@@ -1529,6 +2024,17 @@ font_bitmap_cache::get_advance(char32_t codepoint, float* advance, float font_sc
 		return FONT_BASIC_RESULT::NOT_FOUND;
 	}
 
+	// ASCII skips the block lookup.
+	if(codepoint < FONT_ASCII_GLYPHS && ascii_glyphs[FONT_STYLE_NORMAL] != NULL)
+	{
+		font_glyph_entry& glyph = ascii_glyphs[FONT_STYLE_NORMAL][codepoint];
+		if(glyph.type != FONT_ENTRY::UNDEFINED)
+		{
+			*advance = static_cast<float>(glyph.advance) * font_scale * bitmap_scale;
+			return FONT_BASIC_RESULT::SUCCESS;
+		}
+	}
+
 	size_t block_chunk = codepoint / FONT_CACHE_CHUNK_GLYPHS;
 	size_t block_index = codepoint % FONT_CACHE_CHUNK_GLYPHS;
 
@@ -1549,6 +2055,7 @@ font_bitmap_cache::get_advance(char32_t codepoint, float* advance, float font_sc
 		case FONT_ENTRY::UNDEFINED: break;
 		case FONT_ENTRY::GLYPH:
 		case FONT_ENTRY::SPACE:
+		case FONT_ENTRY::PENDING:
 			*advance = static_cast<float>(glyph.advance) * font_scale * bitmap_scale;
 			return FONT_BASIC_RESULT::SUCCESS;
 		}
@@ -1577,6 +2084,21 @@ font_bitmap_cache::get_advance(char32_t codepoint, float* advance, float font_sc
 		return fallback->get_advance(codepoint, advance, fallback_scale);
 	}
 
+	int font_advance;
+	if(!load_glyph_advance(glyph_index, &font_advance))
+	{
+		return FONT_BASIC_RESULT::ERROR;
+	}
+	*advance = static_cast<float>(font_advance) * font_scale * bitmap_scale;
+
+	return FONT_BASIC_RESULT::SUCCESS;
+}
+
+bool font_bitmap_cache::load_glyph_advance(FT_UInt glyph_index, int* advance_out)
+{
+	ASSERT(current_rasterizer != NULL);
+	ASSERT(advance_out != NULL);
+
 #if 0
     //getting the advance is sort of slow, but not that slow.
 	TIMER_U tick1;
@@ -1596,17 +2118,15 @@ font_bitmap_cache::get_advance(char32_t codepoint, float* advance, float font_sc
 	if((error = FT_Load_Glyph(current_rasterizer->face, glyph_index, ftflags)) != 0)
 	{
 		TTF_SetFTError(current_rasterizer->font_file->name(), error);
-		return FONT_BASIC_RESULT::ERROR;
+		return false;
 	}
 #if 0
 	tick2 = timer_now();
 	slogf("advance time = %f\n", timer_delta_ms(tick1, tick2));
 #endif
 
-	int font_advance = FT_FLOOR(current_rasterizer->face->glyph->advance.x);
-	*advance = static_cast<float>(font_advance) * font_scale * bitmap_scale;
-
-	return FONT_BASIC_RESULT::SUCCESS;
+	*advance_out = FT_FLOOR(current_rasterizer->face->glyph->advance.x);
+	return true;
 }
 
 FONT_RESULT font_bitmap_cache::get_glyph(
@@ -1631,6 +2151,19 @@ FONT_RESULT font_bitmap_cache::get_glyph(
 		return FONT_RESULT::NOT_FOUND;
 	}
 
+	font_style_type raster_style = get_raster_style(style);
+
+	// ASCII skips the block lookup.
+	if(codepoint < FONT_ASCII_GLYPHS && ascii_glyphs[raster_style] != NULL)
+	{
+		FONT_RESULT ret;
+		if(get_cached_glyph(
+			   &ascii_glyphs[raster_style][codepoint], style, glyph_out, font_scale, &ret))
+		{
+			return ret;
+		}
+	}
+
 	size_t block_chunk = codepoint / FONT_CACHE_CHUNK_GLYPHS;
 	size_t block_index = codepoint % FONT_CACHE_CHUNK_GLYPHS;
 
@@ -1643,18 +2176,13 @@ FONT_RESULT font_bitmap_cache::get_glyph(
 	font_cache_block& block = font_cache_blocks[block_chunk];
 
 	// fast path for cached glyphs.
-	if(block.glyphs[style])
+	if(block.glyphs[raster_style])
 	{
-		font_glyph_entry* glyph_in = &block.glyphs[style][block_index];
-		switch(glyph_in->type)
+		FONT_RESULT ret;
+		if(get_cached_glyph(
+			   &block.glyphs[raster_style][block_index], style, glyph_out, font_scale, &ret))
 		{
-		case FONT_ENTRY::UNDEFINED: break;
-		case FONT_ENTRY::GLYPH:
-			convert_glyph_format(this, glyph_in, glyph_out, font_scale * bitmap_scale);
-			return FONT_RESULT::SUCCESS;
-		case FONT_ENTRY::SPACE:
-			glyph_out->advance = static_cast<float>(glyph_in->advance) * font_scale * bitmap_scale;
-			return FONT_RESULT::SPACE;
+			return ret;
 		}
 	}
 
@@ -1690,13 +2218,58 @@ FONT_RESULT font_bitmap_cache::get_glyph(
 		return ret;
 	}
 
-	// this owns the FT_Bitmap memory (but sometimes it's convert_bitmap)
+	if(!block.glyphs[raster_style])
+	{
+		// allocate the style array
+		block.glyphs[raster_style] =
+			std::make_unique<font_glyph_entry[]>(FONT_CACHE_CHUNK_GLYPHS);
+		// zero initialize.
+		memset(
+			block.glyphs[raster_style].get(),
+			0,
+			sizeof(font_glyph_entry) * FONT_CACHE_CHUNK_GLYPHS);
+		if(block_chunk == 0)
+		{
+			ascii_glyphs[raster_style] = block.glyphs[raster_style].get();
+		}
+	}
+
+	// this slot should be undefined.
+	ASSERT(block.glyphs[raster_style][block_index].type == FONT_ENTRY::UNDEFINED);
+
+	font_glyph_entry* glyph_in = &block.glyphs[raster_style][block_index];
+	++glyph_misses;
+
+#ifndef __EMSCRIPTEN__
+	if(raster_pool != NULL)
+	{
+		// only the advance is needed to layout the placeholder,
+		// the glyph will be drawn once process_raster_results stores it.
+		int font_advance;
+		if(!load_glyph_advance(glyph_index, &font_advance))
+		{
+			serrf("%s error: U+%X\n", current_rasterizer->font_file->name(), codepoint);
+			block.bad_indexes.set(block_index);
+			return FONT_RESULT::ERROR;
+		}
+		glyph_in->type = FONT_ENTRY::PENDING;
+		// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+		glyph_in->advance = font_advance;
+		raster_pool->push(codepoint, glyph_index, raster_style);
+
+		glyph_out->advance = static_cast<float>(glyph_in->advance) * font_scale * bitmap_scale;
+		return FONT_RESULT::SPACE;
+	}
+#endif
+
+	// this owns the FT_Bitmap memory (but sometimes it's the scratch)
 	unique_ft_glyph ftglyph;
 
 	// TODO (dootsie): Maybe load normal and outline together
 	// because I can avoid rasterizing twice if I use a bitmap embolden.
 	// but it should only be a "hint" because I might not use the outline...
-	FT_Bitmap* bitmap = render_tf_glyph(glyph_index, style, ftglyph);
+	bool sdf;
+	FT_Bitmap* bitmap = render_tf_glyph(glyph_index, raster_style, ftglyph, &sdf);
 
 	/// load the glyph
 	if(bitmap == NULL)
@@ -1708,32 +2281,94 @@ FONT_RESULT font_bitmap_cache::get_glyph(
 		return FONT_RESULT::ERROR;
 	}
 
-	if(!block.glyphs[style])
+	// freetype bitmaps flow down, so the pitch should never be negative.
+	ASSERT(bitmap->pitch >= 0);
+	FT_BitmapGlyph ftglyph_bitmap = reinterpret_cast<FT_BitmapGlyph>(ftglyph.get());
+
+	FONT_RESULT ret = store_bitmap_glyph(
+		glyph_in,
+		codepoint,
+		bitmap->buffer,
+		bitmap->width,
+		bitmap->rows,
+		bitmap->pitch,
+		ftglyph_bitmap->left,
+		ftglyph_bitmap->top,
+		FT_FLOOR(current_rasterizer->face->glyph->advance.x),
+		sdf);
+	switch(ret)
 	{
-		// allocate the style array
-		block.glyphs[style] = std::make_unique<font_glyph_entry[]>(FONT_CACHE_CHUNK_GLYPHS);
-		// zero initialize.
-		memset(block.glyphs[style].get(), 0, sizeof(font_glyph_entry) * FONT_CACHE_CHUNK_GLYPHS);
+	case FONT_RESULT::SUCCESS:
+		convert_glyph_format(this, glyph_in, glyph_out, font_scale * bitmap_scale);
+		if(sdf)
+		{
+			glyph_out->sdf_weight = get_sdf_weight(style);
+		}
+		break;
+	case FONT_RESULT::SPACE:
+		glyph_out->advance = static_cast<float>(glyph_in->advance) * font_scale * bitmap_scale;
+		break;
+	default:
+		// next time just load the fallback
+		block.bad_indexes.set(block_index);
+		break;
 	}
 
-	// this slot should be undefined.
-	ASSERT(block.glyphs[style][block_index].type == FONT_ENTRY::UNDEFINED);
+	return ret;
+}
 
-	font_glyph_entry* glyph_in = &block.glyphs[style][block_index];
+bool font_bitmap_cache::get_cached_glyph(
+	font_glyph_entry* glyph_in,
+	font_style_type style,
+	font_style_result* glyph_out,
+	float font_scale,
+	FONT_RESULT* result_out)
+{
+	switch(glyph_in->type)
+	{
+	case FONT_ENTRY::UNDEFINED: return false;
+	case FONT_ENTRY::GLYPH:
+		atlas->touch_glyph(glyph_in);
+		convert_glyph_format(this, glyph_in, glyph_out, font_scale * bitmap_scale);
+		if(glyph_in->sdf != 0)
+		{
+			glyph_out->sdf_weight = get_sdf_weight(style);
+		}
+		*result_out = FONT_RESULT::SUCCESS;
+		return true;
+	case FONT_ENTRY::SPACE:
+	case FONT_ENTRY::PENDING:
+		glyph_out->advance = static_cast<float>(glyph_in->advance) * font_scale * bitmap_scale;
+		*result_out = FONT_RESULT::SPACE;
+		return true;
+	}
+	return false;
+}
 
-	int font_advance = FT_FLOOR(current_rasterizer->face->glyph->advance.x);
+FONT_RESULT font_bitmap_cache::store_bitmap_glyph(
+	font_glyph_entry* glyph_in,
+	char32_t codepoint,
+	const uint8_t* pixels,
+	uint32_t width,
+	uint32_t rows,
+	uint32_t pitch,
+	int left,
+	int top,
+	int advance,
+	bool sdf)
+{
+	ASSERT(atlas != NULL);
+	ASSERT(glyph_in != NULL);
+	ASSERT(glyph_in->type == FONT_ENTRY::UNDEFINED || glyph_in->type == FONT_ENTRY::PENDING);
 
 	// this is a space character.
-	if(bitmap->width == 0)
+	if(width == 0)
 	{
 		// use this to signal this is a space
 		glyph_in->type = FONT_ENTRY::SPACE;
 
 		// NOLINTNEXTLINE(bugprone-narrowing-conversions)
-		glyph_in->advance = font_advance;
-
-		// glyph_convert(glyph_in, glyph_out, font_scale);
-		glyph_out->advance = static_cast<float>(glyph_in->advance) * font_scale * bitmap_scale;
+		glyph_in->advance = advance;
 		return FONT_RESULT::SPACE;
 	}
 
@@ -1749,72 +2384,139 @@ FONT_RESULT font_bitmap_cache::get_glyph(
 
 	unsigned int x_out;
 	unsigned int y_out;
-	if(!atlas->find_atlas_slot(bitmap->pitch + padding, bitmap->rows + padding, &x_out, &y_out))
+	if(!atlas->find_atlas_slot(width + padding, rows + padding, &x_out, &y_out))
 	{
 		// I could use the fallback, but I want to only use it to show the glyph
 		// isn't found.
 		serrf("%s atlas out of space: U+%X\n", current_rasterizer->font_file->name(), codepoint);
-		// it->second[raster_mask] = font_manager.error_glyph;
-		//*glyph = it->second[raster_mask];
-		// next time just load the fallback
-		block.bad_indexes.set(block_index);
-		return FONT_RESULT::ERROR;
-	}
-#if 0
-    if(cv_has_EXT_disjoint_timer_query.data == 1)
-    {
-        static GLuint query = 0;
-        if(query == 0)
-        {
-            ctx.glGenQueriesEXT(1, &query);
-        }
-        ctx.glBeginQueryEXT(GL_TIME_ELAPSED_EXT,query);
-        TIMER_U t1 = timer_now();
-    }
-#endif
-	ctx.glTexSubImage2D(
-		GL_TEXTURE_2D,
-		0,
-		x_out + offset, // NOLINT(bugprone-narrowing-conversions)
-		y_out + offset, // NOLINT(bugprone-narrowing-conversions)
-		bitmap->pitch,
-		bitmap->rows, // NOLINT(bugprone-narrowing-conversions)
-		GL_RED,
-		GL_UNSIGNED_BYTE,
-		bitmap->buffer);
-#if 0
-    if(cv_has_EXT_disjoint_timer_query.data == 1)
-    {
-        TIMER_U t2 = timer_now();
-        ctx.glEndQueryEXT(GL_TIME_ELAPSED_EXT);
-
-        GLuint64 elapsed_time;
-        ctx.glGetQueryObjectui64vEXT(query, GL_QUERY_RESULT, &elapsed_time);
-        slogf("glTexSubImage2D time: %f, wait: %f\n", elapsed_time / 1000000.0, timer_delta_ms(t1, t2));
-    }
-#endif
-	if(GL_RUNTIME(__func__) != GL_NO_ERROR)
-	{
 		return FONT_RESULT::ERROR;
 	}
+	// uploaded with the next flush_uploads()
+	atlas->stage_glyph(
+		x_out, y_out, width + padding, rows + padding, offset, pixels, width, rows, pitch);
 
 	glyph_in->rect_x = x_out;
 	glyph_in->rect_y = y_out;
-	glyph_in->rect_w = bitmap->width + padding;
-	glyph_in->rect_h = bitmap->rows + padding;
+	glyph_in->rect_w = width + padding;
+	glyph_in->rect_h = rows + padding;
 	// NOLINTNEXTLINE(bugprone-narrowing-conversions)
-	glyph_in->advance = font_advance;
-	FT_BitmapGlyph ftglyph_bitmap = reinterpret_cast<FT_BitmapGlyph>(ftglyph.get());
+	glyph_in->advance = advance;
 	// NOLINTNEXTLINE(bugprone-narrowing-conversions)
-	glyph_in->xmin = (ftglyph_bitmap->left) - offset;
+	glyph_in->xmin = left - offset;
 	// NOLINTNEXTLINE(bugprone-narrowing-conversions)
-	glyph_in->ymin = (ftglyph_bitmap->top) + offset;
+	glyph_in->ymin = top + offset;
 	glyph_in->type = FONT_ENTRY::GLYPH;
-	convert_glyph_format(this, glyph_in, glyph_out, font_scale * bitmap_scale);
+	glyph_in->sdf = sdf ? 1 : 0;
+	atlas->touch_glyph(glyph_in);
 
 	return FONT_RESULT::SUCCESS;
 }
 
+#ifndef __EMSCRIPTEN__
+void font_bitmap_cache::process_raster_results()
+{
+	ASSERT(atlas != NULL);
+
+	if(raster_pool == NULL)
+	{
+		return;
+	}
+
+	std::vector<font_raster_pool::raster_result>& results = raster_pool->pop_results();
+	if(results.empty())
+	{
+		return;
+	}
+
+	ZONE_SCOPE("font_bitmap_cache::process_raster_results");
+
+	for(font_raster_pool::raster_result& result : results)
+	{
+		size_t block_chunk = result.codepoint / FONT_CACHE_CHUNK_GLYPHS;
+		size_t block_index = result.codepoint % FONT_CACHE_CHUNK_GLYPHS;
+
+		// get_glyph made the PENDING entry, so the block must exist.
+		ASSERT(block_chunk < font_cache_blocks.size());
+		font_cache_block& block = font_cache_blocks[block_chunk];
+		ASSERT(block.glyphs[result.style]);
+		font_glyph_entry* glyph_in = &block.glyphs[result.style][block_index];
+		ASSERT(glyph_in->type == FONT_ENTRY::PENDING);
+
+		FONT_RESULT ret = FONT_RESULT::ERROR;
+		if(result.success)
+		{
+			ret = store_bitmap_glyph(
+				glyph_in,
+				result.codepoint,
+				result.pixels.data(),
+				result.width,
+				result.rows,
+				result.width,
+				result.left,
+				result.top,
+				result.advance,
+				result.sdf);
+		}
+		if(ret == FONT_RESULT::ERROR)
+		{
+			// the error was already printed, next time just load the fallback
+			block.bad_indexes.set(block_index);
+			// FONT_ENTRY::UNDEFINED
+			memset(glyph_in, 0, sizeof(*glyph_in));
+		}
+	}
+
+	// the placeholders were drawn as spaces, so anything that holds vertices needs to redraw.
+	++atlas->evict_generation;
+}
+#endif
+
+void font_bitmap_cache::get_atlas_glyphs(std::vector<font_glyph_entry*>& glyphs_out)
+{
+	for(font_cache_block& block : font_cache_blocks)
+	{
+		for(std::unique_ptr<font_glyph_entry[]>& style_glyphs : block.glyphs)
+		{
+			if(!style_glyphs)
+			{
+				continue;
+			}
+			for(size_t i = 0; i < FONT_CACHE_CHUNK_GLYPHS; ++i)
+			{
+				if(style_glyphs[i].type == FONT_ENTRY::GLYPH)
+				{
+					glyphs_out.push_back(&style_glyphs[i]);
+				}
+			}
+		}
+	}
+}
+
+void font_bitmap_cache::evict_atlas_glyphs(uint32_t frame)
+{
+	for(font_cache_block& block : font_cache_blocks)
+	{
+		for(std::unique_ptr<font_glyph_entry[]>& style_glyphs : block.glyphs)
+		{
+			if(!style_glyphs)
+			{
+				continue;
+			}
+			for(size_t i = 0; i < FONT_CACHE_CHUNK_GLYPHS; ++i)
+			{
+				font_glyph_entry& entry = style_glyphs[i];
+				if(entry.type == FONT_ENTRY::GLYPH && entry.last_used < frame)
+				{
+					atlas->free_slot(entry);
+					// FONT_ENTRY::UNDEFINED will load the glyph again.
+					memset(&entry, 0, sizeof(entry));
+					++atlas->stats.evicted_glyphs;
+				}
+			}
+		}
+	}
+}
+
 FONT_BASIC_RESULT
 internal_font_painter_state::load_glyph_verts(
 	char32_t codepoint, std::array<uint8_t, 4> color, font_style_type style, float font_scale)
@@ -1835,7 +2537,7 @@ internal_font_painter_state::load_glyph_verts(
 			draw_y_pos + glyph.glyph_ymin,
 			draw_x_pos + glyph.glyph_xmax,
 			draw_y_pos + glyph.glyph_ymax};
-		batcher->draw_rect(pos, uv, color);
+		batcher->draw_rect(pos, uv, color, glyph.sdf_weight);
 		draw_x_pos += glyph.advance;
 		return FONT_BASIC_RESULT::SUCCESS;
 	}
@@ -1847,6 +2549,79 @@ internal_font_painter_state::load_glyph_verts(
 	return FONT_BASIC_RESULT::SUCCESS;
 }
 
+uint64_t font_layout_cache::get_key(
+	const char* text,
+	size_t size,
+	font_style_type style,
+	TEXT_FLAGS flags,
+	TEXT_ANCHOR anchor,
+	float scale)
+{
+	// it's just FNV-1a
+	uint64_t hash = hex_binary_hash(text, size);
+	hash = hex_binary_hash(&style, sizeof(style), hash);
+	hash = hex_binary_hash(&flags, sizeof(flags), hash);
+	hash = hex_binary_hash(&anchor, sizeof(anchor), hash);
+	hash = hex_binary_hash(&scale, sizeof(scale), hash);
+	return hash;
+}
+
+const font_layout_cache::layout_entry* font_layout_cache::find(
+	uint64_t key,
+	const char* text,
+	size_t size,
+	font_style_type style,
+	TEXT_FLAGS flags,
+	TEXT_ANCHOR anchor,
+	float scale,
+	uint32_t generation)
+{
+	auto it = entries.find(key);
+	if(it == entries.end())
+	{
+		return NULL;
+	}
+	layout_entry& entry = it->second;
+	// check for collisions.
+	if(entry.generation != generation || entry.style != style || entry.flags != flags ||
+	   entry.anchor != anchor || entry.scale != scale || entry.text.size() != size ||
+	   memcmp(entry.text.data(), text, size) != 0)
+	{
+		return NULL;
+	}
+	entry.used = true;
+	return &entry;
+}
+
+font_layout_cache::layout_entry& font_layout_cache::insert(
+	uint64_t key, const char* text, size_t size)
+{
+	if(entries.size() >= MAX_ENTRIES && entries.find(key) == entries.end())
+	{
+		for(auto it = entries.begin(); it != entries.end();)
+		{
+			if(!it->second.used)
+			{
+				it = entries.erase(it);
+			}
+			else
+			{
+				it->second.used = false;
+				++it;
+			}
+		}
+		// everything was used, so the working set is too big for the cache.
+		if(entries.size() >= MAX_ENTRIES)
+		{
+			entries.clear();
+		}
+	}
+	layout_entry& entry = entries[key];
+	entry.text.assign(text, size);
+	entry.used = true;
+	return entry;
+}
+
 float font_sprite_painter::get_scale() const
 {
 	return raw_font_scale * static_cast<float>(cv_ui_scale.data);
@@ -1859,8 +2634,8 @@ void font_sprite_painter::set_scale(float font_scale)
 
 void font_sprite_painter::begin()
 {
-	newline_cursor = state.batcher->get_current_vertex_count();
-	flush_cursor = state.batcher->get_current_vertex_count();
+	newline_cursor = state.batcher->get_quad_count();
+	flush_cursor = state.batcher->get_quad_count();
 }
 
 void font_sprite_painter::end()
@@ -1955,52 +2730,48 @@ bool font_sprite_painter::measure_text_bounds(
 	float current_line_width = 0;
 	float line_count = 1;
 
+	char32_t codepoints[256];
+
 	while(str_cur != str_end)
 	{
-		uint32_t codepoint;
-		utf8::internal::utf_error err_code =
-			utf8::internal::validate_next(str_cur, str_end, codepoint);
-		if(err_code != utf8::internal::UTF8_OK)
-		{
-			// this will render some invalid glyph,
-			// unifont makes it very descriptive.
-			codepoint = static_cast<unsigned char>(*str_cur++);
-		}
-#if 0
-		if(err_code != utf8::internal::UTF8_OK)
-		{
-			serrf("%s bad utf8: %s\n", __func__, cpputf_get_error(err_code));
-			return false;
-		}
-#endif
+		// bad utf8 will render some invalid glyph,
+		// unifont makes it very descriptive.
+		cpputf_decode_result decoded =
+			cpputf_decode(str_cur, str_end - str_cur, codepoints, std::size(codepoints), true);
+		str_cur += decoded.read;
 
-		if((current_flags & TEXT_FLAGS::NEWLINE) != 0 && codepoint == '\n')
+		for(size_t i = 0; i < decoded.written; ++i)
 		{
-			max_width = std::max(current_line_width, max_width);
-			current_line_width = 0;
-			line_count += 1;
-		}
-		else if((current_flags & TEXT_FLAGS::NEWLINE) != 0 && codepoint == '\r')
-		{
-			// assume that this is a carriage return (common on windows files),
-			// but I should check if the next character is a newline...
-		}
-		else
-		{
-			float advance = 0;
-			switch(state.font->get_advance(codepoint, &advance, get_scale()))
+			char32_t codepoint = codepoints[i];
+
+			if((current_flags & TEXT_FLAGS::NEWLINE) != 0 && codepoint == '\n')
+			{
+				max_width = std::max(current_line_width, max_width);
+				current_line_width = 0;
+				line_count += 1;
+			}
+			else if((current_flags & TEXT_FLAGS::NEWLINE) != 0 && codepoint == '\r')
 			{
-			case FONT_BASIC_RESULT::NOT_FOUND:
-				// serrf("%s glyph not found: U+%X\n", __func__, codepoint);
+				// assume that this is a carriage return (common on windows files),
+				// but I should check if the next character is a newline...
+			}
+			else
+			{
+				float advance = 0;
+				switch(state.font->get_advance(codepoint, &advance, get_scale()))
 				{
-					// TODO(dootsie): this is copy pasted between the prompt and painter
-					float padding = 1.f * (16.f / state.font->get_point_size());
-					float width = (state.font->get_point_size() / 2.f);
-					current_line_width += std::ceil(width + padding * 2.f) * get_scale();
-					break;
+				case FONT_BASIC_RESULT::NOT_FOUND:
+					// serrf("%s glyph not found: U+%X\n", __func__, codepoint);
+					{
+						// TODO(dootsie): this is copy pasted between the prompt and painter
+						float padding = 1.f * (16.f / state.font->get_point_size());
+						float width = (state.font->get_point_size() / 2.f);
+						current_line_width += std::ceil(width + padding * 2.f) * get_scale();
+						break;
+					}
+				case FONT_BASIC_RESULT::ERROR: return false;
+				case FONT_BASIC_RESULT::SUCCESS: current_line_width += advance; break;
 				}
-			case FONT_BASIC_RESULT::ERROR: return false;
-			case FONT_BASIC_RESULT::SUCCESS: current_line_width += advance; break;
 			}
 		}
 	}
@@ -2023,60 +2794,136 @@ bool font_sprite_painter::draw_text(const char* text, size_t size)
 	ASSERT(state.font != NULL);
 	size = (size == 0) ? strlen(text) : size;
 
+	// the cache only works at the start of a line,
+	// otherwise the newline alignment would move the vertices before this text.
+	if(cv_font_layout_cache.data == 0 || size > font_layout_cache::MAX_TEXT_SIZE ||
+	   state.draw_x_pos != anchor_x ||
+	   newline_cursor != state.batcher->get_quad_count())
+	{
+		return internal_draw_text(text, size);
+	}
+
+	font_atlas* atlas = state.font->get_font_atlas();
+	uint32_t generation = atlas->evict_generation;
+	float scale = get_scale();
+	uint64_t key = font_layout_cache::get_key(
+		text, size, current_style, current_flags, current_anchor, scale);
+
+	float start_x = state.draw_x_pos;
+	float start_y = state.draw_y_pos;
+
+	const font_layout_cache::layout_entry* entry = layout_cache.find(
+		key, text, size, current_style, current_flags, current_anchor, scale, generation);
+	if(entry != NULL)
+	{
+		++layout_cache.stats.hits;
+		for(font_glyph_entry* glyph : entry->glyphs)
+		{
+			atlas->touch_glyph(glyph);
+		}
+		state.batcher->draw_quads(
+			entry->quads.data(), entry->quads.size(), start_x,
+			start_y,
+			cur_color);
+		newline_cursor += entry->newline_offset;
+		state.draw_x_pos = start_x + entry->end_x;
+		state.draw_y_pos = start_y + entry->end_y;
+		return true;
+	}
+	++layout_cache.stats.misses;
+
+	size_t start_quad = state.batcher->get_quad_count();
+	size_t start_dropped = state.batcher->stats.dropped_quads;
+	layout_cache.record_glyphs.clear();
+	atlas->touch_record = &layout_cache.record_glyphs;
+	bool success = internal_draw_text(text, size);
+	atlas->touch_record = NULL;
+	if(!success)
+	{
+		return false;
+	}
+
+	// if the batcher hit max_size, some quads were dropped.
+	if(state.batcher->stats.dropped_quads != start_dropped)
+	{
+		return true;
+	}
+
+	font_layout_cache::layout_entry& new_entry = layout_cache.insert(key, text, size);
+	new_entry.style = current_style;
+	new_entry.flags = current_flags;
+	new_entry.anchor = current_anchor;
+	new_entry.scale = scale;
+	// if glyphs were evicted while drawing, the entry will be stale the next time.
+	new_entry.generation = generation;
+	new_entry.end_x = state.draw_x_pos - start_x;
+	new_entry.end_y = state.draw_y_pos - start_y;
+	new_entry.newline_offset = newline_cursor - start_quad;
+	size_t end_quad = state.batcher->get_quad_count();
+	new_entry.quads.assign(state.batcher->buffer + start_quad, state.batcher->buffer + end_quad);
+	gl_translate_mono_quads(new_entry.quads.data(), new_entry.quads.size(), -start_x, -start_y);
+	std::vector<font_glyph_entry*>& glyphs = layout_cache.record_glyphs;
+	std::sort(glyphs.begin(), glyphs.end());
+	glyphs.erase(std::unique(glyphs.begin(), glyphs.end()), glyphs.end());
+	new_entry.glyphs.assign(glyphs.begin(), glyphs.end());
+
+	return true;
+}
+
+bool font_sprite_painter::internal_draw_text(const char* text, size_t size)
+{
+	ASSERT(state.font != NULL);
+
 	const char* str_cur = text;
 	const char* str_end = text + size;
 
+	char32_t codepoints[256];
+
 	while(str_cur != str_end)
 	{
-		uint32_t codepoint;
-		utf8::internal::utf_error err_code =
-			utf8::internal::validate_next(str_cur, str_end, codepoint);
-		if(err_code != utf8::internal::UTF8_OK)
-		{
-			// this will render some invalid glyph,
-			// unifont makes it very descriptive.
-			codepoint = static_cast<unsigned char>(*str_cur++);
-		}
-#if 0
-		if(err_code != utf8::internal::UTF8_OK)
-		{
-			serrf("%s bad utf8: %s\n", __func__, cpputf_get_error(err_code));
-			return false;
-		}
-#endif
+		// bad utf8 will render some invalid glyph,
+		// unifont makes it very descriptive.
+		cpputf_decode_result decoded =
+			cpputf_decode(str_cur, str_end - str_cur, codepoints, std::size(codepoints), true);
+		str_cur += decoded.read;
 
-		if((current_flags & TEXT_FLAGS::NEWLINE) != 0 && codepoint == '\n')
-		{
-			newline();
-		}
-		else if((current_flags & TEXT_FLAGS::NEWLINE) != 0 && codepoint == '\r')
-		{
-			// assume that this is a carriage return (common on windows files),
-			// but I should check if the next character is a newline...
-		}
-		else
+		for(size_t i = 0; i < decoded.written; ++i)
 		{
-			switch(state.load_glyph_verts(codepoint, cur_color, current_style, get_scale()))
+			char32_t codepoint = codepoints[i];
+
+			if((current_flags & TEXT_FLAGS::NEWLINE) != 0 && codepoint == '\n')
+			{
+				newline();
+			}
+			else if((current_flags & TEXT_FLAGS::NEWLINE) != 0 && codepoint == '\r')
+			{
+				// assume that this is a carriage return (common on windows files),
+				// but I should check if the next character is a newline...
+			}
+			else
 			{
-			case FONT_BASIC_RESULT::NOT_FOUND:
-				// serrf("%s glyph not found: U+%X\n", __func__, codepoint);
-				// TODO(dootsie): this is copy pasted between the prompt and painter
+				switch(state.load_glyph_verts(codepoint, cur_color, current_style, get_scale()))
 				{
-					float padding = 1.f * (16.f / state.font->get_point_size());
-					float width = (state.font->get_point_size() / 2.f);
-					float height = state.font->get_point_size() * get_scale();
-					std::array<float, 4> pos{
-						state.draw_x_pos + (padding)*get_scale(),
-						state.draw_y_pos,
-						state.draw_x_pos + (padding + width) * get_scale(),
-						state.draw_y_pos + height};
-					state.batcher->draw_rect(
-						pos, state.font->get_font_atlas()->white_uv, cur_color);
-					state.draw_x_pos += std::ceil(width + padding * 2.f) * get_scale();
+				case FONT_BASIC_RESULT::NOT_FOUND:
+					// serrf("%s glyph not found: U+%X\n", __func__, codepoint);
+					// TODO(dootsie): this is copy pasted between the prompt and painter
+					{
+						float padding = 1.f * (16.f / state.font->get_point_size());
+						float width = (state.font->get_point_size() / 2.f);
+						float height = state.font->get_point_size() * get_scale();
+						std::array<float, 4> pos{
+							state.draw_x_pos + (padding)*get_scale(),
+							state.draw_y_pos,
+							state.draw_x_pos + (padding + width) * get_scale(),
+							state.draw_y_pos + height};
+						state.batcher->draw_rect(
+							pos, state.font->get_font_atlas()->white_uv, cur_color);
+						state.draw_x_pos += std::ceil(width + padding * 2.f) * get_scale();
+					}
+					break;
+				case FONT_BASIC_RESULT::ERROR: return false;
+				case FONT_BASIC_RESULT::SUCCESS: break;
 				}
-				break;
-			case FONT_BASIC_RESULT::ERROR: return false;
-			case FONT_BASIC_RESULT::SUCCESS: break;
 			}
 		}
 	}
@@ -2089,7 +2936,7 @@ void font_sprite_painter::internal_flush()
 	// finish the x axis alignment of any leftover newline
 	newline();
 
-	size_t size = state.batcher->get_current_vertex_count();
+	size_t size = state.batcher->get_quad_count();
 
 	switch(current_anchor)
 	{
@@ -2098,61 +2945,43 @@ void font_sprite_painter::internal_flush()
 	case TEXT_ANCHOR::TOP_RIGHT: break;
 	case TEXT_ANCHOR::BOTTOM_LEFT: {
 		float off_h = state.draw_y_pos - anchor_y;
-		for(; flush_cursor < size; ++flush_cursor)
-		{
-			state.batcher->buffer[flush_cursor].pos[1] -= off_h;
-		}
+		state.batcher->translate_quads(flush_cursor, size, 0, -off_h);
 	}
 	break;
 	case TEXT_ANCHOR::BOTTOM_RIGHT: {
 		float off_h = state.draw_y_pos - anchor_y;
-		for(; flush_cursor < size; ++flush_cursor)
-		{
-			state.batcher->buffer[flush_cursor].pos[1] -= off_h;
-		}
+		state.batcher->translate_quads(flush_cursor, size, 0, -off_h);
 	}
 	break;
 	case TEXT_ANCHOR::CENTER_PERFECT: {
 		float off_h = std::floor((state.draw_y_pos - anchor_y) / 2);
-		for(; flush_cursor < size; ++flush_cursor)
-		{
-			state.batcher->buffer[flush_cursor].pos[1] -= off_h;
-		}
+		state.batcher->translate_quads(flush_cursor, size, 0, -off_h);
 	}
 	break;
 	case TEXT_ANCHOR::CENTER_TOP: break;
 	case TEXT_ANCHOR::CENTER_BOTTOM: {
 		float off_h = state.draw_y_pos - anchor_y;
-		for(; flush_cursor < size; ++flush_cursor)
-		{
-			state.batcher->buffer[flush_cursor].pos[1] -= off_h;
-		}
+		state.batcher->translate_quads(flush_cursor, size, 0, -off_h);
 	}
 	break;
 	case TEXT_ANCHOR::CENTER_LEFT: {
 		float off_h = std::floor((state.draw_y_pos - anchor_y) / 2);
-		for(; flush_cursor < size; ++flush_cursor)
-		{
-			state.batcher->buffer[flush_cursor].pos[1] -= off_h;
-		}
+		state.batcher->translate_quads(flush_cursor, size, 0, -off_h);
 	}
 	break;
 	case TEXT_ANCHOR::CENTER_RIGHT: {
 		float off_h = std::floor((state.draw_y_pos - anchor_y) / 2);
-		for(; flush_cursor < size; ++flush_cursor)
-		{
-			state.batcher->buffer[flush_cursor].pos[1] -= off_h;
-		}
+		state.batcher->translate_quads(flush_cursor, size, 0, -off_h);
 	}
 	break;
 	}
-	// for any cases that didn't move the flush_cursor
+	// move the flush_cursor past the quads that were aligned
 	flush_cursor = size;
 }
 
 void font_sprite_painter::newline()
 {
-	size_t size = state.batcher->get_current_vertex_count();
+	size_t size = state.batcher->get_quad_count();
 
 	switch(current_anchor)
 	{
@@ -2160,56 +2989,38 @@ void font_sprite_painter::newline()
 	case TEXT_ANCHOR::TOP_LEFT: break;
 	case TEXT_ANCHOR::TOP_RIGHT: {
 		float off_w = state.draw_x_pos - anchor_x;
-		for(; newline_cursor < size; ++newline_cursor)
-		{
-			state.batcher->buffer[newline_cursor].pos[0] -= off_w;
-		}
+		state.batcher->translate_quads(newline_cursor, size, -off_w, 0);
 	}
 	break;
 	case TEXT_ANCHOR::BOTTOM_LEFT: break;
 	case TEXT_ANCHOR::BOTTOM_RIGHT: {
 		float off_w = state.draw_x_pos - anchor_x;
-		for(; newline_cursor < size; ++newline_cursor)
-		{
-			state.batcher->buffer[newline_cursor].pos[0] -= off_w;
-		}
+		state.batcher->translate_quads(newline_cursor, size, -off_w, 0);
 	}
 	break;
 	case TEXT_ANCHOR::CENTER_PERFECT: {
 		float off_w = std::floor((state.draw_x_pos - anchor_x) / 2);
-		for(; newline_cursor < size; ++newline_cursor)
-		{
-			state.batcher->buffer[newline_cursor].pos[0] -= off_w;
-		}
+		state.batcher->translate_quads(newline_cursor, size, -off_w, 0);
 	}
 	break;
 	case TEXT_ANCHOR::CENTER_TOP: {
 		float off_w = std::floor((state.draw_x_pos - anchor_x) / 2);
-		for(; newline_cursor < size; ++newline_cursor)
-		{
-			state.batcher->buffer[newline_cursor].pos[0] -= off_w;
-		}
+		state.batcher->translate_quads(newline_cursor, size, -off_w, 0);
 	}
 	break;
 	case TEXT_ANCHOR::CENTER_BOTTOM: {
 		float off_w = std::floor((state.draw_x_pos - anchor_x) / 2);
-		for(; newline_cursor < size; ++newline_cursor)
-		{
-			state.batcher->buffer[newline_cursor].pos[0] -= off_w;
-		}
+		state.batcher->translate_quads(newline_cursor, size, -off_w, 0);
 	}
 	break;
 	case TEXT_ANCHOR::CENTER_LEFT: break;
 	case TEXT_ANCHOR::CENTER_RIGHT: {
 		float off_w = state.draw_x_pos - anchor_x;
-		for(; newline_cursor < size; ++newline_cursor)
-		{
-			state.batcher->buffer[newline_cursor].pos[0] -= off_w;
-		}
+		state.batcher->translate_quads(newline_cursor, size, -off_w, 0);
 	}
 	break;
 	}
-	// for any cases that didn't move the newline_cursor
+	// move the newline_cursor past the quads that were aligned
 	newline_cursor = size;
 
 	state.draw_x_pos = anchor_x;
@@ -4,6 +4,8 @@
 #include "../opengles2/opengl_stuff.h"
 #include "../shaders/mono.h"
 #include "../RWops.h"
+#include "atlas_packer.h"
+#include "hex_font_binary.h"
 
 #include <cmath>
 #include <cstdint>
@@ -13,12 +15,20 @@
 #include FT_GLYPH_H
 #include FT_BITMAP_H
 
+// FT_RENDER_MODE_SDF was added in freetype 2.11
+#if FREETYPE_MAJOR > 2 || (FREETYPE_MAJOR == 2 && FREETYPE_MINOR >= 11)
+#define FONT_HAS_SDF 1
+#endif
+
 #include <memory>
 #include <deque>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <string>
 #include <array>
 #include <bitset>
+#include <algorithm>
 
 // I don't like enum classes, but here it's useful.
 enum class FONT_RESULT
@@ -71,7 +81,7 @@ struct FT_Done_Glyph_wrapper
 };
 typedef std::unique_ptr<FT_GlyphRec, FT_Done_Glyph_wrapper> unique_ft_glyph;
 
-enum class FONT_ENTRY : uint16_t
+enum class FONT_ENTRY : uint8_t
 {
 	// undefined is used internally to define initialization.
 	// note that I memset zero font_glyph_entry so this MUST be zero.
@@ -84,7 +94,10 @@ enum class FONT_ENTRY : uint16_t
 	// scale this assuming it's 16 pixels high.
 	// HEXFONT,
 	// there is no texture, use advance.
-	SPACE
+	SPACE,
+	// the glyph is being rasterized by a font_raster_pool worker,
+	// draw it like a SPACE until font_bitmap_cache::process_raster_results stores it.
+	PENDING
 };
 
 // glyph stored in the atlas
@@ -102,6 +115,7 @@ struct font_glyph_entry
 		int16_t xmin_,
 		int16_t ymin_)
 	: type(type_)
+	, sdf(0)
 	, rect_x(rect_x_)
 	, rect_y(rect_y_)
 	, rect_w(rect_w_)
@@ -109,11 +123,15 @@ struct font_glyph_entry
 	, advance(advance_)
 	, xmin(xmin_)
 	, ymin(ymin_)
+	, last_used(0)
 	{
 	}
 
 	FONT_ENTRY type;
 
+	// the pixels are a signed distance field instead of coverage (see FT_RENDER_MODE_SDF)
+	uint8_t sdf;
+
 	// location on atlas
 	uint16_t rect_x;
 	uint16_t rect_y;
@@ -124,64 +142,108 @@ struct font_glyph_entry
 	int16_t advance;
 	int16_t xmin;
 	int16_t ymin;
+
+	// the frame the glyph was last drawn, for evicting (see font_atlas::touch_glyph)
+	uint32_t last_used;
+};
+
+// anything that stores font_glyph_entry's inside of the atlas needs to be registered
+// into the atlas, so that the glyphs can be evicted or moved when the atlas is full.
+struct font_atlas_listener
+{
+	// append every glyph that is inside of the atlas,
+	// the atlas will write the new rect_x and rect_y when compacting.
+	virtual void get_atlas_glyphs(std::vector<font_glyph_entry*>& glyphs_out) = 0;
+	// forget every glyph with a last_used older than the frame,
+	// and give the slot back with font_atlas::free_slot.
+	virtual void evict_atlas_glyphs(uint32_t frame) = 0;
+	virtual ~font_atlas_listener() = default;
 };
 
 struct font_atlas
 {
 	/*
 	optimzation: Use rectpack2d for caching the fonts onto the disk,
-			keep using my "very inefficient" atlas,
 			but when I gracefully quit, put all the fonts into rectpack2d,
 			save it as a png, store the font path & glyph metrics into json,
 			(maybe do pessimistic garbage collecton for any unused fonts?)
 			then on startup load it back into the atlas,
 			this has the benefit of no stutter from loading glyphs,
 			and techinically the cache could be distributed to help everyone.
-			Also a potential optimization for "ran out of atlas space"
-			just allocate a larger altas + rectpack2d
-			(but I currently I don't handle running out of atlas space...
-			and it would be difficult because all glyphs must be redrawn)
-			This would also help prevent the problem of "running out of spans"
-
-	to fix the "very inefficient" atlas a tiny bit,
-	maybe make the buckets into a 2D grid
-	because once all the buckets have been allocated
-	the spans start being cannabalized, and the canabalization
-	can't be done in reverse (leading to a allocation error).
-	the problem is that using 2d grids could also cause the atlas to be slower
-	because very deep and commmon buckets are fast, but the buckets wont be deep anymore.
-	and rectpack2d could solve all problems
+			(font_atlas_cache.h does the disk part, but with a BS_Archive binary)
+
+	The atlas starts small, and doubles in size (copying the old texture) when it runs out of space,
+	once it hits atlas_max_size, the least recently used glyphs get evicted,
+	and if the free space is too fragmented, the glyphs are compacted.
+	The UV's are in pixels (the shader divides by the texture size),
+	so resizing won't break any vertices that are already in a buffer,
+	but evicting and compacting will, so check evict_generation if you keep vertices around.
 	*/
 
+	GLuint gl_atlas_tex_id = 0;
+
 	// width and height of the atlas.
 	uint32_t atlas_size = 0;
 
-	// the number of pixels each span holds.
-	// needs to be a power of 2
-	uint32_t span_granularity = 8;
+	// the atlas will not grow past this size, this is the memory budget.
+	uint32_t atlas_max_size = 0;
+
+	// used for the LRU, increment with new_frame()
+	uint32_t current_frame = 1;
+
+	// incremented every time glyphs are evicted or moved,
+	// anything that holds onto vertices must redraw when this changes.
+	uint32_t evict_generation = 0;
+
+	// if set, touch_glyph also adds the glyph to this (see font_layout_cache).
+	std::vector<font_glyph_entry*>* touch_record = NULL;
+
+	font_guillotine_packer packer;
 
-	// so I don't need to loop through span_buckets to get the size.
-	uint32_t spans_allocated = 0;
+	std::vector<font_atlas_listener*> listeners;
 
-	struct span_bucket
+	// the slot of the white_uv, not owned by any listener but it's moved by compact().
+	font_glyph_entry white_glyph{};
+
+	struct atlas_stats
 	{
-		// emplace_back annoyance.
-		span_bucket(uint32_t start, uint32_t count, uint32_t depth)
-		: span_start(start)
-		, span_count(count)
-		, bucket_depth(depth)
-		{
-		}
-		// the chunk offset (in spans)
-		uint32_t span_start;
-		// the number of spans of width (in spans)
-		uint32_t span_count;
-		// the ammount of the chunk that is allocated (in pixels)
-		uint32_t bucket_depth;
+		uint32_t resize_count = 0;
+		uint32_t evict_count = 0;
+		uint32_t evicted_glyphs = 0;
+		uint32_t compact_count = 0;
+		uint32_t upload_count = 0;
+		uint64_t upload_bytes = 0;
 	};
+	atlas_stats stats;
 
-	// a span is the unit slot within the atlas
-	std::deque<span_bucket> span_buckets;
+	struct upload_stats
+	{
+		// the number of glTexSubImage2D calls
+		uint32_t uploads = 0;
+		uint32_t glyphs = 0;
+		uint32_t bytes = 0;
+	};
+	// frame_uploads is reset by new_frame(), and copied into last_frame_uploads.
+	upload_stats frame_uploads;
+	upload_stats last_frame_uploads;
+
+	// a glyph waiting for flush_uploads()
+	struct staged_rect
+	{
+		uint32_t x;
+		uint32_t y;
+		uint32_t w;
+		uint32_t h;
+		// the offset into staging_pixels (tightly packed)
+		size_t offset;
+	};
+	std::vector<staged_rect> staged_rects;
+	std::vector<uint8_t> staging_pixels;
+	// the staged rects that are next to each other are merged into this before uploading.
+	std::vector<uint8_t> merge_pixels;
+
+	// only used if cv_font_atlas_pbo is set.
+	GLuint gl_upload_pbo = 0;
 
 	// for drawing primitives, this is a single white pixel.
 	// this is very out of place, but this needs to be somewhere...
@@ -190,7 +252,100 @@ struct font_atlas
 	// and I could also make the mono shader support colored textures too.
 	std::array<float, 4> white_uv;
 
+	void update_white_uv()
+	{
+		white_uv[0] = static_cast<float>(white_glyph.rect_x) + 0.5f;
+		white_uv[2] = static_cast<float>(white_glyph.rect_x) + 1.5f;
+		white_uv[1] = static_cast<float>(white_glyph.rect_y) + 0.5f;
+		white_uv[3] = static_cast<float>(white_glyph.rect_y) + 1.5f;
+	}
+
+	NDSERR bool create(uint32_t initial_size, uint32_t max_size);
+	NDSERR bool destroy();
+
+	// this will resize the atlas, evict old glyphs, or compact if there is no space.
+	// the atlas texture must be bound, and it will stay bound (the id could change).
 	NDSERR bool find_atlas_slot(uint32_t w_in, uint32_t h_in, uint32_t* x_out, uint32_t* y_out);
+
+	// copy a glyph into the staging area, the glyph is uploaded in flush_uploads().
+	// the slot is the rect from find_atlas_slot, the image is placed at offset inside of it,
+	// and the rest of the slot is cleared (so padding doesn't contain an evicted glyph).
+	void stage_glyph(
+		uint32_t slot_x,
+		uint32_t slot_y,
+		uint32_t slot_w,
+		uint32_t slot_h,
+		uint32_t offset,
+		const uint8_t* pixels,
+		uint32_t w,
+		uint32_t h,
+		uint32_t pitch);
+
+	// upload every staged glyph, glyphs that are next to each other are merged into one upload.
+	// this needs to be called before drawing anything that could use a new glyph,
+	// the atlas texture must be bound and GL_UNPACK_ALIGNMENT must be 1.
+	NDSERR bool flush_uploads();
+
+	// give back a slot from find_atlas_slot (for font_atlas_listener::evict_atlas_glyphs)
+	void free_slot(const font_glyph_entry& glyph)
+	{
+		packer.remove(glyph.rect_x, glyph.rect_y, glyph.rect_w, glyph.rect_h);
+	}
+
+	// copies the atlas into a texture twice the size.
+	NDSERR bool grow_atlas();
+
+	// evict the least recently used glyphs, at least area_in worth of pixels,
+	// returns false if there is nothing to evict.
+	bool evict_lru_glyphs(uint64_t area_in);
+
+	// re-pack every glyph into a new texture, and fix the rects of every glyph.
+	// this is done automatically when the atlas is too fragmented,
+	// note that this will leave the new atlas texture bound.
+	NDSERR bool compact();
+
+	void add_listener(font_atlas_listener* listener)
+	{
+		listeners.push_back(listener);
+	}
+	void remove_listener(font_atlas_listener* listener)
+	{
+		listeners.erase(
+			std::remove(listeners.begin(), listeners.end(), listener), listeners.end());
+	}
+
+	// mark the glyph as being used this frame.
+	void touch_glyph(font_glyph_entry* glyph)
+	{
+		glyph->last_used = current_frame;
+		if(touch_record != NULL)
+		{
+			touch_record->push_back(glyph);
+		}
+	}
+
+	void new_frame()
+	{
+		++current_frame;
+		last_frame_uploads = frame_uploads;
+		frame_uploads = upload_stats();
+	}
+
+	// the percentage of the atlas that has been allocated (0-1)
+	float get_occupancy() const;
+
+	// copy the top rows of the atlas into pixels_out (atlas_size wide, tightly packed).
+	// GLES doesn't have glGetTexImage so this goes through a framebuffer,
+	// staged glyphs are not included (call flush_uploads first).
+	NDSERR bool read_pixels(uint32_t rows, std::vector<uint8_t>& pixels_out);
+
+	// replace the texture with pixels (size * size) in one upload, and replace the packer.
+	// this is for font_atlas_cache_load, every listener must have evicted all it's glyphs.
+	NDSERR bool restore(
+		uint32_t size,
+		const std::vector<uint8_t>& pixels,
+		font_guillotine_packer packer_in,
+		const font_glyph_entry& white_glyph_in);
 };
 
 // don't mix up font_style_result with font_glyph_entry
@@ -210,6 +365,10 @@ struct font_style_result
 	float glyph_ymax;
 
 	float advance;
+
+	// 0 if the glyph is a normal bitmap, otherwise it's a distance field,
+	// and the edge is moved outwards by (sdf_weight - 1), see shader_mono_state::create_sdf
+	float sdf_weight;
 };
 
 // abstract interface to work with a font that could be a hexfont or truetype font.
@@ -228,6 +387,7 @@ struct font_style_interface
 	NDSERR virtual FONT_BASIC_RESULT
 		get_advance(char32_t codepoint, float* advance, float font_scale) = 0;
 	// you require to bind the atlas texture and set the GL_UNPACK_ALIGNMENT to 1
+	// new glyphs are staged, so call font_atlas::flush_uploads before drawing.
 	virtual FONT_RESULT get_glyph(
 		char32_t codepoint,
 		font_style_type style,
@@ -242,7 +402,7 @@ struct font_style_interface
 // First you need to get unifont-14.0.02.hex and unifont_upper-14.0.02.hex
 // Then you need to remove all codepoints that are overlap between both hexfonts,
 // or else you get an error, and then combine both fonts.
-struct hex_font_data : public font_style_interface
+struct hex_font_data : public font_style_interface, public font_atlas_listener
 {
 	// this is a hex font glyph.
 	struct hex_glyph_entry
@@ -253,6 +413,8 @@ struct hex_font_data : public font_style_interface
 		uint8_t hex_full : 1;
 		// is hex_glyph initialized?
 		uint8_t hex_init : 1;
+		// the glyph was evicted from the atlas, hex_data needs to be loaded again.
+		uint8_t hex_evicted : 1;
 		// I don't like unions, but this is very big, and any size shrink can help.
 		union
 		{
@@ -271,32 +433,44 @@ struct hex_font_data : public font_style_interface
 		} u;
 	};
 
-	// first parse the whole hex file
-	// and copy the offsets for the beginning of each chunk.
-	// chunk size is HEX_CHUNK_COUNT
+	// the blocks are loaded from the binary version of the hex file (see hex_font_binary.h)
+	// chunk size is HEX_CHUNK_GLYPHS
 	struct hex_block_chunk
 	{
-		RW_ssize_t offset = -1;
+		// the offset of the hex_binary_block in hex_binary, 0 if the block has no glyphs.
+		uint32_t offset = 0;
 		std::unique_ptr<hex_glyph_entry[]> glyphs;
 	};
 
 	std::vector<hex_block_chunk> hex_block_chunks;
 
-	Unique_RWops hex_font_file;
+	// the path of the .hex file, only used for the name.
+	std::string hex_font_name;
+	hex_binary_view hex_binary;
 	font_atlas* atlas = NULL;
 
-	NDSERR bool init(Unique_RWops file, font_atlas* atlas_);
+	// loads the binary cache at cache_path, if the cache is missing or the .hex file changed,
+	// the .hex file will be parsed and the cache will be written.
+	// if cache_path is NULL, the .hex file is parsed without writing a cache.
+	NDSERR bool init(const char* hex_path, const char* cache_path, font_atlas* atlas_);
 	NDSERR bool destroy();
 
-	NDSERR FONT_BASIC_RESULT load_hex_block(size_t block_index);
+	// glyphs_out must be HEX_CHUNK_GLYPHS big and zeroed.
+	NDSERR FONT_BASIC_RESULT load_hex_block(size_t block_index, hex_glyph_entry* glyphs_out);
+
+	// load the hex_data back for any evicted glyphs in the chunk.
+	NDSERR FONT_BASIC_RESULT reload_evicted_glyphs(size_t block_index);
+
+	void get_atlas_glyphs(std::vector<font_glyph_entry*>& glyphs_out) override;
+	void evict_atlas_glyphs(uint32_t frame) override;
 
 	// virtual functions
 	const char* get_name() override
 	{
-		ASSERT(hex_font_file);
-		if(hex_font_file)
+		ASSERT(hex_binary.data != NULL);
+		if(hex_binary.data != NULL)
 		{
-			return hex_font_file->name();
+			return hex_font_name.c_str();
 		}
 		return "!!!UNINTIALIZED!!!";
 	}
@@ -338,10 +512,10 @@ struct hex_font_placeholder : public font_style_interface
 	const char* get_name() override
 	{
 		ASSERT(hex_font != NULL);
-		ASSERT(hex_font->hex_font_file);
-		if(hex_font != NULL && hex_font->hex_font_file)
+		ASSERT(hex_font->hex_binary.data != NULL);
+		if(hex_font != NULL && hex_font->hex_binary.data != NULL)
 		{
-			return hex_font->hex_font_file->name();
+			return hex_font->hex_font_name.c_str();
 		}
 		return "!!!UNINTIALIZED!!!";
 	}
@@ -388,8 +562,6 @@ struct font_manager_state
 {
 	FT_Library FTLibrary = NULL;
 
-	GLuint gl_atlas_tex_id = 0;
-
 	// to simplify the code a bit, I am considering just combining
 	// font_atlas, hex_font_data, and font_manager_state together
 	font_atlas atlas;
@@ -439,8 +611,14 @@ struct font_ttf_face_settings
 	// supported modes are:
 	// FT_RENDER_MODE_LIGHT
 	// FT_RENDER_MODE_MONO
+	// FT_RENDER_MODE_SDF (if FONT_HAS_SDF), bold and outlines are done by the shader,
+	// so every style shares the same glyph (except italics).
 	FT_Render_Mode render_mode = FT_RENDER_MODE_NORMAL;
 
+	// the distance in pixels that FT_RENDER_MODE_SDF stores outside of the glyph,
+	// this needs to be bigger than the outline_size and bold_x/y.
+	int sdf_spread = 4;
+
 	// supported options are:
 	// FT_LOAD_TARGET_MONO
 	// FT_LOAD_TARGET_LIGHT
@@ -450,6 +628,17 @@ struct font_ttf_face_settings
 	FT_Int32 load_flags = FT_LOAD_DEFAULT;
 };
 
+// the temporary bitmaps for font_ttf_rasterizer::render_bitmap_glyph,
+// the returned bitmap could point into this, so each thread needs it's own.
+struct font_bitmap_scratch
+{
+	// allocated by freetype, init with FT_Bitmap_Init and free with FT_Bitmap_Done.
+	FT_Bitmap convert_bitmap;
+	// FT_PIXEL_MODE_MONO glyphs are expanded into expand_pixels (not owned by freetype).
+	FT_Bitmap expand_bitmap;
+	std::vector<uint8_t> expand_pixels;
+};
+
 // yes I know freetype supports more than just truetype.
 struct font_ttf_rasterizer
 {
@@ -486,17 +675,39 @@ struct font_ttf_rasterizer
 	// if no error, you must call FT_Done_Glyph on glyph_out,
 	// and glyph_out needs to be casted to FT_BitmapGlyph.
 	NDSERR bool render_glyph(FT_Glyph* glyph_out, unsigned style_flags = FONT_STYLE_NORMAL);
+
+	// loads and renders the glyph into a FT_PIXEL_MODE_GRAY bitmap, returns NULL if failed.
+	// ftglyph holds the lifetime of bitmap returned,
+	// but sometimes the bitmap is stored in the scratch
+	// if the glyph was not an outline or FT_PIXEL_MODE_GRAY.
+	// this only touches this face, so every thread needs it's own rasterizer.
+	// sdf_out is set if the bitmap is a distance field
+	// (only outlines are, even if the render_mode is FT_RENDER_MODE_SDF)
+	NDSERR FT_Bitmap* render_bitmap_glyph(
+		FT_UInt glyph_index,
+		font_style_type style,
+		unique_ft_glyph& ftglyph,
+		font_bitmap_scratch* scratch,
+		bool* sdf_out);
+
+	bool is_sdf() const;
 };
 
+#ifndef __EMSCRIPTEN__
+struct font_raster_pool;
+#endif
+
 // cached in the atlas.
-struct font_bitmap_cache : public font_style_interface
+struct font_bitmap_cache : public font_style_interface, public font_atlas_listener
 {
 	enum
 	{
 		// to make loading glyphs fast I use random access indexes
 		// but if you load a unicode emoji it would load like 40mb
 		// if the memory was in one continuous array, so I cut it into blocks.
-		FONT_CACHE_CHUNK_GLYPHS = 16 * 16
+		FONT_CACHE_CHUNK_GLYPHS = 16 * 16,
+		// the first glyphs of block 0
+		FONT_ASCII_GLYPHS = 128
 	};
 
 	struct font_cache_block
@@ -513,8 +724,12 @@ struct font_bitmap_cache : public font_style_interface
 
 	std::vector<font_cache_block> font_cache_blocks;
 
+	// ASCII is most of the text, so this skips the block lookup,
+	// these point into font_cache_blocks[0].glyphs (the arrays never move).
+	font_glyph_entry* ascii_glyphs[FONT_STYLE_MASK + 1] = {};
+
 	// RAII_FT_Bitmap convert_bitmap;
-	FT_Bitmap convert_bitmap;
+	font_bitmap_scratch scratch;
 
 	// font_manager_state* font_manager = NULL;
 	font_atlas* atlas = NULL;
@@ -536,6 +751,15 @@ struct font_bitmap_cache : public font_style_interface
 	// have the same size (but readable!)
 	float bitmap_scale = 1.f;
 
+#ifndef __EMSCRIPTEN__
+	// optional, if set new glyphs are rasterized on worker threads,
+	// and they show up as FONT_ENTRY::PENDING until process_raster_results.
+	font_raster_pool* raster_pool = NULL;
+#endif
+
+	// the glyphs that weren't cached and had to be rasterized (including evicted glyphs).
+	uint32_t glyph_misses = 0;
+
 	void init(font_manager_state* font_manager, font_ttf_rasterizer* rasterizer);
 	NDSERR bool destroy();
 	~font_bitmap_cache() override;
@@ -549,11 +773,55 @@ struct font_bitmap_cache : public font_style_interface
 	// internal use only
 	// returns NULL if failed to load.
 	// index is the index from FT_Get_Char_Index
-	// ftglyph holds the lifetime of bitmap returned,
-	// but sometimes the bitmap is stored in convert_bitmap
-	// if the glyph was not an outline or FT_PIXEL_MODE_GRAY.
-	NDSERR FT_Bitmap*
-		render_tf_glyph(FT_UInt glyph_index, font_style_type style, unique_ft_glyph& ftglyph);
+	// see font_ttf_rasterizer::render_bitmap_glyph
+	NDSERR FT_Bitmap* render_tf_glyph(
+		FT_UInt glyph_index, font_style_type style, unique_ft_glyph& ftglyph, bool* sdf_out);
+
+	// internal use only
+	// with FT_RENDER_MODE_SDF the bold and outline styles use the same glyph,
+	// so this is the style of the glyph that is rasterized.
+	font_style_type get_raster_style(font_style_type style) const;
+
+	// internal use only
+	// the font_style_result::sdf_weight of a distance field glyph.
+	float get_sdf_weight(font_style_type style) const;
+
+	// internal use only
+	// the fast path of get_glyph, returns false if the glyph isn't loaded yet.
+	bool get_cached_glyph(
+		font_glyph_entry* glyph_in,
+		font_style_type style,
+		font_style_result* glyph_out,
+		float font_scale,
+		FONT_RESULT* result_out);
+
+	// internal use only
+	// the advance of the glyph in pixels (without rasterizing)
+	NDSERR bool load_glyph_advance(FT_UInt glyph_index, int* advance_out);
+
+	// internal use only
+	// put a rasterized glyph into the atlas and fill glyph_in (which must be undefined or pending)
+	// returns SPACE if the bitmap is empty, and ERROR if the atlas is out of space.
+	NDSERR FONT_RESULT store_bitmap_glyph(
+		font_glyph_entry* glyph_in,
+		char32_t codepoint,
+		const uint8_t* pixels,
+		uint32_t width,
+		uint32_t rows,
+		uint32_t pitch,
+		int left,
+		int top,
+		int advance,
+		bool sdf);
+
+#ifndef __EMSCRIPTEN__
+	// store the glyphs finished by raster_pool into the atlas, call this once per frame.
+	// glyphs that failed will use the fallback next time.
+	// the atlas texture must be bound (like get_glyph),
+	// and font_atlas::evict_generation is incremented if anything was stored,
+	// because the placeholders need to be redrawn.
+	void process_raster_results();
+#endif
 
 	const char* get_name() override
 	{
@@ -581,6 +849,9 @@ struct font_bitmap_cache : public font_style_interface
 		font_style_type style,
 		font_style_result* glyph_out,
 		float font_scale) override;
+
+	void get_atlas_glyphs(std::vector<font_glyph_entry*>& glyphs_out) override;
+	void evict_atlas_glyphs(uint32_t frame) override;
 };
 
 // shared data between the text painter and text prompt.
@@ -652,13 +923,84 @@ enum TEXT_FLAGS : uint8_t
 	// FORMATTING
 };
 
-struct font_sprite_painter
+// remembers the vertices of strings that were drawn before, so that text that doesn't change
+// (menus, labels, the perf overlay) is just a copy instead of decoding and loading every glyph.
+// the quads are relative to the start of the text, and the color is replaced when copied.
+// a hit touches the glyphs that the text used, so the atlas LRU doesn't evict them
+// (the glyphs are only valid while the evict_generation is the same).
+struct font_layout_cache
 {
 	enum
 	{
-		FONT_BATCH_VERTS = 6
+		// once this is full, the entries that weren't used since the last trim are removed.
+		MAX_ENTRIES = 256,
+		// don't bother with big blocks of text (like a text file)
+		MAX_TEXT_SIZE = 1024
 	};
 
+	struct layout_entry
+	{
+		std::string text;
+		font_style_type style;
+		TEXT_FLAGS flags;
+		TEXT_ANCHOR anchor;
+		float scale;
+		// the atlas evict_generation when the quads were made.
+		uint32_t generation;
+		// used since the last trim.
+		bool used;
+		// relative to the start.
+		std::vector<gl_mono_instance> quads;
+		// the glyphs the quads use, touched on every hit (no duplicates).
+		std::vector<font_glyph_entry*> glyphs;
+		// the draw position at the end, relative to the start.
+		float end_x;
+		float end_y;
+		// the newline_cursor at the end, relative to the first quad.
+		size_t newline_offset;
+	};
+
+	std::unordered_map<uint64_t, layout_entry> entries;
+
+	// the glyphs touched while a miss is drawn (font_atlas::touch_record), reused.
+	std::vector<font_glyph_entry*> record_glyphs;
+
+	struct layout_stats
+	{
+		uint32_t hits = 0;
+		uint32_t misses = 0;
+	} stats;
+
+	static uint64_t get_key(
+		const char* text,
+		size_t size,
+		font_style_type style,
+		TEXT_FLAGS flags,
+		TEXT_ANCHOR anchor,
+		float scale);
+
+	// returns NULL if the entry is missing or it's from an older evict_generation.
+	const layout_entry* find(
+		uint64_t key,
+		const char* text,
+		size_t size,
+		font_style_type style,
+		TEXT_FLAGS flags,
+		TEXT_ANCHOR anchor,
+		float scale,
+		uint32_t generation);
+
+	// returns an entry with the text and the key set, fill in the rest.
+	layout_entry& insert(uint64_t key, const char* text, size_t size);
+
+	void clear()
+	{
+		entries.clear();
+	}
+};
+
+struct font_sprite_painter
+{
 	internal_font_painter_state state;
 
 	size_t flush_cursor = 0;
@@ -673,9 +1015,12 @@ struct font_sprite_painter
 	TEXT_FLAGS current_flags = TEXT_FLAGS::NONE;
 	font_style_type current_style = 0;
 
+	font_layout_cache layout_cache;
+
 	void init(mono_2d_batcher* batcher_, font_style_interface* font_)
 	{
 		state.init(batcher_, font_);
+		layout_cache.clear();
 	}
 
 	float raw_font_scale = 1;
@@ -774,5 +1119,9 @@ struct font_sprite_painter
 	NDSERR bool draw_format(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
 
 	// you can use null terminated strings if size = 0, but strlen will be used.
+	// this uses the layout_cache if the text starts at the beginning of a line.
 	NDSERR bool draw_text(const char* text, size_t size = 0);
+
+	// draw_text without the cache.
+	NDSERR bool internal_draw_text(const char* text, size_t size);
 };
@@ -0,0 +1,239 @@
+#include "../global_pch.h"
+#include "../global.h"
+
+#include "font_raster_pool.h"
+
+#include "../zone_profiler.h"
+
+#ifndef __EMSCRIPTEN__
+
+#include <cstring>
+
+bool font_raster_pool::init(
+	const char* path, const font_ttf_face_settings* settings, int thread_count)
+{
+	ASSERT(path != NULL);
+	ASSERT(settings != NULL);
+	ASSERT(workers.empty());
+
+	if(thread_count <= 0)
+	{
+		serrf("%s error: invalid thread count: %d\n", __func__, thread_count);
+		return false;
+	}
+
+	quit = false;
+
+	// load every face before starting any threads, so destroy() is simple if this fails.
+	for(int i = 0; i < thread_count; ++i)
+	{
+		workers.push_back(std::make_unique<raster_worker>());
+		raster_worker& worker = *workers.back();
+		FT_Bitmap_Init(&worker.scratch.convert_bitmap);
+
+		FT_Error error;
+		if((error = FT_Init_FreeType(&worker.FTLibrary)) != 0)
+		{
+			TTF_SetFTError("font_raster_pool", error);
+			worker.FTLibrary = NULL;
+			return false;
+		}
+
+		Unique_RWops font_file = Unique_RWops_OpenFS(path, "rb");
+		if(!font_file)
+		{
+			return false;
+		}
+
+		if(!worker.rasterizer.create(worker.FTLibrary, std::move(font_file)))
+		{
+			return false;
+		}
+
+		if(!worker.rasterizer.set_face_settings(settings))
+		{
+			return false;
+		}
+	}
+
+	for(std::unique_ptr<raster_worker>& worker : workers)
+	{
+		worker->thread = std::thread(&font_raster_pool::run_worker, this, worker.get());
+	}
+
+	slogf("info: font raster threads: %d\n", thread_count);
+
+	return true;
+}
+
+bool font_raster_pool::destroy()
+{
+	{
+		std::lock_guard<std::mutex> lk(mut);
+		quit = true;
+	}
+	cond.notify_all();
+
+	bool success = true;
+	for(std::unique_ptr<raster_worker>& worker : workers)
+	{
+		if(worker->thread.joinable())
+		{
+			worker->thread.join();
+		}
+
+		FT_Error error;
+		if(worker->FTLibrary != NULL)
+		{
+			if((error = FT_Bitmap_Done(worker->FTLibrary, &worker->scratch.convert_bitmap)) != 0)
+			{
+				TTF_SetFTError("font_raster_pool", error);
+				success = false;
+			}
+		}
+
+		success = worker->rasterizer.destroy() && success;
+
+		if(worker->FTLibrary != NULL)
+		{
+			if((error = FT_Done_FreeType(worker->FTLibrary)) != 0)
+			{
+				TTF_SetFTError("font_raster_pool", error);
+				success = false;
+			}
+			worker->FTLibrary = NULL;
+		}
+	}
+	workers.clear();
+
+	requests.clear();
+	results.clear();
+	popped_results.clear();
+	free_pixels.clear();
+
+	return success;
+}
+
+font_raster_pool::~font_raster_pool()
+{
+	if(!workers.empty())
+	{
+		// the error is ignored
+		bool ret = destroy();
+		ASSERT(ret);
+		(void)ret;
+	}
+}
+
+void font_raster_pool::push(char32_t codepoint, FT_UInt glyph_index, font_style_type style)
+{
+	ASSERT(!workers.empty());
+	{
+		std::lock_guard<std::mutex> lk(mut);
+		requests.push_back(raster_request{codepoint, glyph_index, style});
+	}
+	cond.notify_one();
+}
+
+std::vector<font_raster_pool::raster_result>& font_raster_pool::pop_results()
+{
+	std::lock_guard<std::mutex> lk(mut);
+	// the last results were handled, give their pixel buffers back to the workers.
+	for(raster_result& result : popped_results)
+	{
+		if(free_pixels.size() >= FREE_PIXELS_MAX)
+		{
+			break;
+		}
+		if(result.pixels.capacity() != 0)
+		{
+			result.pixels.clear();
+			free_pixels.push_back(std::move(result.pixels));
+		}
+	}
+	popped_results.clear();
+	// swap so that the capacity of both vectors gets reused.
+	popped_results.swap(results);
+	return popped_results;
+}
+
+void font_raster_pool::run_worker(raster_worker* worker)
+{
+	ASSERT(worker != NULL);
+
+	zone_profiler_set_thread_name("font raster");
+
+	while(true)
+	{
+		raster_request request;
+		raster_result result;
+		{
+			std::unique_lock<std::mutex> lk(mut);
+			cond.wait(lk, [this] { return quit || !requests.empty(); });
+			if(quit)
+			{
+				return;
+			}
+			request = requests.front();
+			requests.pop_front();
+			if(!free_pixels.empty())
+			{
+				result.pixels = std::move(free_pixels.back());
+				free_pixels.pop_back();
+			}
+		}
+
+		result.codepoint = request.codepoint;
+		result.style = request.style;
+		result.success = false;
+		result.width = 0;
+		result.rows = 0;
+		result.left = 0;
+		result.top = 0;
+		result.advance = 0;
+		result.sdf = false;
+
+		// this owns the FT_Bitmap memory (but sometimes it's the scratch)
+		unique_ft_glyph ftglyph;
+
+		FT_Bitmap* bitmap = worker->rasterizer.render_bitmap_glyph(
+			request.glyph_index, request.style, ftglyph, &worker->scratch, &result.sdf);
+		if(bitmap == NULL)
+		{
+			// render_bitmap_glyph won't print the codepoint, so might as well include it here.
+			serrf(
+				"%s error: U+%X\n",
+				worker->rasterizer.font_file->name(),
+				static_cast<unsigned>(request.codepoint));
+		}
+		else
+		{
+			// freetype bitmaps flow down, so the pitch should never be negative.
+			ASSERT(bitmap->pitch >= 0);
+			FT_BitmapGlyph ftglyph_bitmap = reinterpret_cast<FT_BitmapGlyph>(ftglyph.get());
+
+			result.success = true;
+			result.width = bitmap->width;
+			result.rows = bitmap->rows;
+			result.left = ftglyph_bitmap->left;
+			result.top = ftglyph_bitmap->top;
+			// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+			result.advance = (worker->rasterizer.face->glyph->advance.x & -64) / 64;
+			result.pixels.resize(static_cast<size_t>(bitmap->width) * bitmap->rows);
+			for(uint32_t y = 0; y < bitmap->rows; ++y)
+			{
+				memcpy(
+					result.pixels.data() + static_cast<size_t>(y) * bitmap->width,
+					bitmap->buffer + static_cast<size_t>(y) * bitmap->pitch,
+					bitmap->width);
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lk(mut);
+			results.push_back(std::move(result));
+		}
+	}
+}
+
+#endif // __EMSCRIPTEN__
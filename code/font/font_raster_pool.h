@@ -0,0 +1,89 @@
+#pragma once
+
+#include "../global.h"
+#include "font_manager.h"
+
+// I don't use threads on emscripten.
+#ifndef __EMSCRIPTEN__
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <vector>
+
+// rasterizes TTF glyphs on worker threads, so that loading a page of CJK or emojis
+// doesn't stall the frame (font_bitmap_cache draws a placeholder in the meantime).
+// freetype libraries are not thread safe, so every worker has it's own FT_Library and FT_Face
+// of the same file, the face settings are shared because they are read only.
+// only the main thread touches the atlas (see font_bitmap_cache::process_raster_results)
+struct font_raster_pool
+{
+	enum
+	{
+		// the most pixel buffers that are kept for reuse.
+		FREE_PIXELS_MAX = 64
+	};
+
+	struct raster_request
+	{
+		char32_t codepoint;
+		FT_UInt glyph_index;
+		font_style_type style;
+	};
+
+	struct raster_result
+	{
+		char32_t codepoint;
+		font_style_type style;
+		// false if the glyph failed to load, the worker will print the error.
+		bool success;
+		// tightly packed, the pitch is the width.
+		std::vector<uint8_t> pixels;
+		uint32_t width;
+		uint32_t rows;
+		int left;
+		int top;
+		int advance;
+		// see font_ttf_rasterizer::render_bitmap_glyph
+		bool sdf;
+	};
+
+	struct raster_worker
+	{
+		FT_Library FTLibrary = NULL;
+		font_ttf_rasterizer rasterizer;
+		font_bitmap_scratch scratch;
+		std::thread thread;
+	};
+
+	// unique_ptr because the rasterizer holds the FT_Stream that the FT_Face points to.
+	std::vector<std::unique_ptr<raster_worker>> workers;
+
+	// protects everything below.
+	std::mutex mut;
+	std::condition_variable cond;
+	std::deque<raster_request> requests;
+	std::vector<raster_result> results;
+	// the pixel buffers of the results that were popped, so the workers don't allocate.
+	std::vector<std::vector<uint8_t>> free_pixels;
+	bool quit = false;
+
+	// the results that were swapped out by pop_results.
+	std::vector<raster_result> popped_results;
+
+	// opens the font again for each worker, the settings must outlive the pool.
+	NDSERR bool init(const char* path, const font_ttf_face_settings* settings, int thread_count);
+	NDSERR bool destroy();
+	~font_raster_pool();
+
+	// the glyph_index is from FT_Get_Char_Index.
+	void push(char32_t codepoint, FT_UInt glyph_index, font_style_type style);
+
+	// the finished glyphs, the vector is valid until the next pop_results.
+	std::vector<raster_result>& pop_results();
+
+	// the worker thread.
+	void run_worker(raster_worker* worker);
+};
+#endif
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "../global.h"
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+// a text editor buffer, the free space (the gap) is moved to where you insert,
+// so typing in the middle only moves the text between the last edit and this one,
+// and the text is in 2 contiguous halves instead of deque blocks.
+// erasing from the front only moves the start (for logs that trim the oldest lines),
+// the space is reclaimed the next time the buffer grows.
+// T must be trivially copyable, the elements are moved with memmove.
+template<class T>
+class gap_buffer
+{
+	static_assert(std::is_trivially_copyable<T>::value, "gap_buffer uses memmove");
+
+	// [head, gap_begin) is the first half, [gap_end, data.size()) is the second half.
+	std::vector<T> data;
+	size_t head = 0;
+	size_t gap_begin = 0;
+	size_t gap_end = 0;
+
+	size_t first_size() const
+	{
+		return gap_begin - head;
+	}
+
+	// move the gap so that it starts at the index (the text is not modified)
+	void move_gap(size_t index)
+	{
+		ASSERT(index <= size());
+		size_t target = head + index;
+		if(target < gap_begin)
+		{
+			size_t count = gap_begin - target;
+			memmove(data.data() + gap_end - count, data.data() + target, count * sizeof(T));
+			gap_begin -= count;
+			gap_end -= count;
+		}
+		else if(target > gap_begin)
+		{
+			size_t count = target - gap_begin;
+			memmove(data.data() + gap_begin, data.data() + gap_end, count * sizeof(T));
+			gap_begin += count;
+			gap_end += count;
+		}
+	}
+
+	// reallocate so the gap is at least n, the gap must be at the insert position.
+	void grow_gap(size_t n)
+	{
+		size_t first = first_size();
+		size_t second = data.size() - gap_end;
+		size_t capacity = std::max<size_t>(64, (first + second + n) * 2);
+		std::vector<T> new_data(capacity);
+		memcpy(new_data.data(), data.data() + head, first * sizeof(T));
+		memcpy(
+			new_data.data() + capacity - second, data.data() + gap_end, second * sizeof(T));
+		data.swap(new_data);
+		head = 0;
+		gap_begin = first;
+		gap_end = capacity - second;
+	}
+
+public:
+	size_t size() const
+	{
+		return first_size() + (data.size() - gap_end);
+	}
+	bool empty() const
+	{
+		return size() == 0;
+	}
+	// the memory used (including the gap).
+	size_t capacity_bytes() const
+	{
+		return data.capacity() * sizeof(T);
+	}
+
+	T& operator[](size_t index)
+	{
+		ASSERT(index < size());
+		return index < first_size() ? data[head + index] : data[gap_end + (index - first_size())];
+	}
+	const T& operator[](size_t index) const
+	{
+		ASSERT(index < size());
+		return index < first_size() ? data[head + index] : data[gap_end + (index - first_size())];
+	}
+	T& back()
+	{
+		return (*this)[size() - 1];
+	}
+
+	// returns n uninitialized elements at the index to fill in,
+	// the pointer is valid until the next modification.
+	T* insert(size_t index, size_t n)
+	{
+		ASSERT(index <= size());
+		move_gap(index);
+		if(gap_end - gap_begin < n)
+		{
+			grow_gap(n);
+		}
+		T* out = data.data() + gap_begin;
+		gap_begin += n;
+		return out;
+	}
+	void push_back(const T& value)
+	{
+		*insert(size(), 1) = value;
+	}
+
+	void erase(size_t index, size_t n)
+	{
+		ASSERT(index + n <= size());
+		if(index == 0 && n <= first_size())
+		{
+			head += n;
+			return;
+		}
+		move_gap(index);
+		gap_end += n;
+	}
+	void pop_back()
+	{
+		ASSERT(!empty());
+		erase(size() - 1, 1);
+	}
+
+	// keeps the memory.
+	void clear()
+	{
+		head = 0;
+		gap_begin = 0;
+		gap_end = data.size();
+	}
+
+	// calls func(const T* span, size_t count) for the contiguous parts of [begin, end).
+	template<class F>
+	void for_each_span(size_t begin, size_t end, F&& func) const
+	{
+		ASSERT(begin <= end && end <= size());
+		size_t first = first_size();
+		if(begin < first)
+		{
+			size_t first_end = std::min(end, first);
+			func(data.data() + head + begin, first_end - begin);
+			begin = first_end;
+		}
+		if(begin < end)
+		{
+			func(data.data() + gap_end + (begin - first), end - begin);
+		}
+	}
+};
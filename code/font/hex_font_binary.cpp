@@ -0,0 +1,445 @@
+#include "../global_pch.h"
+#include "../global.h"
+
+#include "hex_font_binary.h"
+
+#include "../RWops.h"
+#include "font_bit_kernels.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// windows would need MapViewOfFile, and emscripten files are already in memory.
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#define HEX_BINARY_USE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+// this is annoying but I would rather do this than suppress warnings
+#define _stat stat
+#endif
+
+static_assert(sizeof(hex_binary_header) % 8 == 0);
+static_assert(sizeof(hex_binary_block) == HEX_BINARY_BLOCK_GLYPHS * (HEX_BINARY_GLYPH_BYTES + 1));
+
+bool hex_binary_view::open_file(const char* path)
+{
+	ASSERT(path != NULL);
+	close();
+
+#ifdef HEX_BINARY_USE_MMAP
+	int fd = open(path, O_RDONLY);
+	if(fd < 0)
+	{
+		if(errno != ENOENT)
+		{
+			slogf("info: failed to open: `%s`, reason: %s\n", path, strerror(errno));
+		}
+		return false;
+	}
+	struct stat info;
+	if(fstat(fd, &info) != 0 || info.st_size <= 0)
+	{
+		::close(fd);
+		return false;
+	}
+	void* ptr = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// the mapping holds onto the file.
+	::close(fd);
+	if(ptr == MAP_FAILED)
+	{
+		slogf("info: failed to mmap: `%s`, reason: %s\n", path, strerror(errno));
+		return false;
+	}
+	data = static_cast<const uint8_t*>(ptr);
+	size = info.st_size;
+	mapped = true;
+	return true;
+#else
+	FILE* fp = fopen(path, "rb");
+	if(fp == NULL)
+	{
+		if(errno != ENOENT)
+		{
+			slogf("info: failed to open: `%s`, reason: %s\n", path, strerror(errno));
+		}
+		return false;
+	}
+	std::vector<uint8_t> buffer;
+	uint8_t chunk[4096];
+	size_t read_size;
+	while((read_size = fread(chunk, 1, sizeof(chunk), fp)) != 0)
+	{
+		buffer.insert(buffer.end(), chunk, chunk + read_size);
+	}
+	bool failed = ferror(fp) != 0;
+	fclose(fp);
+	if(failed || buffer.empty())
+	{
+		slogf("info: failed to read: `%s`\n", path);
+		return false;
+	}
+	use_memory(std::move(buffer));
+	return true;
+#endif
+}
+
+void hex_binary_view::use_memory(std::vector<uint8_t> buffer)
+{
+	close();
+	memory = std::move(buffer);
+	data = memory.data();
+	size = memory.size();
+}
+
+void hex_binary_view::close()
+{
+#ifdef HEX_BINARY_USE_MMAP
+	if(mapped)
+	{
+		munmap(const_cast<uint8_t*>(data), size);
+	}
+#endif
+	mapped = false;
+	memory.clear();
+	memory.shrink_to_fit();
+	data = NULL;
+	size = 0;
+}
+
+hex_binary_view::~hex_binary_view()
+{
+	close();
+}
+
+bool hex_binary_stat(const char* path, uint64_t* size_out, int64_t* mtime_out)
+{
+	ASSERT(path != NULL);
+	ASSERT(size_out != NULL);
+	ASSERT(mtime_out != NULL);
+	struct _stat info;
+	if(_stat(path, &info) != 0)
+	{
+		serrf("Failed to stat: `%s`, reason: %s\n", path, strerror(errno));
+		return false;
+	}
+	*size_out = info.st_size;
+	*mtime_out = info.st_mtime;
+	return true;
+}
+
+uint64_t hex_binary_hash(const void* data, size_t size, uint64_t hash)
+{
+	const uint8_t* cur = static_cast<const uint8_t*>(data);
+	for(size_t i = 0; i < size; ++i)
+	{
+		hash ^= cur[i];
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+bool hex_binary_hash_file(const char* path, uint64_t* hash_out)
+{
+	ASSERT(path != NULL);
+	ASSERT(hash_out != NULL);
+	Unique_RWops file = Unique_RWops_OpenFS(path, "rb");
+	if(!file)
+	{
+		return false;
+	}
+	uint64_t hash = hex_binary_hash(NULL, 0);
+	char buffer[4096];
+	size_t read_size;
+	while((read_size = file->read(buffer, 1, sizeof(buffer))) != 0)
+	{
+		hash = hex_binary_hash(buffer, read_size, hash);
+	}
+	if(!file->close())
+	{
+		return false;
+	}
+	*hash_out = hash;
+	return true;
+}
+
+static int hex_digit(char c)
+{
+	if(c >= '0' && c <= '9')
+	{
+		return c - '0';
+	}
+	if(c >= 'A' && c <= 'F')
+	{
+		return c - 'A' + 10;
+	}
+	if(c >= 'a' && c <= 'f')
+	{
+		return c - 'a' + 10;
+	}
+	return -1;
+}
+
+bool hex_binary_build(
+	const char* hex_path,
+	uint64_t source_size,
+	int64_t source_mtime,
+	std::vector<uint8_t>& binary_out)
+{
+	ASSERT(hex_path != NULL);
+
+	// read the whole file at once, it's only a few MB.
+	std::vector<char> text;
+	{
+		Unique_RWops file = Unique_RWops_OpenFS(hex_path, "rb");
+		if(!file)
+		{
+			return false;
+		}
+		RW_ssize_t file_size = file->size();
+		if(file_size < 0)
+		{
+			return false;
+		}
+		text.resize(file_size);
+		if(!text.empty() && file->read(text.data(), 1, text.size()) != text.size())
+		{
+			serrf("%s: failed to read\n", file->name());
+			return false;
+		}
+		if(!file->close())
+		{
+			return false;
+		}
+	}
+
+	// index + 1 into blocks, 0 = no glyphs.
+	std::vector<uint32_t> block_indexes;
+	std::vector<hex_binary_block> blocks;
+
+	const char* cur = text.data();
+	const char* end = text.data() + text.size();
+	size_t line = 1;
+	while(cur != end)
+	{
+		// blank lines, or linux inserting a newline at the end of the file.
+		if(*cur == '\n' || *cur == '\r')
+		{
+			line += (*cur == '\n') ? 1 : 0;
+			++cur;
+			continue;
+		}
+
+		// get the character XXXX:...
+		uint32_t codepoint = 0;
+		{
+			size_t digits = 0;
+			for(; cur != end && *cur != ':'; ++cur, ++digits)
+			{
+				int value = hex_digit(*cur);
+				// in hexadecimal, 8 characters = 4 bytes.
+				if(value < 0 || digits == 8)
+				{
+					serrf("%s: failed to convert hex (line: %zu)\n", hex_path, line);
+					return false;
+				}
+				codepoint = (codepoint << 4) | value;
+			}
+			if(cur == end || digits == 0)
+			{
+				serrf("%s: unexpected end or null (line: %zu)\n", hex_path, line);
+				return false;
+			}
+			// skip ':'
+			++cur;
+		}
+		if(codepoint > 0x10FFFF)
+		{
+			serrf("%s: out of range (line: %zu)\n", hex_path, line);
+			return false;
+		}
+
+		size_t block_index = codepoint / HEX_BINARY_BLOCK_GLYPHS;
+		if(block_index >= block_indexes.size())
+		{
+			block_indexes.resize(block_index + 1, 0);
+		}
+		// if the codepoint is using a block that is before the back() block.
+		if(block_index + 1 < block_indexes.size())
+		{
+			serrf("%s: hex unsorted %u (line: %zu)\n", hex_path, codepoint, line);
+			return false;
+		}
+		if(block_indexes[block_index] == 0)
+		{
+			blocks.emplace_back();
+			memset(&blocks.back(), 0, sizeof(hex_binary_block));
+			block_indexes[block_index] = blocks.size();
+		}
+		hex_binary_block& block = blocks[block_indexes[block_index] - 1];
+		size_t glyph_index = codepoint % HEX_BINARY_BLOCK_GLYPHS;
+
+		// get the bitmap XXXX:XXXXXXXXXXXXXXXX...
+		const char* line_end = static_cast<const char*>(memchr(cur, '\n', end - cur));
+		if(line_end == NULL)
+		{
+			line_end = end;
+		}
+		size_t length = line_end - cur;
+		if(length != 0 && cur[length - 1] == '\r')
+		{
+			--length;
+		}
+		if(length != HEX_BINARY_GLYPH_BYTES && length != HEX_BINARY_GLYPH_BYTES * 2)
+		{
+			serrf("%s: bad size (line: %zu)\n", hex_path, line);
+			return false;
+		}
+		size_t size = length / 2;
+		if(!font_decode_hex(cur, block.data[glyph_index], size))
+		{
+			serrf("%s: bad hex (line: %zu)\n", hex_path, line);
+			return false;
+		}
+		cur += length;
+
+		block.flags[glyph_index] =
+			HEX_BINARY_FOUND | (size == HEX_BINARY_GLYPH_BYTES ? HEX_BINARY_FULL : 0);
+	}
+
+	size_t table_size = sizeof(uint32_t) * block_indexes.size();
+	size_t blocks_start = sizeof(hex_binary_header) + table_size;
+
+	// convert the indexes into offsets.
+	std::vector<uint32_t> block_offsets(block_indexes.size());
+	for(size_t i = 0; i < block_indexes.size(); ++i)
+	{
+		if(block_indexes[i] != 0)
+		{
+			block_offsets[i] = blocks_start + (block_indexes[i] - 1) * sizeof(hex_binary_block);
+		}
+	}
+
+	hex_binary_header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = HEX_BINARY_MAGIC;
+	header.version = HEX_BINARY_VERSION;
+	header.block_count = block_offsets.size();
+	header.source_size = source_size;
+	header.source_mtime = source_mtime;
+	header.source_hash = hex_binary_hash(text.data(), text.size());
+	header.binary_size = blocks_start + sizeof(hex_binary_block) * blocks.size();
+	header.table_hash = hex_binary_hash(block_offsets.data(), table_size);
+
+	binary_out.resize(header.binary_size);
+	uint8_t* out = binary_out.data();
+	memcpy(out, &header, sizeof(header));
+	memcpy(out + sizeof(header), block_offsets.data(), table_size);
+	memcpy(out + blocks_start, blocks.data(), sizeof(hex_binary_block) * blocks.size());
+
+	return true;
+}
+
+bool hex_binary_validate(const hex_binary_view& view, const char* name)
+{
+	ASSERT(name != NULL);
+	if(view.size < sizeof(hex_binary_header))
+	{
+		slogf("info: %s: too small\n", name);
+		return false;
+	}
+	const hex_binary_header* header = view.header();
+	if(header->magic != HEX_BINARY_MAGIC || header->version != HEX_BINARY_VERSION)
+	{
+		slogf("info: %s: wrong version\n", name);
+		return false;
+	}
+	if(header->binary_size != view.size)
+	{
+		slogf("info: %s: wrong size\n", name);
+		return false;
+	}
+	size_t blocks_start = sizeof(hex_binary_header) + sizeof(uint32_t) * header->block_count;
+	if(blocks_start > view.size)
+	{
+		slogf("info: %s: table out of bounds\n", name);
+		return false;
+	}
+	const uint32_t* block_offsets = view.block_offsets();
+	if(hex_binary_hash(block_offsets, sizeof(uint32_t) * header->block_count) !=
+	   header->table_hash)
+	{
+		slogf("info: %s: table hash mismatch\n", name);
+		return false;
+	}
+	for(size_t i = 0; i < header->block_count; ++i)
+	{
+		uint32_t offset = block_offsets[i];
+		if(offset != 0 &&
+		   (offset < blocks_start || offset + sizeof(hex_binary_block) > view.size))
+		{
+			slogf("info: %s: block out of bounds\n", name);
+			return false;
+		}
+	}
+	return true;
+}
+
+bool hex_binary_save(const char* path, const std::vector<uint8_t>& binary)
+{
+	ASSERT(path != NULL);
+	std::string temp_path = std::string(path) + ".tmp";
+	FILE* fp = fopen(temp_path.c_str(), "wb");
+	if(fp == NULL)
+	{
+		slogf("info: failed to open: `%s`, reason: %s\n", temp_path.c_str(), strerror(errno));
+		return false;
+	}
+	bool failed = fwrite(binary.data(), 1, binary.size(), fp) != binary.size();
+	failed = (fclose(fp) != 0) || failed;
+	if(failed)
+	{
+		slogf("info: failed to write: `%s`, reason: %s\n", temp_path.c_str(), strerror(errno));
+		remove(temp_path.c_str());
+		return false;
+	}
+#ifdef _WIN32
+	// windows won't rename over an existing file.
+	remove(path);
+#endif
+	if(rename(temp_path.c_str(), path) != 0)
+	{
+		slogf("info: failed to rename: `%s`, reason: %s\n", temp_path.c_str(), strerror(errno));
+		remove(temp_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool hex_binary_update_mtime(const char* path, int64_t source_mtime)
+{
+	ASSERT(path != NULL);
+	FILE* fp = fopen(path, "r+b");
+	if(fp == NULL)
+	{
+		slogf("info: failed to open: `%s`, reason: %s\n", path, strerror(errno));
+		return false;
+	}
+	bool failed = fseek(fp, offsetof(hex_binary_header, source_mtime), SEEK_SET) != 0 ||
+				  fwrite(&source_mtime, sizeof(source_mtime), 1, fp) != 1;
+	failed = (fclose(fp) != 0) || failed;
+	if(failed)
+	{
+		slogf("info: failed to write: `%s`, reason: %s\n", path, strerror(errno));
+		return false;
+	}
+	return true;
+}
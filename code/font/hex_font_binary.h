@@ -0,0 +1,112 @@
+#pragma once
+
+#include "../global.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// a binary version of a unifont .hex file, so hex_font_data doesn't parse text on startup.
+// it is generated from the .hex file the first time, and then it is memory mapped.
+// the layout is:
+//   hex_binary_header
+//   uint32_t block_offsets[block_count] (the offset of a hex_binary_block, 0 = no glyphs)
+//   hex_binary_block blocks[] (only for blocks that have glyphs)
+// it is native endian, the magic won't match if the endian is different.
+enum
+{
+	HEX_BINARY_MAGIC = 0x42584548, // "HEXB"
+	// increment this if the layout changes.
+	HEX_BINARY_VERSION = 1,
+	// flags for hex_binary_block::flags
+	HEX_BINARY_FOUND = 1,
+	HEX_BINARY_FULL = 2,
+	// the same as HEX_CHUNK_GLYPHS.
+	HEX_BINARY_BLOCK_GLYPHS = 16 * 16,
+	HEX_BINARY_GLYPH_BYTES = 16 * 16 / 8
+};
+
+struct hex_binary_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t block_count;
+	uint32_t reserved;
+	// used to check if the .hex file changed, if the size and mtime match the hash is skipped.
+	uint64_t source_size;
+	int64_t source_mtime;
+	uint64_t source_hash;
+	// the size of the whole binary (to catch a truncated file)
+	uint64_t binary_size;
+	// hash of block_offsets.
+	uint64_t table_hash;
+};
+
+struct hex_binary_block
+{
+	// HEX_BINARY_FOUND | HEX_BINARY_FULL
+	uint8_t flags[HEX_BINARY_BLOCK_GLYPHS];
+	// the 1bpp bitmaps, half width glyphs only use the first half.
+	uint8_t data[HEX_BINARY_BLOCK_GLYPHS][HEX_BINARY_GLYPH_BYTES];
+};
+
+// a read only view of a whole file.
+// this is mmap on posix, but on windows and emscripten the file is read into memory.
+// the memory can also be a buffer that was just generated (so it doesn't need to be read back).
+struct hex_binary_view : public nocopy
+{
+	const uint8_t* data = NULL;
+	size_t size = 0;
+
+	// if the file was read or generated instead of mapped.
+	std::vector<uint8_t> memory;
+	bool mapped = false;
+
+	// returns false if the file can't be opened, this only prints info
+	// because a missing cache is expected (it just gets built again).
+	[[nodiscard]] bool open_file(const char* path);
+	void use_memory(std::vector<uint8_t> buffer);
+	void close();
+
+	~hex_binary_view();
+
+	const hex_binary_header* header() const
+	{
+		return reinterpret_cast<const hex_binary_header*>(data);
+	}
+	const uint32_t* block_offsets() const
+	{
+		return reinterpret_cast<const uint32_t*>(data + sizeof(hex_binary_header));
+	}
+};
+
+// the size and modified time of a file, returns false if it doesn't exist.
+NDSERR bool hex_binary_stat(const char* path, uint64_t* size_out, int64_t* mtime_out);
+
+// FNV-1a, not cryptographic, this is only for checking if a file changed.
+uint64_t hex_binary_hash(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325);
+
+// hashes a whole file (for when the mtime changed but the file might be the same).
+NDSERR bool hex_binary_hash_file(const char* path, uint64_t* hash_out);
+
+// parse the .hex file and write the binary into binary_out,
+// the source_size and source_mtime are from hex_binary_stat.
+NDSERR bool hex_binary_build(
+	const char* hex_path,
+	uint64_t source_size,
+	int64_t source_mtime,
+	std::vector<uint8_t>& binary_out);
+
+// checks that the header and block table are in bounds (prints info if not).
+// does not check if the .hex file changed.
+[[nodiscard]] bool hex_binary_validate(const hex_binary_view& view, const char* name);
+
+// writes to a temporary file and renames it, so a crash won't leave a half written cache.
+// this only prints info, because the cache is optional (the folder could be read only).
+[[nodiscard]] bool hex_binary_save(const char* path, const std::vector<uint8_t>& binary);
+
+// rewrites the source_mtime in the header of the cache at path,
+// for when the hash matched but the mtime didn't (so the next startup skips the hash).
+// this only prints info, same as hex_binary_save.
+[[nodiscard]] bool hex_binary_update_mtime(const char* path, int64_t source_mtime);
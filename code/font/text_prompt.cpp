@@ -6,6 +6,7 @@
 #include "../app.h" // for the scroll cvar
 #include "utf8_stuff.h"
 #include "../ui.h"
+#include "../zone_profiler.h"
 
 // TODO(dootsie): add in double click selection?
 // TODO(dootsie): add in size limited option (in bytes)
@@ -152,20 +153,11 @@ void text_prompt_wrapper::replace_string(std::string_view contents, bool clear_h
 	update_buffer = true;
 
 	std::u32string wstr;
-	wstr.reserve(contents.size());
-	std::string_view::iterator str_cur = contents.begin();
-	std::string_view::iterator str_end = contents.end();
-	while(str_cur != str_end)
+	utf8::internal::utf_error err_code =
+		cpputf_decode_string(wstr, contents.data(), contents.size());
+	if(err_code != utf8::internal::UTF8_OK)
 	{
-		uint32_t codepoint;
-		utf8::internal::utf_error err_code =
-			utf8::internal::validate_next(str_cur, str_end, codepoint);
-		if(err_code != utf8::internal::UTF8_OK)
-		{
-			slogf("info: %s bad utf8: %s\n", __func__, cpputf_get_error(err_code));
-			break;
-		}
-		wstr.push_back(codepoint);
+		slogf("info: %s bad utf8: %s\n", __func__, cpputf_get_error(err_code));
 	}
 
 	if(clear_history)
@@ -175,6 +167,7 @@ void text_prompt_wrapper::replace_string(std::string_view contents, bool clear_h
 		// dynamic).
 		stb_textedit_clear_state(&stb_state, single_line() ? 1 : 0);
 		text_data.clear();
+		rows_valid = false;
 	}
 	else
 	{
@@ -218,6 +211,7 @@ void text_prompt_wrapper::clear_string()
 	// and I would need to manually create a undo record, because paste would create 2.
 	stb_textedit_clear_state(&stb_state, single_line() ? 1 : 0);
 	text_data.clear();
+	rows_valid = false;
 
 	// stb_state.select_start = STB_TEXTEDIT_STRINGLEN(this);
 	// stb_state.select_end = STB_TEXTEDIT_STRINGLEN(this);
@@ -227,13 +221,15 @@ void text_prompt_wrapper::clear_string()
 std::string text_prompt_wrapper::get_string() const
 {
 	std::string out;
-	for(const prompt_char& c : text_data)
-	{
-		if(!cpputf_append_string(out, c.codepoint))
+	text_data.for_each_span(0, text_data.size(), [&out](const prompt_char* span, size_t count) {
+		for(size_t i = 0; i < count; ++i)
 		{
-			slogf("info: invalid codepoint from prompt: U+%X\n", c.codepoint);
+			if(!cpputf_append_string(out, span[i].codepoint))
+			{
+				slogf("info: invalid codepoint from prompt: U+%X\n", span[i].codepoint);
+			}
 		}
-	}
+	});
 	return out;
 }
 
@@ -289,6 +285,8 @@ void text_prompt_wrapper::update(double)
 
 bool text_prompt_wrapper::draw()
 {
+	ZONE_SCOPE("text_prompt_wrapper::draw");
+
 	float lineskip = get_lineskip();
 
 	// we don't need to draw again.
@@ -307,7 +305,7 @@ bool text_prompt_wrapper::draw()
 	float caret_x = -1;
 	float caret_y = -1;
 	bool caret_visible = false;
-	if(!internal_draw_text(0, &caret_visible, &caret_x, &caret_y))
+	if(!internal_draw_text(&caret_visible, &caret_x, &caret_y))
 	{
 		return false;
 	}
@@ -367,7 +365,7 @@ void text_prompt_wrapper::internal_draw_widgets()
 		{
 			bool has_vertical = (y_scrollable() && get_scroll_height() > (box_ymax - box_ymin));
 			bool has_horizontal = (x_scrollable() && get_scroll_width() > (box_xmax - box_xmin));
-			if(has_vertical)
+			if(has_vertical && !external_y_scroll())
 			{
 				float scrollbar_max_height =
 					(box_ymax - box_ymin) - (has_horizontal ? scrollbar_thickness - 1 : 0.f);
@@ -427,7 +425,7 @@ void text_prompt_wrapper::internal_draw_widgets()
 		// draw the thumbs
 		bool has_vertical = (y_scrollable() && get_scroll_height() > (box_ymax - box_ymin));
 		bool has_horizontal = (x_scrollable() && get_scroll_width() > (box_xmax - box_xmin));
-		if(has_vertical)
+		if(has_vertical && !external_y_scroll())
 		{
 			float scrollbar_max_height =
 				(box_ymax - box_ymin) - (has_horizontal ? scrollbar_thickness - 1 : 0.f);
@@ -482,133 +480,47 @@ bool text_prompt_wrapper::internal_draw_pretext()
 
 	if(y_scrollable() || x_scrollable())
 	{
-		// find the cursor to check if we need to move the scroll.
-		// this is mainly for the worst case which is if the cursor is below the box.
-		// this could be slow?, could be optimized by caching the previous scroll area.
-		// probably not neccessary because STB's whole API slow (but simple!) so just refactor
-		// everything.
+		// the size comes from the line index, and the cursor is found with a binary search.
+		internal_update_rows();
+
+		size_t end = text_data.size();
+		bool trailing_newline = !text_data.empty() && text_data.back().codepoint == '\n';
 
 		if(x_scrollable())
 		{
-			scroll_w = 0;
+			scroll_w = rows_max_width;
 		}
 
-		size_t cur = 0;
-		size_t end = text_data.size();
-		float cur_x = 0;
-		float cur_y = 0;
-		float found_cur_x = -1;
-		float found_cur_y = -1;
-#ifndef NDEBUG
-		bool found_cur = false;
-#endif
-		while(cur != end)
+		// the y of the last row (the newline at the end makes a empty row).
+		float cur_y = rows.empty() ? 0 : static_cast<float>(rows.size() - 1) * lineskip;
+		if(trailing_newline)
 		{
-			StbTexteditRow r;
-			STB_TEXTEDIT_LAYOUTROW(&r, this, cur);
+			cur_y += lineskip;
+		}
 
-			// if we can scroll horizontally, we need to find the width of every line.
-			if(x_scrollable())
+		float found_cur_x = 0;
+		float found_cur_y = 0;
+		if(scroll_to_cursor && !rows.empty())
+		{
+			size_t cursor = std::min<size_t>(std::max(stb_state.cursor, 0), end);
+			if(cursor == end && trailing_newline)
 			{
-				int i;
-				float width = 0;
-				for(i = 0; i != r.num_chars; ++i)
-				{
-					prompt_char c = text_data.at(cur + i);
-					if(c.codepoint != '\n')
-					{
-						width += c.advance * get_scale();
-					}
-				}
-				scroll_w = std::max(scroll_w, width);
+				found_cur_x = 0;
+				found_cur_y = cur_y;
 			}
-
-			if(scroll_to_cursor)
+			else
 			{
-				if(stb_state.cursor >= static_cast<int>(cur) &&
-				   stb_state.cursor <= static_cast<int>(cur + r.num_chars))
+				size_t row_index = internal_find_row(cursor);
+				found_cur_y = static_cast<float>(row_index) * lineskip;
+				for(size_t i = rows[row_index].start; i != cursor; ++i)
 				{
-					if(x_scrollable() || y_scrollable())
+					if(text_data[i].codepoint != '\n')
 					{
-						cur_x = 0;
-						int i;
-						for(i = 0; i != r.num_chars; ++i)
-						{
-							if(static_cast<int>(cur + i) == stb_state.cursor)
-							{
-#ifndef NDEBUG
-								// ASSERT(!found_cur);
-								found_cur = true;
-#endif
-								found_cur_x = cur_x;
-								found_cur_y = cur_y;
-								break;
-							}
-							if(text_data.at(cur + i).codepoint != '\n')
-							{
-								cur_x += text_data.at(cur + i).advance * get_scale();
-							}
-						}
-						if(i == r.num_chars && ((static_cast<int>(cur + i) == stb_state.cursor)))
-						{
-#ifndef NDEBUG
-							// ASSERT(!found_cur);
-							found_cur = true;
-#endif
-							if(!text_data.empty() && text_data.at(cur + i - 1).codepoint == '\n')
-							{
-								found_cur_x = 0;
-								found_cur_y = cur_y + lineskip;
-							}
-							else
-							{
-								found_cur_x = cur_x;
-								found_cur_y = cur_y;
-							}
-						}
+						found_cur_x += text_data[i].advance * get_scale();
 					}
 				}
-
-				// this is a hint if the cursor is below the view,
-				// this could still be as bad as starting from the beginning,
-				// but most of the time it's probably just one line away.
-				if(cur_y < scroll_y)
-				{
-					// first_pass_hint = static_cast<int>(cur);
-				}
-			}
-
-			cur += r.num_chars;
-			if(cur != end)
-			{
-				// don't do this at the end because the newline decides if there is a lineskip.
-				cur_y += lineskip;
 			}
 		}
-		if(!text_data.empty() && text_data.back().codepoint == '\n')
-		{
-			cur_y += lineskip;
-			cur_x = 0;
-		}
-
-		if(stb_state.cursor == static_cast<int>(end))
-		{
-			if((x_scrollable() || y_scrollable()) && scroll_to_cursor)
-			{
-#ifndef NDEBUG
-				// ASSERT(!found_cur);
-				found_cur = true;
-#endif
-				found_cur_x = cur_x;
-				found_cur_y = cur_y;
-			}
-		}
-#ifndef NDEBUG
-		if(scroll_to_cursor && (x_scrollable() || y_scrollable()))
-		{
-			ASSERT(found_cur && "cursor not found");
-		}
-#endif
 
 		if(y_scrollable())
 		{
@@ -678,8 +590,7 @@ bool text_prompt_wrapper::internal_draw_pretext()
 	return true;
 }
 
-bool text_prompt_wrapper::internal_draw_text(
-	size_t offset, bool* caret_visible, float* caret_x, float* caret_y)
+bool text_prompt_wrapper::internal_draw_text(bool* caret_visible, float* caret_x, float* caret_y)
 {
 	auto white_uv = state.font->get_font_atlas()->white_uv;
 
@@ -704,10 +615,35 @@ bool text_prompt_wrapper::internal_draw_text(
 	float backdrop_minx = -1;
 	int active_color_index = -1;
 
-	size_t i = offset;
-	size_t cur = offset;
+	size_t i = 0;
+	size_t cur = 0;
 	size_t end = text_data.size();
 
+	// skip to the first visible row, the rows above would only change the selection.
+	internal_update_rows();
+	if(y_scrollable() && cull_box() && !rows.empty())
+	{
+		size_t first_row = 0;
+		if(scroll_y > 0 && lineskip > 0)
+		{
+			first_row = std::min<size_t>(
+				static_cast<size_t>(std::floor(scroll_y / lineskip)), rows.size() - 1);
+		}
+		// the same test as the loop below, in case of rounding.
+		while(first_row != 0 &&
+			  state.draw_y_pos + static_cast<float>(first_row) * lineskip > box_ymin)
+		{
+			--first_row;
+		}
+		i = rows[first_row].start;
+		cur = i;
+		state.draw_y_pos += static_cast<float>(first_row) * lineskip;
+		if(STB_TEXT_HAS_SELECTION(&stb_state))
+		{
+			currently_selected = selection_start < cur && selection_end >= cur;
+		}
+	}
+
 	while(cur != end)
 	{
 		StbTexteditRow r;
@@ -764,7 +700,7 @@ bool text_prompt_wrapper::internal_draw_text(
 
 		for(; cur != i; ++cur)
 		{
-			prompt_char ret = text_data.at(cur);
+			prompt_char ret = text_data[cur];
 			if(draw_backdrop())
 			{
 				if(active_color_index != -1 && active_color_index != ret.color_index)
@@ -1054,7 +990,7 @@ bool text_prompt_wrapper::internal_draw_marked(float x, float y)
 	marked_caret_x = state.draw_x_pos;
 	marked_caret_y = state.draw_y_pos;
 
-	size_t marked_text_buffer_index = state.batcher->get_current_vertex_count();
+	size_t marked_text_buffer_index = state.batcher->get_quad_count();
 
 	while(str_cur != str_end)
 	{
@@ -1105,11 +1041,8 @@ bool text_prompt_wrapper::internal_draw_marked(float x, float y)
 	if(cull_box() && pos_w > box_xmax)
 	{
 		float x_off = pos_w - box_xmax;
-		size_t size = state.batcher->get_current_vertex_count();
-		for(; marked_text_buffer_index < size; ++marked_text_buffer_index)
-		{
-			state.batcher->buffer[marked_text_buffer_index].pos[0] -= x_off;
-		}
+		state.batcher->translate_quads(
+			marked_text_buffer_index, state.batcher->get_quad_count(), -x_off, 0);
 		pos_x -= x_off;
 		pos_w -= x_off;
 		marked_caret_x -= x_off;
@@ -1272,7 +1205,7 @@ TEXT_PROMPT_RESULT text_prompt_wrapper::input(SDL_Event& e)
 
 	// lazy scroll
 	case SDL_MOUSEWHEEL:
-		if(y_scrollable())
+		if(y_scrollable() && !external_y_scroll())
 		{
 			// only scroll when the mouse is currently hovering over the bounding box
 			int x;
@@ -1443,7 +1376,8 @@ TEXT_PROMPT_RESULT text_prompt_wrapper::input(SDL_Event& e)
 			float mouse_x = static_cast<float>(e.button.x);
 			float mouse_y = static_cast<float>(e.button.y);
 
-			if(y_scrollable() && internal_scroll_y_inside(mouse_x, mouse_y))
+			if(y_scrollable() && !external_y_scroll() &&
+			   internal_scroll_y_inside(mouse_x, mouse_y))
 			{
 				y_scrollbar_held = true;
 				internal_scroll_y_to(mouse_y);
@@ -1521,24 +1455,12 @@ TEXT_PROMPT_RESULT text_prompt_wrapper::input(SDL_Event& e)
 		drag_x = -1;
 		drag_y = -1;
 
-		size_t text_len = strlen(e.text.text);
-
 		std::u32string wstr;
-		wstr.reserve(text_len);
-		const char* str_cur = e.text.text;
-		const char* str_end = e.text.text + text_len;
-
-		while(str_cur != str_end)
+		utf8::internal::utf_error err_code =
+			cpputf_decode_string(wstr, e.text.text, strlen(e.text.text));
+		if(err_code != utf8::internal::UTF8_OK)
 		{
-			uint32_t codepoint;
-			utf8::internal::utf_error err_code =
-				utf8::internal::validate_next(str_cur, str_end, codepoint);
-			if(err_code != utf8::internal::UTF8_OK)
-			{
-				slogf("info: %s bad utf8: %s\n", __func__, cpputf_get_error(err_code));
-				break;
-			}
-			wstr.push_back(codepoint);
+			slogf("info: %s bad utf8: %s\n", __func__, cpputf_get_error(err_code));
 		}
 
 		// NOLINTNEXTLINE(bugprone-narrowing-conversions)
@@ -1734,16 +1656,15 @@ TEXT_PROMPT_RESULT text_prompt_wrapper::input(SDL_Event& e)
 			{
 				if(STB_TEXT_HAS_SELECTION(&stb_state))
 				{
-					auto start =
-						text_data.begin() + std::min(stb_state.select_start, stb_state.select_end);
-					auto end =
-						text_data.begin() + std::max(stb_state.select_start, stb_state.select_end);
+					size_t start = std::min(stb_state.select_start, stb_state.select_end);
+					size_t end = std::max(stb_state.select_start, stb_state.select_end);
 					std::string out;
 					for(; start != end; ++start)
 					{
-						if(!cpputf_append_string(out, start->codepoint))
+						char32_t codepoint = text_data[start].codepoint;
+						if(!cpputf_append_string(out, codepoint))
 						{
-							slogf("info: invalid codepoint from prompt: U+%X\n", start->codepoint);
+							slogf("info: invalid codepoint from prompt: U+%X\n", codepoint);
 						}
 					}
 					if(SDL_SetClipboardText(out.c_str()) != 0)
@@ -1767,16 +1688,15 @@ TEXT_PROMPT_RESULT text_prompt_wrapper::input(SDL_Event& e)
 				if(STB_TEXT_HAS_SELECTION(&stb_state))
 				{
 					scroll_to_cursor = true;
-					auto start =
-						text_data.begin() + std::min(stb_state.select_start, stb_state.select_end);
-					auto end =
-						text_data.begin() + std::max(stb_state.select_start, stb_state.select_end);
+					size_t start = std::min(stb_state.select_start, stb_state.select_end);
+					size_t end = std::max(stb_state.select_start, stb_state.select_end);
 					std::string out;
 					for(; start != end; ++start)
 					{
-						if(!cpputf_append_string(out, start->codepoint))
+						char32_t codepoint = text_data[start].codepoint;
+						if(!cpputf_append_string(out, codepoint))
 						{
-							slogf("info: invalid codepoint from prompt: U+%X\n", start->codepoint);
+							slogf("info: invalid codepoint from prompt: U+%X\n", codepoint);
 						}
 					}
 					if(stb_textedit_cut(this, &stb_state) != 1)
@@ -1814,25 +1734,12 @@ TEXT_PROMPT_RESULT text_prompt_wrapper::input(SDL_Event& e)
 					slogf("info: Failed to get clipboard! SDL Error: %s\n", SDL_GetError());
 					break;
 				}
-				size_t text_len = strlen(utext.get());
-				const char* str_cur = utext.get();
-				const char* str_end = utext.get() + text_len;
-
 				std::u32string wstr;
-				// not accurate but faster than nothing.
-				wstr.reserve(text_len);
-
-				while(str_cur != str_end)
+				utf8::internal::utf_error err_code =
+					cpputf_decode_string(wstr, utext.get(), strlen(utext.get()));
+				if(err_code != utf8::internal::UTF8_OK)
 				{
-					uint32_t codepoint;
-					utf8::internal::utf_error err_code =
-						utf8::internal::validate_next(str_cur, str_end, codepoint);
-					if(err_code != utf8::internal::UTF8_OK)
-					{
-						slogf("info: %s bad utf8: %s\n", __func__, cpputf_get_error(err_code));
-						break;
-					}
-					wstr.push_back(codepoint);
+					slogf("info: %s bad utf8: %s\n", __func__, cpputf_get_error(err_code));
 				}
 
 				// if you paste ontop of a selection, stb has a bug where it will require 2 undo's.
@@ -1891,9 +1798,11 @@ TEXT_PROMPT_RESULT text_prompt_wrapper::input(SDL_Event& e)
 			// to the right where there is no text on the wrapped line
 			// (the 2nd bottom row must be longer than the wrapped bottom row)
 			// then press down then up and you won't move up (without this fix)
-			text_data.push_back({'\n', STB_TEXTEDIT_GETWIDTH_NEWLINE, 0, FONT_STYLE_NORMAL});
+			text_data.push_back({'\n', FONT_STYLE_NORMAL, 0, STB_TEXTEDIT_GETWIDTH_NEWLINE});
+			internal_edit_rows(text_data.size() - 1, 1, 0);
 			stb_textedit_key(this, &stb_state, STB_TEXTEDIT_K_UP | key_shift_mod);
 			text_data.pop_back();
+			internal_edit_rows(text_data.size(), 0, 1);
 			blink_timer = timer_now();
 			update_buffer = true;
 			// eat
@@ -1989,17 +1898,27 @@ TEXT_PROMPT_RESULT text_prompt_wrapper::input(SDL_Event& e)
 	return TEXT_PROMPT_RESULT::CONTINUE;
 }
 
-void text_prompt_wrapper::stb_layout_func(StbTexteditRow* row, int i)
+text_prompt_wrapper::row_layout_key text_prompt_wrapper::internal_get_row_key() const
 {
-	auto last_space = text_data.end();
+	// the read only flag is toggled when the console adds to the log.
+	TEXTP_FLAG layout_flags = flags & (TEXTP_WORD_WRAP | TEXTP_X_SCROLL | TEXTP_SINGLE_LINE |
+									   TEXTP_DISABLE_CULL);
+	return {
+		get_scale(), box_xmax - box_xmin, space_advance_cache, scrollbar_thickness, layout_flags};
+}
+
+void text_prompt_wrapper::internal_layout_row(size_t start, prompt_row* row_out)
+{
+	size_t end = text_data.size();
+	size_t last_space = end;
 	float last_space_advance = STB_TEXTEDIT_GETWIDTH_NEWLINE;
 	float total_advance = box_xmin;
 
-	auto cur = text_data.begin() + i;
-	auto start = cur;
-	for(; cur != text_data.end(); ++cur)
+	size_t cur = start;
+	for(; cur != end; ++cur)
 	{
-		if(cur->codepoint == '\n')
+		prompt_char& c = text_data[cur];
+		if(c.codepoint == '\n')
 		{
 			ASSERT(!single_line());
 			++cur;
@@ -2008,31 +1927,31 @@ void text_prompt_wrapper::stb_layout_func(StbTexteditRow* row, int i)
 
 		// I really want to support U+3000 which is CJK space,
 		// but lets pretend like CJK people hate word wrap :)
-		if(word_wrap() && cur->codepoint == ' ')
+		if(word_wrap() && c.codepoint == ' ')
 		{
-			cur->advance = space_advance_cache;
-			total_advance += cur->advance * get_scale();
+			c.advance = space_advance_cache;
+			total_advance += c.advance * get_scale();
 			last_space = cur;
 			last_space_advance = total_advance;
 		}
 		else
 		{
-			if(cur->codepoint == '\t')
+			if(c.codepoint == '\t')
 			{
 				total_advance += space_advance_cache * 4 * get_scale();
 			}
 			else
 			{
-				total_advance += cur->advance * get_scale();
+				total_advance += c.advance * get_scale();
 			}
 			// I can't remove the padding for the scrollbar because this function is
 			// used to calculate scroll_h, which means scroll_h will be incorrect.
 			if(!single_line() && !x_scrollable() && cull_box() &&
 			   total_advance > box_xmax - scrollbar_thickness)
 			{
-				if(word_wrap() && last_space != text_data.end())
+				if(word_wrap() && last_space != end)
 				{
-					last_space->advance = STB_TEXTEDIT_GETWIDTH_NEWLINE;
+					text_data[last_space].advance = STB_TEXTEDIT_GETWIDTH_NEWLINE;
 					cur = last_space + 1;
 					total_advance = last_space_advance;
 				}
@@ -2040,12 +1959,137 @@ void text_prompt_wrapper::stb_layout_func(StbTexteditRow* row, int i)
 			}
 		}
 	}
+	// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+	row_out->start = start;
 	// num_chars must be more than 0 or else infinate loop.
 	// this happens if the width of the box is 0 or very small
 	// NOLINTNEXTLINE(bugprone-narrowing-conversions)
-	row->num_chars = std::max<int>(1, std::distance(start, cur));
+	row_out->num_chars = std::max<size_t>(1, cur - start);
+	row_out->width = total_advance - box_xmin;
+}
+
+void text_prompt_wrapper::internal_update_rows()
+{
+	row_layout_key key = internal_get_row_key();
+	if(rows_valid && key == rows_key)
+	{
+		return;
+	}
+	ZONE_SCOPE("text_prompt_wrapper::internal_update_rows");
+	rows_key = key;
+	rows_valid = true;
+	rows.clear();
+	rows_max_width = 0;
+	size_t size = text_data.size();
+	for(size_t pos = 0; pos < size;)
+	{
+		prompt_row row;
+		internal_layout_row(pos, &row);
+		rows.push_back(row);
+		rows_max_width = std::max(rows_max_width, row.width);
+		pos += row.num_chars;
+	}
+}
+
+void text_prompt_wrapper::internal_edit_rows(size_t index, size_t inserted, size_t deleted)
+{
+	if(!rows_valid)
+	{
+		return;
+	}
+	if(rows.empty())
+	{
+		// lay out everything on the next update.
+		rows_valid = false;
+		return;
+	}
+
+	// start from the row before, because removing the start of a row with word wrap
+	// could let the first word fit on the previous row.
+	size_t first = internal_find_row(index);
+	if(first != 0)
+	{
+		--first;
+	}
+
+	// a row only depends on the text after it's start,
+	// so once a new row starts where an old row after the edit started, the rest are the same.
+	size_t edit_end = index + deleted;
+	size_t old = first + 1;
+	size_t size = text_data.size();
+	size_t pos = rows[first].start;
+	std::vector<prompt_row> new_rows;
+	bool resync = false;
+	while(pos < size)
+	{
+		while(old < rows.size() &&
+			  (rows[old].start < edit_end || rows[old].start + inserted - deleted < pos))
+		{
+			++old;
+		}
+		if(old < rows.size() && rows[old].start + inserted - deleted == pos)
+		{
+			resync = true;
+			break;
+		}
+		prompt_row row;
+		internal_layout_row(pos, &row);
+		new_rows.push_back(row);
+		pos += row.num_chars;
+	}
+
+	if(resync)
+	{
+		for(size_t i = old; i < rows.size(); ++i)
+		{
+			// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+			rows[i].start = rows[i].start + inserted - deleted;
+		}
+	}
+	else
+	{
+		old = rows.size();
+	}
+	rows.erase(rows.begin() + first, rows.begin() + old);
+	rows.insert(rows.begin() + first, new_rows.begin(), new_rows.end());
+
+	rows_max_width = 0;
+	for(const prompt_row& row : rows)
+	{
+		rows_max_width = std::max(rows_max_width, row.width);
+	}
+}
+
+size_t text_prompt_wrapper::internal_find_row(size_t index) const
+{
+	ASSERT(!rows.empty());
+	auto it = std::upper_bound(
+		rows.begin(), rows.end(), index, [](size_t value, const prompt_row& row) {
+			return value < row.start;
+		});
+	return (it == rows.begin()) ? 0 : std::distance(rows.begin(), it) - 1;
+}
+
+void text_prompt_wrapper::stb_layout_func(StbTexteditRow* row, int i)
+{
+	internal_update_rows();
+
+	prompt_row cached;
+	size_t row_index = rows.empty() ? 0 : internal_find_row(i);
+	if(row_index < rows.size() && rows[row_index].start == static_cast<size_t>(i))
+	{
+		cached = rows[row_index];
+	}
+	else
+	{
+		// stb only starts rows where the last one ended, so this shouldn't happen.
+		internal_layout_row(i, &cached);
+	}
+
+	// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+	row->num_chars = cached.num_chars;
 	row->x0 = box_xmin - scroll_x;
-	row->x1 = total_advance - scroll_x;
+	row->x1 = box_xmin + cached.width - scroll_x;
 	row->ymin = box_ymin - scroll_y;
 	row->ymax = box_ymin + get_lineskip() - scroll_y;
 	row->baseline_y_delta = get_lineskip();
@@ -2062,15 +2106,21 @@ int text_prompt_wrapper::stb_insert_chars(int index, const STB_TEXTEDIT_CHARTYPE
 		return 0;
 	}
 
-	auto it = text_data.insert(text_data.begin() + index, n, prompt_char{});
+	prompt_char* it = text_data.insert(index, n);
 	for(int i = 0; i < n; ++i, ++it)
 	{
+		it->advance = 0;
 		it->color_index = current_color_index;
 		it->style = current_style;
 		if(single_line() && text[i] == STB_TEXTEDIT_NEWLINE)
 		{
 			it->codepoint = '#';
 		}
+		else if(text[i] > 0x10FFFF)
+		{
+			// this won't fit into prompt_char
+			it->codepoint = 0xFFFD;
+		}
 		else
 		{
 			it->codepoint = text[i];
@@ -2097,10 +2147,14 @@ int text_prompt_wrapper::stb_insert_chars(int index, const STB_TEXTEDIT_CHARTYPE
 			break;
 			case FONT_BASIC_RESULT::ERROR:
 				// TODO: handle this error???
+				// remove what was inserted, so the text is unchanged (stb expects that for 0).
+				text_data.erase(index, n);
+				rows_valid = false;
 				return 0;
 			}
 		}
 	}
+	internal_edit_rows(index, n, 0);
 	return 1;
 }
 
@@ -2112,7 +2166,8 @@ void text_prompt_wrapper::stb_delete_chars(int index, int n)
 		// yes this does happen because stb undo/redo is broken
 		return;
 	}
-	text_data.erase(text_data.begin() + index, text_data.begin() + (index + n));
+	text_data.erase(index, n);
+	internal_edit_rows(index, 0, n);
 }
 
 float text_prompt_wrapper::stb_get_width(int linestart, int index)
@@ -2124,7 +2179,7 @@ float text_prompt_wrapper::stb_get_width(int linestart, int index)
 		// more bugs that are caused by this...
 		return STB_TEXTEDIT_GETWIDTH_NEWLINE;
 	}
-	return text_data.at(linestart + index).advance * get_scale();
+	return text_data[linestart + index].advance * get_scale();
 }
 
 STB_TEXTEDIT_CHARTYPE text_prompt_wrapper::stb_get_char(int index)
@@ -2134,5 +2189,5 @@ STB_TEXTEDIT_CHARTYPE text_prompt_wrapper::stb_get_char(int index)
 		// yes this does happen because stb undo/redo is broken
 		return 0;
 	}
-	return text_data.at(index).codepoint;
+	return text_data[index].codepoint;
 }
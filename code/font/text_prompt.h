@@ -2,6 +2,7 @@
 
 #include "../global.h"
 #include "font_manager.h"
+#include "gap_buffer.h"
 
 #define STB_TEXTEDIT_CHARTYPE char32_t
 
@@ -51,7 +52,12 @@ enum TEXT_PROMPT_FLAGS : TEXTP_FLAG
 	TEXTP_DISABLE_CULL = (1 << 7),
 	// fill the back of each letter of text with a backdrop
 	// if you want a full backdrop, just draw it yourself.
-	TEXTP_DRAW_BACKDROP = (1 << 8)
+	TEXTP_DRAW_BACKDROP = (1 << 8),
+	// for text that only holds the part of a bigger document that is on screen
+	// (like the console log), the owner scrolls the document and draws it's own scrollbar,
+	// so the vertical scrollbar and the mouse wheel are disabled.
+	// combine with TEXTP_Y_SCROLL, the space for the scrollbar is still reserved.
+	TEXTP_EXTERNAL_Y_SCROLL = (1 << 9)
 };
 
 struct text_prompt_wrapper
@@ -63,20 +69,56 @@ struct text_prompt_wrapper
 	// to use dynamic allocation.
 	STB_TexteditState stb_state;
 
+	// packed into 8 bytes, unicode only needs 21 bits.
 	struct prompt_char
 	{
 		// char32_t is overkill, but stb_textedit doesn't like utf8
 		// Also in hindsight, the downside of ucs32 is that
 		// it's harder to limit the prompt text to a utf8 length...
-		char32_t codepoint;
-		float advance;
+		uint32_t codepoint : 21;
+		// font_style_type (FONT_STYLE_MASK)
+		uint32_t style : 3;
 		// index 0 uses text_color
 		// index 1 uses index 0 of the optional color_table
-		uint8_t color_index;
-		font_style_type style;
+		uint32_t color_index : 8;
+		float advance;
 	};
+	static_assert(sizeof(prompt_char) == 8);
 
-	std::deque<prompt_char> text_data;
+	// the text is edited where the cursor is, so the gap stays there while typing.
+	gap_buffer<prompt_char> text_data;
+
+	// the line index, every row that stb_layout_func would make from the start of the text,
+	// so drawing and scrolling can jump to a row instead of laying out everything above it.
+	// edits only lay out the rows around the edit (see internal_edit_rows).
+	struct prompt_row
+	{
+		uint32_t start;
+		uint32_t num_chars;
+		// the advance from box_xmin, the newline is not included.
+		float width;
+	};
+	std::vector<prompt_row> rows;
+
+	// if any of these change, all the rows are laid out again.
+	struct row_layout_key
+	{
+		float scale;
+		float box_width;
+		float space_advance;
+		float scrollbar_thickness;
+		TEXTP_FLAG flags;
+		bool operator==(const row_layout_key& rhs) const
+		{
+			return scale == rhs.scale && box_width == rhs.box_width &&
+				   space_advance == rhs.space_advance &&
+				   scrollbar_thickness == rhs.scrollbar_thickness && flags == rhs.flags;
+		}
+	};
+	row_layout_key rows_key{};
+	bool rows_valid = false;
+	// the widest row, for scroll_w.
+	float rows_max_width = 0;
 
 	internal_font_painter_state state;
 
@@ -323,6 +365,10 @@ struct text_prompt_wrapper
 	{
 		return (flags & TEXTP_DRAW_BACKDROP) != 0;
 	}
+	bool external_y_scroll() const
+	{
+		return (flags & TEXTP_EXTERNAL_Y_SCROLL) != 0;
+	}
 
 	// scroll_w will not account for the padding for the scrollbar
 	float get_scroll_width()
@@ -354,9 +400,7 @@ struct text_prompt_wrapper
 	}
 
 	NDSERR bool internal_draw_pretext();
-	// TODO(dootsie): the offset was supposed to be from pretext to speed up scanning
-	NDSERR bool
-		internal_draw_text(size_t offset, bool* caret_visible, float* caret_x, float* caret_y);
+	NDSERR bool internal_draw_text(bool* caret_visible, float* caret_x, float* caret_y);
 	NDSERR bool internal_draw_marked(float x, float y);
 	void internal_draw_widgets();
 
@@ -366,6 +410,18 @@ struct text_prompt_wrapper
 	bool internal_scroll_x_inside(float mouse_x, float mouse_y);
 	void internal_scroll_x_to(float mouse_x);
 
+	// the line index
+	row_layout_key internal_get_row_key() const;
+	// lays out the row that starts at the index (this modifies the advance of spaces for
+	// word wrapping).
+	void internal_layout_row(size_t start, prompt_row* row_out);
+	// lays out every row if the rows are out of date.
+	void internal_update_rows();
+	// call this after the text is modified, the indexes are from before the edit.
+	void internal_edit_rows(size_t index, size_t inserted, size_t deleted);
+	// the row that the character is in (the last row if it's the end of the text).
+	size_t internal_find_row(size_t index) const;
+
 	// functions internally used by stb_textedit
 	void stb_layout_func(StbTexteditRow* row, int i);
 	int stb_insert_chars(int index, const STB_TEXTEDIT_CHARTYPE* text, int n);
@@ -1,5 +1,21 @@
+#include "../global_pch.h"
+#include "../global.h"
+
 #include "utf8_stuff.h"
 
+#include <vector>
+
+// the multi-byte sequences are scalar, vectorizing them (like simdutf) is a lot of code,
+// and the text I draw is mostly ASCII, the CJK path is still faster than validate_next.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UTF8_USE_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+// vmaxvq_u8 is only on aarch64
+#define UTF8_USE_NEON
+#include <arm_neon.h>
+#endif
+
 const char* cpputf_get_error(utf8::internal::utf_error err_code)
 {
 #define UTF8_ERROR(x) \
@@ -45,4 +61,323 @@ bool cpputf_append_string(std::string& str, char32_t cp)
 		str += static_cast<char>((cp & 0x3f) | 0x80);
 	}
 	return true;
-}
\ No newline at end of file
+}
+
+const char* cpputf_decode_kernel_name()
+{
+#if defined(UTF8_USE_SSE2)
+	return "sse2";
+#elif defined(UTF8_USE_NEON)
+	return "neon";
+#else
+	return "scalar";
+#endif
+}
+
+// the same as validate_next (including the error codes), but for pointers.
+static utf8::internal::utf_error cpputf_decode_sequence(
+	const uint8_t* cur, const uint8_t* end, char32_t* cp_out, size_t* len_out)
+{
+	uint8_t lead = cur[0];
+	size_t length;
+	char32_t cp;
+	if((lead >> 5) == 0x6)
+	{
+		length = 2;
+		cp = lead & 0x1f;
+	}
+	else if((lead >> 4) == 0xe)
+	{
+		length = 3;
+		cp = lead & 0xf;
+	}
+	else if((lead >> 3) == 0x1e)
+	{
+		length = 4;
+		cp = lead & 0x7;
+	}
+	else
+	{
+		return utf8::internal::INVALID_LEAD;
+	}
+
+	for(size_t i = 1; i < length; ++i)
+	{
+		if(cur + i == end)
+		{
+			return utf8::internal::NOT_ENOUGH_ROOM;
+		}
+		if((cur[i] & 0xc0) != 0x80)
+		{
+			return utf8::internal::INCOMPLETE_SEQUENCE;
+		}
+		cp = (cp << 6) | (cur[i] & 0x3f);
+	}
+
+	if(!utf8::internal::is_code_point_valid(cp))
+	{
+		return utf8::internal::INVALID_CODE_POINT;
+	}
+	if(utf8::internal::is_overlong_sequence(cp, length))
+	{
+		return utf8::internal::OVERLONG_SEQUENCE;
+	}
+
+	*cp_out = cp;
+	*len_out = length;
+	return utf8::internal::UTF8_OK;
+}
+
+cpputf_decode_result
+	cpputf_decode(const char* str, size_t size, char32_t* out, size_t out_size, bool lossy)
+{
+	ASSERT(str != NULL || size == 0);
+	ASSERT(out != NULL || out_size == 0);
+
+	cpputf_decode_result result;
+
+	const uint8_t* cur = reinterpret_cast<const uint8_t*>(str);
+	const uint8_t* end = cur + size;
+	char32_t* out_cur = out;
+	char32_t* out_end = out + out_size;
+
+	while(cur != end && out_cur != out_end)
+	{
+		if(*cur < 0x80)
+		{
+#if defined(UTF8_USE_SSE2)
+			// 16 ASCII bytes at a time.
+			const __m128i zero = _mm_setzero_si128();
+			while(end - cur >= 16 && out_end - out_cur >= 16)
+			{
+				__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur));
+				if(_mm_movemask_epi8(chunk) != 0)
+				{
+					break;
+				}
+				__m128i lo = _mm_unpacklo_epi8(chunk, zero);
+				__m128i hi = _mm_unpackhi_epi8(chunk, zero);
+				__m128i* dst = reinterpret_cast<__m128i*>(out_cur);
+				_mm_storeu_si128(dst + 0, _mm_unpacklo_epi16(lo, zero));
+				_mm_storeu_si128(dst + 1, _mm_unpackhi_epi16(lo, zero));
+				_mm_storeu_si128(dst + 2, _mm_unpacklo_epi16(hi, zero));
+				_mm_storeu_si128(dst + 3, _mm_unpackhi_epi16(hi, zero));
+				cur += 16;
+				out_cur += 16;
+			}
+#elif defined(UTF8_USE_NEON)
+			while(end - cur >= 16 && out_end - out_cur >= 16)
+			{
+				uint8x16_t chunk = vld1q_u8(cur);
+				if(vmaxvq_u8(chunk) >= 0x80)
+				{
+					break;
+				}
+				uint16x8_t lo = vmovl_u8(vget_low_u8(chunk));
+				uint16x8_t hi = vmovl_u8(vget_high_u8(chunk));
+				uint32_t* dst = reinterpret_cast<uint32_t*>(out_cur);
+				vst1q_u32(dst + 0, vmovl_u16(vget_low_u16(lo)));
+				vst1q_u32(dst + 4, vmovl_u16(vget_high_u16(lo)));
+				vst1q_u32(dst + 8, vmovl_u16(vget_low_u16(hi)));
+				vst1q_u32(dst + 12, vmovl_u16(vget_high_u16(hi)));
+				cur += 16;
+				out_cur += 16;
+			}
+#endif
+			// the ASCII before the next sequence (or the tail).
+			while(cur != end && out_cur != out_end && *cur < 0x80)
+			{
+				*out_cur++ = *cur++;
+			}
+			continue;
+		}
+
+		uint8_t lead = *cur;
+		ptrdiff_t remaining = end - cur;
+
+		// the common 2 and 3 byte sequences, anything weird goes to cpputf_decode_sequence.
+		if((lead & 0xe0) == 0xc0 && remaining >= 2 && (cur[1] & 0xc0) == 0x80)
+		{
+			char32_t cp = ((lead & 0x1f) << 6) | (cur[1] & 0x3f);
+			if(cp >= 0x80)
+			{
+				*out_cur++ = cp;
+				cur += 2;
+				continue;
+			}
+		}
+		else if(
+			(lead & 0xf0) == 0xe0 && remaining >= 3 && (cur[1] & 0xc0) == 0x80 &&
+			(cur[2] & 0xc0) == 0x80)
+		{
+			char32_t cp = ((lead & 0xf) << 12) | ((cur[1] & 0x3f) << 6) | (cur[2] & 0x3f);
+			// not overlong, and not a surrogate.
+			if(cp >= 0x800 && (cp < 0xd800 || cp > 0xdfff))
+			{
+				*out_cur++ = cp;
+				cur += 3;
+				continue;
+			}
+		}
+
+		char32_t cp;
+		size_t length;
+		utf8::internal::utf_error err_code = cpputf_decode_sequence(cur, end, &cp, &length);
+		if(err_code != utf8::internal::UTF8_OK)
+		{
+			if(result.error == utf8::internal::UTF8_OK)
+			{
+				result.error = err_code;
+			}
+			if(!lossy)
+			{
+				break;
+			}
+			cp = *cur;
+			length = 1;
+		}
+		*out_cur++ = cp;
+		cur += length;
+	}
+
+	result.read = cur - reinterpret_cast<const uint8_t*>(str);
+	result.written = out_cur - out;
+	return result;
+}
+
+utf8::internal::utf_error
+	cpputf_decode_string(std::u32string& str_out, const char* str, size_t size)
+{
+	// there can't be more codepoints than bytes.
+	size_t start = str_out.size();
+	str_out.resize(start + size);
+	cpputf_decode_result result = cpputf_decode(str, size, str_out.data() + start, size, false);
+	str_out.resize(start + result.written);
+	return result.error;
+}
+
+bool bench_cpputf_decode()
+{
+	// roughly 1MB of text for each test.
+	const size_t text_size = 1024 * 1024;
+	const size_t passes = 8;
+
+	uint32_t rng = 0x12345678;
+	auto next_random = [&rng]() {
+		// xorshift32
+		rng ^= rng << 13;
+		rng ^= rng >> 17;
+		rng ^= rng << 5;
+		return rng;
+	};
+
+	// ASCII, mixed has mostly ASCII with some latin/cyrillic/emoji, CJK is all 3 bytes.
+	struct bench_text
+	{
+		const char* name;
+		std::string text;
+	};
+	bench_text tests[3] = {{"ascii", ""}, {"mixed", ""}, {"cjk", ""}};
+	for(bench_text& test : tests)
+	{
+		while(test.text.size() < text_size)
+		{
+			char32_t cp;
+			uint32_t value = next_random();
+			if(&test == &tests[0])
+			{
+				cp = 0x20 + value % 0x5f;
+			}
+			else if(&test == &tests[1])
+			{
+				switch(value % 16)
+				{
+				case 0: cp = 0xc0 + (value >> 8) % 0x40; break;
+				case 1: cp = 0x410 + (value >> 8) % 0x40; break;
+				case 2: cp = 0x1f600 + (value >> 8) % 0x40; break;
+				default: cp = 0x20 + (value >> 8) % 0x5f; break;
+				}
+			}
+			else
+			{
+				cp = 0x4e00 + value % 0x5000;
+			}
+			if(!cpputf_append_string(test.text, cp))
+			{
+				serrf("%s: bad codepoint: U+%X\n", __func__, static_cast<unsigned>(cp));
+				return false;
+			}
+		}
+	}
+
+	slogf(
+		"info: utf8 decode (%s), %zu bytes x %zu passes\n",
+		cpputf_decode_kernel_name(),
+		text_size,
+		passes);
+
+	for(bench_text& test : tests)
+	{
+		std::vector<char32_t> codepoints(test.text.size());
+		std::vector<char32_t> codepoints_ref(test.text.size());
+		size_t count = 0;
+		size_t count_ref = 0;
+
+		TIMER_RESULT ref_ns = 0;
+		TIMER_RESULT decode_ns = 0;
+
+		for(size_t pass = 0; pass < passes; ++pass)
+		{
+			TIMER_U start = timer_now();
+			count_ref = 0;
+			const char* str_cur = test.text.data();
+			const char* str_end = test.text.data() + test.text.size();
+			while(str_cur != str_end)
+			{
+				uint32_t codepoint;
+				utf8::internal::utf_error err_code =
+					utf8::internal::validate_next(str_cur, str_end, codepoint);
+				if(err_code != utf8::internal::UTF8_OK)
+				{
+					serrf("%s: %s bad utf8: %s\n", __func__, test.name, cpputf_get_error(err_code));
+					return false;
+				}
+				codepoints_ref[count_ref++] = codepoint;
+			}
+			TIMER_U end = timer_now();
+			ref_ns += timer_delta<1000000000>(start, end);
+
+			start = timer_now();
+			cpputf_decode_result result = cpputf_decode(
+				test.text.data(), test.text.size(), codepoints.data(), codepoints.size(), false);
+			end = timer_now();
+			decode_ns += timer_delta<1000000000>(start, end);
+			if(result.error != utf8::internal::UTF8_OK)
+			{
+				serrf(
+					"%s: %s bad utf8: %s\n", __func__, test.name, cpputf_get_error(result.error));
+				return false;
+			}
+			count = result.written;
+		}
+
+		if(count != count_ref ||
+		   memcmp(codepoints.data(), codepoints_ref.data(), count * sizeof(char32_t)) != 0)
+		{
+			serrf("%s: %s codepoints don't match\n", __func__, test.name);
+			return false;
+		}
+
+		auto mb_per_sec = [&](TIMER_RESULT ns) {
+			return static_cast<double>(test.text.size() * passes) / (ns / 1000.0);
+		};
+		slogf(
+			"info: %-5s validate_next: %.1fMB/sec, cpputf_decode: %.1fMB/sec\n",
+			test.name,
+			mb_per_sec(ref_ns),
+			mb_per_sec(decode_ns));
+	}
+
+	return true;
+}
+
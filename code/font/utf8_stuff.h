@@ -1,5 +1,10 @@
+#pragma once
+
+#include "../global.h"
+
 #include "../3rdparty/utfcpp/core.hpp"
 
+#include <cstddef>
 #include <string>
 
 /*
@@ -27,4 +32,35 @@ if the string is truncated, you may want to ignore utf8::internal::NOT_ENOUGH_RO
 */
 
 const char* cpputf_get_error(utf8::internal::utf_error err_code);
-bool cpputf_append_string(std::string& str, char32_t cp);
\ No newline at end of file
+bool cpputf_append_string(std::string& str, char32_t cp);
+
+struct cpputf_decode_result
+{
+	// the number of bytes read from the string.
+	size_t read = 0;
+	// the number of codepoints written.
+	size_t written = 0;
+	// the first bad utf8 sequence, if there was one.
+	utf8::internal::utf_error error = utf8::internal::UTF8_OK;
+};
+
+// decodes a whole span of utf8 into codepoints at once (ASCII runs are SIMD if available).
+// this stops at the end of the string or when out_size codepoints were written.
+// if lossy, bad bytes are written as the byte value (this will render some invalid glyph,
+// unifont makes it very descriptive), otherwise this stops at the bad byte (str + read).
+// NOT_ENOUGH_ROOM is returned if the string ended in the middle of a sequence.
+cpputf_decode_result
+	cpputf_decode(const char* str, size_t size, char32_t* out, size_t out_size, bool lossy);
+
+// decodes the whole string (not lossy), returns UTF8_OK if there was no error,
+// otherwise str_out contains the codepoints before the error.
+utf8::internal::utf_error
+	cpputf_decode_string(std::u32string& str_out, const char* str, size_t size);
+
+// the name of the ascii decoding kernel ("sse2", "neon", "scalar")
+const char* cpputf_decode_kernel_name();
+
+// decodes ASCII, mixed (latin/cyrillic/emoji) and CJK text with validate_next and cpputf_decode
+// and prints the throughput, this also checks that they match.
+NDSERR bool bench_cpputf_decode();
+
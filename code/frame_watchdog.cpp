@@ -0,0 +1,298 @@
+#include "global_pch.h"
+#include "global.h"
+
+#include "frame_watchdog.h"
+
+#include "cvar.h"
+
+// I don't use threads on emscripten.
+#ifndef __EMSCRIPTEN__
+#include "debug_tools.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+#if defined(USE_LIBBACKTRACE) && defined(__linux__)
+#include <pthread.h>
+#include <signal.h>
+// the stack of the watched thread is captured with a signal.
+#define FRAME_WATCHDOG_STACKTRACE
+#endif
+
+static CVAR_T frame_watchdog_enabled
+#ifndef __EMSCRIPTEN__
+	= CVAR_T::RUNTIME;
+#else
+	= CVAR_T::DISABLED;
+#endif
+
+static REGISTER_CVAR_INT(
+	cv_hitch_ms,
+	250,
+	"log the frames that take longer than this, with the stack of the main thread "
+	"(milliseconds, 0 = off)",
+	frame_watchdog_enabled);
+
+#ifndef __EMSCRIPTEN__
+
+enum
+{
+	// a frame that takes this long is logged before it ends.
+	WATCHDOG_HANG_MS = 5000,
+	// how long to wait for the signal handler.
+	WATCHDOG_CAPTURE_TIMEOUT_MS = 100
+};
+
+#ifdef FRAME_WATCHDOG_STACKTRACE
+// SIGUSR2 is not used by anything else here.
+#define FRAME_WATCHDOG_SIGNAL SIGUSR2
+#endif
+
+namespace
+{
+enum class CAPTURE_STATE
+{
+	IDLE,
+	REQUESTED,
+	// the handler claimed the request and is writing pcs.
+	CAPTURING,
+	DONE
+};
+
+struct frame_watchdog_state
+{
+	// the start of the current frame (set by the watched thread).
+	std::atomic<TIMER_U> frame_start{TIMER_NULL};
+	// cv_hitch_ms, copied by the watched thread (the cvars are not thread safe).
+	std::atomic<int> hitch_ms{0};
+
+	// the stack from the signal handler.
+	std::atomic<CAPTURE_STATE> capture{CAPTURE_STATE::IDLE};
+	uintptr_t pcs[DEBUG_STACKTRACE_MAX_FRAMES];
+	int pc_count = 0;
+
+#ifdef FRAME_WATCHDOG_STACKTRACE
+	pthread_t watched_thread;
+	bool installed = false;
+	bool has_stacktrace = false;
+#endif
+
+	std::thread thread;
+	std::mutex mut;
+	std::condition_variable cond;
+	bool quit = false;
+};
+} // namespace
+
+static frame_watchdog_state g_watchdog;
+
+#ifdef FRAME_WATCHDOG_STACKTRACE
+// this must be async signal safe.
+static void frame_watchdog_handler(int sig, siginfo_t* info, void* ucontext)
+{
+	(void)sig;
+	(void)info;
+	int saved_errno = errno;
+	// claim it first, so the watchdog can't give up on the request while the pcs are written.
+	CAPTURE_STATE expected = CAPTURE_STATE::REQUESTED;
+	if(g_watchdog.capture.compare_exchange_strong(
+		   expected, CAPTURE_STATE::CAPTURING, std::memory_order_acquire))
+	{
+		g_watchdog.pc_count = debug_capture_stacktrace_in_signal(
+			g_watchdog.pcs, DEBUG_STACKTRACE_MAX_FRAMES, ucontext);
+		g_watchdog.capture.store(CAPTURE_STATE::DONE, std::memory_order_release);
+	}
+	errno = saved_errno;
+}
+#endif
+
+// returns the number of pcs in g_watchdog.pcs.
+static int frame_watchdog_capture()
+{
+#ifdef FRAME_WATCHDOG_STACKTRACE
+	if(!g_watchdog.has_stacktrace)
+	{
+		return 0;
+	}
+	g_watchdog.pc_count = 0;
+	g_watchdog.capture.store(CAPTURE_STATE::REQUESTED, std::memory_order_release);
+	if(pthread_kill(g_watchdog.watched_thread, FRAME_WATCHDOG_SIGNAL) != 0)
+	{
+		g_watchdog.capture.store(CAPTURE_STATE::IDLE, std::memory_order_relaxed);
+		return 0;
+	}
+	TIMER_U start = timer_now();
+	while(g_watchdog.capture.load(std::memory_order_acquire) != CAPTURE_STATE::DONE)
+	{
+		if(timer_delta<1000>(start, timer_now()) > WATCHDOG_CAPTURE_TIMEOUT_MS)
+		{
+			// if the handler didn't claim it yet, a late handler won't write anything.
+			// if it's CAPTURING, keep waiting (the frame pointer walk doesn't block).
+			CAPTURE_STATE expected = CAPTURE_STATE::REQUESTED;
+			if(g_watchdog.capture.compare_exchange_strong(expected, CAPTURE_STATE::IDLE))
+			{
+				return 0;
+			}
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	g_watchdog.capture.store(CAPTURE_STATE::IDLE, std::memory_order_relaxed);
+	return g_watchdog.pc_count;
+#else
+	return 0;
+#endif
+}
+
+static void frame_watchdog_report(
+	int threshold,
+	TIMER_RESULT frame_ms,
+	bool ended,
+	TIMER_RESULT capture_ms,
+	const uintptr_t* pcs,
+	int count)
+{
+	std::string msg;
+	if(count == 0)
+	{
+		slogf(
+			"warning: frame hitch: %.1fms%s (cv_hitch_ms = %d), no stacktrace\n",
+			frame_ms,
+			ended ? "" : " and still running",
+			threshold);
+		return;
+	}
+	debug_str_stacktrace_pcs(&msg, pcs, count);
+	slogf(
+		"warning: frame hitch: %.1fms%s (cv_hitch_ms = %d), main thread at %.1fms:\n%s",
+		frame_ms,
+		ended ? "" : " and still running",
+		threshold,
+		capture_ms,
+		msg.c_str());
+}
+
+static void frame_watchdog_run()
+{
+	// the frame that is being watched.
+	TIMER_U watched_start = TIMER_NULL;
+	bool captured = false;
+	bool reported = false;
+	TIMER_RESULT capture_ms = 0;
+	uintptr_t pcs[DEBUG_STACKTRACE_MAX_FRAMES];
+	int pc_count = 0;
+
+	std::unique_lock<std::mutex> lk(g_watchdog.mut);
+	while(!g_watchdog.quit)
+	{
+		int threshold = g_watchdog.hitch_ms.load(std::memory_order_relaxed);
+		// check a few times per threshold, so the stack is close to when it went over.
+		auto interval = std::chrono::milliseconds(std::clamp(threshold / 4, 1, 50));
+		g_watchdog.cond.wait_for(lk, interval, [] { return g_watchdog.quit; });
+		if(g_watchdog.quit || threshold <= 0)
+		{
+			continue;
+		}
+
+		TIMER_U start = g_watchdog.frame_start.load(std::memory_order_acquire);
+		if(start == TIMER_NULL)
+		{
+			continue;
+		}
+		if(start != watched_start)
+		{
+			// the frame ended.
+			if(captured && !reported && watched_start != TIMER_NULL)
+			{
+				frame_watchdog_report(
+					threshold,
+					timer_delta<1000>(watched_start, start),
+					true,
+					capture_ms,
+					pcs,
+					pc_count);
+			}
+			watched_start = start;
+			captured = false;
+			reported = false;
+		}
+
+		TIMER_RESULT elapsed = timer_delta<1000>(start, timer_now());
+		if(!captured && elapsed > threshold)
+		{
+			captured = true;
+			capture_ms = elapsed;
+			pc_count = frame_watchdog_capture();
+			std::copy(g_watchdog.pcs, g_watchdog.pcs + pc_count, pcs);
+		}
+		if(captured && !reported && elapsed > WATCHDOG_HANG_MS)
+		{
+			reported = true;
+			frame_watchdog_report(threshold, elapsed, false, capture_ms, pcs, pc_count);
+		}
+	}
+}
+
+#endif // __EMSCRIPTEN__
+
+bool frame_watchdog_init()
+{
+#ifndef __EMSCRIPTEN__
+	ASSERT(!g_watchdog.thread.joinable());
+#ifdef FRAME_WATCHDOG_STACKTRACE
+	g_watchdog.watched_thread = pthread_self();
+	g_watchdog.has_stacktrace = debug_prepare_signal_stacktrace();
+	if(!g_watchdog.has_stacktrace)
+	{
+		// not fatal, the hitches are logged without the stack.
+		slogf("info: frame watchdog without stacktraces: %s\n", serr_get_error().c_str());
+	}
+	// the handler stays installed, so a late signal won't kill the app.
+	if(g_watchdog.has_stacktrace && !g_watchdog.installed)
+	{
+		struct sigaction action;
+		memset(&action, 0, sizeof(action));
+		action.sa_sigaction = frame_watchdog_handler;
+		sigemptyset(&action.sa_mask);
+		action.sa_flags = SA_SIGINFO | SA_RESTART;
+		if(sigaction(FRAME_WATCHDOG_SIGNAL, &action, NULL) != 0)
+		{
+			serrf("%s: sigaction failed, reason: %s\n", __func__, strerror(errno));
+			return false;
+		}
+		g_watchdog.installed = true;
+	}
+#endif
+	g_watchdog.frame_start.store(TIMER_NULL);
+	g_watchdog.hitch_ms.store(cv_hitch_ms.data, std::memory_order_relaxed);
+	g_watchdog.quit = false;
+	g_watchdog.thread = std::thread(frame_watchdog_run);
+#endif
+	return true;
+}
+
+bool frame_watchdog_destroy()
+{
+#ifndef __EMSCRIPTEN__
+	if(g_watchdog.thread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lk(g_watchdog.mut);
+			g_watchdog.quit = true;
+		}
+		g_watchdog.cond.notify_one();
+		g_watchdog.thread.join();
+	}
+#endif
+	return true;
+}
+
+void frame_watchdog_heartbeat()
+{
+#ifndef __EMSCRIPTEN__
+	g_watchdog.hitch_ms.store(cv_hitch_ms.data, std::memory_order_relaxed);
+	g_watchdog.frame_start.store(timer_now(), std::memory_order_release);
+#endif
+}
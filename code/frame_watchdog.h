@@ -0,0 +1,17 @@
+#pragma once
+
+#include "global.h"
+
+// a thread that watches the frames of the thread that called frame_watchdog_init.
+// if a frame takes longer than cv_hitch_ms, the watched thread is signaled to capture it's stack
+// (linux with libbacktrace), and when the frame ends the hitch is logged with that stack,
+// so a rare stall shows where the time went instead of only making the average worse.
+// if the frame still didn't end after a few seconds, it's logged anyway (a hang).
+// the stack is symbolized on the watchdog thread.
+
+// call this from the thread to watch, it starts the watchdog thread.
+NDSERR bool frame_watchdog_init();
+NDSERR bool frame_watchdog_destroy();
+
+// call this at the start of every frame (from the watched thread).
+void frame_watchdog_heartbeat();
@@ -5,11 +5,8 @@
 
 #include "debug_tools.h"
 
-// disabling the console for emscripten wouldn't be that bad of an idea
-// since I could make the console exist within the
-#ifndef DISABLE_CONSOLE
-#include "console.h"
-#endif
+#include "log_sink.h"
+#include "log_limit.h"
 
 #include <cstring>
 
@@ -105,57 +102,6 @@ implement_CHECK(bool cond, const char* expr, const char* file, int line)
 	return true;
 }
 
-#if 0
-#ifndef LOG_FILENAME
-#define LOG_FILENAME "log.txt"
-#endif
-
-struct log_wrapper : nocopy
-{
-	FILE* fp = NULL;
-
-	log_wrapper()
-	{
-#ifdef DISABLE_CONSOLE
-		fp = fopen(LOG_FILENAME, "w");
-#else
-		// I need the w+ because I read in the in game console
-		fp = fopen(LOG_FILENAME, "w+");
-#endif
-		if(fp == NULL)
-		{
-			printf("Failed to open log: `%s`, reason: %s\n", LOG_FILENAME, strerror(errno));
-			return;
-		}
-	}
-
-	~log_wrapper()
-	{
-		ASSERT(fp != NULL);
-		int prev_error = ferror(fp);
-		int ret = fclose(fp);
-		fp = NULL;
-		if(ret != 0 && prev_error != 0)
-		{
-			printf(
-				"Failed to close log: `%s`, reason: %s (return: %d)\n",
-				LOG_FILENAME,
-				strerror(errno),
-				ret);
-		}
-	}
-};
-FILE* get_global_log_file()
-{
-#ifdef DISABLE_LOG_FILE
-	return NULL;
-#else
-	static log_wrapper log;
-	return log.fp;
-#endif
-}
-#endif
-
 // serr buffer lazy initialized.
 std::shared_ptr<std::string> internal_get_serr_buffer()
 {
@@ -172,7 +118,8 @@ std::shared_ptr<std::string> internal_get_serr_buffer()
 	return buffer;
 }
 
-static void __attribute__((noinline)) serr_safe_stacktrace(int skip = 0)
+// write_log = false only puts the stacktrace into the serr buffer (see log_limit.h)
+static void __attribute__((noinline)) serr_safe_stacktrace(int skip = 0, bool write_log = true)
 {
 	// NOTE: I am thinking of making the stacktrace only appear in stdout
 	// and in the console error section.
@@ -196,15 +143,10 @@ static void __attribute__((noinline)) serr_safe_stacktrace(int skip = 0)
 		msg += '\n';
 
 		internal_get_serr_buffer()->append(msg);
-		fwrite(msg.c_str(), 1, msg.size(), stdout);
-#ifndef DISABLE_CONSOLE
+		if(write_log)
 		{
-#ifndef __EMSCRIPTEN__
-			std::lock_guard<std::mutex> lk(g_log_mut);
-#endif
-			g_log.push(CONSOLE_MESSAGE_TYPE::ERROR, msg.c_str(), msg.size());
+			log_sink_write(CONSOLE_MESSAGE_TYPE::ERROR, msg.c_str(), msg.size());
 		}
-#endif
 	}
 }
 
@@ -231,22 +173,11 @@ void slog_raw(const char* msg, size_t len)
 {
 	ASSERT(msg != NULL);
 	ASSERT(len != 0);
-	if(cv_disable_log.data != 0)
+	if(cv_disable_log.data != 0 || !log_limit_allow_text(msg, len))
 	{
 		return;
 	}
-	// on win32, if did a /subsystem:windows, I would probably
-	// replace stdout with OutputDebugString on the debug build.
-	fwrite(msg, 1, len, stdout);
-
-#ifndef DISABLE_CONSOLE
-	{
-#ifndef __EMSCRIPTEN__
-		std::lock_guard<std::mutex> lk(g_log_mut);
-#endif
-		g_log.push(CONSOLE_MESSAGE_TYPE::INFO, msg, len);
-	}
-#endif
+	log_sink_write(CONSOLE_MESSAGE_TYPE::INFO, msg, len);
 }
 void serr_raw(const char* msg, size_t len)
 {
@@ -259,19 +190,14 @@ void serr_raw(const char* msg, size_t len)
 		*internal_get_serr_buffer() = '!';
 		return;
 	}
-	serr_safe_stacktrace(1);
+	bool write_log = log_limit_allow_text(msg, len);
+	serr_safe_stacktrace(1, write_log);
 
 	internal_get_serr_buffer()->append(msg, msg + len);
-	fwrite(msg, 1, len, stdout);
-
-#ifndef DISABLE_CONSOLE
+	if(write_log)
 	{
-#ifndef __EMSCRIPTEN__
-		std::lock_guard<std::mutex> lk(g_log_mut);
-#endif
-		g_log.push(CONSOLE_MESSAGE_TYPE::ERROR, msg, len);
+		log_sink_write(CONSOLE_MESSAGE_TYPE::ERROR, msg, len);
 	}
-#endif
 }
 
 void slog(const char* msg)
@@ -287,35 +213,14 @@ void serr(const char* msg)
 void slogf(const char* fmt, ...)
 {
 	ASSERT(fmt != NULL);
-	if(cv_disable_log.data != 0)
+	if(cv_disable_log.data != 0 || !log_limit_allow_format(LOG_LIMIT_CALL_SITE(), fmt))
 	{
 		return;
 	}
 	va_list args;
 	va_start(args, fmt);
-#ifndef DISABLE_CONSOLE
-	va_list temp_args;
-	va_copy(temp_args, args);
-#endif
-
-#ifdef WIN32
-	// win32 has a compatible C standard library, but annex k prevents exploits or something.
-	vfprintf_s(stdout, fmt, args);
-#else
-	vfprintf(stdout, fmt, args);
-#endif
+	log_sink_write_vargs(CONSOLE_MESSAGE_TYPE::INFO, fmt, args);
 	va_end(args);
-#ifndef DISABLE_CONSOLE
-	va_start(temp_args, fmt);
-
-	{
-#ifndef __EMSCRIPTEN__
-		std::lock_guard<std::mutex> lk(g_log_mut);
-#endif
-		g_log.push_vargs(CONSOLE_MESSAGE_TYPE::INFO, fmt, temp_args);
-	}
-	va_end(temp_args);
-#endif
 }
 
 void serrf(const char* fmt, ...)
@@ -329,34 +234,20 @@ void serrf(const char* fmt, ...)
 		return;
 	}
 
-	serr_safe_stacktrace(1);
+	bool write_log = log_limit_allow_format(LOG_LIMIT_CALL_SITE(), fmt);
+	serr_safe_stacktrace(1, write_log);
 
+	// the serr buffer needs the text anyway, so it's only formatted once.
 	va_list args;
-	va_list temp_args;
 	va_start(args, fmt);
-	va_copy(temp_args, args);
-
-#ifdef WIN32
-	// win32 has a compatible C standard library, but annex k prevents exploits or something.
-	vfprintf_s(stdout, fmt, args);
-#else
-	vfprintf(stdout, fmt, args);
-#endif
-	va_end(args);
-
 	int len;
-	va_start(temp_args, fmt);
-	std::unique_ptr<char[]> buffer = unique_vasprintf(&len, fmt, temp_args);
-	va_end(temp_args);
+	std::unique_ptr<char[]> buffer = unique_vasprintf(&len, fmt, args);
+	va_end(args);
 	internal_get_serr_buffer()->append(buffer.get(), buffer.get() + len);
-#ifndef DISABLE_CONSOLE
+	if(write_log)
 	{
-#ifndef __EMSCRIPTEN__
-		std::lock_guard<std::mutex> lk(g_log_mut);
-#endif
-		g_log.push(CONSOLE_MESSAGE_TYPE::ERROR, buffer.get(), len);
+		log_sink_write(CONSOLE_MESSAGE_TYPE::ERROR, buffer.get(), len);
 	}
-#endif
 }
 
 std::unique_ptr<char[]> unique_vasprintf(int* length, const char* fmt, va_list args)
@@ -169,6 +169,9 @@ void serr_raw(const char* msg, size_t len);
 void slog(const char* msg);
 void serr(const char* msg);
 
+// with cv_log_deferred, slogf only copies the arguments and the log thread formats them later,
+// so the format must be a string literal (%s arguments are copied).
+// serrf always formats, because the serr buffer needs the text.
 void slogf(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
 void serrf(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
 
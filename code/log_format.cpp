@@ -0,0 +1,507 @@
+#include "global_pch.h"
+#include "global.h"
+
+#include "log_format.h"
+
+#include <climits>
+#include <cstddef>
+#include <cstdio>
+#include <type_traits>
+
+namespace
+{
+enum class LENGTH_MOD
+{
+	NONE,
+	HH,
+	H,
+	L,
+	LL,
+	J,
+	Z,
+	T,
+	LONG_DOUBLE
+};
+
+// one conversion, from the '%' to the conversion character.
+struct format_spec
+{
+	const char* begin;
+	// the '.' (or the length if there is no precision)
+	const char* precision_begin;
+	const char* length_begin;
+	// after the conversion character
+	const char* end;
+	bool width_star;
+	bool precision_star;
+	LENGTH_MOD length;
+	char conversion;
+};
+
+// the spec that is passed to snprintf (the length is replaced)
+enum
+{
+	REPLAY_SPEC_MAX = 40
+};
+
+struct blob_writer
+{
+	char* out;
+	size_t size;
+	size_t pos = 0;
+
+	void write_bytes(const void* data, size_t n)
+	{
+		if(out != NULL)
+		{
+			ASSERT(pos + n <= size);
+			memcpy(out + pos, data, n);
+		}
+		pos += n;
+	}
+	template<class T>
+	void write(T value)
+	{
+		static_assert(std::is_trivially_copyable<T>::value);
+		write_bytes(&value, sizeof(T));
+	}
+};
+
+struct blob_reader
+{
+	const char* data;
+	size_t size;
+	size_t pos = 0;
+
+	const char* read_bytes(size_t n)
+	{
+		if(size - pos < n)
+		{
+			return NULL;
+		}
+		const char* cur = data + pos;
+		pos += n;
+		return cur;
+	}
+	template<class T>
+	bool read(T* value)
+	{
+		const char* cur = read_bytes(sizeof(T));
+		if(cur == NULL)
+		{
+			return false;
+		}
+		memcpy(value, cur, sizeof(T));
+		return true;
+	}
+};
+
+struct text_writer
+{
+	char* out;
+	size_t size;
+	size_t len = 0;
+
+	void append(const char* str, size_t n)
+	{
+		n = std::min(n, size - 1 - len);
+		memcpy(out + len, str, n);
+		len += n;
+	}
+	template<class T>
+	void append_spec(const char* spec, const int* stars, int star_count, T value)
+	{
+		size_t room = size - len;
+		int ret = -1;
+		switch(star_count)
+		{
+		case 0: ret = snprintf(out + len, room, spec, value); break;
+		case 1: ret = snprintf(out + len, room, spec, stars[0], value); break;
+		case 2: ret = snprintf(out + len, room, spec, stars[0], stars[1], value); break;
+		default: ASSERT(false && "too many stars");
+		}
+		if(ret > 0)
+		{
+			len += std::min<size_t>(ret, room - 1);
+		}
+	}
+};
+} // namespace
+
+// cur is the '%', returns false if the conversion isn't supported.
+static bool parse_format_spec(const char* cur, format_spec* spec)
+{
+	ASSERT(*cur == '%');
+	spec->begin = cur;
+	++cur;
+	while(*cur != '\0' && strchr("-+ #0'", *cur) != NULL)
+	{
+		++cur;
+	}
+	spec->width_star = (*cur == '*');
+	if(spec->width_star)
+	{
+		++cur;
+	}
+	while(*cur >= '0' && *cur <= '9')
+	{
+		++cur;
+	}
+	spec->precision_begin = cur;
+	spec->precision_star = false;
+	if(*cur == '.')
+	{
+		++cur;
+		spec->precision_star = (*cur == '*');
+		if(spec->precision_star)
+		{
+			++cur;
+		}
+		while(*cur >= '0' && *cur <= '9')
+		{
+			++cur;
+		}
+	}
+	spec->length_begin = cur;
+	spec->length = LENGTH_MOD::NONE;
+	switch(*cur)
+	{
+	case 'h':
+		++cur;
+		spec->length = LENGTH_MOD::H;
+		if(*cur == 'h')
+		{
+			++cur;
+			spec->length = LENGTH_MOD::HH;
+		}
+		break;
+	case 'l':
+		++cur;
+		spec->length = LENGTH_MOD::L;
+		if(*cur == 'l')
+		{
+			++cur;
+			spec->length = LENGTH_MOD::LL;
+		}
+		break;
+	case 'j':
+		++cur;
+		spec->length = LENGTH_MOD::J;
+		break;
+	case 'z':
+		++cur;
+		spec->length = LENGTH_MOD::Z;
+		break;
+	case 't':
+		++cur;
+		spec->length = LENGTH_MOD::T;
+		break;
+	case 'L':
+		++cur;
+		spec->length = LENGTH_MOD::LONG_DOUBLE;
+		break;
+	}
+	spec->conversion = *cur;
+	if(spec->conversion == '\0' || strchr("diouxXcsfFeEgGaAp%", spec->conversion) == NULL)
+	{
+		return false;
+	}
+	if((spec->conversion == 'c' || spec->conversion == 's') && spec->length != LENGTH_MOD::NONE)
+	{
+		return false;
+	}
+	spec->end = cur + 1;
+	// the replay spec adds at most 3 characters.
+	return (spec->length_begin - spec->begin) + 4 < REPLAY_SPEC_MAX;
+}
+
+// writes the spec for snprintf into out (without the length modifier).
+static void make_replay_spec(const format_spec& spec, char (&out)[REPLAY_SPEC_MAX])
+{
+	// the %s text isn't null terminated, so the length is passed as the precision.
+	const char* copy_end = (spec.conversion == 's') ? spec.precision_begin : spec.length_begin;
+	size_t len = copy_end - spec.begin;
+	memcpy(out, spec.begin, len);
+	switch(spec.conversion)
+	{
+	case 's': memcpy(out + len, ".*s", 3); len += 3; break;
+	case 'd':
+	case 'i':
+	case 'o':
+	case 'u':
+	case 'x':
+	case 'X':
+		out[len++] = 'l';
+		out[len++] = 'l';
+		out[len++] = spec.conversion;
+		break;
+	default: out[len++] = spec.conversion;
+	}
+	ASSERT(len < REPLAY_SPEC_MAX);
+	out[len] = '\0';
+}
+
+static int64_t read_signed_arg(LENGTH_MOD length, va_list& args)
+{
+	switch(length)
+	{
+	case LENGTH_MOD::L: return va_arg(args, long);
+	case LENGTH_MOD::LL: return va_arg(args, long long);
+	case LENGTH_MOD::J: return va_arg(args, intmax_t);
+	case LENGTH_MOD::Z: return va_arg(args, std::make_signed<size_t>::type);
+	case LENGTH_MOD::T: return va_arg(args, ptrdiff_t);
+	// char and short are promoted to int
+	case LENGTH_MOD::HH: return static_cast<signed char>(va_arg(args, int));
+	case LENGTH_MOD::H: return static_cast<short>(va_arg(args, int));
+	default: return va_arg(args, int);
+	}
+}
+
+static uint64_t read_unsigned_arg(LENGTH_MOD length, va_list& args)
+{
+	switch(length)
+	{
+	case LENGTH_MOD::L: return va_arg(args, unsigned long);
+	case LENGTH_MOD::LL: return va_arg(args, unsigned long long);
+	case LENGTH_MOD::J: return va_arg(args, uintmax_t);
+	case LENGTH_MOD::Z: return va_arg(args, size_t);
+	case LENGTH_MOD::T: return va_arg(args, std::make_unsigned<ptrdiff_t>::type);
+	case LENGTH_MOD::HH: return static_cast<unsigned char>(va_arg(args, unsigned int));
+	case LENGTH_MOD::H: return static_cast<unsigned short>(va_arg(args, unsigned int));
+	default: return va_arg(args, unsigned int);
+	}
+}
+
+size_t log_format_capture(char* out, size_t out_size, const char* fmt, va_list args)
+{
+	ASSERT(fmt != NULL);
+	blob_writer writer{out, out_size};
+
+	// va_list might be an array type, so it's copied to pass it by reference.
+	va_list cur_args;
+	va_copy(cur_args, args);
+
+	const char* cur = fmt;
+	while((cur = strchr(cur, '%')) != NULL)
+	{
+		format_spec spec;
+		if(!parse_format_spec(cur, &spec))
+		{
+			va_end(cur_args);
+			return SIZE_MAX;
+		}
+		cur = spec.end;
+		if(spec.conversion == '%')
+		{
+			continue;
+		}
+		if(spec.width_star)
+		{
+			writer.write<int64_t>(va_arg(cur_args, int));
+		}
+		int precision = -1;
+		if(spec.precision_star)
+		{
+			precision = va_arg(cur_args, int);
+			writer.write<int64_t>(precision);
+		}
+		else if(*spec.precision_begin == '.')
+		{
+			precision = atoi(spec.precision_begin + 1);
+		}
+
+		switch(spec.conversion)
+		{
+		case 'd':
+		case 'i': writer.write<int64_t>(read_signed_arg(spec.length, cur_args)); break;
+		case 'o':
+		case 'u':
+		case 'x':
+		case 'X': writer.write<uint64_t>(read_unsigned_arg(spec.length, cur_args)); break;
+		case 'c': writer.write<int64_t>(va_arg(cur_args, int)); break;
+		case 'p':
+			writer.write<uint64_t>(reinterpret_cast<uintptr_t>(va_arg(cur_args, void*)));
+			break;
+		case 's': {
+			const char* str = va_arg(cur_args, const char*);
+			if(str == NULL)
+			{
+				writer.write<uint32_t>(UINT32_MAX);
+				break;
+			}
+			// with a precision the string doesn't need a null terminator.
+			size_t len = (precision >= 0) ? strnlen(str, precision) : strlen(str);
+			if(len >= UINT32_MAX)
+			{
+				va_end(cur_args);
+				return SIZE_MAX;
+			}
+			writer.write<uint32_t>(len);
+			writer.write_bytes(str, len);
+		}
+		break;
+		default:
+			// floating point
+			if(spec.length == LENGTH_MOD::LONG_DOUBLE)
+			{
+				// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+				writer.write<double>(va_arg(cur_args, long double));
+			}
+			else
+			{
+				writer.write<double>(va_arg(cur_args, double));
+			}
+		}
+	}
+	va_end(cur_args);
+	return writer.pos;
+}
+
+// formats one conversion (not %%), returns false if the blob doesn't match.
+static bool replay_conversion(const format_spec& spec, text_writer& writer, blob_reader& reader)
+{
+	int stars[2];
+	int star_count = 0;
+	int64_t star;
+	if(spec.width_star)
+	{
+		if(!reader.read(&star))
+		{
+			return false;
+		}
+		// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+		stars[star_count++] = star;
+	}
+	if(spec.precision_star)
+	{
+		if(!reader.read(&star))
+		{
+			return false;
+		}
+		// the precision of %s was already applied.
+		if(spec.conversion != 's')
+		{
+			// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+			stars[star_count++] = star;
+		}
+	}
+
+	char replay[REPLAY_SPEC_MAX];
+	make_replay_spec(spec, replay);
+	switch(spec.conversion)
+	{
+	case 'd':
+	case 'i': {
+		int64_t value;
+		if(!reader.read(&value))
+		{
+			return false;
+		}
+		writer.append_spec(replay, stars, star_count, static_cast<long long>(value));
+	}
+	break;
+	case 'o':
+	case 'u':
+	case 'x':
+	case 'X': {
+		uint64_t value;
+		if(!reader.read(&value))
+		{
+			return false;
+		}
+		writer.append_spec(replay, stars, star_count, static_cast<unsigned long long>(value));
+	}
+	break;
+	case 'c': {
+		int64_t value;
+		if(!reader.read(&value))
+		{
+			return false;
+		}
+		// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+		writer.append_spec(replay, stars, star_count, static_cast<int>(value));
+	}
+	break;
+	case 'p': {
+		uint64_t value;
+		if(!reader.read(&value))
+		{
+			return false;
+		}
+		// NOLINTNEXTLINE(performance-no-int-to-ptr)
+		writer.append_spec(replay, stars, star_count, reinterpret_cast<void*>(value));
+	}
+	break;
+	case 's': {
+		uint32_t len;
+		if(!reader.read(&len))
+		{
+			return false;
+		}
+		const char* str = "(null)";
+		if(len == UINT32_MAX)
+		{
+			len = 6;
+		}
+		else if((str = reader.read_bytes(len)) == NULL)
+		{
+			return false;
+		}
+		stars[star_count++] = static_cast<int>(std::min<uint32_t>(len, INT_MAX));
+		writer.append_spec(replay, stars, star_count, str);
+	}
+	break;
+	default: {
+		double value;
+		if(!reader.read(&value))
+		{
+			return false;
+		}
+		writer.append_spec(replay, stars, star_count, value);
+	}
+	}
+	return true;
+}
+
+size_t log_format_args(
+	char* out, size_t out_size, const char* fmt, const char* args, size_t args_size)
+{
+	ASSERT(out != NULL);
+	ASSERT(out_size != 0);
+	ASSERT(fmt != NULL);
+	text_writer writer{out, out_size};
+	blob_reader reader{args, args_size};
+
+	const char* cur = fmt;
+	while(true)
+	{
+		const char* next = strchr(cur, '%');
+		if(next == NULL)
+		{
+			writer.append(cur, strlen(cur));
+			break;
+		}
+		writer.append(cur, next - cur);
+
+		format_spec spec;
+		if(!parse_format_spec(next, &spec))
+		{
+			// log_format_capture would have failed, so the format is not the same.
+			writer.append("<bad log format>\n", 17);
+			break;
+		}
+		cur = spec.end;
+		if(spec.conversion == '%')
+		{
+			writer.append("%", 1);
+			continue;
+		}
+		if(!replay_conversion(spec, writer, reader))
+		{
+			writer.append("<bad log args>\n", 15);
+			break;
+		}
+	}
+	out[writer.len] = '\0';
+	return writer.len;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "global.h"
+
+// deferred printf formatting, the arguments of a printf call are copied into a blob
+// (the format string says what the types are), and they are formatted later.
+// the format string is not copied, it must live forever (a string literal).
+// the blob uses the native byte order:
+//   integers (including %c and the '*' width / precision) are int64_t / uint64_t
+//   floating point is a double (long double is converted)
+//   %p is a uint64_t
+//   %s is a uint32_t length and the characters (no null terminator), UINT32_MAX for NULL
+// %n and wide characters (%ls, %lc) are not supported.
+
+// returns the size of the blob, or SIZE_MAX if the format is not supported.
+// if out is not NULL, the blob is written into out (out_size must be the returned size).
+size_t log_format_capture(char* out, size_t out_size, const char* fmt, va_list args);
+
+// formats the blob like vsnprintf (truncated to out_size - 1, always null terminated),
+// returns the length that was written.
+// this doesn't allocate, so it's OK in a signal handler (as much as snprintf is).
+size_t log_format_args(
+	char* out, size_t out_size, const char* fmt, const char* args, size_t args_size);
+
+// the binary log (cv_log_binary_file), tools/log_decode.cpp prints it as text.
+// the file is a log_binary_header, then records until the end of the file:
+// a log_binary_record, then record.size bytes of:
+//   LOG_RECORD_TEXT: the text of the message.
+//   LOG_RECORD_FORMAT: a uint64_t id, and the format string (before the first use of the id).
+//   LOG_RECORD_DEFERRED: a uint64_t id of a format, and the blob from log_format_capture.
+enum
+{
+	LOG_BINARY_VERSION = 1,
+	LOG_BINARY_BYTE_ORDER = 0x01020304
+};
+enum LOG_RECORD_KIND : uint8_t
+{
+	LOG_RECORD_TEXT,
+	LOG_RECORD_FORMAT,
+	LOG_RECORD_DEFERRED
+};
+struct log_binary_header
+{
+	char magic[8] = {'B', 'S', 'L', 'O', 'G', 'B', 'I', 'N'};
+	uint32_t byte_order = LOG_BINARY_BYTE_ORDER;
+	uint32_t version = LOG_BINARY_VERSION;
+};
+struct log_binary_record
+{
+	uint32_t size;
+	LOG_RECORD_KIND kind;
+	// CONSOLE_MESSAGE_TYPE
+	uint8_t message_type;
+	uint16_t reserved;
+};
+static_assert(sizeof(log_binary_header) == 16);
+static_assert(sizeof(log_binary_record) == 8);
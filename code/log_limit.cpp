@@ -0,0 +1,255 @@
+#include "global_pch.h"
+#include "global.h"
+
+#include "log_limit.h"
+
+#include "cvar.h"
+#include "log_sink.h"
+
+#include <atomic>
+
+static REGISTER_CVAR_DOUBLE(
+	cv_log_limit_rate,
+	0,
+	"the messages per second that one log call can write, try 20 (0 = no limit)",
+	CVAR_T::RUNTIME);
+static REGISTER_CVAR_INT(
+	cv_log_limit_burst,
+	100,
+	"the messages that one log call can write at once before cv_log_limit_rate applies",
+	CVAR_T::RUNTIME);
+static REGISTER_CVAR_INT(
+	cv_log_limit_report_ms,
+	1000,
+	"how often the number of suppressed messages is logged (milliseconds)",
+	CVAR_T::RUNTIME);
+
+enum
+{
+	// a power of 2, if it's full the new sites are not limited.
+	LOG_LIMIT_SITE_COUNT = 1024,
+	LOG_LIMIT_MAX_PROBE = 16,
+	// the part of the message that is shown in the report.
+	LOG_LIMIT_SAMPLE_MAX = 80
+};
+
+namespace
+{
+struct log_limit_site
+{
+	// 0 = empty, once it's set it never changes.
+	std::atomic<uintptr_t> key{0};
+	// a spin lock, only held to update the bucket.
+	std::atomic<bool> lock{false};
+
+	// everything below is protected by the lock.
+	bool ready = false;
+	double tokens = 0;
+	TIMER_U last_refill = TIMER_NULL;
+	TIMER_U last_report = TIMER_NULL;
+	size_t suppressed = 0;
+	size_t sample_len = 0;
+	char sample[LOG_LIMIT_SAMPLE_MAX];
+
+	void acquire()
+	{
+		while(lock.exchange(true, std::memory_order_acquire))
+		{
+		}
+	}
+	void release()
+	{
+		lock.store(false, std::memory_order_release);
+	}
+};
+} // namespace
+
+static log_limit_site g_log_limit_sites[LOG_LIMIT_SITE_COUNT];
+
+// the depth of log_limit_exempt_scope on this thread.
+static
+#ifndef __EMSCRIPTEN__
+	thread_local
+#endif
+	int g_log_limit_exempt = 0;
+
+log_limit_exempt_scope::log_limit_exempt_scope()
+{
+	++g_log_limit_exempt;
+}
+log_limit_exempt_scope::~log_limit_exempt_scope()
+{
+	--g_log_limit_exempt;
+}
+
+static bool log_limit_enabled()
+{
+	return cv_log_limit_rate.data > 0 && g_log_limit_exempt == 0;
+}
+
+static void log_limit_write_report(const log_limit_site& site, size_t suppressed)
+{
+	// the sample usually ends with a newline.
+	size_t len = site.sample_len;
+	while(len != 0 && (site.sample[len - 1] == '\n' || site.sample[len - 1] == '\r'))
+	{
+		--len;
+	}
+	char msg[LOG_LIMIT_SAMPLE_MAX + 100];
+	int ret = snprintf(
+		msg,
+		sizeof(msg),
+		"info: suppressed %zu messages like: %.*s%s\n",
+		suppressed,
+		static_cast<int>(len),
+		site.sample,
+		(site.sample_len == LOG_LIMIT_SAMPLE_MAX) ? "..." : "");
+	if(ret > 0)
+	{
+		// this doesn't go through the limit, it's already once per cv_log_limit_report_ms.
+		log_sink_write(
+			CONSOLE_MESSAGE_TYPE::INFO, msg, std::min<size_t>(ret, sizeof(msg) - 1));
+	}
+}
+
+static bool log_limit_allow(uintptr_t key, const char* sample, size_t sample_len)
+{
+	if(!log_limit_enabled())
+	{
+		return true;
+	}
+	double rate = cv_log_limit_rate.data;
+	if(key == 0)
+	{
+		key = 1;
+	}
+
+	// open addressing, the sites are never removed.
+	log_limit_site* site = NULL;
+	size_t index = (key ^ (key >> 17)) * 0x9E3779B97F4A7C15ull >> 32;
+	for(size_t i = 0; i < LOG_LIMIT_MAX_PROBE; ++i)
+	{
+		log_limit_site& cur = g_log_limit_sites[(index + i) & (LOG_LIMIT_SITE_COUNT - 1)];
+		uintptr_t cur_key = cur.key.load(std::memory_order_acquire);
+		if(cur_key == 0 &&
+		   cur.key.compare_exchange_strong(
+			   cur_key, key, std::memory_order_acq_rel, std::memory_order_acquire))
+		{
+			site = &cur;
+			break;
+		}
+		if(cur_key == key)
+		{
+			site = &cur;
+			break;
+		}
+	}
+	if(site == NULL)
+	{
+		// the table is full.
+		return true;
+	}
+
+	double burst = std::max(cv_log_limit_burst.data, 1);
+	TIMER_U now = timer_now();
+	size_t report = 0;
+	bool allow;
+
+	site->acquire();
+	if(!site->ready)
+	{
+		site->ready = true;
+		site->tokens = burst;
+		site->last_refill = now;
+		site->last_report = now;
+		site->sample_len = std::min<size_t>(sample_len, LOG_LIMIT_SAMPLE_MAX);
+		memcpy(site->sample, sample, site->sample_len);
+	}
+	site->tokens = std::min(
+		burst, site->tokens + timer_delta<1>(site->last_refill, now) * rate);
+	site->last_refill = now;
+	allow = (site->tokens >= 1);
+	if(allow)
+	{
+		site->tokens -= 1;
+		if(site->suppressed != 0 &&
+		   timer_delta<1000>(site->last_report, now) >= cv_log_limit_report_ms.data)
+		{
+			report = site->suppressed;
+			site->suppressed = 0;
+			site->last_report = now;
+		}
+	}
+	else
+	{
+		site->suppressed += 1;
+	}
+	site->release();
+
+	if(report != 0)
+	{
+		log_limit_write_report(*site, report);
+	}
+	return allow;
+}
+
+bool log_limit_allow_format(uintptr_t call_site, const char* fmt)
+{
+	ASSERT(fmt != NULL);
+	return log_limit_allow(call_site, fmt, strnlen(fmt, LOG_LIMIT_SAMPLE_MAX));
+}
+
+bool log_limit_allow_text(const char* msg, size_t len)
+{
+	ASSERT(msg != NULL);
+	if(!log_limit_enabled())
+	{
+		return true;
+	}
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ull;
+	for(size_t i = 0; i < len; ++i)
+	{
+		hash = (hash ^ static_cast<unsigned char>(msg[i])) * 1099511628211ull;
+	}
+	return log_limit_allow(static_cast<uintptr_t>(hash), msg, len);
+}
+
+void log_limit_report()
+{
+	if(cv_log_limit_rate.data <= 0)
+	{
+		return;
+	}
+	// most of the time nothing was suppressed, so don't scan the table every call.
+	static std::atomic<TIMER_U> last_scan{TIMER_NULL};
+	TIMER_U now = timer_now();
+	TIMER_U prev = last_scan.load(std::memory_order_relaxed);
+	if(timer_delta<1000>(prev, now) < cv_log_limit_report_ms.data ||
+	   !last_scan.compare_exchange_strong(prev, now, std::memory_order_relaxed))
+	{
+		return;
+	}
+
+	for(log_limit_site& site : g_log_limit_sites)
+	{
+		if(site.key.load(std::memory_order_acquire) == 0)
+		{
+			continue;
+		}
+		size_t report = 0;
+		site.acquire();
+		if(site.suppressed != 0 &&
+		   timer_delta<1000>(site.last_report, now) >= cv_log_limit_report_ms.data)
+		{
+			report = site.suppressed;
+			site.suppressed = 0;
+			site.last_report = now;
+		}
+		site.release();
+		if(report != 0)
+		{
+			log_limit_write_report(site, report);
+		}
+	}
+}
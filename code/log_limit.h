@@ -0,0 +1,40 @@
+#pragma once
+
+#include "global.h"
+
+// rate limits repeated log messages, so a message that is logged every frame
+// (a missing glyph, a GL error) can't flood g_log, the console and the log file.
+// it's off by default (cv_log_limit_rate = 0), because it also limits legitimate repeated output.
+// every call site (the return address of slogf / serrf, or the text of slog / serr)
+// has a token bucket that refills cv_log_limit_rate messages per second (up to cv_log_limit_burst).
+// the output of console commands (like "help") is not limited, see log_limit_exempt_scope.
+// when the bucket is empty the message is dropped and counted,
+// and "suppressed N messages like: ..." is logged at most once every cv_log_limit_report_ms
+// (the next time the site logs, or from log_limit_report).
+// the serr buffer (serr_get_error) still gets every error, only the log is limited.
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define LOG_LIMIT_CALL_SITE() reinterpret_cast<uintptr_t>(_ReturnAddress())
+#else
+#define LOG_LIMIT_CALL_SITE() reinterpret_cast<uintptr_t>(__builtin_return_address(0))
+#endif
+
+// returns false if the message should not be logged (any thread).
+// call_site is LOG_LIMIT_CALL_SITE() in slogf / serrf (the key),
+// fmt is only shown in the report (the same literal could be merged between call sites).
+bool log_limit_allow_format(uintptr_t call_site, const char* fmt);
+// the text is hashed, for messages that are not string literals.
+bool log_limit_allow_text(const char* msg, size_t len);
+
+// logs the suppressed counts of the sites that stopped logging, call this periodically.
+void log_limit_report();
+
+// the messages that this thread logs while this exists are not limited.
+struct log_limit_exempt_scope
+{
+	log_limit_exempt_scope();
+	~log_limit_exempt_scope();
+	log_limit_exempt_scope(const log_limit_exempt_scope&) = delete;
+	log_limit_exempt_scope& operator=(const log_limit_exempt_scope&) = delete;
+};
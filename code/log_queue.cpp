@@ -0,0 +1,374 @@
+#include "global_pch.h"
+#include "global.h"
+
+#include "log_queue.h"
+
+#include "log_format.h"
+
+log_queue g_log;
+
+// a single producer single consumer ring.
+// a message is a record_header, the text, a null terminator, and padding to align the next header.
+// a deferred message is the format pointer and the arguments instead of the text.
+// the records are only 4 byte aligned, so the end of the buffer could be too small for a header,
+// that tail is skipped without a PADDING_RECORD (both sides check is_short_tail).
+struct log_queue::thread_buffer
+{
+	struct record_header
+	{
+		uint32_t size;
+		CONSOLE_MESSAGE_TYPE type;
+		bool deferred;
+	};
+	enum : uint32_t
+	{
+		// the rest of the buffer is skipped because the message didn't fit before the end.
+		PADDING_RECORD = UINT32_MAX
+	};
+
+	// the write position (only increases), set by the owner thread.
+	std::atomic<size_t> head{0};
+	// the read position (only increases), everything before it can be overwritten.
+	std::atomic<size_t> tail{0};
+	// messages that didn't fit.
+	std::atomic<size_t> dropped{0};
+	// false when the thread exits, so another thread can take it.
+	std::atomic<bool> in_use{true};
+	// set before the buffer is added to the list.
+	thread_buffer* next = NULL;
+
+	// only used by the reader.
+	size_t read_cursor = 0;
+
+	// only used by the owner, the head of the message being written.
+	size_t write_cursor = 0;
+
+	alignas(record_header) char data[BUFFER_SIZE];
+
+	static size_t record_size(size_t size)
+	{
+		size_t total = sizeof(record_header) + size + 1;
+		return (total + alignof(record_header) - 1) & ~(alignof(record_header) - 1);
+	}
+	// true if a record_header doesn't fit between index and the end.
+	static bool is_short_tail(size_t index)
+	{
+		return BUFFER_SIZE - index < sizeof(record_header);
+	}
+};
+
+// set when log_thread_owner is destroyed, a thread_local destructor that runs after it
+// can't push (this is trivially destructible, so it can still be read).
+static
+#ifndef __EMSCRIPTEN__
+	thread_local
+#endif
+	bool g_log_thread_exited = false;
+
+namespace
+{
+// marks the buffer as free when the thread exits.
+struct log_thread_owner
+{
+	log_queue::thread_buffer* buffer = NULL;
+	~log_thread_owner()
+	{
+		g_log_thread_exited = true;
+		if(buffer != NULL)
+		{
+			// another thread can take the buffer after in_use is cleared.
+			log_queue::thread_buffer* buf = buffer;
+			buffer = NULL;
+			buf->in_use.store(false, std::memory_order_release);
+		}
+	}
+};
+} // namespace
+
+bool log_queue::can_push()
+{
+	return !g_log_thread_exited;
+}
+
+log_queue::thread_buffer* log_queue::internal_get_thread_buffer()
+{
+	static
+#ifndef __EMSCRIPTEN__
+		thread_local
+#endif
+		log_thread_owner owner;
+	if(g_log_thread_exited)
+	{
+		return NULL;
+	}
+	if(owner.buffer != NULL)
+	{
+		return owner.buffer;
+	}
+
+	// reuse the buffer of a thread that exited (the messages left in it are still read).
+	for(thread_buffer* buf = buffers.load(std::memory_order_acquire); buf != NULL;
+		buf = buf->next)
+	{
+		bool expected = false;
+		if(buf->in_use.compare_exchange_strong(
+			   expected, true, std::memory_order_acquire, std::memory_order_relaxed))
+		{
+			owner.buffer = buf;
+			return buf;
+		}
+	}
+
+	thread_buffer* buf = new thread_buffer;
+	buf->next = buffers.load(std::memory_order_relaxed);
+	while(!buffers.compare_exchange_weak(
+		buf->next, buf, std::memory_order_release, std::memory_order_relaxed))
+	{
+	}
+	owner.buffer = buf;
+	return buf;
+}
+
+char* log_queue::internal_reserve(
+	thread_buffer* buf, CONSOLE_MESSAGE_TYPE type, size_t size, bool deferred)
+{
+	ASSERT(buf != NULL);
+	ASSERT(size <= MESSAGE_MAX_SIZE);
+	typedef thread_buffer::record_header record_header;
+
+	size_t head = buf->head.load(std::memory_order_relaxed);
+	size_t tail = buf->tail.load(std::memory_order_acquire);
+	size_t index = head & (BUFFER_SIZE - 1);
+	size_t contiguous = BUFFER_SIZE - index;
+	size_t need = thread_buffer::record_size(size);
+	// if it doesn't fit before the end, the end is skipped.
+	size_t padding = (need > contiguous) ? contiguous : 0;
+	if(BUFFER_SIZE - (head - tail) < padding + need)
+	{
+		buf->dropped.fetch_add(1, std::memory_order_relaxed);
+		return NULL;
+	}
+	if(padding != 0)
+	{
+		if(!thread_buffer::is_short_tail(index))
+		{
+			record_header skip{thread_buffer::PADDING_RECORD, type, false};
+			memcpy(buf->data + index, &skip, sizeof(skip));
+		}
+		head += padding;
+		index = 0;
+	}
+
+	// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+	record_header header{static_cast<uint32_t>(size), type, deferred};
+	memcpy(buf->data + index, &header, sizeof(header));
+	// the padding and the message are published by internal_commit.
+	buf->write_cursor = head + need;
+	return buf->data + index + sizeof(header);
+}
+
+void log_queue::internal_commit(thread_buffer* buf)
+{
+	size_t head = buf->write_cursor;
+	buf->head.store(head, std::memory_order_release);
+	void (*wake)() = reader_wake.load(std::memory_order_relaxed);
+	if(wake != NULL && head - buf->tail.load(std::memory_order_relaxed) > BUFFER_SIZE / 2)
+	{
+		wake();
+	}
+}
+
+void log_queue::push(CONSOLE_MESSAGE_TYPE type, const char* str, size_t len)
+{
+	ASSERT(str != NULL);
+	thread_buffer* buf = internal_get_thread_buffer();
+	if(buf == NULL)
+	{
+		return;
+	}
+	size_t count = std::min<size_t>(len, MESSAGE_MAX_SIZE);
+	char* cur = internal_reserve(buf, type, count);
+	if(cur == NULL)
+	{
+		return;
+	}
+	memcpy(cur, str, count);
+	if(count != 0 && len > MESSAGE_MAX_SIZE)
+	{
+		cur[count - 1] = '\n';
+	}
+	cur[count] = '\0';
+	internal_commit(buf);
+}
+void log_queue::push_vargs(CONSOLE_MESSAGE_TYPE type, const char* fmt, va_list args)
+{
+	ASSERT(fmt != NULL);
+	thread_buffer* buf = internal_get_thread_buffer();
+	if(buf == NULL)
+	{
+		return;
+	}
+	int ret;
+	va_list temp_args;
+	va_copy(temp_args, args);
+#ifdef WIN32
+	// win32 has a compatible C standard library, but annex k prevents exploits or something.
+	ret = _vscprintf(fmt, temp_args);
+#else
+	ret = vsnprintf(NULL, 0, fmt, temp_args);
+#endif
+	ASSERT(ret != -1);
+	va_end(temp_args);
+
+	size_t len = ret;
+
+	size_t count = std::min<size_t>(len, MESSAGE_MAX_SIZE);
+	char* cur = internal_reserve(buf, type, count);
+	if(cur == NULL)
+	{
+		return;
+	}
+
+#ifdef WIN32
+	ret = vsprintf_s(cur, count + 1, fmt, args);
+#else
+	ret = vsnprintf(cur, count + 1, fmt, args);
+#endif
+	if(count != 0 && len > MESSAGE_MAX_SIZE)
+	{
+		cur[count - 1] = '\n';
+	}
+	cur[count] = '\0';
+	internal_commit(buf);
+}
+bool log_queue::push_deferred(CONSOLE_MESSAGE_TYPE type, const char* fmt, va_list args)
+{
+	ASSERT(fmt != NULL);
+	size_t args_size = log_format_capture(NULL, 0, fmt, args);
+	if(args_size == SIZE_MAX || args_size > MESSAGE_MAX_SIZE - sizeof(fmt))
+	{
+		return false;
+	}
+
+	thread_buffer* buf = internal_get_thread_buffer();
+	if(buf == NULL)
+	{
+		return true;
+	}
+	char* cur = internal_reserve(buf, type, sizeof(fmt) + args_size, true);
+	if(cur == NULL)
+	{
+		return true;
+	}
+	memcpy(cur, &fmt, sizeof(fmt));
+	size_t ret = log_format_capture(cur + sizeof(fmt), args_size, fmt, args);
+	ASSERT(ret == args_size);
+	(void)ret;
+	cur[sizeof(fmt) + args_size] = '\0';
+	internal_commit(buf);
+	return true;
+}
+
+const char* log_queue::pop(log_message* message)
+{
+	ASSERT(message != NULL);
+	typedef thread_buffer::record_header record_header;
+	if(!reading)
+	{
+		reading = true;
+		read_buffer = buffers.load(std::memory_order_acquire);
+		if(read_buffer != NULL)
+		{
+			read_end = read_buffer->head.load(std::memory_order_acquire);
+		}
+	}
+	while(read_buffer != NULL)
+	{
+		thread_buffer* buf = read_buffer;
+		// the message from the last pop can be overwritten now.
+		buf->tail.store(buf->read_cursor, std::memory_order_release);
+
+		// only read up to the head from when the buffer was reached,
+		// so a thread that keeps logging can't keep this busy.
+		while(buf->read_cursor != read_end)
+		{
+			size_t index = buf->read_cursor & (BUFFER_SIZE - 1);
+			if(thread_buffer::is_short_tail(index))
+			{
+				buf->read_cursor += BUFFER_SIZE - index;
+				continue;
+			}
+			record_header header;
+			memcpy(&header, buf->data + index, sizeof(header));
+			if(header.size == thread_buffer::PADDING_RECORD)
+			{
+				buf->read_cursor += BUFFER_SIZE - index;
+				continue;
+			}
+			const char* data = buf->data + index + sizeof(header);
+			message->count = header.size;
+			message->type = header.type;
+			message->format = NULL;
+			if(header.deferred)
+			{
+				memcpy(&message->format, data, sizeof(message->format));
+				data += sizeof(message->format);
+				message->count -= sizeof(message->format);
+			}
+			buf->read_cursor += thread_buffer::record_size(header.size);
+			return data;
+		}
+		buf->tail.store(buf->read_cursor, std::memory_order_release);
+
+		read_buffer = buf->next;
+		if(read_buffer != NULL)
+		{
+			read_end = read_buffer->head.load(std::memory_order_acquire);
+		}
+	}
+	reading = false;
+	return NULL;
+}
+const char* log_queue::get_text(const char* data, log_message* message)
+{
+	ASSERT(data != NULL);
+	ASSERT(message != NULL);
+	if(message->format == NULL)
+	{
+		return data;
+	}
+	size_t len = log_format_args(
+		text_buffer, sizeof(text_buffer), message->format, data, message->count);
+	// same as push_vargs
+	if(len == MESSAGE_MAX_SIZE)
+	{
+		text_buffer[len - 1] = '\n';
+	}
+	message->count = len;
+	message->format = NULL;
+	return text_buffer;
+}
+size_t log_queue::pop_dropped()
+{
+	size_t dropped = 0;
+	for(thread_buffer* buf = buffers.load(std::memory_order_acquire); buf != NULL;
+		buf = buf->next)
+	{
+		dropped += buf->dropped.exchange(0, std::memory_order_relaxed);
+	}
+	return dropped;
+}
+
+size_t log_queue::pending_bytes()
+{
+	size_t pending = 0;
+	for(thread_buffer* buf = buffers.load(std::memory_order_acquire); buf != NULL;
+		buf = buf->next)
+	{
+		size_t tail = buf->tail.load(std::memory_order_relaxed);
+		size_t head = buf->head.load(std::memory_order_relaxed);
+		// the tail could be newer than the head.
+		pending += (head > tail) ? head - tail : 0;
+	}
+	return pending;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "global.h"
+
+#include <atomic>
+
+enum class CONSOLE_MESSAGE_TYPE
+{
+	INFO,
+	ERROR
+};
+
+// the messages that go to the console from any thread.
+// every thread that logs gets it's own ring buffer (the first time it logs),
+// so pushing a message is a copy and one atomic store, and it never waits for the console.
+// the buffers are reused by new threads when a thread exits.
+// if a thread fills it's buffer faster than the console reads it,
+// the message is dropped and counted (see pop_dropped).
+// the order is only kept for the messages of the same thread.
+struct log_queue
+{
+	enum
+	{
+		// the size of each thread's buffer (a power of 2)
+		BUFFER_SIZE = 1 << 16,
+		// longer messages are truncated
+		MESSAGE_MAX_SIZE = BUFFER_SIZE / 4,
+	};
+	struct log_message
+	{
+		size_t count; // the number of characters written (the return value of fprintf)
+		CONSOLE_MESSAGE_TYPE type;
+		// if this is not NULL, the message is the arguments of push_deferred (count is the size),
+		// and get_text formats it.
+		const char* format;
+	};
+
+	struct thread_buffer;
+
+	// a list of every thread_buffer, new buffers are added to the front.
+	// the buffers are never freed, so logging still works in static destructors.
+	std::atomic<thread_buffer*> buffers{NULL};
+
+	// called by a thread when it's buffer is more than half full,
+	// so the reader can read it sooner than it's usual interval (see log_sink).
+	std::atomic<void (*)()> reader_wake{NULL};
+
+	// the reader's position in the list.
+	thread_buffer* read_buffer = NULL;
+	size_t read_end = 0;
+	bool reading = false;
+
+	// only used by the reader, for get_text.
+	char text_buffer[MESSAGE_MAX_SIZE + 1];
+
+	// any thread
+	void push(CONSOLE_MESSAGE_TYPE type, const char* str, size_t len);
+	void push_vargs(CONSOLE_MESSAGE_TYPE type, const char* fmt, va_list args);
+	// copies the arguments instead of formatting them (see log_format.h),
+	// the format must be a string literal because only the pointer is kept.
+	// returns false if the format is not supported or the arguments are too large,
+	// then use push_vargs (a full buffer returns true, and the message is dropped).
+	NDSERR bool push_deferred(CONSOLE_MESSAGE_TYPE type, const char* fmt, va_list args);
+	// false if this thread is exiting (a thread_local destructor that logs),
+	// its buffer was given to other threads, so the push functions drop the message.
+	static bool can_push();
+
+	// only one thread can read.
+	// returns NULL after every buffer was read, the next call reads from the start again.
+	// the string is null terminated, and valid until the next pop.
+	// if message->format is set, this is the arguments, use get_text for the text.
+	const char* pop(log_message* message);
+	// formats the message from pop if it was deferred, message->count is set to the length.
+	// the text is valid until the next pop or get_text.
+	const char* get_text(const char* data, log_message* message);
+	// the number of messages that were dropped since the last call.
+	size_t pop_dropped();
+	// the bytes that were pushed but not read yet (any thread, it's only an estimate).
+	size_t pending_bytes();
+
+	// internal
+	// NULL if can_push() is false.
+	thread_buffer* internal_get_thread_buffer();
+	// returns the space for the message (size + the null terminator), or NULL if it's full
+	char* internal_reserve(
+		thread_buffer* buf, CONSOLE_MESSAGE_TYPE type, size_t size, bool deferred = false);
+	void internal_commit(thread_buffer* buf);
+};
+
+extern log_queue g_log;
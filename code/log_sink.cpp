@@ -0,0 +1,605 @@
+#include "global_pch.h"
+#include "global.h"
+
+#include "log_sink.h"
+#include "log_format.h"
+#include "log_limit.h"
+
+#include "cvar.h"
+#include "RWops.h"
+#include "zone_profiler.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <type_traits>
+#include <unordered_set>
+
+// I don't use threads on emscripten.
+#ifndef __EMSCRIPTEN__
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#endif
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#include <signal.h>
+#include <unistd.h>
+#define LOG_SINK_CRASH_HANDLER
+#endif
+
+static CVAR_T log_async_enabled
+#ifndef __EMSCRIPTEN__
+	= CVAR_T::STARTUP;
+#else
+	= CVAR_T::DISABLED;
+#endif
+
+static REGISTER_CVAR_INT(
+	cv_log_async,
+	1,
+	"0 = write the log on the thread that logs, 1 = write the log on a separate thread",
+	log_async_enabled);
+static REGISTER_CVAR_INT(
+	cv_log_deferred,
+	1,
+	"1 = slogf copies the arguments and the log thread formats them (requires cv_log_async)",
+	log_async_enabled);
+static REGISTER_CVAR_INT(
+	cv_log_flush_ms, 10, "how often the log thread writes the log (milliseconds)", CVAR_T::STARTUP);
+static REGISTER_CVAR_STRING(
+	cv_log_file, "", "also write the log into this file (empty = no file)", CVAR_T::STARTUP);
+static REGISTER_CVAR_INT(cv_log_stdout, 1, "0 = don't write the log into stdout", CVAR_T::STARTUP);
+static REGISTER_CVAR_STRING(
+	cv_log_binary_file,
+	"",
+	"write the log unformatted into this file (requires cv_log_async), "
+	"read it with the log_decode tool",
+	log_async_enabled);
+
+enum
+{
+	// if the console doesn't read the messages (before it's created), the batch stops growing.
+	CONSOLE_BATCH_MAX_SIZE = 1 << 20
+};
+
+namespace
+{
+struct log_sink_state
+{
+	FILE* log_file = NULL;
+	// cv_log_binary_file, only written by the log thread.
+	FILE* binary_file = NULL;
+	// the formats that were written into binary_file.
+	std::unordered_set<const char*> binary_formats;
+
+	// only one thread can read g_log (the log thread, the console or the crash handler),
+	// this is a try lock because the crash handler can't wait.
+	std::atomic<bool> reading{false};
+
+#ifndef __EMSCRIPTEN__
+	// true while the thread is writing the log.
+	std::atomic<bool> running{false};
+	// the number of threads that are pushing into g_log because running was true,
+	// log_sink_destroy waits for them so that the thread reads the last messages.
+	std::atomic<int> writers{0};
+	std::thread thread;
+
+	// protects everything below.
+	std::mutex mut;
+	std::condition_variable cond;
+	bool quit = false;
+	bool wake = false;
+	// the thread puts the console messages here.
+	log_sink_batch console_batch;
+#endif
+
+#ifdef LOG_SINK_CRASH_HANDLER
+	// the handlers from before log_sink_init.
+	struct sigaction old_actions[5];
+#endif
+};
+} // namespace
+
+static log_sink_state g_sink;
+
+#ifdef LOG_SINK_CRASH_HANDLER
+static const int crash_signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+static_assert(
+	std::size(crash_signals) == std::extent<decltype(log_sink_state::old_actions)>::value);
+#endif
+
+static bool log_sink_try_read()
+{
+	return !g_sink.reading.exchange(true, std::memory_order_acquire);
+}
+static void log_sink_end_read()
+{
+	g_sink.reading.store(false, std::memory_order_release);
+}
+
+static void log_sink_write_sync(CONSOLE_MESSAGE_TYPE type, const char* msg, size_t len)
+{
+	// on win32, if did a /subsystem:windows, I would probably
+	// replace stdout with OutputDebugString on the debug build.
+	if(cv_log_stdout.data != 0)
+	{
+		fwrite(msg, 1, len, stdout);
+	}
+	if(g_sink.log_file != NULL)
+	{
+		fwrite(msg, 1, len, g_sink.log_file);
+	}
+#ifndef DISABLE_CONSOLE
+	g_log.push(type, msg, len);
+#else
+	(void)type;
+#endif
+}
+
+void log_sink_write(CONSOLE_MESSAGE_TYPE type, const char* msg, size_t len)
+{
+	ASSERT(msg != NULL);
+#ifndef __EMSCRIPTEN__
+	g_sink.writers.fetch_add(1);
+	// an exiting thread can't use g_log, so it's written like before log_sink_init.
+	if(g_sink.running.load() && log_queue::can_push())
+	{
+		g_log.push(type, msg, len);
+		g_sink.writers.fetch_sub(1, std::memory_order_release);
+		return;
+	}
+	g_sink.writers.fetch_sub(1, std::memory_order_release);
+#endif
+	log_sink_write_sync(type, msg, len);
+}
+
+void log_sink_write_vargs(CONSOLE_MESSAGE_TYPE type, const char* fmt, va_list args)
+{
+	ASSERT(fmt != NULL);
+#ifndef __EMSCRIPTEN__
+	g_sink.writers.fetch_add(1);
+	if(g_sink.running.load() && log_queue::can_push())
+	{
+		if(cv_log_deferred.data == 0 || !g_log.push_deferred(type, fmt, args))
+		{
+			g_log.push_vargs(type, fmt, args);
+		}
+		g_sink.writers.fetch_sub(1, std::memory_order_release);
+		return;
+	}
+	g_sink.writers.fetch_sub(1, std::memory_order_release);
+#endif
+	// most messages fit, so the heap is only used for long messages.
+	char buffer[512];
+	va_list temp_args;
+	va_copy(temp_args, args);
+	int ret = vsnprintf(buffer, sizeof(buffer), fmt, temp_args);
+	va_end(temp_args);
+	ASSERT(ret != -1);
+	if(ret < 0)
+	{
+		return;
+	}
+	if(static_cast<size_t>(ret) < sizeof(buffer))
+	{
+		log_sink_write_sync(type, buffer, ret);
+		return;
+	}
+	int len;
+	std::unique_ptr<char[]> long_buffer = unique_vasprintf(&len, fmt, args);
+	log_sink_write_sync(type, long_buffer.get(), len);
+}
+
+#ifndef __EMSCRIPTEN__
+
+// the record for cv_log_binary_file (the format is written the first time it's used).
+static void log_sink_append_binary(
+	std::string& out, const char* data, const log_queue::log_message& message)
+{
+	log_binary_record record{};
+	record.message_type = static_cast<uint8_t>(message.type);
+	if(message.format == NULL)
+	{
+		record.kind = LOG_RECORD_TEXT;
+		// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+		record.size = message.count;
+		out.append(reinterpret_cast<const char*>(&record), sizeof(record));
+		out.append(data, message.count);
+		return;
+	}
+
+	uint64_t id = reinterpret_cast<uintptr_t>(message.format);
+	if(g_sink.binary_formats.insert(message.format).second)
+	{
+		size_t format_len = strlen(message.format);
+		record.kind = LOG_RECORD_FORMAT;
+		// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+		record.size = sizeof(id) + format_len;
+		out.append(reinterpret_cast<const char*>(&record), sizeof(record));
+		out.append(reinterpret_cast<const char*>(&id), sizeof(id));
+		out.append(message.format, format_len);
+	}
+	record.kind = LOG_RECORD_DEFERRED;
+	// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+	record.size = sizeof(id) + message.count;
+	out.append(reinterpret_cast<const char*>(&record), sizeof(record));
+	out.append(reinterpret_cast<const char*>(&id), sizeof(id));
+	out.append(data, message.count);
+}
+
+// reads g_log into the console batch and writes the text, requires log_sink_try_read.
+// the deferred messages are only formatted if something needs the text.
+static void log_sink_drain(
+	std::string& out, std::string& binary_out, log_sink_batch& staged, bool write_text)
+{
+	out.clear();
+	binary_out.clear();
+	staged.clear();
+
+	write_text = write_text && (cv_log_stdout.data != 0 || g_sink.log_file != NULL);
+	bool need_text = write_text;
+#ifndef DISABLE_CONSOLE
+	need_text = true;
+#endif
+
+	const char* msg;
+	log_queue::log_message message;
+	while((msg = g_log.pop(&message)) != NULL)
+	{
+		if(g_sink.binary_file != NULL)
+		{
+			log_sink_append_binary(binary_out, msg, message);
+		}
+		if(!need_text)
+		{
+			continue;
+		}
+		msg = g_log.get_text(msg, &message);
+		if(write_text)
+		{
+			out.append(msg, message.count);
+		}
+#ifndef DISABLE_CONSOLE
+		staged.text.append(msg, message.count);
+		staged.messages.push_back(message);
+#endif
+	}
+	size_t dropped = g_log.pop_dropped();
+	if(dropped != 0)
+	{
+		char note[100];
+		int ret = snprintf(
+			note,
+			sizeof(note),
+			"warning: %zu log messages were dropped (the log buffer was full)\n",
+			dropped);
+		if(ret > 0)
+		{
+			out.append(note, std::min<size_t>(ret, sizeof(note) - 1));
+		}
+		staged.dropped += dropped;
+	}
+
+	if(write_text && !out.empty())
+	{
+		if(cv_log_stdout.data != 0)
+		{
+			fwrite(out.data(), 1, out.size(), stdout);
+			fflush(stdout);
+		}
+		if(g_sink.log_file != NULL)
+		{
+			fwrite(out.data(), 1, out.size(), g_sink.log_file);
+			fflush(g_sink.log_file);
+		}
+	}
+	if(!binary_out.empty())
+	{
+		fwrite(binary_out.data(), 1, binary_out.size(), g_sink.binary_file);
+		fflush(g_sink.binary_file);
+	}
+
+	if(!staged.messages.empty() || staged.dropped != 0)
+	{
+		std::lock_guard<std::mutex> lk(g_sink.mut);
+		log_sink_batch& batch = g_sink.console_batch;
+		if(batch.text.size() + staged.text.size() > CONSOLE_BATCH_MAX_SIZE)
+		{
+			batch.dropped += staged.messages.size() + staged.dropped;
+		}
+		else
+		{
+			batch.text += staged.text;
+			batch.messages.insert(
+				batch.messages.end(), staged.messages.begin(), staged.messages.end());
+			batch.dropped += staged.dropped;
+		}
+	}
+}
+
+static void log_sink_run()
+{
+	zone_profiler_set_thread_name("log");
+
+	// reused between writes.
+	std::string out;
+	std::string binary_out;
+	log_sink_batch staged;
+
+	auto interval = std::chrono::milliseconds(std::max(cv_log_flush_ms.data, 1));
+	std::unique_lock<std::mutex> lk(g_sink.mut);
+	while(!g_sink.quit)
+	{
+		g_sink.cond.wait_for(lk, interval, [] { return g_sink.quit || g_sink.wake; });
+		g_sink.wake = false;
+		lk.unlock();
+		log_limit_report();
+		if(log_sink_try_read())
+		{
+			log_sink_drain(out, binary_out, staged, true);
+			log_sink_end_read();
+		}
+		lk.lock();
+	}
+	lk.unlock();
+
+	// the last messages before log_sink_destroy.
+	if(log_sink_try_read())
+	{
+		log_sink_drain(out, binary_out, staged, true);
+		log_sink_end_read();
+	}
+}
+
+#endif // __EMSCRIPTEN__
+
+void log_sink_flush()
+{
+#ifndef __EMSCRIPTEN__
+	if(g_sink.running.load(std::memory_order_acquire))
+	{
+		{
+			std::lock_guard<std::mutex> lk(g_sink.mut);
+			g_sink.wake = true;
+		}
+		g_sink.cond.notify_one();
+	}
+#endif
+}
+
+#ifdef LOG_SINK_CRASH_HANDLER
+static void write_all(int fd, const char* data, size_t size)
+{
+	while(size != 0)
+	{
+		ssize_t ret = write(fd, data, size);
+		if(ret <= 0)
+		{
+			if(ret == -1 && errno == EINTR)
+			{
+				continue;
+			}
+			return;
+		}
+		data += ret;
+		size -= ret;
+	}
+}
+
+// write what is left in g_log with write() and pass the signal to the handler from before
+// log_sink_init (like the ASAN report), or the default action.
+// if the log thread was in the middle of writing, what it had is lost.
+static void log_sink_crash_handler(int sig, siginfo_t* info, void* /*context*/)
+{
+	if(log_sink_try_read())
+	{
+		int file_fd = (g_sink.log_file != NULL) ? fileno(g_sink.log_file) : -1;
+		const char* msg;
+		log_queue::log_message message;
+		while((msg = g_log.pop(&message)) != NULL)
+		{
+			// get_text doesn't allocate.
+			msg = g_log.get_text(msg, &message);
+			if(cv_log_stdout.data != 0)
+			{
+				write_all(STDOUT_FILENO, msg, message.count);
+			}
+			if(file_fd != -1)
+			{
+				write_all(file_fd, msg, message.count);
+			}
+		}
+	}
+	for(size_t i = 0; i < std::size(crash_signals); ++i)
+	{
+		if(crash_signals[i] == sig)
+		{
+			sigaction(sig, &g_sink.old_actions[i], NULL);
+			break;
+		}
+	}
+	// a fault from the kernel happens again when this returns,
+	// so the old handler gets the real siginfo (the fault address).
+	if(info != NULL && info->si_code > 0 && sig != SIGABRT)
+	{
+		return;
+	}
+	raise(sig);
+}
+#endif
+
+#ifndef __EMSCRIPTEN__
+static void log_sink_atexit()
+{
+	// in case exit() was called without log_sink_destroy
+	// (the error is ignored, there is nothing left to print it)
+	bool ret = log_sink_destroy();
+	(void)ret;
+}
+#endif
+
+bool log_sink_init()
+{
+	if(!cv_log_file.data.empty())
+	{
+		ASSERT(g_sink.log_file == NULL);
+		g_sink.log_file = serr_wrapper_fopen(cv_log_file.data.c_str(), "wb");
+		if(g_sink.log_file == NULL)
+		{
+			return false;
+		}
+	}
+
+#ifndef __EMSCRIPTEN__
+	if(cv_log_async.data != 0)
+	{
+		ASSERT(!g_sink.thread.joinable());
+
+		if(!cv_log_binary_file.data.empty())
+		{
+			ASSERT(g_sink.binary_file == NULL);
+			g_sink.binary_file = serr_wrapper_fopen(cv_log_binary_file.data.c_str(), "wb");
+			if(g_sink.binary_file == NULL)
+			{
+				return false;
+			}
+			log_binary_header header;
+			fwrite(&header, 1, sizeof(header), g_sink.binary_file);
+			g_sink.binary_formats.clear();
+		}
+
+		// the messages before this were already written, so only give them to the console
+		// (and the binary file).
+		if(log_sink_try_read())
+		{
+			std::string out;
+			std::string binary_out;
+			log_sink_batch staged;
+			log_sink_drain(out, binary_out, staged, false);
+			log_sink_end_read();
+		}
+
+		g_sink.quit = false;
+		g_sink.wake = false;
+		g_log.reader_wake.store(log_sink_flush, std::memory_order_relaxed);
+		g_sink.running.store(true, std::memory_order_release);
+		g_sink.thread = std::thread(log_sink_run);
+
+#ifdef LOG_SINK_CRASH_HANDLER
+		struct sigaction action;
+		memset(&action, 0, sizeof(action));
+		action.sa_sigaction = log_sink_crash_handler;
+		sigemptyset(&action.sa_mask);
+		action.sa_flags = SA_SIGINFO | SA_RESETHAND | SA_NODEFER;
+		for(size_t i = 0; i < std::size(crash_signals); ++i)
+		{
+			sigaction(crash_signals[i], &action, &g_sink.old_actions[i]);
+		}
+#endif
+		static bool registered_atexit = false;
+		if(!registered_atexit)
+		{
+			registered_atexit = true;
+			std::atexit(log_sink_atexit);
+		}
+	}
+#endif
+	return true;
+}
+
+bool log_sink_destroy()
+{
+	bool success = true;
+
+#ifndef __EMSCRIPTEN__
+	if(g_sink.thread.joinable())
+	{
+		// new messages are written by the thread that logs.
+		g_sink.running.store(false);
+		// a thread that saw running might still be pushing a message.
+		while(g_sink.writers.load() != 0)
+		{
+			std::this_thread::yield();
+		}
+		g_log.reader_wake.store(NULL, std::memory_order_relaxed);
+		{
+			std::lock_guard<std::mutex> lk(g_sink.mut);
+			g_sink.quit = true;
+		}
+		g_sink.cond.notify_one();
+		g_sink.thread.join();
+
+#ifdef LOG_SINK_CRASH_HANDLER
+		for(size_t i = 0; i < std::size(crash_signals); ++i)
+		{
+			sigaction(crash_signals[i], &g_sink.old_actions[i], NULL);
+		}
+#endif
+	}
+	if(g_sink.binary_file != NULL)
+	{
+		FILE* fp = g_sink.binary_file;
+		g_sink.binary_file = NULL;
+		int prev_error = ferror(fp);
+		if(fclose(fp) != 0 || prev_error != 0)
+		{
+			serrf(
+				"Failed to close binary log: `%s`, reason: %s\n",
+				cv_log_binary_file.data.c_str(),
+				strerror(errno));
+			success = false;
+		}
+	}
+#endif
+
+	if(g_sink.log_file != NULL)
+	{
+		FILE* fp = g_sink.log_file;
+		g_sink.log_file = NULL;
+		int prev_error = ferror(fp);
+		if(fclose(fp) != 0 || prev_error != 0)
+		{
+			serrf(
+				"Failed to close log: `%s`, reason: %s\n",
+				cv_log_file.data.c_str(),
+				strerror(errno));
+			success = false;
+		}
+	}
+
+	fflush(stdout);
+	return success;
+}
+
+void log_sink_take_console_batch(log_sink_batch* batch)
+{
+	ASSERT(batch != NULL);
+	batch->clear();
+#ifndef __EMSCRIPTEN__
+	{
+		std::lock_guard<std::mutex> lk(g_sink.mut);
+		std::swap(*batch, g_sink.console_batch);
+	}
+	if(g_sink.running.load(std::memory_order_acquire))
+	{
+		return;
+	}
+#endif
+	// without the thread, the console polls the suppressed messages.
+	log_limit_report();
+
+	// the messages were already written, so only read them.
+	if(log_sink_try_read())
+	{
+		const char* msg;
+		log_queue::log_message message;
+		while((msg = g_log.pop(&message)) != NULL)
+		{
+			msg = g_log.get_text(msg, &message);
+			batch->text.append(msg, message.count);
+			batch->messages.push_back(message);
+		}
+		batch->dropped += g_log.pop_dropped();
+		log_sink_end_read();
+	}
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "global.h"
+#include "log_queue.h"
+
+#include <string>
+#include <vector>
+
+// writes the log into stdout, the log file (cv_log_file) and gives it to the console.
+// if cv_log_async is set, slog only copies the message into g_log,
+// and a thread writes everything that was logged every cv_log_flush_ms with one fwrite.
+// before log_sink_init and after log_sink_destroy, the log is written on the calling thread.
+// if the program crashes (SIGSEGV, SIGABRT...), the messages that are left are written first.
+// with cv_log_deferred, slogf copies the arguments, and the log thread only formats them
+// if something needs the text (stdout, cv_log_file or the console).
+// cv_log_binary_file gets the arguments without formatting (read it with tools/log_decode.cpp).
+
+// call this after the cvars are loaded.
+NDSERR bool log_sink_init();
+// writes everything that is left, stops the thread and closes the log file.
+NDSERR bool log_sink_destroy();
+
+// slog and serr use this (any thread)
+void log_sink_write(CONSOLE_MESSAGE_TYPE type, const char* msg, size_t len);
+void log_sink_write_vargs(CONSOLE_MESSAGE_TYPE type, const char* fmt, va_list args);
+
+// wake up the thread so it writes now instead of waiting for the interval.
+void log_sink_flush();
+
+// the messages for the console.
+struct log_sink_batch
+{
+	// the messages are back to back (without null terminators)
+	std::string text;
+	std::vector<log_queue::log_message> messages;
+	// messages that didn't fit into g_log or the batch.
+	size_t dropped = 0;
+
+	void clear()
+	{
+		text.clear();
+		messages.clear();
+		dropped = 0;
+	}
+};
+
+// the messages since the last call, only the console should call this.
+void log_sink_take_console_batch(log_sink_batch* batch);
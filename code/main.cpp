@@ -2,6 +2,10 @@
 #include "global.h"
 #include "app.h"
 #include "demo.h"
+#include "log_sink.h"
+#include "sampling_profiler.h"
+#include "telemetry.h"
+#include "zone_profiler.h"
 #include <SDL2/SDL.h>
 
 #ifdef __EMSCRIPTEN__
@@ -48,6 +52,10 @@ void emscripten_loop()
 		{
 			success_loop = false;
 		}
+		if(!log_sink_destroy())
+		{
+			success_loop = false;
+		}
 		emscripten_cancel_main_loop();
 	}
 
@@ -83,6 +91,8 @@ int main(int argc, char** argv)
 
 	cvar_init();
 
+	zone_profiler_set_thread_name("main");
+
 	bool success = true;
 
 	const char* path = "cvar.cfg";
@@ -155,6 +165,24 @@ int main(int argc, char** argv)
 		}
 	}
 
+	// after this the log is written on a thread (if cv_log_async)
+	if(success)
+	{
+		if(!log_sink_init())
+		{
+			success = false;
+		}
+	}
+
+	// cv_telemetry_shm (does nothing by default).
+	if(success)
+	{
+		if(!telemetry_init())
+		{
+			success = false;
+		}
+	}
+
 	if(success)
 	{
 		if(!app_init(g_app))
@@ -223,6 +251,31 @@ int main(int argc, char** argv)
 #endif
 	}
 
+	if(!telemetry_destroy())
+	{
+		success = false;
+	}
+
+#ifndef __EMSCRIPTEN__
+	// if cv_prof is still running, write the profile.
+	if(!sampling_profiler_destroy())
+	{
+		success = false;
+	}
+
+	// same for cv_zone_trace.
+	if(!zone_profiler_destroy())
+	{
+		success = false;
+	}
+
+	// write everything that is left in the log.
+	if(!log_sink_destroy())
+	{
+		success = false;
+	}
+#endif
+
 	if(!success)
 	{
 		// TODO: probably should wrap this around a wrapper, and limit the string to a certain width
@@ -163,7 +163,7 @@ bool option_error_prompt::draw_buffer()
 	auto white_uv = font_painter->state.font->get_font_atlas()->white_uv;
 	std::array<uint8_t, 4> bbox_color{0, 0, 0, 255};
 
-	gl_batch_buffer_offset = batcher->get_current_vertex_count();
+	gl_batch_buffer_offset = batcher->get_current_quad_count();
 
 	resize_view();
 
@@ -189,13 +189,13 @@ bool option_error_prompt::draw_buffer()
 		return false;
 	}
 
-	gl_batch_vertex_count = batcher->get_current_vertex_count();
+	gl_batch_quad_count = batcher->get_current_quad_count();
 
 	if(!prompt.draw())
 	{
 		return false;
 	}
-	gl_batch_vertex_scroll_count = batcher->get_current_vertex_count();
+	gl_batch_quad_scroll_count = batcher->get_current_quad_count();
 
 	return true;
 }
@@ -204,12 +204,12 @@ bool option_error_prompt::render()
 	ASSERT(state != NULL);
 	ASSERT(gl_batch_buffer_offset != -1);
 
-	GLint vertex_offset = gl_batch_buffer_offset;
-	GLsizei vertex_count = gl_batch_vertex_count;
+	GLint quad_offset = gl_batch_buffer_offset;
+	GLsizei quad_count = gl_batch_quad_count;
 
-	if(vertex_count - vertex_offset > 0)
+	if(quad_count - quad_offset > 0)
 	{
-		vertex_count -= vertex_offset;
+		quad_count -= quad_offset;
 
 		// optimization: some render() calls use a draw call, and some dont,
 		// This is a microoptimization because focus_element isn't a hot path (only called once)
@@ -220,13 +220,13 @@ bool option_error_prompt::render()
 		// using glScissor), then use your exclusive draw. and then after drawing do *offset +=
 		// *count; *count = 0; then when all the elements are draw, make sure to complete the last
 		// draw call.
-		ctx.glDrawArrays(GL_TRIANGLES, vertex_offset, vertex_count);
-		vertex_offset += vertex_count;
+		gl_draw_mono_quads(state->gl_options_interleave_vbo, quad_offset, quad_count);
+		quad_offset += quad_count;
 	}
-	vertex_count = gl_batch_vertex_scroll_count;
-	if(vertex_count - vertex_offset > 0)
+	quad_count = gl_batch_quad_scroll_count;
+	if(quad_count - quad_offset > 0)
 	{
-		vertex_count -= vertex_offset;
+		quad_count -= quad_offset;
 
 		// the scroll box
 		GLint scissor_x = prompt.box_xmin; // NOLINT(bugprone-narrowing-conversions)
@@ -241,7 +241,7 @@ bool option_error_prompt::render()
 			// don't forget that 0,0 is the bottom left corner...
 			ctx.glScissor(
 				scissor_x, cv_screen_height.data - scissor_y - scissor_h, scissor_w, scissor_h);
-			ctx.glDrawArrays(GL_TRIANGLES, vertex_offset, vertex_count);
+			gl_draw_mono_quads(state->gl_options_interleave_vbo, quad_offset, quad_count);
 			ctx.glDisable(GL_SCISSOR_TEST);
 		}
 	}
@@ -257,8 +257,8 @@ bool option_error_prompt::draw_requested()
 bool option_error_prompt::close()
 {
 	gl_batch_buffer_offset = 0;
-	gl_batch_vertex_count = 0;
-	gl_batch_vertex_scroll_count = 0;
+	gl_batch_quad_count = 0;
+	gl_batch_quad_scroll_count = 0;
 	return true;
 }
 
@@ -1372,7 +1372,7 @@ bool option_keybind_request::init(
 	update_buffer = true;
 
 	gl_batch_buffer_offset = -1;
-	batch_vertex_count = 0;
+	batch_quad_count = 0;
 
 	// TODO: should be font_painter.init(state->font_painter)
 	font_painter.state = state->font_painter->state;
@@ -1596,7 +1596,7 @@ bool option_keybind_request::draw_buffer()
 	auto white_uv = font_painter.state.font->get_font_atlas()->white_uv;
 	std::array<uint8_t, 4> bbox_color{0, 0, 0, 255};
 
-	gl_batch_buffer_offset = batcher->get_current_vertex_count();
+	gl_batch_buffer_offset = batcher->get_current_quad_count();
 
 	resize_view();
 
@@ -1654,7 +1654,7 @@ bool option_keybind_request::draw_buffer()
 		return false;
 	}
 
-	batch_vertex_count = batcher->get_current_vertex_count();
+	batch_quad_count = batcher->get_current_quad_count();
 
 	update_buffer = false;
 
@@ -1665,10 +1665,12 @@ bool option_keybind_request::render()
 	ASSERT(state != NULL);
 	ASSERT(gl_batch_buffer_offset != -1);
 
-	if(batch_vertex_count - gl_batch_buffer_offset > 0)
+	if(batch_quad_count - gl_batch_buffer_offset > 0)
 	{
-		ctx.glDrawArrays(
-			GL_TRIANGLES, gl_batch_buffer_offset, batch_vertex_count - gl_batch_buffer_offset);
+		gl_draw_mono_quads(
+			state->gl_options_interleave_vbo,
+			gl_batch_buffer_offset,
+			batch_quad_count - gl_batch_buffer_offset);
 	}
 
 	return GL_RUNTIME(__func__) == GL_NO_ERROR;
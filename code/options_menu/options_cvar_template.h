@@ -94,8 +94,8 @@ struct option_error_prompt : public abstract_focus_element
 	mono_button_object ok_button;
 
 	GLint gl_batch_buffer_offset = -1;
-	GLsizei gl_batch_vertex_count = 0;
-	GLsizei gl_batch_vertex_scroll_count = 0;
+	GLsizei gl_batch_quad_count = 0;
+	GLsizei gl_batch_quad_scroll_count = 0;
 
 	float edge_padding = 100;
 
@@ -152,7 +152,7 @@ struct option_keybind_request : public abstract_focus_element
 	mono_button_object unbind_button;
 
 	GLint gl_batch_buffer_offset = -1;
-	GLsizei batch_vertex_count = 0;
+	GLsizei batch_quad_count = 0;
 
 	// the dimensions of the whole backdrop
 	float box_xmin = -1;
@@ -498,14 +498,14 @@ bool options_list_state::render()
 		}
 
 		// I need to split the batch into 2 draw calls for clipping the scroll.
-		menu_batch_vertex_count = batcher->get_current_vertex_count();
+		menu_batch_quad_count = batcher->get_current_quad_count();
 
 		if(!draw_scroll())
 		{
 			return false;
 		}
 
-		scroll_batch_vertex_count = batcher->get_current_vertex_count();
+		scroll_batch_quad_count = batcher->get_current_quad_count();
 
 		if(shared_state->focus_element != NULL)
 		{
@@ -520,15 +520,21 @@ bool options_list_state::render()
 			// upload
 			ctx.glBindBuffer(GL_ARRAY_BUFFER, shared_state->gl_options_interleave_vbo);
 			ctx.glBufferData(
-				GL_ARRAY_BUFFER, batcher->get_total_vertex_size(), NULL, GL_STREAM_DRAW);
+				GL_ARRAY_BUFFER, batcher->get_total_buffer_size(), NULL, GL_STREAM_DRAW);
 			ctx.glBufferSubData(
-				GL_ARRAY_BUFFER, 0, batcher->get_current_vertex_size(), batcher->buffer);
+				GL_ARRAY_BUFFER, 0, batcher->get_current_buffer_size(), batcher->buffer);
 			ctx.glBindBuffer(GL_ARRAY_BUFFER, 0);
 		}
 
 		update_buffer = false;
 	}
 
+	// upload any new glyphs into the atlas
+	if(!shared_state->font_painter->state.font->get_font_atlas()->flush_uploads())
+	{
+		return false;
+	}
+
 	//
 	// actual rendering
 	//
@@ -536,16 +542,16 @@ bool options_list_state::render()
 	// bind the vao which is used for all the batches here
 	ctx.glBindVertexArray(shared_state->gl_options_vao_id);
 
-	if(menu_batch_vertex_count != 0)
+	if(menu_batch_quad_count != 0)
 	{
 		// the draw_menu() call
-		ctx.glDrawArrays(GL_TRIANGLES, 0, menu_batch_vertex_count);
+		gl_draw_mono_quads(shared_state->gl_options_interleave_vbo, 0, menu_batch_quad_count);
 	}
 
-	GLint vertex_offset = menu_batch_vertex_count;
-	GLsizei vertex_count = scroll_batch_vertex_count - menu_batch_vertex_count;
+	GLint quad_offset = menu_batch_quad_count;
+	GLsizei quad_count = scroll_batch_quad_count - menu_batch_quad_count;
 
-	if(vertex_count != 0)
+	if(quad_count != 0)
 	{
 		// the scroll box
 
@@ -561,7 +567,7 @@ bool options_list_state::render()
 			// don't forget that 0,0 is the bottom left corner...
 			ctx.glScissor(
 				scissor_x, cv_screen_height.data - scissor_y - scissor_h, scissor_w, scissor_h);
-			ctx.glDrawArrays(GL_TRIANGLES, vertex_offset, vertex_count);
+			gl_draw_mono_quads(shared_state->gl_options_interleave_vbo, quad_offset, quad_count);
 			ctx.glDisable(GL_SCISSOR_TEST);
 		}
 	}
@@ -34,9 +34,9 @@ struct options_list_state
 	float footer_text_y = -1;
 
 	// since I only render when it is requested, I need to keep this.
-	GLsizei menu_batch_vertex_count = 0;
+	GLsizei menu_batch_quad_count = 0;
 	// the scroll goes right after the menu batch.
-	GLsizei scroll_batch_vertex_count = 0;
+	GLsizei scroll_batch_quad_count = 0;
 
 	// added size to the lineskip for the button size.
 	// float font_padding = 4;
@@ -12,8 +12,7 @@
 // the change will not appear in the menu even if you close and open it...
 // I think I need a bool open() callback... or just refresh every second...
 
-bool options_tree_state::init(
-	font_style_interface* font_, mono_2d_batcher* batcher_, shader_mono_state& mono_shader)
+bool options_tree_state::init(font_style_interface* font_, mono_2d_batcher* batcher_)
 {
 	ASSERT(font_ != NULL);
 	ASSERT(batcher_ != NULL);
@@ -42,7 +41,7 @@ bool options_tree_state::init(
 	// vertex setup
 	ctx.glBindVertexArray(gl_options_vao_id);
 	ctx.glBindBuffer(GL_ARRAY_BUFFER, gl_options_interleave_vbo);
-	gl_create_interleaved_mono_vertex_vao(mono_shader);
+	gl_create_mono_instance_vao();
 	ctx.glBindBuffer(GL_ARRAY_BUFFER, 0);
 	ctx.glBindVertexArray(0);
 
@@ -287,19 +286,25 @@ bool options_tree_state::tree_render()
 			// upload
 			ctx.glBindBuffer(GL_ARRAY_BUFFER, gl_options_interleave_vbo);
 			ctx.glBufferData(
-				GL_ARRAY_BUFFER, batcher->get_total_vertex_size(), NULL, GL_STREAM_DRAW);
+				GL_ARRAY_BUFFER, batcher->get_total_buffer_size(), NULL, GL_STREAM_DRAW);
 			ctx.glBufferSubData(
-				GL_ARRAY_BUFFER, 0, batcher->get_current_vertex_size(), batcher->buffer);
+				GL_ARRAY_BUFFER, 0, batcher->get_current_buffer_size(), batcher->buffer);
 			ctx.glBindBuffer(GL_ARRAY_BUFFER, 0);
 		}
-		gl_batch_vertex_count = batcher->get_current_vertex_count();
+		gl_batch_quad_count = batcher->get_current_quad_count();
 	}
 
-	if(gl_batch_vertex_count != 0)
+	// upload any new glyphs into the atlas
+	if(!font_painter.state.font->get_font_atlas()->flush_uploads())
+	{
+		return false;
+	}
+
+	if(gl_batch_quad_count != 0)
 	{
 		// draw
 		ctx.glBindVertexArray(gl_options_vao_id);
-		ctx.glDrawArrays(GL_TRIANGLES, 0, gl_batch_vertex_count);
+		gl_draw_mono_quads(gl_options_interleave_vbo, 0, gl_batch_quad_count);
 		ctx.glBindVertexArray(0);
 	}
 	return GL_RUNTIME(__func__) == GL_NO_ERROR;
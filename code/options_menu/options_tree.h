@@ -44,7 +44,7 @@ struct options_tree_state
 	};
 
 	std::vector<menu_entry> menus;
-	GLsizei gl_batch_vertex_count = 0;
+	GLsizei gl_batch_quad_count = 0;
 
 	// -1 == show selection list.
 	int current_menu_index = -1;
@@ -66,8 +66,7 @@ struct options_tree_state
 	// this is not required, but it's better to be explicit
 	bool tree_draw_buffer = false;
 
-	NDSERR bool init(
-		font_style_interface* font_, mono_2d_batcher* batcher_, shader_mono_state& mono_shader);
+	NDSERR bool init(font_style_interface* font_, mono_2d_batcher* batcher_);
 
 	NDSERR bool destroy();
 
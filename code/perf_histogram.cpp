@@ -0,0 +1,203 @@
+#include "global_pch.h"
+#include "global.h"
+
+#include "perf_histogram.h"
+
+#include "RWops.h"
+
+#include <cmath>
+
+static_assert(
+	PERF_HISTOGRAM_MAX_BITS < 32, "the values are uint32_t and the counts might overflow");
+
+// values below 2 * PERF_HISTOGRAM_SUB_BUCKETS have their own bucket,
+// after that each power of 2 has PERF_HISTOGRAM_SUB_BUCKETS buckets.
+static size_t perf_histogram_index(uint32_t us)
+{
+	uint32_t shift = 0;
+	while((us >> shift) >= 2 * PERF_HISTOGRAM_SUB_BUCKETS)
+	{
+		++shift;
+	}
+	return static_cast<size_t>(shift) * PERF_HISTOGRAM_SUB_BUCKETS + (us >> shift);
+}
+
+// the highest value that is in the bucket (in microseconds).
+static uint32_t perf_histogram_bucket_high(size_t index)
+{
+	if(index < 2 * PERF_HISTOGRAM_SUB_BUCKETS)
+	{
+		// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+		return index;
+	}
+	size_t shift = index / PERF_HISTOGRAM_SUB_BUCKETS - 1;
+	size_t mantissa = index - shift * PERF_HISTOGRAM_SUB_BUCKETS;
+	// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+	return ((mantissa + 1) << shift) - 1;
+}
+
+void perf_histogram::record(TIMER_RESULT ms)
+{
+	low = std::min(low, ms);
+	high = std::max(high, ms);
+	accum += ms;
+	++samples;
+
+	TIMER_RESULT us = std::round(ms * 1000);
+	uint32_t value = (1u << PERF_HISTOGRAM_MAX_BITS) - 1;
+	if(us < 0)
+	{
+		value = 0;
+	}
+	else if(us < value)
+	{
+		value = static_cast<uint32_t>(us);
+	}
+	++buckets[perf_histogram_index(value)];
+}
+
+void perf_histogram::merge(const perf_histogram& other)
+{
+	for(size_t i = 0; i < PERF_HISTOGRAM_BUCKETS; ++i)
+	{
+		buckets[i] += other.buckets[i];
+	}
+	samples += other.samples;
+	accum += other.accum;
+	high = std::max(high, other.high);
+	low = std::min(low, other.low);
+}
+
+void perf_histogram::reset()
+{
+	*this = perf_histogram();
+}
+
+TIMER_RESULT perf_histogram::percentile(double percent) const
+{
+	if(samples == 0)
+	{
+		return 0;
+	}
+	// the rank of the sample, 1 to samples.
+	double rank =
+		std::ceil(std::clamp(percent, 0.0, 100.0) / 100.0 * static_cast<double>(samples));
+	size_t target = std::max<size_t>(static_cast<size_t>(rank), 1);
+	size_t count = 0;
+	for(size_t i = 0; i < PERF_HISTOGRAM_BUCKETS; ++i)
+	{
+		count += buckets[i];
+		if(count >= target)
+		{
+			// the last bucket also has the values that were clamped.
+			if(i == PERF_HISTOGRAM_BUCKETS - 1)
+			{
+				return high;
+			}
+			// the bucket could be bigger than the real values.
+			TIMER_RESULT ms = static_cast<TIMER_RESULT>(perf_histogram_bucket_high(i)) / 1000;
+			return std::clamp(ms, low, high);
+		}
+	}
+	return high;
+}
+
+TIMER_RESULT perf_histogram::average_ms() const
+{
+	if(samples == 0)
+	{
+		return 0;
+	}
+	return accum / static_cast<TIMER_RESULT>(samples);
+}
+
+TIMER_RESULT perf_histogram::low_ms() const
+{
+	if(samples == 0)
+	{
+		return 0;
+	}
+	return low;
+}
+
+TIMER_RESULT perf_histogram::high_ms() const
+{
+	return high;
+}
+
+static bool perf_histogram_is_json(const char* path)
+{
+	size_t len = strlen(path);
+	return len >= 5 && strcmp(path + len - 5, ".json") == 0;
+}
+
+bool perf_histogram_dump(
+	const char* path, TIMER_RESULT time_sec, const perf_histogram_row* rows, size_t count)
+{
+	ASSERT(path != NULL);
+	ASSERT(rows != NULL);
+
+	FILE* fp = serr_wrapper_fopen(path, "ab");
+	if(fp == NULL)
+	{
+		return false;
+	}
+	bool json = perf_histogram_is_json(path);
+	if(json)
+	{
+		fprintf(fp, "{\"time\":%.3f,\"counters\":{", time_sec);
+	}
+	else if(fseek(fp, 0, SEEK_END) == 0 && ftell(fp) == 0)
+	{
+		// a new file.
+		fputs("time,counter,samples,average,low,p50,p90,p99,p99.9,high\n", fp);
+	}
+	for(size_t i = 0; i < count; ++i)
+	{
+		const perf_histogram& hist = *rows[i].histogram;
+		if(json)
+		{
+			fprintf(
+				fp,
+				"%s\"%s\":{\"samples\":%zu,\"average\":%.3f,\"low\":%.3f,\"p50\":%.3f,"
+				"\"p90\":%.3f,\"p99\":%.3f,\"p99.9\":%.3f,\"high\":%.3f}",
+				(i == 0) ? "" : ",",
+				rows[i].name,
+				hist.samples,
+				hist.average_ms(),
+				hist.low_ms(),
+				hist.percentile(50),
+				hist.percentile(90),
+				hist.percentile(99),
+				hist.percentile(99.9),
+				hist.high_ms());
+		}
+		else
+		{
+			fprintf(
+				fp,
+				"%.3f,%s,%zu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+				time_sec,
+				rows[i].name,
+				hist.samples,
+				hist.average_ms(),
+				hist.low_ms(),
+				hist.percentile(50),
+				hist.percentile(90),
+				hist.percentile(99),
+				hist.percentile(99.9),
+				hist.high_ms());
+		}
+	}
+	if(json)
+	{
+		fputs("}}\n", fp);
+	}
+	int prev_error = ferror(fp);
+	if(fclose(fp) != 0 || prev_error != 0)
+	{
+		serrf("Failed to write: `%s`, reason: %s\n", path, strerror(errno));
+		return false;
+	}
+	return true;
+}
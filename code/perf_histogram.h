@@ -0,0 +1,52 @@
+#pragma once
+
+#include "global.h"
+
+#include <limits>
+
+// a log bucketed histogram of times (like HdrHistogram),
+// every power of 2 of microseconds is split into PERF_HISTOGRAM_SUB_BUCKETS buckets,
+// so a percentile is within ~1.5% of the real value, from 1us to ~67 seconds.
+// recording a sample never allocates.
+
+enum
+{
+	PERF_HISTOGRAM_SUB_BITS = 6,
+	PERF_HISTOGRAM_SUB_BUCKETS = 1 << PERF_HISTOGRAM_SUB_BITS,
+	// the largest value is 2^PERF_HISTOGRAM_MAX_BITS - 1 microseconds (bigger values are clamped).
+	PERF_HISTOGRAM_MAX_BITS = 26,
+	PERF_HISTOGRAM_BUCKETS =
+		(PERF_HISTOGRAM_MAX_BITS - PERF_HISTOGRAM_SUB_BITS + 1) * PERF_HISTOGRAM_SUB_BUCKETS
+};
+
+struct perf_histogram
+{
+	uint32_t buckets[PERF_HISTOGRAM_BUCKETS] = {};
+	size_t samples = 0;
+	// exact, the buckets are not.
+	TIMER_RESULT accum = 0;
+	TIMER_RESULT high = 0;
+	TIMER_RESULT low = std::numeric_limits<TIMER_RESULT>::max();
+
+	void record(TIMER_RESULT ms);
+	void merge(const perf_histogram& other);
+	void reset();
+
+	// all in milliseconds, 0 if there are no samples.
+	// percent is 0 to 100 (99.9 is p99.9).
+	TIMER_RESULT percentile(double percent) const;
+	TIMER_RESULT average_ms() const;
+	TIMER_RESULT low_ms() const;
+	TIMER_RESULT high_ms() const;
+};
+
+struct perf_histogram_row
+{
+	const char* name;
+	const perf_histogram* histogram;
+};
+
+// appends the percentiles of each histogram to path, with the time in seconds.
+// if the path ends with ".json" it's one JSON object per line (JSON lines), otherwise CSV.
+NDSERR bool perf_histogram_dump(
+	const char* path, TIMER_RESULT time_sec, const perf_histogram_row* rows, size_t count);
@@ -0,0 +1,309 @@
+#include "global_pch.h"
+#include "global.h"
+
+#include "sampling_profiler.h"
+
+#include "cvar.h"
+
+#if defined(USE_LIBBACKTRACE) && defined(__linux__)
+#define HAS_SAMPLING_PROFILER
+#endif
+
+#ifdef HAS_SAMPLING_PROFILER
+#include "debug_tools.h"
+#include "RWops.h"
+
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+static CVAR_T sampling_profiler_enabled
+#ifdef HAS_SAMPLING_PROFILER
+	= CVAR_T::RUNTIME;
+#else
+	= CVAR_T::DISABLED;
+#endif
+
+static REGISTER_CVAR_STRING(
+	cv_prof_file, "profile.folded", "the file cv_prof writes when it stops", CVAR_T::RUNTIME);
+static REGISTER_CVAR_INT(
+	cv_prof_buffer_mb,
+	16,
+	"the memory for the samples of cv_prof (megabytes), the samples after it's full are dropped",
+	sampling_profiler_enabled);
+
+namespace
+{
+class cvar_sampling_profiler : public cvar_int
+{
+public:
+	cvar_sampling_profiler();
+	NDSERR bool cvar_read(const char* buffer) override;
+};
+} // namespace
+
+static cvar_sampling_profiler cv_prof;
+
+#ifdef HAS_SAMPLING_PROFILER
+
+enum
+{
+	PROF_MAX_DEPTH = 64
+};
+
+namespace
+{
+struct sampling_profiler_state
+{
+	// each sample is the number of pcs, then the pcs (from the top of the stack).
+	std::unique_ptr<uintptr_t[]> buffer;
+	size_t buffer_size = 0;
+	// never more than buffer_size, so everything before it was written.
+	std::atomic<size_t> write_pos{0};
+	std::atomic<size_t> samples{0};
+	std::atomic<size_t> dropped{0};
+	// the number of signal handlers that are running.
+	std::atomic<int> handlers{0};
+	std::atomic<bool> running{false};
+	bool installed = false;
+	TIMER_U start_time = TIMER_NULL;
+};
+} // namespace
+
+static sampling_profiler_state g_prof;
+
+// this must be async signal safe.
+static void sampling_profiler_handler(int sig, siginfo_t* info, void* ucontext)
+{
+	(void)sig;
+	(void)info;
+	int saved_errno = errno;
+	g_prof.handlers.fetch_add(1);
+	if(g_prof.running.load())
+	{
+		uintptr_t pcs[PROF_MAX_DEPTH];
+		size_t depth = debug_capture_stacktrace_in_signal(pcs, PROF_MAX_DEPTH, ucontext);
+
+		size_t pos = g_prof.write_pos.load(std::memory_order_relaxed);
+		bool stored = false;
+		while(depth != 0 && pos + 1 + depth <= g_prof.buffer_size)
+		{
+			if(g_prof.write_pos.compare_exchange_weak(
+				   pos, pos + 1 + depth, std::memory_order_relaxed))
+			{
+				g_prof.buffer[pos] = depth;
+				memcpy(&g_prof.buffer[pos + 1], pcs, depth * sizeof(uintptr_t));
+				stored = true;
+				break;
+			}
+		}
+		if(stored)
+		{
+			g_prof.samples.fetch_add(1, std::memory_order_relaxed);
+		}
+		else
+		{
+			g_prof.dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	g_prof.handlers.fetch_sub(1);
+	errno = saved_errno;
+}
+
+static bool sampling_profiler_set_rate(int rate)
+{
+	itimerval timer;
+	memset(&timer, 0, sizeof(timer));
+	if(rate > 0)
+	{
+		int interval_us = std::max(1000000 / rate, 1);
+		timer.it_interval.tv_sec = interval_us / 1000000;
+		timer.it_interval.tv_usec = interval_us % 1000000;
+		timer.it_value = timer.it_interval;
+	}
+	if(setitimer(ITIMER_PROF, &timer, NULL) != 0)
+	{
+		serrf("%s: setitimer failed, reason: %s\n", __func__, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+static bool sampling_profiler_start(int rate)
+{
+	ASSERT(!g_prof.running.load());
+	if(!debug_prepare_signal_stacktrace())
+	{
+		return false;
+	}
+
+	size_t buffer_size =
+		static_cast<size_t>(std::max(cv_prof_buffer_mb.data, 1)) * 1024 * 1024 / sizeof(uintptr_t);
+	g_prof.buffer = std::make_unique<uintptr_t[]>(buffer_size);
+	g_prof.buffer_size = buffer_size;
+	g_prof.write_pos.store(0);
+	g_prof.samples.store(0);
+	g_prof.dropped.store(0);
+
+	// the handler stays installed, because a SIGPROF after the timer stops would kill the app.
+	if(!g_prof.installed)
+	{
+		struct sigaction action;
+		memset(&action, 0, sizeof(action));
+		action.sa_sigaction = sampling_profiler_handler;
+		sigemptyset(&action.sa_mask);
+		action.sa_flags = SA_SIGINFO | SA_RESTART;
+		if(sigaction(SIGPROF, &action, NULL) != 0)
+		{
+			serrf("%s: sigaction failed, reason: %s\n", __func__, strerror(errno));
+			g_prof.buffer.reset();
+			return false;
+		}
+		g_prof.installed = true;
+	}
+
+	g_prof.start_time = timer_now();
+	g_prof.running.store(true);
+	if(!sampling_profiler_set_rate(rate))
+	{
+		g_prof.running.store(false);
+		g_prof.buffer.reset();
+		return false;
+	}
+	slogf("info: profiling at %d samples per second\n", rate);
+	return true;
+}
+
+static bool sampling_profiler_write(const char* path)
+{
+	// count the same stacks once (the key is the raw pcs)
+	std::unordered_map<std::string, size_t> stacks;
+	size_t end = g_prof.write_pos.load();
+	size_t pos = 0;
+	while(pos < end)
+	{
+		size_t depth = g_prof.buffer[pos];
+		ASSERT(depth != 0 && pos + 1 + depth <= end);
+		const char* data = reinterpret_cast<const char*>(&g_prof.buffer[pos + 1]);
+		stacks[std::string(data, depth * sizeof(uintptr_t))] += 1;
+		pos += 1 + depth;
+	}
+
+	// different pcs in the same functions are the same folded stack.
+	std::unordered_map<std::string, size_t> folded;
+	std::string line;
+	std::vector<uintptr_t> pcs;
+	for(const auto& [key, count] : stacks)
+	{
+		pcs.resize(key.size() / sizeof(uintptr_t));
+		memcpy(pcs.data(), key.data(), key.size());
+		line.clear();
+		// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+		if(debug_str_folded_stack(&line, pcs.data(), pcs.size()))
+		{
+			folded[line] += count;
+		}
+	}
+
+	FILE* fp = serr_wrapper_fopen(path, "wb");
+	if(fp == NULL)
+	{
+		return false;
+	}
+	for(const auto& [stack, count] : folded)
+	{
+		line = stack;
+		line += ' ';
+		line += std::to_string(count);
+		line += '\n';
+		fwrite(line.data(), 1, line.size(), fp);
+	}
+	int prev_error = ferror(fp);
+	if(fclose(fp) != 0 || prev_error != 0)
+	{
+		serrf("Failed to write: `%s`, reason: %s\n", path, strerror(errno));
+		return false;
+	}
+	slogf(
+		"info: wrote %s (%zu samples, %zu stacks, %zu dropped, %.2fs)\n",
+		path,
+		g_prof.samples.load(),
+		folded.size(),
+		g_prof.dropped.load(),
+		timer_delta<1>(g_prof.start_time, timer_now()));
+	return true;
+}
+
+static bool sampling_profiler_stop()
+{
+	ASSERT(g_prof.running.load());
+	bool success = sampling_profiler_set_rate(0);
+	g_prof.running.store(false);
+	// a handler might still be writing a sample.
+	while(g_prof.handlers.load() != 0)
+	{
+		std::this_thread::yield();
+	}
+
+	if(!sampling_profiler_write(cv_prof_file.data.c_str()))
+	{
+		success = false;
+	}
+	g_prof.buffer.reset();
+	g_prof.buffer_size = 0;
+	return success;
+}
+
+#endif // HAS_SAMPLING_PROFILER
+
+cvar_sampling_profiler::cvar_sampling_profiler()
+: cvar_int(
+	  "cv_prof",
+	  0,
+	  "0 = stop the sampling profiler (writes cv_prof_file), N = start with N samples per second",
+	  sampling_profiler_enabled,
+	  __FILE__,
+	  __LINE__)
+{
+}
+
+bool cvar_sampling_profiler::cvar_read(const char* buffer)
+{
+	if(!cvar_int::cvar_read(buffer))
+	{
+		return false;
+	}
+#ifdef HAS_SAMPLING_PROFILER
+	if(data < 0)
+	{
+		data = 0;
+	}
+	if(g_prof.running.load())
+	{
+		// the rate can be changed while it's running.
+		return (data == 0) ? sampling_profiler_stop() : sampling_profiler_set_rate(data);
+	}
+	if(data != 0 && !sampling_profiler_start(data))
+	{
+		data = 0;
+		return false;
+	}
+#endif
+	return true;
+}
+
+bool sampling_profiler_destroy()
+{
+#ifdef HAS_SAMPLING_PROFILER
+	if(g_prof.running.load())
+	{
+		cv_prof.data = 0;
+		return sampling_profiler_stop();
+	}
+#endif
+	return true;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "global.h"
+
+// a sampling profiler (linux with libbacktrace, so it works without perf).
+// "cv_prof 1000" starts taking 1000 samples per second of cpu time (SIGPROF),
+// "cv_prof 0" stops it and writes cv_prof_file.
+// the kernel might not send signals faster than it's tick rate (often 250 per second).
+// the signal handler walks the frame pointers (see debug_capture_stacktrace_in_signal),
+// and copies the raw pcs into a preallocated buffer (cv_prof_buffer_mb),
+// the stacks are symbolized when the profile is written.
+// the file is folded stacks (one "main;demo_state::process;... COUNT" per line),
+// it can be viewed with flamegraph.pl or speedscope.
+
+// stops the profiler and writes the profile if it's running.
+NDSERR bool sampling_profiler_destroy();
@@ -3,23 +3,36 @@
 
 #include "mono.h"
 
+// every quad is an instance of a 4 vertex triangle strip, see gl_mono_instance.
 static const char* shader_mono_vs = R"(#version 300 es
 precision mediump float;
 
 uniform mat4 u_mvp;
+uniform sampler2D u_tex;
 
-in vec3 a_pos;
-in vec2 a_tex;
-in vec4 a_color;
+// minx, miny, maxx, maxy in 1/4 pixels.
+layout(location = 0) in highp vec4 a_rect;
+// the texture coordinates are in 1/2 pixels, so the atlas can be resized.
+// highp because mediump can't hold the size of a 16k texture.
+layout(location = 1) in highp vec4 a_tex;
+layout(location = 2) in vec4 a_color;
+// only used by the sdf shader.
+layout(location = 3) in float a_weight;
 
 out vec2 tex_coord;
 out vec4 vert_color;
+out float sdf_weight;
 
 void main()
 {
-	gl_Position = u_mvp * vec4(a_pos, 1.0);
-    tex_coord = a_tex;
+    // 0=(min,min) 1=(max,min) 2=(min,max) 3=(max,max)
+    vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));
+    highp vec2 pos = mix(a_rect.xy, a_rect.zw, corner) * 0.25;
+    highp vec2 tex = mix(a_tex.xy, a_tex.zw, corner) * 0.5;
+	gl_Position = u_mvp * vec4(pos, 0.0, 1.0);
+    tex_coord = tex / vec2(textureSize(u_tex, 0));
 	vert_color = a_color;
+	sdf_weight = a_weight * 2.0;
 }
 )";
 
@@ -68,6 +81,34 @@ void main()
 }
 )";
 
+static const char* shader_mono_sdf_fs = R"(#version 300 es
+precision mediump float;
+
+uniform sampler2D u_tex;
+
+in vec2 tex_coord;
+in vec4 vert_color;
+in float sdf_weight;
+
+out vec4 color;
+
+void main()
+{
+    float texel = texture(u_tex, tex_coord).r;
+    if(sdf_weight < 0.5)
+    {
+        // not a distance field (hexfont, bitmap fonts, and the white_uv)
+        color = texel * vert_color;
+        return;
+    }
+    // the weight moves the edge outwards for bold and outlines.
+    float edge = 0.5 - (sdf_weight - 1.0);
+    // fwidth makes the anti-aliasing about 1 pixel on the screen at any scale.
+    float smoothing = max(fwidth(texel) * 0.75, 0.001);
+    color = smoothstep(edge - smoothing, edge + smoothing, texel) * vert_color;
+}
+)";
+
 bool shader_mono_state::create()
 {
 	info = "shader_mono";
@@ -103,14 +144,26 @@ bool shader_mono_state::create_alpha_test()
 	return GL_CHECK(__func__) == GL_NO_ERROR;
 }
 
+bool shader_mono_state::create_sdf()
+{
+	info = "shader_mono_sdf";
+
+	gl_program_id = gl_create_program(
+		"shader_mono_vs", shader_mono_vs, "shader_mono_sdf_fs", shader_mono_sdf_fs);
+	if(gl_program_id == 0)
+	{
+		return false;
+	}
+
+	internal_find_locations();
+
+	return GL_CHECK(__func__) == GL_NO_ERROR;
+}
+
 void shader_mono_state::internal_find_locations()
 {
 	SET_GL_UNIFORM_ID(info, u_tex);
 	SET_GL_UNIFORM_ID(info, u_mvp);
-
-	SET_GL_ATTRIBUTE_ID(info, a_pos);
-	SET_GL_ATTRIBUTE_ID(info, a_tex);
-	SET_GL_ATTRIBUTE_ID(info, a_color);
 }
 
 bool shader_mono_state::destroy()
@@ -123,42 +176,100 @@ bool shader_mono_state::destroy()
 	return GL_CHECK(__func__) == GL_NO_ERROR;
 }
 
-void gl_create_interleaved_mono_vertex_vao(shader_mono_state& mono_shader)
+static void set_mono_instance_pointers(GLint first_quad)
+{
+	size_t base = static_cast<size_t>(first_quad) * sizeof(gl_mono_instance);
+	ctx.glVertexAttribPointer(
+		MONO_ATTRIBUTE_RECT, // attribute
+		4, // size
+		GL_SHORT, // type
+		GL_FALSE, // normalized?
+		sizeof(gl_mono_instance), // stride
+		(void*)(base + offsetof(gl_mono_instance, rect)) // NOLINT
+	);
+	ctx.glVertexAttribPointer(
+		MONO_ATTRIBUTE_TEX, // attribute
+		4, // size
+		GL_UNSIGNED_SHORT, // type
+		GL_FALSE, // normalized?
+		sizeof(gl_mono_instance), // stride
+		(void*)(base + offsetof(gl_mono_instance, tex)) // NOLINT
+	);
+	ctx.glVertexAttribPointer(
+		MONO_ATTRIBUTE_COLOR, // attribute
+		4, // size
+		GL_UNSIGNED_BYTE, // type
+		GL_TRUE, // normalized?
+		sizeof(gl_mono_instance), // stride
+		(void*)(base + offsetof(gl_mono_instance, color)) // NOLINT
+	);
+	ctx.glVertexAttribPointer(
+		MONO_ATTRIBUTE_WEIGHT, // attribute
+		1, // size
+		GL_UNSIGNED_BYTE, // type
+		GL_TRUE, // normalized?
+		sizeof(gl_mono_instance), // stride
+		(void*)(base + offsetof(gl_mono_instance, weight)) // NOLINT
+	);
+}
+
+void gl_create_mono_instance_vao()
+{
+	const GLuint attributes[] = {
+		MONO_ATTRIBUTE_RECT, MONO_ATTRIBUTE_TEX, MONO_ATTRIBUTE_COLOR, MONO_ATTRIBUTE_WEIGHT};
+	for(GLuint attribute : attributes)
+	{
+		ctx.glEnableVertexAttribArray(attribute);
+		ctx.glVertexAttribDivisor(attribute, 1);
+	}
+	set_mono_instance_pointers(0);
+}
+
+void gl_draw_mono_quads(GLuint vbo, GLint first_quad, GLsizei quad_count)
+{
+	if(quad_count == 0)
+	{
+		return;
+	}
+	// the pointers are stored in the VAO, so this changes the VAO.
+	ctx.glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	set_mono_instance_pointers(first_quad);
+	ctx.glBindBuffer(GL_ARRAY_BUFFER, 0);
+	ctx.glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, quad_count);
+}
+
+void mono_2d_batcher::init(size_t initial_size, size_t max_size_)
+{
+	ASSERT(initial_size != 0);
+	ASSERT(initial_size <= max_size_);
+	storage.resize(initial_size);
+	buffer = storage.data();
+	size = storage.size();
+	cursor = 0;
+	max_size = max_size_;
+}
+
+bool mono_2d_batcher::grow(size_t count)
 {
-	if(mono_shader.gl_attributes.a_pos != -1)
+	ASSERT(buffer != NULL);
+	size_t needed = cursor + count;
+	if(size < max_size)
 	{
-		ctx.glEnableVertexAttribArray(mono_shader.gl_attributes.a_pos);
-		ctx.glVertexAttribPointer(
-			mono_shader.gl_attributes.a_pos, // attribute
-			3, // size
-			GL_FLOAT, // type
-			GL_FALSE, // normalized?
-			sizeof(gl_mono_vertex), // stride
-			(void*)offsetof(gl_mono_vertex, pos) // NOLINT
-		);
+		// double so that a big log only reallocates a few times.
+		size_t new_size = std::min(std::max(size * 2, needed), max_size);
+		storage.resize(new_size);
+		buffer = storage.data();
+		size = storage.size();
+		++stats.grow_count;
 	}
-	if(mono_shader.gl_attributes.a_tex != -1)
+	if(needed <= size)
 	{
-		ctx.glEnableVertexAttribArray(mono_shader.gl_attributes.a_tex);
-		ctx.glVertexAttribPointer(
-			mono_shader.gl_attributes.a_tex, // attribute
-			2, // size
-			GL_FLOAT, // type
-			GL_FALSE, // normalized?
-			sizeof(gl_mono_vertex), // stride
-			(void*)offsetof(gl_mono_vertex, tex) // NOLINT
-		);
+		return true;
 	}
-	if(mono_shader.gl_attributes.a_color != -1)
+	if(stats.dropped_quads == 0)
 	{
-		ctx.glEnableVertexAttribArray(mono_shader.gl_attributes.a_color);
-		ctx.glVertexAttribPointer(
-			mono_shader.gl_attributes.a_color, // attribute
-			4, // size
-			GL_UNSIGNED_BYTE, // type
-			GL_TRUE, // normalized?
-			sizeof(gl_mono_vertex), // stride
-			(void*)offsetof(gl_mono_vertex, color) // NOLINT
-		);
+		slogf("warning: mono_2d_batcher is full, dropping quads (max: %zu)\n", max_size);
 	}
+	stats.dropped_quads += needed - size;
+	return false;
 }
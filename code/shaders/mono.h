@@ -2,9 +2,23 @@
 
 #include "../global.h"
 
+#include <algorithm>
 #include <array>
+#include <cmath>
+#include <cstring>
+#include <vector>
 #include "../opengles2/opengl_stuff.h"
 
+// the attribute locations are fixed (layout(location) in the shader),
+// so gl_draw_mono_quads can move the pointers without knowing which shader is bound.
+enum : GLuint
+{
+	MONO_ATTRIBUTE_RECT = 0,
+	MONO_ATTRIBUTE_TEX = 1,
+	MONO_ATTRIBUTE_COLOR = 2,
+	MONO_ATTRIBUTE_WEIGHT = 3
+};
+
 struct shader_mono_state
 {
 	const char* info = NULL;
@@ -18,82 +32,122 @@ struct shader_mono_state
 		GLint u_alpha_test = -1;
 	} gl_uniforms;
 
-	struct
-	{
-		GLint a_pos = -1;
-		GLint a_tex = -1;
-		GLint a_color = -1;
-	} gl_attributes;
-
 	bool create();
 	// if the pixel's alpha is is greater/equal than the u_alpha_test, draw the pixel.
 	// you need to set u_alpha_test.
 	bool create_alpha_test();
+	// the texture is a signed distance field (0.5 is the edge),
+	// and the z of the quad is the weight, 0 means the texture is not a distance field,
+	// and 1+ moves the edge outwards (for bold and outlines), see font_style_result::sdf_weight
+	// the texture needs linear filtering to look smooth.
+	bool create_sdf();
 	bool destroy();
 
 	void internal_find_locations();
 };
 
-// this is a vao that works with interleaved gl_mono_vertex
-// bind the VBO and VAO
-void gl_create_interleaved_mono_vertex_vao(shader_mono_state& mono_shader);
-
-struct gl_mono_vertex
+// one quad, the vertex shader expands this into a triangle strip with glDrawArraysInstanced.
+// this used to be 6 expanded vertices (144 bytes), now it's 24 bytes.
+struct gl_mono_instance
 {
-	gl_mono_vertex() = default;
-	// for emplace_back
-	gl_mono_vertex(
-		GLfloat posx,
-		GLfloat posy,
-		GLfloat posz,
-		GLfloat texx,
-		GLfloat texy,
-		GLubyte r,
-		GLubyte g,
-		GLubyte b,
-		GLubyte a)
-	: pos{posx, posy, posz}
-	, tex{texx, texy}
-	, color{r, g, b, a}
-	{
-	}
-	GLfloat pos[3];
-	GLfloat tex[2];
+	enum
+	{
+		// the rect is in 1/4 pixels, so it fits -8192 to 8191.75
+		POS_SCALE = 4,
+		// the texture coordinates are in 1/2 pixels (the white_uv is in the middle of a pixel)
+		TEX_SCALE = 2,
+		// the weight is stored as weight / WEIGHT_MAX, see shader_mono_state::create_sdf
+		WEIGHT_MAX = 2
+	};
+
+	// [0]=minx,[1]=miny,[2]=maxx,[3]=maxy
+	GLshort rect[4];
+	// in pixels * TEX_SCALE, the shader divides this by the texture size.
+	GLushort tex[4];
 	GLubyte color[4];
+	GLubyte weight;
+	GLubyte unused[3];
+
+	static GLshort to_pos(float x)
+	{
+		float value = std::round(x * static_cast<float>(POS_SCALE));
+		return static_cast<GLshort>(std::clamp(value, -32768.f, 32767.f));
+	}
+	static GLushort to_tex(float x)
+	{
+		float value = std::round(x * static_cast<float>(TEX_SCALE));
+		return static_cast<GLushort>(std::clamp(value, 0.f, 65535.f));
+	}
+	static GLubyte to_weight(float z)
+	{
+		float value = std::round(z * (255.f / static_cast<float>(WEIGHT_MAX)));
+		return static_cast<GLubyte>(std::clamp(value, 0.f, 255.f));
+	}
 };
+static_assert(sizeof(gl_mono_instance) == 24);
 
-struct mono_2d_batcher
+// the VAO for gl_mono_instance's, bind the VBO and VAO first.
+void gl_create_mono_instance_vao();
+
+// draw quad_count quads starting at first_quad from the vbo (the VAO must be bound).
+// GLES3 doesn't have a base instance, so this moves the attribute pointers to first_quad.
+void gl_draw_mono_quads(GLuint vbo, GLint first_quad, GLsizei quad_count);
+
+// the offset is rounded once, so that moving quads back and forth doesn't drift.
+inline void gl_translate_mono_quads(gl_mono_instance* quads, size_t count, float x, float y)
 {
-	enum
+	int off_x = gl_mono_instance::to_pos(x);
+	int off_y = gl_mono_instance::to_pos(y);
+	for(size_t i = 0; i < count; ++i)
 	{
-		QUAD_VERTS = 6
-	};
+		GLshort* rect = quads[i].rect;
+		rect[0] = static_cast<GLshort>(std::clamp(rect[0] + off_x, -32768, 32767));
+		rect[1] = static_cast<GLshort>(std::clamp(rect[1] + off_y, -32768, 32767));
+		rect[2] = static_cast<GLshort>(std::clamp(rect[2] + off_x, -32768, 32767));
+		rect[3] = static_cast<GLshort>(std::clamp(rect[3] + off_y, -32768, 32767));
+	}
+}
 
-	gl_mono_vertex* buffer = NULL;
+// the buffer grows when it's full (up to max_size), so it only needs to be as big as the text.
+// the buffer pointer changes when it grows, so use indexes to remember quads.
+struct mono_2d_batcher
+{
+	std::vector<gl_mono_instance> storage;
+	// storage.data() and storage.size()
+	gl_mono_instance* buffer = NULL;
 	size_t size = 0;
 	size_t cursor = 0;
+	// if this is reached the quads will be dropped (and draw_rect returns false).
+	size_t max_size = 0;
 
-	void init(gl_mono_vertex* buffer_, size_t size_)
+	struct batch_stats
 	{
-		ASSERT(buffer_);
-		buffer = buffer_;
-		size = size_;
-	}
+		// the most quads in a batch (between clear() calls)
+		size_t peak_quads = 0;
+		// the quads from the batch before the last clear()
+		size_t last_batch_quads = 0;
+		// the number of times the buffer was reallocated.
+		uint32_t grow_count = 0;
+		// the quads that didn't fit into max_size (it prints a warning the first time).
+		size_t dropped_quads = 0;
+	} stats;
+
+	void init(size_t initial_size, size_t max_size_);
 
-	GLsizei get_current_vertex_count() const
+	GLsizei get_current_quad_count() const
 	{
 		// NOLINTNEXTLINE(bugprone-narrowing-conversions)
-		return cursor * QUAD_VERTS;
+		return cursor;
 	}
-	GLsizeiptr get_current_vertex_size() const
+	GLsizeiptr get_current_buffer_size() const
 	{
 		// NOLINTNEXTLINE(bugprone-narrowing-conversions)
-		return cursor * QUAD_VERTS * sizeof(gl_mono_vertex);
+		return cursor * sizeof(gl_mono_instance);
 	}
-	GLsizeiptr get_total_vertex_size() const
+	GLsizeiptr get_total_buffer_size() const
 	{
 		// NOLINTNEXTLINE(bugprone-narrowing-conversions)
-		return size * QUAD_VERTS * sizeof(gl_mono_vertex);
+		return size * sizeof(gl_mono_instance);
 	}
 	size_t get_quad_count() const
 	{
@@ -103,14 +157,16 @@ struct mono_2d_batcher
 	void clear()
 	{
 		ASSERT(buffer != NULL);
+		stats.last_batch_quads = cursor;
+		stats.peak_quads = std::max(stats.peak_quads, cursor);
 		cursor = 0;
 	}
 	// use the return from get_quad_count
 	NDSERR bool set_cursor(size_t pos)
 	{
 		ASSERT(buffer != NULL);
-		ASSERT(pos < size);
-		if(pos >= size)
+		ASSERT(pos <= size);
+		if(pos > size)
 		{
 			serrf("%s out of bounds: %zu (size: %zu)\n", __func__, pos, size);
 			return false;
@@ -119,21 +175,40 @@ struct mono_2d_batcher
 		return true;
 	}
 
+	// make room for count more quads, returns false if it would go over max_size,
+	// the dropped quads are added to the stats.
+	bool reserve_quads(size_t count)
+	{
+		if(count <= size - cursor)
+		{
+			return true;
+		}
+		return grow(count);
+	}
+
+	// the slow path of reserve_quads.
+	bool grow(size_t count);
+
 	// [0]=minx,[1]=miny,[2]=maxx,[3]=maxy
-	bool draw_rect(std::array<float, 4> pos, std::array<float, 4> uv, std::array<uint8_t, 4> color)
+	// the z is only used by shader_mono_state::create_sdf
+	bool draw_rect(
+		std::array<float, 4> pos,
+		std::array<float, 4> uv,
+		std::array<uint8_t, 4> color,
+		float z = 0.f)
 	{
 		ASSERT(buffer != NULL);
-		if(cursor >= size)
+		if(!reserve_quads(1))
 		{
 			return false;
 		}
-		return draw_rect_at(cursor++, pos, uv, color);
+		return draw_rect_at(cursor++, pos, uv, color, z);
 	}
 
 	int placeholder_rect()
 	{
 		ASSERT(buffer != NULL);
-		if(cursor >= size)
+		if(!reserve_quads(1))
 		{
 			return -1;
 		}
@@ -141,26 +216,65 @@ struct mono_2d_batcher
 		return cursor++;
 	}
 
+	// copy quads that were drawn before, offset by x and y,
+	// the color replaces the color of every quad.
+	// returns false if it didn't fit (the quads that fit are still drawn, like draw_rect).
+	bool draw_quads(
+		const gl_mono_instance* quads,
+		size_t quad_count,
+		float x,
+		float y,
+		std::array<uint8_t, 4> color)
+	{
+		ASSERT(buffer != NULL);
+		bool success = reserve_quads(quad_count);
+		if(!success)
+		{
+			quad_count = size - cursor;
+		}
+		memcpy(buffer + cursor, quads, quad_count * sizeof(gl_mono_instance));
+		for(size_t i = cursor; i < cursor + quad_count; ++i)
+		{
+			memcpy(buffer[i].color, color.data(), sizeof(buffer[i].color));
+		}
+		translate_quads(cursor, cursor + quad_count, x, y);
+		cursor += quad_count;
+		return success;
+	}
+
+	// move the quads from begin to end (for aligning text after it was drawn)
+	void translate_quads(size_t begin, size_t end, float x, float y)
+	{
+		ASSERT(buffer != NULL);
+		ASSERT(begin <= end && end <= size);
+		gl_translate_mono_quads(buffer + begin, end - begin, x, y);
+	}
+
 	// index is the quad index.
 	// [0]=minx,[1]=miny,[2]=maxx,[3]=maxy
 	bool draw_rect_at(
 		size_t index,
 		std::array<float, 4> pos,
 		std::array<float, 4> uv,
-		std::array<uint8_t, 4> color)
+		std::array<uint8_t, 4> color,
+		float z = 0.f)
 	{
 		ASSERT(buffer != NULL);
 		if(index >= size)
 		{
 			return false;
 		}
-		gl_mono_vertex* cur = buffer + index * QUAD_VERTS;
-		*cur++ = {pos[0], pos[1], 0.f, uv[0], uv[1], color[0], color[1], color[2], color[3]};
-		*cur++ = {pos[2], pos[3], 0.f, uv[2], uv[3], color[0], color[1], color[2], color[3]};
-		*cur++ = {pos[2], pos[1], 0.f, uv[2], uv[1], color[0], color[1], color[2], color[3]};
-		*cur++ = {pos[0], pos[1], 0.f, uv[0], uv[1], color[0], color[1], color[2], color[3]};
-		*cur++ = {pos[0], pos[3], 0.f, uv[0], uv[3], color[0], color[1], color[2], color[3]};
-		*cur++ = {pos[2], pos[3], 0.f, uv[2], uv[3], color[0], color[1], color[2], color[3]};
+		gl_mono_instance& cur = buffer[index];
+		for(size_t i = 0; i < 4; ++i)
+		{
+			cur.rect[i] = gl_mono_instance::to_pos(pos[i]);
+			cur.tex[i] = gl_mono_instance::to_tex(uv[i]);
+			cur.color[i] = color[i];
+		}
+		cur.weight = gl_mono_instance::to_weight(z);
+		cur.unused[0] = 0;
+		cur.unused[1] = 0;
+		cur.unused[2] = 0;
 		return true;
 	}
 };
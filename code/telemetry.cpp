@@ -0,0 +1,212 @@
+#include "global_pch.h"
+#include "global.h"
+
+#include "telemetry.h"
+
+#include "cvar.h"
+
+#if !defined(__EMSCRIPTEN__) && (defined(__linux__) || defined(__APPLE__))
+#define HAS_TELEMETRY
+#endif
+
+#ifdef HAS_TELEMETRY
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static CVAR_T telemetry_enabled
+#ifdef HAS_TELEMETRY
+	= CVAR_T::STARTUP;
+#else
+	= CVAR_T::DISABLED;
+#endif
+
+static REGISTER_CVAR_STRING(
+	cv_telemetry_shm,
+	"",
+	"the POSIX shared memory name for the frame counters (like /bs_telemetry), "
+	"read it with telemetry_read, \"\" = off",
+	telemetry_enabled);
+static REGISTER_CVAR_INT(
+	cv_telemetry_frames,
+	1024,
+	"the frames the cv_telemetry_shm ring keeps, a reader that falls behind skips frames",
+	telemetry_enabled);
+
+#ifdef HAS_TELEMETRY
+
+static const char* const telemetry_names[] = {
+	"frame_ms",
+	"input_ms",
+	"update_ms",
+	"render_ms",
+	"swap_ms",
+	"glyph_misses",
+	"layout_misses",
+	"atlas_occupancy",
+	"atlas_upload_bytes",
+	"atlas_evicted_glyphs",
+	"atlas_resizes",
+	"batch_grows",
+	"log_queue_bytes",
+};
+static_assert(std::size(telemetry_names) == TELEMETRY_COUNTER_COUNT);
+
+namespace
+{
+struct telemetry_state
+{
+	telemetry_header* header = NULL;
+	telemetry_frame* frames = NULL;
+	size_t map_size = 0;
+	uint32_t ring_size = 0;
+	// only the writer changes write_count, so it doesn't need to load it.
+	uint64_t write_count = 0;
+	TIMER_U start_time = TIMER_NULL;
+	std::string name;
+};
+} // namespace
+
+static telemetry_state g_telemetry;
+
+#endif // HAS_TELEMETRY
+
+bool telemetry_init()
+{
+#ifdef HAS_TELEMETRY
+	ASSERT(g_telemetry.header == NULL);
+	if(cv_telemetry_shm.data.empty())
+	{
+		return true;
+	}
+	const char* name = cv_telemetry_shm.data.c_str();
+	uint32_t ring_size = std::max(cv_telemetry_frames.data, 2);
+	size_t map_size = sizeof(telemetry_header) + sizeof(telemetry_frame) * ring_size;
+
+	// a segment from a crash is replaced (the size could be different).
+	shm_unlink(name);
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if(fd == -1)
+	{
+		serrf("%s: shm_open(`%s`) failed, reason: %s\n", __func__, name, strerror(errno));
+		return false;
+	}
+	// ftruncate zero fills it.
+	if(ftruncate(fd, static_cast<off_t>(map_size)) != 0)
+	{
+		serrf("%s: ftruncate(`%s`) failed, reason: %s\n", __func__, name, strerror(errno));
+		close(fd);
+		shm_unlink(name);
+		return false;
+	}
+	void* memory = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	// the mapping keeps the memory.
+	close(fd);
+	if(memory == MAP_FAILED)
+	{
+		serrf("%s: mmap(`%s`) failed, reason: %s\n", __func__, name, strerror(errno));
+		shm_unlink(name);
+		return false;
+	}
+
+	// the memory is zeroed, so the atomics only need to be constructed.
+	auto* header = new(memory) telemetry_header;
+	header->write_count.store(0, std::memory_order_relaxed);
+	header->version = TELEMETRY_VERSION;
+	header->header_size = sizeof(telemetry_header);
+	header->frame_size = sizeof(telemetry_frame);
+	header->ring_size = ring_size;
+	header->counter_count = TELEMETRY_COUNTER_COUNT;
+	header->pid = getpid();
+	for(size_t i = 0; i < TELEMETRY_COUNTER_COUNT; ++i)
+	{
+		strncpy(header->names[i], telemetry_names[i], TELEMETRY_NAME_SIZE - 1);
+	}
+	auto* frames = reinterpret_cast<telemetry_frame*>(header + 1);
+	for(size_t i = 0; i < ring_size; ++i)
+	{
+		new(&frames[i]) telemetry_frame;
+		frames[i].sequence.store(0, std::memory_order_relaxed);
+		frames[i].index.store(0, std::memory_order_relaxed);
+	}
+	// a reader checks the magic first.
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(header->magic, TELEMETRY_MAGIC, sizeof(header->magic));
+
+	g_telemetry.header = header;
+	g_telemetry.frames = frames;
+	g_telemetry.map_size = map_size;
+	g_telemetry.ring_size = ring_size;
+	g_telemetry.write_count = 0;
+	g_telemetry.start_time = timer_now();
+	g_telemetry.name = name;
+	slogf("info: publishing telemetry to %s (%u frames)\n", name, ring_size);
+#endif
+	return true;
+}
+
+bool telemetry_destroy()
+{
+#ifdef HAS_TELEMETRY
+	if(g_telemetry.header == NULL)
+	{
+		return true;
+	}
+	bool success = true;
+	if(munmap(g_telemetry.header, g_telemetry.map_size) != 0)
+	{
+		serrf("%s: munmap failed, reason: %s\n", __func__, strerror(errno));
+		success = false;
+	}
+	// a reader that is attached keeps the memory until it unmaps it.
+	if(shm_unlink(g_telemetry.name.c_str()) != 0)
+	{
+		serrf(
+			"%s: shm_unlink(`%s`) failed, reason: %s\n",
+			__func__,
+			g_telemetry.name.c_str(),
+			strerror(errno));
+		success = false;
+	}
+	g_telemetry.header = NULL;
+	g_telemetry.frames = NULL;
+	return success;
+#else
+	return true;
+#endif
+}
+
+void telemetry_publish(const double* values)
+{
+#ifdef HAS_TELEMETRY
+	if(g_telemetry.header == NULL)
+	{
+		return;
+	}
+	ASSERT(values != NULL);
+	uint64_t index = g_telemetry.write_count;
+	telemetry_frame& frame = g_telemetry.frames[index % g_telemetry.ring_size];
+
+	// the fence makes the odd sequence visible before any store of the frame.
+	uint32_t sequence = frame.sequence.load(std::memory_order_relaxed);
+	frame.sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	frame.index.store(index, std::memory_order_relaxed);
+	frame.time_sec.store(
+		timer_delta<1>(g_telemetry.start_time, timer_now()), std::memory_order_relaxed);
+	for(size_t i = 0; i < TELEMETRY_COUNTER_COUNT; ++i)
+	{
+		frame.values[i].store(values[i], std::memory_order_relaxed);
+	}
+
+	frame.sequence.store(sequence + 2, std::memory_order_release);
+	g_telemetry.write_count = index + 1;
+	g_telemetry.header->write_count.store(index + 1, std::memory_order_release);
+#else
+	(void)values;
+#endif
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "global.h"
+
+#include <atomic>
+#include <cstdint>
+
+// publishes a few counters of every frame into POSIX shared memory (cv_telemetry_shm),
+// so a soak run can be watched or recorded live with tools/telemetry_read.cpp,
+// without drawing anything or parsing the log.
+// the segment is a ring of frames, each frame is a seqlock:
+// the sequence is odd while the frame is written, so a reader copies the frame,
+// and throws it away if the sequence changed (the writer never waits for the reader).
+// a frame is published with a few relaxed stores (there is one writer, the main thread).
+
+enum
+{
+	TELEMETRY_VERSION = 1,
+	TELEMETRY_MAX_COUNTERS = 16,
+	TELEMETRY_NAME_SIZE = 32
+};
+
+// the counters of a frame, the names are in the header so the reader doesn't need these.
+enum
+{
+	// the time since the last frame.
+	TELEMETRY_FRAME_MS,
+	TELEMETRY_INPUT_MS,
+	TELEMETRY_UPDATE_MS,
+	TELEMETRY_RENDER_MS,
+	TELEMETRY_SWAP_MS,
+	// the glyphs that were rasterized (since startup).
+	TELEMETRY_GLYPH_MISSES,
+	// the text layouts that were not cached (since startup).
+	TELEMETRY_LAYOUT_MISSES,
+	// percent
+	TELEMETRY_ATLAS_OCCUPANCY,
+	// the last frame.
+	TELEMETRY_ATLAS_UPLOAD_BYTES,
+	// since startup, the resizes and grows are the allocations of the atlas and batch.
+	TELEMETRY_ATLAS_EVICTED_GLYPHS,
+	TELEMETRY_ATLAS_RESIZES,
+	TELEMETRY_BATCH_GROWS,
+	// bytes in g_log that the log thread didn't write yet.
+	TELEMETRY_LOG_QUEUE_BYTES,
+	TELEMETRY_COUNTER_COUNT
+};
+static_assert(static_cast<int>(TELEMETRY_COUNTER_COUNT) <= TELEMETRY_MAX_COUNTERS);
+
+// the shared memory is a telemetry_header followed by ring_size telemetry_frames.
+// everything that changes is atomic, lock free atomics work between processes.
+struct telemetry_frame
+{
+	// odd while the writer is changing the frame.
+	std::atomic<uint32_t> sequence;
+	uint32_t reserved;
+	// the number of frames published before this one.
+	std::atomic<uint64_t> index;
+	// since telemetry_init.
+	std::atomic<double> time_sec;
+	std::atomic<double> values[TELEMETRY_MAX_COUNTERS];
+};
+
+struct telemetry_header
+{
+	// "BSTELEM" with a null terminator, set last.
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t frame_size;
+	uint32_t ring_size;
+	uint32_t counter_count;
+	// the writer, so the reader knows when it's gone.
+	int32_t pid;
+	char names[TELEMETRY_MAX_COUNTERS][TELEMETRY_NAME_SIZE];
+	// the number of frames published, frame N is at frames[N % ring_size].
+	std::atomic<uint64_t> write_count;
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+static_assert(std::atomic<double>::is_always_lock_free);
+
+#define TELEMETRY_MAGIC "BSTELEM"
+
+// call this after the cvars are loaded, does nothing if cv_telemetry_shm is empty.
+NDSERR bool telemetry_init();
+// removes the shared memory.
+NDSERR bool telemetry_destroy();
+
+// values is TELEMETRY_COUNTER_COUNT values (main thread).
+void telemetry_publish(const double* values);
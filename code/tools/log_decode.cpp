@@ -0,0 +1,128 @@
+// prints a binary log (cv_log_binary_file) as text.
+// usage: log_decode <file>
+// this only needs log_format.cpp, the formats are stored in the file
+// (only the arguments depend on the machine, so decode it on the same kind of machine).
+
+#include "../global_pch.h"
+#include "../global.h"
+
+#include "../log_format.h"
+
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+struct file_closer
+{
+	void operator()(FILE* fp) const
+	{
+		fclose(fp);
+	}
+};
+} // namespace
+
+// returns false at the end of the file, or if the file is truncated (prints why).
+static bool read_exact(FILE* fp, void* out, size_t size, const char* path)
+{
+	size_t ret = fread(out, 1, size, fp);
+	if(ret == size)
+	{
+		return true;
+	}
+	if(ferror(fp) != 0)
+	{
+		fprintf(stderr, "failed to read `%s`, reason: %s\n", path, strerror(errno));
+	}
+	else if(ret != 0)
+	{
+		// probably a crash while writing.
+		fprintf(stderr, "`%s` ends in the middle of a record\n", path);
+	}
+	return false;
+}
+
+int main(int argc, char** argv)
+{
+	if(argc != 2)
+	{
+		fprintf(stderr, "usage: %s <binary log>\n", argc > 0 ? argv[0] : "log_decode");
+		return 1;
+	}
+	const char* path = argv[1];
+	std::unique_ptr<FILE, file_closer> file(fopen(path, "rb"));
+	if(!file)
+	{
+		fprintf(stderr, "failed to open `%s`, reason: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	log_binary_header header;
+	log_binary_header expected;
+	if(fread(&header, 1, sizeof(header), file.get()) != sizeof(header) ||
+	   memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0)
+	{
+		fprintf(stderr, "`%s` is not a binary log\n", path);
+		return 1;
+	}
+	if(header.byte_order != expected.byte_order || header.version != expected.version)
+	{
+		fprintf(
+			stderr,
+			"`%s` version %u is not supported (or it's from a different byte order)\n",
+			path,
+			header.version);
+		return 1;
+	}
+
+	std::unordered_map<uint64_t, std::string> formats;
+	std::vector<char> data;
+	std::vector<char> text(1 << 16);
+	log_binary_record record;
+	while(read_exact(file.get(), &record, sizeof(record), path))
+	{
+		data.resize(record.size);
+		if(!read_exact(file.get(), data.data(), data.size(), path))
+		{
+			return 1;
+		}
+		if(record.kind == LOG_RECORD_TEXT)
+		{
+			fwrite(data.data(), 1, data.size(), stdout);
+			continue;
+		}
+
+		uint64_t id;
+		if(data.size() < sizeof(id) ||
+		   (record.kind != LOG_RECORD_FORMAT && record.kind != LOG_RECORD_DEFERRED))
+		{
+			fprintf(stderr, "`%s` has a bad record\n", path);
+			return 1;
+		}
+		memcpy(&id, data.data(), sizeof(id));
+		const char* payload = data.data() + sizeof(id);
+		size_t payload_size = data.size() - sizeof(id);
+
+		if(record.kind == LOG_RECORD_FORMAT)
+		{
+			formats[id].assign(payload, payload_size);
+			continue;
+		}
+		auto it = formats.find(id);
+		if(it == formats.end())
+		{
+			fprintf(stderr, "`%s` uses a format that wasn't defined\n", path);
+			return 1;
+		}
+		size_t len = log_format_args(
+			text.data(), text.size(), it->second.c_str(), payload, payload_size);
+		fwrite(text.data(), 1, len, stdout);
+	}
+	if(ferror(file.get()) != 0)
+	{
+		return 1;
+	}
+	return 0;
+}
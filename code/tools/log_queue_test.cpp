@@ -0,0 +1,123 @@
+// checks that log_queue wraps around the end of a thread's buffer,
+// from every 4 byte offset near the end (where a record_header might not fit).
+// usage: log_queue_test (returns 0 if it passed, build it with USE_ASAN to catch overflows)
+
+#include "../global_pch.h"
+#include "../global.h"
+
+#include "../log_queue.h"
+
+#include <cstdio>
+#include <string>
+
+// the size of a record in the buffer (same as thread_buffer::record_size, the header is 12 bytes).
+static size_t test_record_size(size_t len)
+{
+	return (12 + len + 1 + 3) & ~static_cast<size_t>(3);
+}
+
+// returns the number of messages, and checks that they match expected (if not NULL).
+static size_t drain(log_queue* queue, const std::string* expected, size_t expected_count)
+{
+	size_t count = 0;
+	log_queue::log_message message;
+	const char* data;
+	while((data = queue->pop(&message)) != NULL)
+	{
+		if(expected != NULL)
+		{
+			if(count >= expected_count || message.count != expected[count].size() ||
+			   memcmp(data, expected[count].data(), message.count) != 0 ||
+			   data[message.count] != '\0')
+			{
+				return SIZE_MAX;
+			}
+		}
+		++count;
+	}
+	return count;
+}
+
+// the thread buffers are never freed, so one queue (and one buffer) is used for every test.
+static log_queue g_queue;
+// the write position in the buffer of this thread.
+static size_t g_position = 0;
+
+static void push_message(const std::string& text)
+{
+	size_t need = test_record_size(text.size());
+	size_t contiguous = log_queue::BUFFER_SIZE - (g_position & (log_queue::BUFFER_SIZE - 1));
+	if(need > contiguous)
+	{
+		g_position += contiguous;
+	}
+	g_position += need;
+	g_queue.push(CONSOLE_MESSAGE_TYPE::INFO, text.data(), text.size());
+}
+
+// moves the write position to BUFFER_SIZE - end_gap, then pushes messages that wrap.
+static bool test_gap(size_t end_gap)
+{
+	size_t index = g_position & (log_queue::BUFFER_SIZE - 1);
+	size_t target = log_queue::BUFFER_SIZE - end_gap;
+	size_t remaining = (target - index) & (log_queue::BUFFER_SIZE - 1);
+	if(remaining < test_record_size(0))
+	{
+		remaining += log_queue::BUFFER_SIZE;
+	}
+	const size_t filler_len = 1023;
+	while(remaining != 0)
+	{
+		size_t len = filler_len;
+		if(remaining < test_record_size(filler_len) + test_record_size(0))
+		{
+			// the last one fills it exactly.
+			len = remaining - 13;
+		}
+		push_message(std::string(len, 'x'));
+		if(drain(&g_queue, NULL, 0) != 1)
+		{
+			fprintf(stderr, "gap %zu: a filler message was lost\n", end_gap);
+			return false;
+		}
+		remaining -= test_record_size(len);
+	}
+	if((g_position & (log_queue::BUFFER_SIZE - 1)) != target)
+	{
+		fprintf(stderr, "gap %zu: the test is wrong\n", end_gap);
+		return false;
+	}
+
+	// the first message doesn't fit before the end (unless the gap is big),
+	// so every size of the skipped tail is tried.
+	std::string expected[4];
+	for(size_t i = 0; i < std::size(expected); ++i)
+	{
+		expected[i] = "message " + std::to_string(i) + std::string(i * 5, '-');
+		push_message(expected[i]);
+	}
+	if(drain(&g_queue, expected, std::size(expected)) != std::size(expected))
+	{
+		fprintf(stderr, "gap %zu: the messages after the wrap are wrong\n", end_gap);
+		return false;
+	}
+	if(g_queue.pop_dropped() != 0)
+	{
+		fprintf(stderr, "gap %zu: messages were dropped\n", end_gap);
+		return false;
+	}
+	return true;
+}
+
+int main()
+{
+	for(size_t end_gap = 4; end_gap <= 64; end_gap += 4)
+	{
+		if(!test_gap(end_gap))
+		{
+			return 1;
+		}
+	}
+	printf("log_queue_test passed\n");
+	return 0;
+}
@@ -0,0 +1,246 @@
+// prints the frame counters that the demo publishes to cv_telemetry_shm.
+// usage: telemetry_read [-o <file.csv>] [shm name, default /bs_telemetry]
+// every frame is written to the csv (unless the reader falls more than cv_telemetry_frames behind),
+// and a summary of the latest frame is printed about once a second.
+// this exits when the demo exits (POSIX only).
+
+#include "../global_pch.h"
+#include "../global.h"
+
+#include "../telemetry.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <string>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace
+{
+struct file_closer
+{
+	void operator()(FILE* fp) const
+	{
+		fclose(fp);
+	}
+};
+
+struct frame_copy
+{
+	uint64_t index;
+	double time_sec;
+	double values[TELEMETRY_MAX_COUNTERS];
+};
+} // namespace
+
+// returns false if the writer changed the frame while it was copied, or if it's not frame index.
+static bool read_frame(const telemetry_frame& frame, uint64_t index, frame_copy* out)
+{
+	uint32_t before = frame.sequence.load(std::memory_order_acquire);
+	if((before & 1) != 0)
+	{
+		return false;
+	}
+	out->index = frame.index.load(std::memory_order_relaxed);
+	out->time_sec = frame.time_sec.load(std::memory_order_relaxed);
+	for(size_t i = 0; i < TELEMETRY_MAX_COUNTERS; ++i)
+	{
+		out->values[i] = frame.values[i].load(std::memory_order_relaxed);
+	}
+	// the fence keeps the loads of the frame before the second load of the sequence.
+	std::atomic_thread_fence(std::memory_order_acquire);
+	uint32_t after = frame.sequence.load(std::memory_order_relaxed);
+	return before == after && out->index == index;
+}
+
+static bool writer_alive(pid_t pid)
+{
+	return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+static void sleep_ms(long ms)
+{
+	timespec ts{};
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000;
+	nanosleep(&ts, NULL);
+}
+
+int main(int argc, char** argv)
+{
+	const char* name = "/bs_telemetry";
+	const char* csv_path = NULL;
+	for(int i = 1; i < argc; ++i)
+	{
+		if(strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+		{
+			csv_path = argv[++i];
+		}
+		else if(argv[i][0] != '-')
+		{
+			name = argv[i];
+		}
+		else
+		{
+			fprintf(
+				stderr,
+				"usage: %s [-o <file.csv>] [shm name]\n",
+				argc > 0 ? argv[0] : "telemetry_read");
+			return 1;
+		}
+	}
+
+	int fd = shm_open(name, O_RDONLY, 0);
+	if(fd == -1)
+	{
+		fprintf(
+			stderr,
+			"failed to open `%s`, reason: %s (is the demo running with cv_telemetry_shm?)\n",
+			name,
+			strerror(errno));
+		return 1;
+	}
+	struct stat info;
+	if(fstat(fd, &info) != 0)
+	{
+		fprintf(stderr, "failed to stat `%s`, reason: %s\n", name, strerror(errno));
+		close(fd);
+		return 1;
+	}
+	size_t map_size = info.st_size;
+	void* memory = NULL;
+	if(map_size >= sizeof(telemetry_header))
+	{
+		memory = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if(memory == NULL || memory == MAP_FAILED)
+	{
+		fprintf(stderr, "failed to map `%s` (size: %zu)\n", name, map_size);
+		return 1;
+	}
+
+	const auto* header = static_cast<const telemetry_header*>(memory);
+	if(memcmp(header->magic, TELEMETRY_MAGIC, sizeof(header->magic)) != 0)
+	{
+		fprintf(stderr, "`%s` is not telemetry (or the demo didn't finish creating it)\n", name);
+		return 1;
+	}
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if(header->version != TELEMETRY_VERSION || header->header_size != sizeof(telemetry_header) ||
+	   header->frame_size != sizeof(telemetry_frame) ||
+	   header->counter_count > TELEMETRY_MAX_COUNTERS || header->ring_size == 0 ||
+	   map_size < sizeof(telemetry_header) + sizeof(telemetry_frame) * header->ring_size)
+	{
+		fprintf(stderr, "`%s` version %u is not supported\n", name, header->version);
+		return 1;
+	}
+	const auto* frames = reinterpret_cast<const telemetry_frame*>(header + 1);
+	uint32_t ring_size = header->ring_size;
+	uint32_t counter_count = header->counter_count;
+	std::string names[TELEMETRY_MAX_COUNTERS];
+	for(size_t i = 0; i < counter_count; ++i)
+	{
+		names[i].assign(header->names[i], strnlen(header->names[i], TELEMETRY_NAME_SIZE));
+	}
+
+	std::unique_ptr<FILE, file_closer> csv;
+	if(csv_path != NULL)
+	{
+		csv.reset(fopen(csv_path, "wb"));
+		if(!csv)
+		{
+			fprintf(stderr, "failed to open `%s`, reason: %s\n", csv_path, strerror(errno));
+			return 1;
+		}
+		fputs("frame,time", csv.get());
+		for(size_t i = 0; i < counter_count; ++i)
+		{
+			fprintf(csv.get(), ",%s", names[i].c_str());
+		}
+		fputs("\n", csv.get());
+	}
+
+	printf("reading `%s` (pid: %d, %u frames)\n", name, header->pid, ring_size);
+
+	// start from the frames that are still in the ring.
+	uint64_t next = header->write_count.load(std::memory_order_acquire);
+	next = (next > ring_size) ? next - ring_size : 0;
+	uint64_t skipped = 0;
+	double last_print = -1;
+	frame_copy latest{};
+	bool has_latest = false;
+	for(;;)
+	{
+		// checked before reading, so the last frames are read after the demo exits.
+		bool alive = writer_alive(header->pid);
+		uint64_t write_count = header->write_count.load(std::memory_order_acquire);
+		// keep a frame of space, the writer could be writing over the oldest frame.
+		if(write_count - next + 1 > ring_size)
+		{
+			uint64_t oldest = write_count - ring_size + 1;
+			skipped += oldest - next;
+			next = oldest;
+		}
+		for(; next < write_count; ++next)
+		{
+			frame_copy copy;
+			if(!read_frame(frames[next % ring_size], next, &copy))
+			{
+				// overwritten, the reader is too slow.
+				++skipped;
+				continue;
+			}
+			if(csv)
+			{
+				fprintf(csv.get(), "%" PRIu64 ",%.6f", copy.index, copy.time_sec);
+				for(size_t i = 0; i < counter_count; ++i)
+				{
+					fprintf(csv.get(), ",%.17g", copy.values[i]);
+				}
+				fputs("\n", csv.get());
+			}
+			latest = copy;
+			has_latest = true;
+		}
+
+		if(has_latest && latest.time_sec - last_print >= 1.0)
+		{
+			last_print = latest.time_sec;
+			printf("[%.1fs] frame: %" PRIu64, latest.time_sec, latest.index);
+			for(size_t i = 0; i < counter_count; ++i)
+			{
+				printf(" %s=%.6g", names[i].c_str(), latest.values[i]);
+			}
+			if(skipped != 0)
+			{
+				printf(" (skipped %" PRIu64 " frames)", skipped);
+			}
+			printf("\n");
+			fflush(stdout);
+		}
+
+		if(!alive)
+		{
+			break;
+		}
+		sleep_ms(10);
+	}
+
+	printf("the demo exited (skipped %" PRIu64 " frames)\n", skipped);
+	if(csv)
+	{
+		int prev_error = ferror(csv.get());
+		if(fclose(csv.release()) != 0 || prev_error != 0)
+		{
+			fprintf(stderr, "failed to write `%s`, reason: %s\n", csv_path, strerror(errno));
+			return 1;
+		}
+	}
+	return 0;
+}
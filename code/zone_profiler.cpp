@@ -0,0 +1,490 @@
+#include "global_pch.h"
+#include "global.h"
+
+#include "zone_profiler.h"
+
+#include "cvar.h"
+#include "RWops.h"
+#include "BS_Archive/BS_json.h"
+#include "BS_Archive/BS_stream.h"
+
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// emscripten doesn't have BS_json.
+#ifndef DISABLE_BS_JSON
+#define HAS_ZONE_PROFILER
+#endif
+
+// steady_clock can take 20-50ns (more in a VM), rdtsc is a few ns,
+// and it's converted to time with the timer_now of the start and the end of the capture.
+#if defined(HAS_ZONE_PROFILER) && (defined(__GNUC__) || defined(__clang__)) && \
+	(defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define ZONE_USE_RDTSC
+#endif
+
+static CVAR_T zone_profiler_enabled
+#ifdef HAS_ZONE_PROFILER
+	= CVAR_T::RUNTIME;
+#else
+	= CVAR_T::DISABLED;
+#endif
+
+static REGISTER_CVAR_STRING(
+	cv_zone_trace_file,
+	"trace.json",
+	"the file cv_zone_trace writes when it's done",
+	zone_profiler_enabled);
+static REGISTER_CVAR_INT(
+	cv_zone_buffer_events,
+	65536,
+	"the zone events each thread keeps for cv_zone_trace, the oldest are overwritten",
+	zone_profiler_enabled);
+
+namespace
+{
+class cvar_zone_trace : public cvar_int
+{
+public:
+	cvar_zone_trace();
+	NDSERR bool cvar_read(const char* buffer) override;
+};
+} // namespace
+
+static cvar_zone_trace cv_zone_trace;
+
+std::atomic<bool> g_zone_capturing{false};
+
+#ifdef HAS_ZONE_PROFILER
+
+namespace
+{
+struct zone_event
+{
+	const char* name;
+	// from zone_profiler_ticks.
+	uint64_t ticks;
+	bool begin;
+};
+
+struct zone_thread_buffer
+{
+	std::string name;
+	uint32_t id = 0;
+
+	// only the owner thread writes the events, and only while writing is set.
+	std::unique_ptr<zone_event[]> events;
+	size_t capacity = 0;
+	// the number of events written since the capture started (not wrapped).
+	size_t head = 0;
+	std::atomic<bool> writing{false};
+	// false after the thread exited, then a new thread can take it (protected by mut).
+	bool in_use = true;
+};
+
+struct zone_profiler_state
+{
+	// protects threads (not the events).
+	std::mutex mut;
+	std::vector<std::unique_ptr<zone_thread_buffer>> threads;
+
+	// set before g_zone_capturing.
+	size_t capacity = 0;
+	TIMER_U start_time = TIMER_NULL;
+	uint64_t start_ticks = 0;
+	int frames_left = 0;
+};
+} // namespace
+
+static zone_profiler_state g_zone;
+
+// set when zone_thread_owner is destroyed, so a thread_local destructor doesn't register again.
+static thread_local bool t_zone_exited = false;
+
+namespace
+{
+// gives the buffer back when the thread exits.
+struct zone_thread_owner
+{
+	zone_thread_buffer* buffer = NULL;
+	~zone_thread_owner()
+	{
+		t_zone_exited = true;
+		if(buffer != NULL)
+		{
+			std::lock_guard<std::mutex> lk(g_zone.mut);
+			buffer->in_use = false;
+			buffer = NULL;
+		}
+	}
+};
+} // namespace
+
+static uint64_t zone_profiler_ticks()
+{
+#ifdef ZONE_USE_RDTSC
+	return __rdtsc();
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			   std::chrono::steady_clock::now().time_since_epoch())
+		.count();
+#endif
+}
+
+// returns NULL if the thread is exiting.
+static zone_thread_buffer* zone_profiler_get_thread()
+{
+	static thread_local zone_thread_owner owner;
+	if(t_zone_exited)
+	{
+		return NULL;
+	}
+	if(owner.buffer != NULL)
+	{
+		return owner.buffer;
+	}
+
+	std::lock_guard<std::mutex> lk(g_zone.mut);
+	// reuse the buffer of a thread that exited, unless it has events of this capture.
+	// (the start clears head before g_zone_capturing is set, so it's empty or not capturing)
+	for(auto& buffer : g_zone.threads)
+	{
+		if(!buffer->in_use && (buffer->head == 0 || !g_zone_capturing.load()))
+		{
+			buffer->in_use = true;
+			buffer->head = 0;
+			buffer->name = "thread " + std::to_string(buffer->id);
+			owner.buffer = buffer.get();
+			return owner.buffer;
+		}
+	}
+	auto buffer = std::make_unique<zone_thread_buffer>();
+	// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+	buffer->id = g_zone.threads.size() + 1;
+	buffer->name = "thread " + std::to_string(buffer->id);
+	owner.buffer = buffer.get();
+	g_zone.threads.push_back(std::move(buffer));
+	return owner.buffer;
+}
+
+static bool zone_profiler_record(const char* name, bool begin)
+{
+	zone_thread_buffer* buffer = zone_profiler_get_thread();
+	if(buffer == NULL)
+	{
+		return false;
+	}
+	// the stop sets g_zone_capturing before it checks writing, and this is the opposite,
+	// so either the stop waits for this event, or this sees that it stopped.
+	buffer->writing.store(true);
+	if(!g_zone_capturing.load())
+	{
+		buffer->writing.store(false, std::memory_order_release);
+		return false;
+	}
+	if(buffer->capacity != g_zone.capacity)
+	{
+		// only once per thread (unless cv_zone_buffer_events changes).
+		buffer->events = std::make_unique<zone_event[]>(g_zone.capacity);
+		buffer->capacity = g_zone.capacity;
+		buffer->head = 0;
+	}
+	zone_event& event = buffer->events[buffer->head & (buffer->capacity - 1)];
+	event.name = name;
+	event.ticks = zone_profiler_ticks();
+	event.begin = begin;
+	++buffer->head;
+	buffer->writing.store(false, std::memory_order_release);
+	return true;
+}
+
+static bool zone_profiler_start(int frames)
+{
+	ASSERT(!g_zone_capturing.load());
+	// a power of 2 so the ring index is a mask.
+	size_t capacity = 1;
+	while(capacity < static_cast<size_t>(std::max(cv_zone_buffer_events.data, 2)))
+	{
+		capacity *= 2;
+	}
+	{
+		// nothing is writing events when it's not capturing.
+		std::lock_guard<std::mutex> lk(g_zone.mut);
+		for(auto& buffer : g_zone.threads)
+		{
+			buffer->head = 0;
+		}
+	}
+	g_zone.capacity = capacity;
+	g_zone.frames_left = frames;
+	g_zone.start_time = timer_now();
+	g_zone.start_ticks = zone_profiler_ticks();
+	g_zone_capturing.store(true);
+	slogf("info: capturing %d frames of zones\n", frames);
+	return true;
+}
+
+namespace
+{
+struct zone_trace_writer
+{
+	BS_Archive& ar;
+	uint64_t start_ticks;
+	double us_per_tick;
+	size_t zone_count = 0;
+
+	void write_zone(const zone_thread_buffer& buffer, const zone_event& begin, uint64_t end)
+	{
+		ar.StartObject();
+		ar.Key("name");
+		ar.String_CB(begin.name, NULL, NULL);
+		ar.Key("ph");
+		ar.String_CB("X", NULL, NULL);
+		ar.Key("pid");
+		ar.Uint32_CB(1, NULL, NULL);
+		ar.Key("tid");
+		ar.Uint32_CB(buffer.id, NULL, NULL);
+		// chrome wants microseconds.
+		ar.Key("ts");
+		// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+		ar.Double_CB((begin.ticks - start_ticks) * us_per_tick, NULL, NULL);
+		ar.Key("dur");
+		// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+		ar.Double_CB((end - begin.ticks) * us_per_tick, NULL, NULL);
+		ar.EndObject();
+		++zone_count;
+	}
+
+	void write_thread_name(const zone_thread_buffer& buffer)
+	{
+		ar.StartObject();
+		ar.Key("name");
+		ar.String_CB("thread_name", NULL, NULL);
+		ar.Key("ph");
+		ar.String_CB("M", NULL, NULL);
+		ar.Key("pid");
+		ar.Uint32_CB(1, NULL, NULL);
+		ar.Key("tid");
+		ar.Uint32_CB(buffer.id, NULL, NULL);
+		ar.Key("args");
+		ar.StartObject();
+		ar.Key("name");
+		ar.String_CB(buffer.name, NULL, NULL);
+		ar.EndObject();
+		ar.EndObject();
+	}
+
+	// the zones that were still open when it stopped end at end_ticks.
+	void write_thread(const zone_thread_buffer& buffer, uint64_t end_ticks)
+	{
+		size_t first = (buffer.head > buffer.capacity) ? buffer.head - buffer.capacity : 0;
+		// the begin events of the open zones.
+		std::vector<const zone_event*> open;
+		for(size_t i = first; i < buffer.head; ++i)
+		{
+			const zone_event& event = buffer.events[i & (buffer.capacity - 1)];
+			if(event.begin)
+			{
+				open.push_back(&event);
+				continue;
+			}
+			// the begin was overwritten.
+			if(open.empty())
+			{
+				continue;
+			}
+			ASSERT(open.back()->name == event.name);
+			write_zone(buffer, *open.back(), event.ticks);
+			open.pop_back();
+		}
+		for(const zone_event* event : open)
+		{
+			write_zone(buffer, *event, end_ticks);
+		}
+	}
+};
+} // namespace
+
+static bool zone_profiler_write(const char* path, TIMER_U end_time, uint64_t end_ticks)
+{
+	FILE* fp = serr_wrapper_fopen(path, "wb");
+	if(fp == NULL)
+	{
+		return false;
+	}
+	RWops_Stdio trace_file(fp, path);
+	char buffer[4096];
+	BS_WriteStream sb(&trace_file, buffer, sizeof(buffer));
+	// the pretty writer would double the size of the file.
+	BS_JsonWriter<BS_WriteStream, rj::Writer<BS_WriteStream>> ar(sb);
+	double us_per_tick = 0;
+	if(end_ticks > g_zone.start_ticks)
+	{
+		// NOLINTNEXTLINE(bugprone-narrowing-conversions)
+		us_per_tick = timer_delta<1000000>(g_zone.start_time, end_time) /
+					  (end_ticks - g_zone.start_ticks);
+	}
+	zone_trace_writer writer{ar, g_zone.start_ticks, us_per_tick};
+
+	size_t overwritten = 0;
+	ar.StartObject();
+	ar.Key("displayTimeUnit");
+	ar.String_CB("ms", NULL, NULL);
+	ar.Key("traceEvents");
+	ar.StartArray();
+	for(const auto& thread : g_zone.threads)
+	{
+		writer.write_thread_name(*thread);
+		if(thread->capacity != 0)
+		{
+			writer.write_thread(*thread, end_ticks);
+			overwritten += thread->head - std::min(thread->head, thread->capacity);
+		}
+	}
+	ar.EndArray();
+	ar.EndObject();
+
+	bool success = ar.Finish(trace_file.name());
+	if(!trace_file.close())
+	{
+		success = false;
+	}
+	if(success)
+	{
+		slogf(
+			"info: wrote %s (%zu zones, %zu threads, %zu events overwritten, %.2fs)\n",
+			path,
+			writer.zone_count,
+			g_zone.threads.size(),
+			overwritten,
+			timer_delta<1>(g_zone.start_time, end_time));
+	}
+	return success;
+}
+
+static bool zone_profiler_stop()
+{
+	ASSERT(g_zone_capturing.load());
+	TIMER_U end_time = timer_now();
+	uint64_t end_ticks = zone_profiler_ticks();
+	g_zone_capturing.store(false);
+
+	std::lock_guard<std::mutex> lk(g_zone.mut);
+	// a thread might still be writing an event.
+	for(auto& buffer : g_zone.threads)
+	{
+		while(buffer->writing.load())
+		{
+			std::this_thread::yield();
+		}
+	}
+	return zone_profiler_write(cv_zone_trace_file.data.c_str(), end_time, end_ticks);
+}
+
+#endif // HAS_ZONE_PROFILER
+
+bool zone_profiler_begin(const char* name)
+{
+#ifdef HAS_ZONE_PROFILER
+	return zone_profiler_record(name, true);
+#else
+	(void)name;
+	return false;
+#endif
+}
+
+void zone_profiler_end(const char* name)
+{
+#ifdef HAS_ZONE_PROFILER
+	zone_profiler_record(name, false);
+#else
+	(void)name;
+#endif
+}
+
+void zone_profiler_set_thread_name(const char* name)
+{
+#ifdef HAS_ZONE_PROFILER
+	zone_thread_buffer* buffer = zone_profiler_get_thread();
+	if(buffer == NULL)
+	{
+		return;
+	}
+	std::lock_guard<std::mutex> lk(g_zone.mut);
+	buffer->name = name;
+#else
+	(void)name;
+#endif
+}
+
+cvar_zone_trace::cvar_zone_trace()
+: cvar_int(
+	  "cv_zone_trace",
+	  0,
+	  "N = capture the zones of the next N frames into cv_zone_trace_file, 0 = stop early",
+	  zone_profiler_enabled,
+	  __FILE__,
+	  __LINE__)
+{
+}
+
+bool cvar_zone_trace::cvar_read(const char* buffer)
+{
+	if(!cvar_int::cvar_read(buffer))
+	{
+		return false;
+	}
+#ifdef HAS_ZONE_PROFILER
+	if(data < 0)
+	{
+		data = 0;
+	}
+	if(g_zone_capturing.load())
+	{
+		if(data == 0)
+		{
+			return zone_profiler_stop();
+		}
+		// restart the frame count.
+		g_zone.frames_left = data;
+		return true;
+	}
+	if(data != 0 && !zone_profiler_start(data))
+	{
+		data = 0;
+		return false;
+	}
+#endif
+	return true;
+}
+
+bool zone_profiler_new_frame()
+{
+#ifdef HAS_ZONE_PROFILER
+	if(g_zone_capturing.load(std::memory_order_relaxed))
+	{
+		// if it started in the middle of a frame, that frame doesn't count.
+		if(g_zone.frames_left <= 0)
+		{
+			cv_zone_trace.data = 0;
+			return zone_profiler_stop();
+		}
+		--g_zone.frames_left;
+	}
+#endif
+	return true;
+}
+
+bool zone_profiler_destroy()
+{
+#ifdef HAS_ZONE_PROFILER
+	if(g_zone_capturing.load())
+	{
+		cv_zone_trace.data = 0;
+		return zone_profiler_stop();
+	}
+#endif
+	return true;
+}
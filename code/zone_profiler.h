@@ -0,0 +1,57 @@
+#pragma once
+
+#include "global.h"
+
+#include <atomic>
+
+// a profiler for the time of nested zones (a zone is a scope marked with ZONE_SCOPE).
+// "cv_zone_trace N" captures the next N frames (or "cv_zone_trace 0" stops it early),
+// and writes cv_zone_trace_file as chrome trace JSON (chrome://tracing, perfetto, speedscope).
+// each thread writes the begin and end of it's zones into it's own ring buffer,
+// so a long capture only keeps the last cv_zone_buffer_events of each thread.
+// when it's not capturing a zone is only a relaxed atomic load.
+
+// the name must be a string literal (only the pointer is stored).
+#define ZONE_SCOPE(name) ZONE_SCOPE_INTERNAL(name, __LINE__)
+#define ZONE_SCOPE_INTERNAL(name, line) ZONE_SCOPE_INTERNAL2(name, line)
+#define ZONE_SCOPE_INTERNAL2(name, line) zone_profiler_scope zone_scope_##line(name)
+
+// don't use this directly, use g_zone_capturing.
+extern std::atomic<bool> g_zone_capturing;
+
+// returns false if the event wasn't recorded.
+bool zone_profiler_begin(const char* name);
+void zone_profiler_end(const char* name);
+
+class zone_profiler_scope
+{
+public:
+	const char* name;
+	bool active;
+
+	explicit zone_profiler_scope(const char* name_)
+	: name(name_)
+	, active(g_zone_capturing.load(std::memory_order_relaxed) && zone_profiler_begin(name_))
+	{
+	}
+	~zone_profiler_scope()
+	{
+		// if the begin wasn't recorded, neither is the end.
+		if(active)
+		{
+			zone_profiler_end(name);
+		}
+	}
+	zone_profiler_scope(const zone_profiler_scope&) = delete;
+	zone_profiler_scope& operator=(const zone_profiler_scope&) = delete;
+};
+
+// the name shown for the thread that calls this (copied).
+void zone_profiler_set_thread_name(const char* name);
+
+// call this at the start of every frame (from the main thread),
+// it counts the frames of cv_zone_trace, and writes the trace when it's done.
+NDSERR bool zone_profiler_new_frame();
+
+// writes the trace if it's capturing.
+NDSERR bool zone_profiler_destroy();